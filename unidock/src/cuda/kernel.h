@@ -142,6 +142,31 @@ typedef struct {
     int m_num_movable_atoms;  // will be -1 if ligand parsing failed
 } m_cuda_t;
 
+// Device copy of packed_batch (batch_pack.h), ligand l owns [x_offsets[l], x_offsets[l + 1])
+typedef struct {
+    int *atom_offsets;
+    int *pair_offsets;
+    int *node_offsets;
+    int *atom_types;      // [atom][4]
+    float *atom_coords;   // [atom][3]
+    float *coords;        // [atom][3]
+    float *minus_forces;  // [atom][3]
+    int *pair_type_pair_index;
+    int *pair_a;
+    int *pair_b;
+    int *node_atom_range;  // [node][2]
+    int *node_parent;
+    float *node_origin;           // [node][3]
+    float *node_orientation_m;    // [node][9]
+    float *node_orientation_q;    // [node][4]
+    float *node_axis;             // [node][3]
+    float *node_relative_axis;    // [node][3]
+    float *node_relative_origin;  // [node][3]
+    int *ligand_begin;
+    int *ligand_end;
+    int *num_movable_atoms;  // -1 if ligand parsing failed
+} packed_batch_cuda_t;
+
 typedef struct {
     float m_init[3];
     float m_range[3];
@@ -198,6 +223,14 @@ typedef struct {
     float epsilon_fl5;
 } variables_bfgs;
 
+typedef struct {  // per thread counterpart of search_stats (search_stats.h), summed per ligand
+    unsigned int evals;
+    unsigned int bfgs_iterations;
+    unsigned int line_search_backtracks;
+    unsigned int metropolis_trials;
+    unsigned int metropolis_accepts;
+} search_stats_cuda_t;
+
 typedef struct {
     output_type_cuda_t container[MAX_CONTAINER_SIZE_EVERY_WI];
     int current_size;
@@ -34,6 +34,11 @@
 #include "precalculate.h"
 #include "cache.h"
 #include "ad4cache.h"
+#include "batch_pack.h"
+#include "search_stats.h"
+#include "memory_plan.h"
+#include "start_sampling.h"
+#include <boost/thread/thread.hpp>  // hardware_concurrency
 
 /* Below based on mutate_conf.cpp */
 
@@ -856,7 +861,7 @@ __device__ __forceinline__ float line_search(m_cuda_t* m_cuda_gpu, p_cuda_t* p_c
                                              const float f0, const change_cuda_t* p,
                                              output_type_cuda_t* x_new, change_cuda_t* g_new,
                                              float* f1, const float epsilon_fl,
-                                             const float* hunt_cap) {
+                                             const float* hunt_cap, search_stats_cuda_t* stats) {
     const float c0 = 0.0001;
     const int max_trials = 10;
     const float multiplier = 0.5;
@@ -868,7 +873,9 @@ __device__ __forceinline__ float line_search(m_cuda_t* m_cuda_gpu, p_cuda_t* p_c
         output_type_cuda_init_with_output(x_new, x);
         output_type_cuda_increment(x_new, p, alpha, epsilon_fl);
         *f1 = m_eval_deriv(x_new, g_new, m_cuda_gpu, p_cuda_gpu, ig_cuda_gpu, hunt_cap, epsilon_fl);
+        ++stats->evals;
         if (*f1 - f0 < c0 * alpha * pg) break;
+        ++stats->line_search_backtracks;
         alpha *= multiplier;
     }
     return alpha;
@@ -906,7 +913,7 @@ __device__ __forceinline__ bool bfgs_update(matrix_d* h, const change_cuda_t* p,
 __device__ __forceinline__ void bfgs(output_type_cuda_t* x, change_cuda_t* g, m_cuda_t* m_cuda_gpu,
                                      p_cuda_t* p_cuda_gpu, ig_cuda_t* ig_cuda_gpu,
                                      const float* hunt_cap, const float epsilon_fl,
-                                     const int max_steps) {
+                                     const int max_steps, search_stats_cuda_t* stats) {
     int n = 3 + 3 + x->lig_torsion_size; /* the dimensions of matirx */
 
     matrix_d h;
@@ -920,6 +927,7 @@ __device__ __forceinline__ void bfgs(output_type_cuda_t* x, change_cuda_t* g, m_
     output_type_cuda_init_with_output(&x_new, x);
 
     float f0 = m_eval_deriv(x, g, m_cuda_gpu, p_cuda_gpu, ig_cuda_gpu, hunt_cap, epsilon_fl);
+    ++stats->evals;
 
     float f_orig = f0;
     /* Init g_orig, x_orig */
@@ -936,7 +944,8 @@ __device__ __forceinline__ void bfgs(output_type_cuda_t* x, change_cuda_t* g, m_
         float f1 = 0;
 
         const float alpha = line_search(m_cuda_gpu, p_cuda_gpu, ig_cuda_gpu, n, x, g, f0, &p,
-                                        &x_new, &g_new, &f1, epsilon_fl, hunt_cap);
+                                        &x_new, &g_new, &f1, epsilon_fl, hunt_cap, stats);
+        ++stats->bfgs_iterations;
 
         change_cuda_t y;
         change_cuda_init_with_change(&y, &g_new);
@@ -975,13 +984,60 @@ __device__ __forceinline__ void bfgs(output_type_cuda_t* x, change_cuda_t* g, m_
 
 /* Below is monte-carlo kernel, based on kernel.cl*/
 
-__device__ __forceinline__ void m_cuda_init_with_m_cuda(const m_cuda_t* m_cuda_old,
+// Expands ligand l of the packed batch into the private m_cuda_t of a thread, touching only the
+// atoms, pairs and tree nodes the ligand actually has
+__device__ __forceinline__ void m_cuda_init_with_packed(const packed_batch_cuda_t* batch, int l,
                                                         m_cuda_t* m_cuda_new) {
-    memcpy(m_cuda_new, m_cuda_old, MAX_NUM_OF_ATOMS * sizeof(atom_cuda_t));
-    m_cuda_new->m_coords = m_cuda_old->m_coords;
-    m_cuda_new->minus_forces = m_cuda_old->minus_forces;
-    m_cuda_new->ligand = m_cuda_old->ligand;
-    m_cuda_new->m_num_movable_atoms = m_cuda_old->m_num_movable_atoms;
+    m_cuda_new->m_num_movable_atoms = batch->num_movable_atoms[l];
+    if (m_cuda_new->m_num_movable_atoms == -1) return;
+
+    const int atom_begin = batch->atom_offsets[l];
+    const int num_atoms = batch->atom_offsets[l + 1] - atom_begin;
+    for (int i = 0; i < num_atoms; i++) {
+        const int a = atom_begin + i;
+        for (int j = 0; j < 4; j++) m_cuda_new->atoms[i].types[j] = batch->atom_types[a * 4 + j];
+        for (int j = 0; j < 3; j++) {
+            m_cuda_new->atoms[i].coords[j] = batch->atom_coords[a * 3 + j];
+            m_cuda_new->m_coords.coords[i][j] = batch->coords[a * 3 + j];
+            m_cuda_new->minus_forces.coords[i][j] = batch->minus_forces[a * 3 + j];
+        }
+    }
+
+    ligand_cuda_t* ligand = &m_cuda_new->ligand;
+    const int pair_begin = batch->pair_offsets[l];
+    ligand->pairs.num_pairs = batch->pair_offsets[l + 1] - pair_begin;
+    for (int i = 0; i < ligand->pairs.num_pairs; i++) {
+        ligand->pairs.type_pair_index[i] = batch->pair_type_pair_index[pair_begin + i];
+        ligand->pairs.a[i] = batch->pair_a[pair_begin + i];
+        ligand->pairs.b[i] = batch->pair_b[pair_begin + i];
+    }
+    ligand->begin = batch->ligand_begin[l];
+    ligand->end = batch->ligand_end[l];
+
+    rigid_cuda_t* rigid = &ligand->rigid;
+    const int node_begin = batch->node_offsets[l];
+    const int num_nodes = batch->node_offsets[l + 1] - node_begin;
+    rigid->num_children = num_nodes - 1;
+    for (int i = 0; i < num_nodes; i++) {
+        const int n = node_begin + i;
+        rigid->parent[i] = batch->node_parent[n];
+        rigid->atom_range[i][0] = batch->node_atom_range[n * 2];
+        rigid->atom_range[i][1] = batch->node_atom_range[n * 2 + 1];
+        for (int j = 0; j < 9; j++)
+            rigid->orientation_m[i][j] = batch->node_orientation_m[n * 9 + j];
+        for (int j = 0; j < 4; j++)
+            rigid->orientation_q[i][j] = batch->node_orientation_q[n * 4 + j];
+        for (int j = 0; j < 3; j++) {
+            rigid->origin[i][j] = batch->node_origin[n * 3 + j];
+            rigid->axis[i][j] = batch->node_axis[n * 3 + j];
+            rigid->relative_axis[i][j] = batch->node_relative_axis[n * 3 + j];
+            rigid->relative_origin[i][j] = batch->node_relative_origin[n * 3 + j];
+        }
+    }
+    // the tree code only reads children_map[i][j] for i, j < num_nodes
+    for (int i = 0; i < num_nodes; i++)
+        for (int j = 0; j < num_nodes; j++) rigid->children_map[i][j] = false;
+    for (int i = 1; i < num_nodes; i++) rigid->children_map[rigid->parent[i]][i] = true;
 }
 
 __device__ __forceinline__ void get_heavy_atom_movable_coords(output_type_cuda_t* tmp,
@@ -1032,11 +1088,11 @@ __device__ __forceinline__ void write_back(output_type_cuda_t* results,
 #define MAX_THREADS_PER_BLOCK 32
 #define MIN_BLOCKS_PER_MP 32
 __global__ __launch_bounds__(MAX_THREADS_PER_BLOCK, MIN_BLOCKS_PER_MP) void kernel(
-    m_cuda_t* m_cuda_global, ig_cuda_t* ig_cuda_gpu, p_cuda_t* p_cuda_gpu,
+    packed_batch_cuda_t batch_gpu, ig_cuda_t* ig_cuda_gpu, p_cuda_t* p_cuda_gpu,
     float* rand_molec_struc_gpu, float* best_e_gpu, int bfgs_max_steps, float mutation_amplitude,
     curandStatePhilox4_32_10_t* states, unsigned long long seed, float epsilon_fl,
     float* hunt_cap_gpu, float* authentic_v_gpu, output_type_cuda_t* results, int search_depth,
-    int num_of_ligands, int threads_per_ligand, bool multi_bias) {
+    int num_of_ligands, int threads_per_ligand, bool multi_bias, search_stats_cuda_t* stats_gpu) {
     int idx = blockIdx.x * blockDim.x + threadIdx.x;
     float best_e = INFINITY;
 
@@ -1049,7 +1105,7 @@ __global__ __launch_bounds__(MAX_THREADS_PER_BLOCK, MIN_BLOCKS_PER_MP) void kern
         output_type_cuda_init(&tmp,
                               rand_molec_struc_gpu + idx * (SIZE_OF_MOLEC_STRUC / sizeof(float)));
         curand_init(seed, idx, 0, &states[idx]);
-        m_cuda_init_with_m_cuda(m_cuda_global + idx / threads_per_ligand, &m_cuda_gpu);
+        m_cuda_init_with_packed(&batch_gpu, idx / threads_per_ligand, &m_cuda_gpu);
         if (multi_bias) {
             ig_cuda_gpu = ig_cuda_gpu + idx / threads_per_ligand;
         }
@@ -1062,6 +1118,7 @@ __global__ __launch_bounds__(MAX_THREADS_PER_BLOCK, MIN_BLOCKS_PER_MP) void kern
         // BFGS
         output_type_cuda_t best_out;
         output_type_cuda_t candidate;
+        search_stats_cuda_t stats = {0, 0, 0, 0, 0};
 
         for (int step = 0; step < search_depth; step++) {
             output_type_cuda_init_with_output(&candidate, &tmp);
@@ -1069,7 +1126,7 @@ __global__ __launch_bounds__(MAX_THREADS_PER_BLOCK, MIN_BLOCKS_PER_MP) void kern
                              m_cuda_gpu.ligand.end, m_cuda_gpu.atoms, &m_cuda_gpu.m_coords,
                              m_cuda_gpu.ligand.rigid.origin[0], epsilon_fl, mutation_amplitude);
             bfgs(&candidate, &g, &m_cuda_gpu, p_cuda_gpu, ig_cuda_gpu, hunt_cap_gpu, epsilon_fl,
-                 bfgs_max_steps);
+                 bfgs_max_steps, &stats);
             // n ~ U[0,1]
             float n = curand_uniform(&states[idx]);
 
@@ -1077,13 +1134,18 @@ __global__ __launch_bounds__(MAX_THREADS_PER_BLOCK, MIN_BLOCKS_PER_MP) void kern
             // 	DEBUG_PRINTF("metropolis_accept tmp.e=%f, candidate.e=%f, n=%f\n", tmp.e,
             // candidate.e, n);
 
-            if (step == 0 || metropolis_accept(tmp.e, candidate.e, 1.2, n)) {
+            const bool accepted = step == 0 || metropolis_accept(tmp.e, candidate.e, 1.2, n);
+            if (step > 0) {
+                ++stats.metropolis_trials;
+                if (accepted) ++stats.metropolis_accepts;
+            }
+            if (accepted) {
                 output_type_cuda_init_with_output(&tmp, &candidate);
                 set(&tmp, &m_cuda_gpu.ligand.rigid, &m_cuda_gpu.m_coords, m_cuda_gpu.atoms,
                     m_cuda_gpu.m_num_movable_atoms, epsilon_fl);
                 if (tmp.e < best_e) {
                     bfgs(&tmp, &g, &m_cuda_gpu, p_cuda_gpu, ig_cuda_gpu, authentic_v_gpu,
-                         epsilon_fl, bfgs_max_steps);
+                         epsilon_fl, bfgs_max_steps, &stats);
                     // set
                     if (tmp.e < best_e) {
                         set(&tmp, &m_cuda_gpu.ligand.rigid, &m_cuda_gpu.m_coords, m_cuda_gpu.atoms,
@@ -1097,6 +1159,7 @@ __global__ __launch_bounds__(MAX_THREADS_PER_BLOCK, MIN_BLOCKS_PER_MP) void kern
         }
         // write the best conformation back to CPU // FIX?? should add more
         write_back(results + idx, &best_out);
+        stats_gpu[idx] = stats;
         // if (idx % 100 == 0) DEBUG_PRINTF("\nThread %d FINISH", idx);
     }
 }
@@ -1135,11 +1198,119 @@ std::vector<output_type> monte_carlo::cuda_to_vina(output_type_cuda_t results_pt
     return results_vina;
 }
 
+template <typename T> __host__ T* packed_array_to_gpu(const std::vector<T>& v) {
+    T* gpu;
+    checkCUDA(cudaMalloc(&gpu, (std::max)(v.size(), size_t(1)) * sizeof(T)));
+    if (!v.empty())
+        checkCUDA(cudaMemcpy(gpu, v.data(), v.size() * sizeof(T), cudaMemcpyHostToDevice));
+    return gpu;
+}
+
+__host__ void packed_batch_to_gpu(const packed_batch& b, packed_batch_cuda_t* out) {
+    out->atom_offsets = packed_array_to_gpu(b.atom_offsets);
+    out->pair_offsets = packed_array_to_gpu(b.pair_offsets);
+    out->node_offsets = packed_array_to_gpu(b.node_offsets);
+    out->atom_types = packed_array_to_gpu(b.atom_types);
+    out->atom_coords = packed_array_to_gpu(b.atom_coords);
+    out->coords = packed_array_to_gpu(b.coords);
+    out->minus_forces = packed_array_to_gpu(b.minus_forces);
+    out->pair_type_pair_index = packed_array_to_gpu(b.pair_type_pair_index);
+    out->pair_a = packed_array_to_gpu(b.pair_a);
+    out->pair_b = packed_array_to_gpu(b.pair_b);
+    out->node_atom_range = packed_array_to_gpu(b.node_atom_range);
+    out->node_parent = packed_array_to_gpu(b.node_parent);
+    out->node_origin = packed_array_to_gpu(b.node_origin);
+    out->node_orientation_m = packed_array_to_gpu(b.node_orientation_m);
+    out->node_orientation_q = packed_array_to_gpu(b.node_orientation_q);
+    out->node_axis = packed_array_to_gpu(b.node_axis);
+    out->node_relative_axis = packed_array_to_gpu(b.node_relative_axis);
+    out->node_relative_origin = packed_array_to_gpu(b.node_relative_origin);
+    out->ligand_begin = packed_array_to_gpu(b.ligand_begin);
+    out->ligand_end = packed_array_to_gpu(b.ligand_end);
+    out->num_movable_atoms = packed_array_to_gpu(b.num_movable_atoms);
+}
+
+__host__ void free_packed_batch_gpu(packed_batch_cuda_t* b) {
+    checkCUDA(cudaFree(b->atom_offsets));
+    checkCUDA(cudaFree(b->pair_offsets));
+    checkCUDA(cudaFree(b->node_offsets));
+    checkCUDA(cudaFree(b->atom_types));
+    checkCUDA(cudaFree(b->atom_coords));
+    checkCUDA(cudaFree(b->coords));
+    checkCUDA(cudaFree(b->minus_forces));
+    checkCUDA(cudaFree(b->pair_type_pair_index));
+    checkCUDA(cudaFree(b->pair_a));
+    checkCUDA(cudaFree(b->pair_b));
+    checkCUDA(cudaFree(b->node_atom_range));
+    checkCUDA(cudaFree(b->node_parent));
+    checkCUDA(cudaFree(b->node_origin));
+    checkCUDA(cudaFree(b->node_orientation_m));
+    checkCUDA(cudaFree(b->node_orientation_q));
+    checkCUDA(cudaFree(b->node_axis));
+    checkCUDA(cudaFree(b->node_relative_axis));
+    checkCUDA(cudaFree(b->node_relative_origin));
+    checkCUDA(cudaFree(b->ligand_begin));
+    checkCUDA(cudaFree(b->ligand_end));
+    checkCUDA(cudaFree(b->num_movable_atoms));
+}
+
+// Fills the device layout of the maps straight from grid views, without copying the grids
+__host__ void ig_cuda_from_igrid(const igrid& ig, ig_cuda_t* ig_cuda_ptr) {
+    ig_cuda_ptr->atu = ig.get_atu();  // atu
+    DEBUG_PRINTF("ig_cuda_ptr->atu=%d\n", ig_cuda_ptr->atu);
+    ig_cuda_ptr->slope = ig.get_slope();  // slope
+    int grid_size = ig.num_grids();
+    DEBUG_PRINTF("ig.size()=%d, GRIDS_SIZE=%d, should be 33\n", grid_size, GRIDS_SIZE);
+    assert(grid_size <= GRIDS_SIZE);
+
+    for (int i = 0; i < grid_size; i++) {
+        const grid_view g = ig.get_grid(i);
+        for (int j = 0; j < 3; j++) {
+            ig_cuda_ptr->grids[i].m_init[j] = g.m_init[j];
+            ig_cuda_ptr->grids[i].m_factor[j] = g.m_factor[j];
+            ig_cuda_ptr->grids[i].m_dim_fl_minus_1[j] = g.m_dim_fl_minus_1[j];
+            ig_cuda_ptr->grids[i].m_factor_inv[j] = g.m_factor_inv[j];
+        }
+        if (g.m_i != 0) {
+            ig_cuda_ptr->grids[i].m_i = g.m_i;
+            assert(MAX_NUM_OF_GRID_MI >= ig_cuda_ptr->grids[i].m_i);
+            ig_cuda_ptr->grids[i].m_j = g.m_j;
+            assert(MAX_NUM_OF_GRID_MJ >= ig_cuda_ptr->grids[i].m_j);
+            ig_cuda_ptr->grids[i].m_k = g.m_k;
+            assert(MAX_NUM_OF_GRID_MK >= ig_cuda_ptr->grids[i].m_k);
+            assert(g.size() <= MAX_NUM_OF_GRID_POINT);
+            memcpy(ig_cuda_ptr->grids[i].m_data, g.m_data, g.size() * sizeof(fl));
+        } else {
+            ig_cuda_ptr->grids[i].m_i = 0;
+            ig_cuda_ptr->grids[i].m_j = 0;
+            ig_cuda_ptr->grids[i].m_k = 0;
+        }
+    }
+}
+
+__host__ gpu_search_sizes query_gpu_search_sizes() {
+    gpu_search_sizes sizes;
+    sizes.rng_state = sizeof(curandStatePhilox4_32_10_t);
+    // kernel stacks are reserved at the first launch for all the threads the device can keep
+    // resident, however few the batch has
+    cudaFuncAttributes attributes;
+    checkCUDA(cudaFuncGetAttributes(&attributes, kernel));
+    int device, multiprocessors, threads_per_multiprocessor;
+    checkCUDA(cudaGetDevice(&device));
+    checkCUDA(cudaDeviceGetAttribute(&multiprocessors, cudaDevAttrMultiProcessorCount, device));
+    checkCUDA(cudaDeviceGetAttribute(&threads_per_multiprocessor,
+                                     cudaDevAttrMaxThreadsPerMultiProcessor, device));
+    sizes.local_memory
+        = sz(attributes.localSizeBytes) * multiprocessors * threads_per_multiprocessor;
+    return sizes;
+}
+
 __host__ void monte_carlo::operator()(
     std::vector<model>& m_gpu, std::vector<output_container>& out_gpu,
     std::vector<precalculate_byatom>& p_gpu, triangular_matrix_cuda_t* m_data_list_gpu,
     const igrid& ig, const vec& corner1, const vec& corner2, rng& generator, int verbosity,
-    unsigned long long seed, std::vector<std::vector<bias_element>>& bias_batch_list) const {
+    unsigned long long seed, std::vector<std::vector<bias_element>>& bias_batch_list,
+    std::vector<search_stats>* stats) const {
     /* Definitions from vina1.2 */
     DEBUG_PRINTF("entering CUDA monte_carlo search\n");  // debug
 
@@ -1150,27 +1321,21 @@ __host__ void monte_carlo::operator()(
 
     /* Allocate CPU memory and define new data structure */
     DEBUG_PRINTF("Allocating CPU memory\n");  // debug
-    m_cuda_t* m_cuda;
-    checkCUDA(cudaMallocHost(&m_cuda, sizeof(m_cuda_t)));
-
     output_type_cuda_t* rand_molec_struc_tmp;
     checkCUDA(cudaMallocHost(&rand_molec_struc_tmp, sizeof(output_type_cuda_t)));
 
     ig_cuda_t* ig_cuda_ptr;
     checkCUDA(cudaMallocHost(&ig_cuda_ptr, sizeof(ig_cuda_t)));
 
-    p_cuda_t_cpu* p_cuda;
-    checkCUDA(cudaMallocHost(&p_cuda, sizeof(p_cuda_t_cpu)));
+    p_cuda_t* p_cuda;  // scalars only, the tables pointer is set on the device copy
+    checkCUDA(cudaMallocHost(&p_cuda, sizeof(p_cuda_t)));
 
     /* End CPU allocation */
 
     /* Allocate GPU memory */
     DEBUG_PRINTF("Allocating GPU memory\n");
-    size_t m_cuda_size = sizeof(m_cuda_t);
-    DEBUG_PRINTF("m_cuda_size=%lu\n", m_cuda_size);
     size_t ig_cuda_size = sizeof(ig_cuda_t);
     DEBUG_PRINTF("ig_cuda_size=%lu\n", ig_cuda_size);
-    DEBUG_PRINTF("p_cuda_size_cpu=%lu\n", sizeof(p_cuda_t_cpu));
 
     size_t p_cuda_size_gpu = sizeof(p_cuda_t);
     DEBUG_PRINTF("p_cuda_size_gpu=%lu\n", p_cuda_size_gpu);
@@ -1195,10 +1360,18 @@ __host__ void monte_carlo::operator()(
                                static_cast<float>(hunt_cap[2])};
 
     checkCUDA(cudaMalloc(&hunt_cap_gpu, 3 * sizeof(float)));
-    // Preparing m related data
-    m_cuda_t* m_cuda_gpu;
-    DEBUG_PRINTF("m_cuda_size=%lu", m_cuda_size);
-    checkCUDA(cudaMalloc(&m_cuda_gpu, num_of_ligands * m_cuda_size));
+    // Preparing m related data: every ligand packed back to back, sized by what it uses
+    packed_batch batch;
+    batch.pack(m_gpu, (std::max)(boost::thread::hardware_concurrency(), 1u));
+    VINA_FOR(l, batch.num_ligands()) {
+        assert(batch.num_atoms(l) < MAX_NUM_OF_ATOMS);
+        assert(batch.num_pairs(l) <= MAX_NUM_OF_LIG_PAIRS);
+        assert(batch.num_nodes(l) <= MAX_NUM_OF_RIGID);
+    }
+    DEBUG_PRINTF("packed batch size=%lu, fixed-size m_cuda_t batch was %lu\n", batch.bytes(),
+                 num_of_ligands * sizeof(m_cuda_t));
+    packed_batch_cuda_t batch_gpu;
+    packed_batch_to_gpu(batch, &batch_gpu);
     // Preparing p related data
 
     p_cuda_t* p_cuda_gpu;
@@ -1216,45 +1389,15 @@ __host__ void monte_carlo::operator()(
     // Preparing result data
     output_type_cuda_t* results_gpu;
     checkCUDA(cudaMalloc(&results_gpu, thread * sizeof(output_type_cuda_t)));
+    search_stats_cuda_t* stats_gpu;  // threads of unparsable ligands never write theirs
+    checkCUDA(cudaMalloc(&stats_gpu, thread * sizeof(search_stats_cuda_t)));
+    checkCUDA(cudaMemset(stats_gpu, 0, thread * sizeof(search_stats_cuda_t)));
 
     /* End Allocating GPU Memory */
 
     assert(num_of_ligands <= MAX_LIGAND_NUM);
     assert(thread <= MAX_THREAD);
 
-    struct tmp_struct {
-        int start_index = 0;
-        int parent_index = 0;
-        void store_node(tree<segment>& child_ptr, rigid_cuda_t& rigid) {
-            start_index++;  // start with index 1, index 0 is root node
-            rigid.parent[start_index] = parent_index;
-            rigid.atom_range[start_index][0] = child_ptr.node.begin;
-            rigid.atom_range[start_index][1] = child_ptr.node.end;
-            for (int i = 0; i < 9; i++)
-                rigid.orientation_m[start_index][i] = child_ptr.node.get_orientation_m().data[i];
-            rigid.orientation_q[start_index][0] = child_ptr.node.orientation().R_component_1();
-            rigid.orientation_q[start_index][1] = child_ptr.node.orientation().R_component_2();
-            rigid.orientation_q[start_index][2] = child_ptr.node.orientation().R_component_3();
-            rigid.orientation_q[start_index][3] = child_ptr.node.orientation().R_component_4();
-            for (int i = 0; i < 3; i++) {
-                rigid.origin[start_index][i] = child_ptr.node.get_origin()[i];
-                rigid.axis[start_index][i] = child_ptr.node.get_axis()[i];
-                rigid.relative_axis[start_index][i] = child_ptr.node.relative_axis[i];
-                rigid.relative_origin[start_index][i] = child_ptr.node.relative_origin[i];
-            }
-            if (child_ptr.children.size() == 0)
-                return;
-            else {
-                assert(start_index < MAX_NUM_OF_RIGID);
-                int parent_index_tmp = start_index;
-                for (int i = 0; i < child_ptr.children.size(); i++) {
-                    this->parent_index = parent_index_tmp;  // Update parent index
-                    this->store_node(child_ptr.children[i], rigid);
-                }
-            }
-        }
-    };
-
     for (int l = 0; l < num_of_ligands; ++l) {
         model& m = m_gpu[l];
         const precalculate_byatom& p = p_gpu[l];
@@ -1265,97 +1408,8 @@ __host__ void monte_carlo::operator()(
         output_type tmp(s, 0);
         tmp.c = m.get_initial_conf();
 
-        assert(m.atoms.size() < MAX_NUM_OF_ATOMS);
-
-        // Preparing ligand data
-        DEBUG_PRINTF("prepare ligand data\n");
-        assert(m.num_other_pairs() == 0);  // m.other_pairs is not supported!
-        assert(m.ligands.size() <= 1);     // Only one ligand supported!
-
-        if (m.ligands.size() == 0) {  // ligand parsing error
-            m_cuda->m_num_movable_atoms = -1;
-            DEBUG_PRINTF("copy m_cuda to gpu, size=%lu\n", sizeof(m_cuda_t));
-            checkCUDA(cudaMemcpy(m_cuda_gpu + l, m_cuda, sizeof(m_cuda_t), cudaMemcpyHostToDevice));
-        } else {
-            for (int i = 0; i < m.atoms.size(); i++) {
-                m_cuda->atoms[i].types[0]
-                    = m.atoms[i].el;  // To store 4 atoms types (el, ad, xs, sy)
-                m_cuda->atoms[i].types[1] = m.atoms[i].ad;
-                m_cuda->atoms[i].types[2] = m.atoms[i].xs;
-                m_cuda->atoms[i].types[3] = m.atoms[i].sy;
-                for (int j = 0; j < 3; j++) {
-                    m_cuda->atoms[i].coords[j] = m.atoms[i].coords[j];  // To store atom coords
-                }
-            }
-
-            // To store atoms coords
-            for (int i = 0; i < m.coords.size(); i++) {
-                for (int j = 0; j < 3; j++) {
-                    m_cuda->m_coords.coords[i][j] = m.coords[i].data[j];
-                }
-            }
-
-            // To store minus forces
-            for (int i = 0; i < m.coords.size(); i++) {
-                for (int j = 0; j < 3; j++) {
-                    m_cuda->minus_forces.coords[i][j] = m.minus_forces[i].data[j];
-                }
-            }
-
-            m_cuda->ligand.pairs.num_pairs = m.ligands[0].pairs.size();
-            for (int i = 0; i < m_cuda->ligand.pairs.num_pairs; i++) {
-                m_cuda->ligand.pairs.type_pair_index[i] = m.ligands[0].pairs[i].type_pair_index;
-                m_cuda->ligand.pairs.a[i] = m.ligands[0].pairs[i].a;
-                m_cuda->ligand.pairs.b[i] = m.ligands[0].pairs[i].b;
-            }
-            m_cuda->ligand.begin = m.ligands[0].begin;  // 0
-            m_cuda->ligand.end = m.ligands[0].end;      // 29
-            ligand& m_ligand = m.ligands[0];            // Only support one ligand
-            DEBUG_PRINTF("m_ligand.end=%lu, MAX_NUM_OF_ATOMS=%d\n", m_ligand.end, MAX_NUM_OF_ATOMS);
-            assert(m_ligand.end < MAX_NUM_OF_ATOMS);
-
-            // Store root node
-            m_cuda->ligand.rigid.atom_range[0][0] = m_ligand.node.begin;
-            m_cuda->ligand.rigid.atom_range[0][1] = m_ligand.node.end;
-            for (int i = 0; i < 3; i++)
-                m_cuda->ligand.rigid.origin[0][i] = m_ligand.node.get_origin()[i];
-            for (int i = 0; i < 9; i++)
-                m_cuda->ligand.rigid.orientation_m[0][i]
-                    = m_ligand.node.get_orientation_m().data[i];
-            m_cuda->ligand.rigid.orientation_q[0][0] = m_ligand.node.orientation().R_component_1();
-            m_cuda->ligand.rigid.orientation_q[0][1] = m_ligand.node.orientation().R_component_2();
-            m_cuda->ligand.rigid.orientation_q[0][2] = m_ligand.node.orientation().R_component_3();
-            m_cuda->ligand.rigid.orientation_q[0][3] = m_ligand.node.orientation().R_component_4();
-            for (int i = 0; i < 3; i++) {
-                m_cuda->ligand.rigid.axis[0][i] = 0;
-                m_cuda->ligand.rigid.relative_axis[0][i] = 0;
-                m_cuda->ligand.rigid.relative_origin[0][i] = 0;
-            }
-
-            // Store children nodes (in depth-first order)
-            DEBUG_PRINTF("store children nodes\n");
-
-            tmp_struct ts;
-            for (int i = 0; i < m_ligand.children.size(); i++) {
-                ts.parent_index = 0;  // Start a new branch, whose parent is 0
-                ts.store_node(m_ligand.children[i], m_cuda->ligand.rigid);
-            }
-            m_cuda->ligand.rigid.num_children = ts.start_index;
-
-            // set children_map
-            DEBUG_PRINTF("set children map\n");
-            for (int i = 0; i < MAX_NUM_OF_RIGID; i++)
-                for (int j = 0; j < MAX_NUM_OF_RIGID; j++)
-                    m_cuda->ligand.rigid.children_map[i][j] = false;
-            for (int i = 1; i < m_cuda->ligand.rigid.num_children + 1; i++) {
-                int parent_index = m_cuda->ligand.rigid.parent[i];
-                m_cuda->ligand.rigid.children_map[parent_index][i] = true;
-            }
-            m_cuda->m_num_movable_atoms = m.num_movable_atoms();
-
-            DEBUG_PRINTF("copy m_cuda to gpu, size=%lu\n", sizeof(m_cuda_t));
-            checkCUDA(cudaMemcpy(m_cuda_gpu + l, m_cuda, sizeof(m_cuda_t), cudaMemcpyHostToDevice));
-
+        // ligand data is packed above, m.ligands is empty on parsing errors
+        if (m.ligands.size() != 0) {
             /* Prepare rand_molec_struc data */
             int lig_torsion_size = tmp.c.ligands[0].torsions.size();
             DEBUG_PRINTF("lig_torsion_size=%d\n", lig_torsion_size);
@@ -1367,8 +1421,16 @@ __host__ void monte_carlo::operator()(
             // std::vector<vec> uniform_data;
             // uniform_data.resize(thread);
 
+            std::vector<conf> starts;
+            if (spread_starts && !local_only) {
+                rng starts_generator = generator.stream(l, threads_per_ligand);
+                starts = ::spread_starts(m, ig, corner1, corner2, threads_per_ligand,
+                                         starts_generator, max_start_energy);
+            }
             for (int i = 0; i < threads_per_ligand; ++i) {
-                if (!local_only) {
+                if (!starts.empty()) {
+                    tmp.c = starts[i];
+                } else if (!local_only) {
                     tmp.c.randomize(
                         corner1, corner2,
                         generator);  // generate a random structure, can move to GPU if necessary
@@ -1429,142 +1491,24 @@ __host__ void monte_carlo::operator()(
 
         checkCUDA(cudaMalloc(&ig_cuda_gpu, ig_cuda_size * num_of_ligands));
         for (int l = 0; l < num_of_ligands; ++l) {
+            // the bias is added to a private copy of the maps, the only place they are copied
             if (ig.get_atu() == atom_type::XS) {
                 cache ig_tmp(ig.get_gd(), ig.get_slope());
-                ig_tmp.m_grids = ig.get_grids();
-                // // debug
-                // if (l == 1){
-                // 	std::cout << "writing original grid map\n";
-                // 	ig_tmp.write(std::string("./ori"), szv(1,0));
-                // }
+                ig_tmp.m_grids = ig.clone_grids();
                 ig_tmp.compute_bias(m_gpu[l], bias_batch_list[l]);
-                // // debug
-                // std::cout << "writing bias\n";
-                // ig_tmp.write(std::string("./")+std::to_string(l), szv(1,0));
-                ig_cuda_ptr->atu = ig.get_atu();  // atu
-                DEBUG_PRINTF("ig_cuda_ptr->atu=%d\n", ig_cuda_ptr->atu);
-                ig_cuda_ptr->slope = ig.get_slope();  // slope
-                std::vector<grid> tmp_grids = ig.get_grids();
-                int grid_size = tmp_grids.size();
-                DEBUG_PRINTF("ig.size()=%d, GRIDS_SIZE=%d, should be 33\n", grid_size, GRIDS_SIZE);
-
-                for (int i = 0; i < grid_size; i++) {
-                    // DEBUG_PRINTF("i=%d\n",i); //debug
-                    for (int j = 0; j < 3; j++) {
-                        ig_cuda_ptr->grids[i].m_init[j] = tmp_grids[i].m_init[j];
-                        ig_cuda_ptr->grids[i].m_factor[j] = tmp_grids[i].m_factor[j];
-                        ig_cuda_ptr->grids[i].m_dim_fl_minus_1[j]
-                            = tmp_grids[i].m_dim_fl_minus_1[j];
-                        ig_cuda_ptr->grids[i].m_factor_inv[j] = tmp_grids[i].m_factor_inv[j];
-                    }
-                    if (tmp_grids[i].m_data.dim0() != 0) {
-                        ig_cuda_ptr->grids[i].m_i = tmp_grids[i].m_data.dim0();
-                        assert(MAX_NUM_OF_GRID_MI >= ig_cuda_ptr->grids[i].m_i);
-                        ig_cuda_ptr->grids[i].m_j = tmp_grids[i].m_data.dim1();
-                        assert(MAX_NUM_OF_GRID_MJ >= ig_cuda_ptr->grids[i].m_j);
-                        ig_cuda_ptr->grids[i].m_k = tmp_grids[i].m_data.dim2();
-                        assert(MAX_NUM_OF_GRID_MK >= ig_cuda_ptr->grids[i].m_k);
-
-                        assert(tmp_grids[i].m_data.m_data.size()
-                               == ig_cuda_ptr->grids[i].m_i * ig_cuda_ptr->grids[i].m_j
-                                      * ig_cuda_ptr->grids[i].m_k);
-                        assert(tmp_grids[i].m_data.m_data.size() <= MAX_NUM_OF_GRID_POINT);
-                        memcpy(ig_cuda_ptr->grids[i].m_data, tmp_grids[i].m_data.m_data.data(),
-                               tmp_grids[i].m_data.m_data.size() * sizeof(fl));
-                    } else {
-                        ig_cuda_ptr->grids[i].m_i = 0;
-                        ig_cuda_ptr->grids[i].m_j = 0;
-                        ig_cuda_ptr->grids[i].m_k = 0;
-                    }
-                }
+                ig_cuda_from_igrid(ig_tmp, ig_cuda_ptr);
             } else {
                 ad4cache ig_tmp(ig.get_slope());
-                ig_tmp.m_grids = ig.get_grids();
-                // // debug
-                // if (l == 1){
-                // 	std::cout << "writing original grid map\n";
-                // 	ig_tmp.write(std::string("./ori"), szv(1,0));
-                // }
+                ig_tmp.m_grids = ig.clone_grids();
                 ig_tmp.set_bias(bias_batch_list[l]);
-                // // debug
-                // std::cout << "writing bias\n";
-                // ig_tmp.write(std::string("./")+std::to_string(l), szv(1,0));
-                ig_cuda_ptr->atu = ig.get_atu();  // atu
-                DEBUG_PRINTF("ig_cuda_ptr->atu=%d\n", ig_cuda_ptr->atu);
-                ig_cuda_ptr->slope = ig.get_slope();  // slope
-                std::vector<grid> tmp_grids = ig.get_grids();
-                int grid_size = tmp_grids.size();
-                DEBUG_PRINTF("ig.size()=%d, GRIDS_SIZE=%d, should be 33\n", grid_size, GRIDS_SIZE);
-
-                for (int i = 0; i < grid_size; i++) {
-                    // DEBUG_PRINTF("i=%d\n",i); //debug
-                    for (int j = 0; j < 3; j++) {
-                        ig_cuda_ptr->grids[i].m_init[j] = tmp_grids[i].m_init[j];
-                        ig_cuda_ptr->grids[i].m_factor[j] = tmp_grids[i].m_factor[j];
-                        ig_cuda_ptr->grids[i].m_dim_fl_minus_1[j]
-                            = tmp_grids[i].m_dim_fl_minus_1[j];
-                        ig_cuda_ptr->grids[i].m_factor_inv[j] = tmp_grids[i].m_factor_inv[j];
-                    }
-                    if (tmp_grids[i].m_data.dim0() != 0) {
-                        ig_cuda_ptr->grids[i].m_i = tmp_grids[i].m_data.dim0();
-                        assert(MAX_NUM_OF_GRID_MI >= ig_cuda_ptr->grids[i].m_i);
-                        ig_cuda_ptr->grids[i].m_j = tmp_grids[i].m_data.dim1();
-                        assert(MAX_NUM_OF_GRID_MJ >= ig_cuda_ptr->grids[i].m_j);
-                        ig_cuda_ptr->grids[i].m_k = tmp_grids[i].m_data.dim2();
-                        assert(MAX_NUM_OF_GRID_MK >= ig_cuda_ptr->grids[i].m_k);
-
-                        assert(tmp_grids[i].m_data.m_data.size()
-                               == ig_cuda_ptr->grids[i].m_i * ig_cuda_ptr->grids[i].m_j
-                                      * ig_cuda_ptr->grids[i].m_k);
-                        memcpy(ig_cuda_ptr->grids[i].m_data, tmp_grids[i].m_data.m_data.data(),
-                               tmp_grids[i].m_data.m_data.size() * sizeof(fl));
-                    } else {
-                        ig_cuda_ptr->grids[i].m_i = 0;
-                        ig_cuda_ptr->grids[i].m_j = 0;
-                        ig_cuda_ptr->grids[i].m_k = 0;
-                    }
-                }
+                ig_cuda_from_igrid(ig_tmp, ig_cuda_ptr);
             }
-
             checkCUDA(
                 cudaMemcpy(ig_cuda_gpu + l, ig_cuda_ptr, ig_cuda_size, cudaMemcpyHostToDevice));
         }
         std::cout << "set\n";
     } else {
-        ig_cuda_ptr->atu = ig.get_atu();  // atu
-        DEBUG_PRINTF("ig_cuda_ptr->atu=%d\n", ig_cuda_ptr->atu);
-        ig_cuda_ptr->slope = ig.get_slope();  // slope
-        std::vector<grid> tmp_grids = ig.get_grids();
-        int grid_size = tmp_grids.size();
-        DEBUG_PRINTF("ig.size()=%d, GRIDS_SIZE=%d, should be 33\n", grid_size, GRIDS_SIZE);
-
-        for (int i = 0; i < grid_size; i++) {
-            // DEBUG_PRINTF("i=%d\n",i); //debug
-            for (int j = 0; j < 3; j++) {
-                ig_cuda_ptr->grids[i].m_init[j] = tmp_grids[i].m_init[j];
-                ig_cuda_ptr->grids[i].m_factor[j] = tmp_grids[i].m_factor[j];
-                ig_cuda_ptr->grids[i].m_dim_fl_minus_1[j] = tmp_grids[i].m_dim_fl_minus_1[j];
-                ig_cuda_ptr->grids[i].m_factor_inv[j] = tmp_grids[i].m_factor_inv[j];
-            }
-            if (tmp_grids[i].m_data.dim0() != 0) {
-                ig_cuda_ptr->grids[i].m_i = tmp_grids[i].m_data.dim0();
-                assert(MAX_NUM_OF_GRID_MI >= ig_cuda_ptr->grids[i].m_i);
-                ig_cuda_ptr->grids[i].m_j = tmp_grids[i].m_data.dim1();
-                assert(MAX_NUM_OF_GRID_MJ >= ig_cuda_ptr->grids[i].m_j);
-                ig_cuda_ptr->grids[i].m_k = tmp_grids[i].m_data.dim2();
-                assert(MAX_NUM_OF_GRID_MK >= ig_cuda_ptr->grids[i].m_k);
-
-                assert(tmp_grids[i].m_data.m_data.size()
-                       == ig_cuda_ptr->grids[i].m_i * ig_cuda_ptr->grids[i].m_j
-                              * ig_cuda_ptr->grids[i].m_k);
-                memcpy(ig_cuda_ptr->grids[i].m_data, tmp_grids[i].m_data.m_data.data(),
-                       tmp_grids[i].m_data.m_data.size() * sizeof(fl));
-            } else {
-                ig_cuda_ptr->grids[i].m_i = 0;
-                ig_cuda_ptr->grids[i].m_j = 0;
-                ig_cuda_ptr->grids[i].m_k = 0;
-            }
-        }
+        ig_cuda_from_igrid(ig, ig_cuda_ptr);
         DEBUG_PRINTF("memcpy ig_cuda, ig_cuda_size=%lu\n", ig_cuda_size);
         checkCUDA(cudaMalloc(&ig_cuda_gpu, ig_cuda_size));
         checkCUDA(cudaMemcpy(ig_cuda_gpu, ig_cuda_ptr, ig_cuda_size, cudaMemcpyHostToDevice));
@@ -1588,15 +1532,19 @@ __host__ void monte_carlo::operator()(
     /* Launch kernel */
     DEBUG_PRINTF("launch kernel, global_steps=%d, thread=%d, num_of_ligands=%d\n", global_steps,
                  thread, num_of_ligands);
-    kernel<<<thread / 32 + 1, 32>>>(m_cuda_gpu, ig_cuda_gpu, p_cuda_gpu, rand_molec_struc_gpu,
+    kernel<<<thread / 32 + 1, 32>>>(batch_gpu, ig_cuda_gpu, p_cuda_gpu, rand_molec_struc_gpu,
                                     best_e_gpu, quasi_newton_par_max_steps,
                                     mutation_amplitude_float, states, seed, epsilon_fl_float,
                                     hunt_cap_gpu, authentic_v_gpu, results_gpu, global_steps,
-                                    num_of_ligands, threads_per_ligand, multi_bias);
+                                    num_of_ligands, threads_per_ligand, multi_bias, stats_gpu);
 
     // Device to Host memcpy of precalculated_byatom, copy back data to p_gpu
+    size_t max_pnum = 1;  // staging for the largest ligand of the batch
+    for (int l = 0; l < num_of_ligands; ++l)
+        max_pnum = (std::max)(max_pnum, p_gpu[l].m_data.m_data.size());
+    assert(max_pnum <= MAX_P_DATA_M_DATA_SIZE);
     p_m_data_cuda_t* p_data;
-    checkCUDA(cudaMallocHost(&p_data, sizeof(p_m_data_cuda_t) * MAX_P_DATA_M_DATA_SIZE));
+    checkCUDA(cudaMallocHost(&p_data, sizeof(p_m_data_cuda_t) * max_pnum));
     output_type_cuda_t* results;
     checkCUDA(cudaMallocHost(&results, thread * sizeof(output_type_cuda_t)));
 
@@ -1642,9 +1590,23 @@ __host__ void monte_carlo::operator()(
 
     DEBUG_PRINTF("result size=%lu\n", result_vina.size());
 
+    std::vector<search_stats_cuda_t> thread_stats(thread);
+    checkCUDA(cudaMemcpy(thread_stats.data(), stats_gpu, thread * sizeof(search_stats_cuda_t),
+                         cudaMemcpyDeviceToHost));
+    if (stats) stats->assign(num_of_ligands, search_stats());
+    search_stats& host_stats = thread_search_stats();
     for (int i = 0; i < thread; ++i) {
+        const unsigned long long replacements = host_stats.output_replacements;
         add_to_output_container(out_gpu[i / threads_per_ligand], result_vina[i], min_rmsd,
                                 num_saved_mins);
+        if (!stats) continue;
+        search_stats& s = (*stats)[i / threads_per_ligand];
+        s.evals += thread_stats[i].evals;
+        s.bfgs_iterations += thread_stats[i].bfgs_iterations;
+        s.line_search_backtracks += thread_stats[i].line_search_backtracks;
+        s.metropolis_trials += thread_stats[i].metropolis_trials;
+        s.metropolis_accepts += thread_stats[i].metropolis_accepts;
+        s.output_replacements += host_stats.output_replacements - replacements;
     }
     for (int i = 0; i < num_of_ligands; ++i) {
         DEBUG_PRINTF("output poses size = %lu\n", out_gpu[i].size());
@@ -1655,7 +1617,7 @@ __host__ void monte_carlo::operator()(
     }
 
     /* Free memory */
-    checkCUDA(cudaFree(m_cuda_gpu));
+    free_packed_batch_gpu(&batch_gpu);
     checkCUDA(cudaFree(ig_cuda_gpu));
     checkCUDA(cudaFree(p_cuda_gpu));
     checkCUDA(cudaFree(rand_molec_struc_gpu));
@@ -1663,8 +1625,8 @@ __host__ void monte_carlo::operator()(
     checkCUDA(cudaFree(hunt_cap_gpu));
     checkCUDA(cudaFree(authentic_v_gpu));
     checkCUDA(cudaFree(results_gpu));
+    checkCUDA(cudaFree(stats_gpu));
     checkCUDA(cudaFree(states));
-    checkCUDA(cudaFreeHost(m_cuda));
     checkCUDA(cudaFreeHost(rand_molec_struc_tmp));
     checkCUDA(cudaFreeHost(ig_cuda_ptr));
     checkCUDA(cudaFreeHost(p_cuda));
@@ -1683,12 +1645,16 @@ bool metropolis_accept(fl old_f, fl new_f, fl temperature, rng& generator) {
 __host__ void monte_carlo::operator()(model& m, output_container& out, const precalculate_byatom& p,
                                       const igrid& ig, const vec& corner1, const vec& corner2,
                                       rng& generator) const {
+    search_stats& stats = thread_search_stats();
     int evalcount = 0;
     vec authentic_v(1000, 1000, 1000);  // FIXME? this is here to avoid max_fl/max_fl
     conf_size s = m.get_size();
     change g(s);
     output_type tmp(s, 0);
-    tmp.c.randomize(corner1, corner2, generator);
+    if (start)
+        tmp.c = *start;
+    else
+        tmp.c.randomize(corner1, corner2, generator);
     fl best_e = max_fl;
     quasi_newton quasi_newton_par;
     quasi_newton_par.max_steps = local_steps;
@@ -1697,9 +1663,16 @@ __host__ void monte_carlo::operator()(model& m, output_container& out, const pre
         // 	++(*increment_me);
         if ((max_evals > 0) & (evalcount > max_evals)) break;
         output_type candidate = tmp;
-        mutate_conf(candidate.c, m, mutation_amplitude, generator);
+        if (step > 0 || !start)  // a warm start is first minimized as given
+            mutate_conf(candidate.c, m, mutation_amplitude, generator);
         quasi_newton_par(m, p, ig, candidate, g, hunt_cap, evalcount);
-        if (step == 0 || metropolis_accept(tmp.e, candidate.e, temperature, generator)) {
+        const bool accepted
+            = step == 0 || metropolis_accept(tmp.e, candidate.e, temperature, generator);
+        if (step > 0) {
+            ++stats.metropolis_trials;
+            if (accepted) ++stats.metropolis_accepts;
+        }
+        if (accepted) {
             tmp = candidate;
 
             m.set(tmp.c);  // FIXME? useless?
@@ -348,3 +348,31 @@ void precalculate_parallel(triangular_matrix_cuda_t *m_data_list_cpu,
     checkCUDA(cudaFree(common_rs_gpu));
     checkCUDA(cudaFree(m_data_gpu_list));
 }
+
+void precalculate_upload(triangular_matrix_cuda_t *m_data_list_cpu,
+                         const std::vector<precalculate_byatom> &m_precalculated_byatom_gpu,
+                         const int thread) {
+    // same layout as the copy back after monte_carlo, factor included
+    size_t max_pnum = 0;
+    for (int i = 0; i < thread; ++i)
+        max_pnum = std::max(max_pnum, m_precalculated_byatom_gpu[i].m_data.m_data.size());
+    precalculate_element_cuda_t *p_data;
+    checkCUDA(cudaMallocHost(&p_data, sizeof(precalculate_element_cuda_t) * max_pnum));
+
+    for (int i = 0; i < thread; ++i) {
+        const std::vector<precalculate_element> &elements
+            = m_precalculated_byatom_gpu[i].m_data.m_data;
+        for (size_t j = 0; j < elements.size(); ++j) {
+            assert(elements[j].fast.size() == FAST_SIZE);
+            memcpy(p_data[j].fast, &elements[j].fast[0], sizeof(p_data[j].fast));
+            memcpy(p_data[j].smooth, &elements[j].smooth[0], sizeof(p_data[j].smooth));
+            p_data[j].factor = elements[j].factor;
+        }
+        checkCUDA(cudaMalloc(&m_data_list_cpu[i].p_data,
+                             sizeof(precalculate_element_cuda_t) * elements.size()));
+        checkCUDA(cudaMemcpy(m_data_list_cpu[i].p_data, p_data,
+                             sizeof(precalculate_element_cuda_t) * elements.size(),
+                             cudaMemcpyHostToDevice));
+    }
+    checkCUDA(cudaFreeHost(p_data));
+}
@@ -21,14 +21,12 @@
 */
 
 #include "ad4cache.h"
+#include "parallel.h"
 
 namespace fs = boost::filesystem;
 
 float ad4cache::get_slope() const { return this->m_slope; }
 
-// Attention: new gridding method
-std::vector<grid> ad4cache::get_grids() const { return this->m_grids; }
-
 int ad4cache::get_atu() const {
     printf("atom_type::AD=%d\n", atom_type::AD);
     return atom_type::AD;
@@ -52,6 +50,7 @@ void set_ad4_bias(grid& g, std::vector<bias_element>::const_iterator bias) {
 }
 
 void ad4cache::set_bias(const std::vector<bias_element> bias_list) {
+    m_interleaved.clear();  // stale once the maps change
     for (auto bias = bias_list.begin(); bias != bias_list.end(); ++bias) {
         DEBUG_PRINTF("bias info: type=%d, x=%f y=%f z=%f, Vset=%f, r=%f\n", bias->type,
                      bias->coords[0], bias->coords[1], bias->coords[2], bias->vset, bias->r);
@@ -140,6 +139,71 @@ std::string get_adtype_str(sz& t) {
     }
 }
 
+fl ad4cache::eval_atom(sz t, const vec& coords, fl charge, fl v, vec* deriv) const {
+    const grid& g = m_grids[t];  // all AD4 maps share the same dims
+    grid_cell cell;
+    g.locate(coords, m_slope, cell);
+
+    fl f[3][8];
+    if (is_interleaved() && !m_interleaved[t].empty()) {
+        const flv& data = m_interleaved[t];
+        VINA_FOR(c, 8) {
+            const fl* voxel = &data[3 * cell.corners[c]];
+            f[0][c] = voxel[0];
+            f[1][c] = voxel[1];
+            f[2][c] = voxel[2];
+        }
+    } else {
+        g.gather(cell, f[0]);
+        m_grids[AD_TYPE_SIZE].gather(cell, f[1]);
+        m_grids[AD_TYPE_SIZE + 1].gather(cell, f[2]);
+    }
+
+    const grid_weights w(cell, deriv != NULL);
+    const fl factors[3] = {1, charge, std::abs(charge)};
+    fl e = 0;
+    if (deriv) deriv->assign(0);
+    VINA_FOR(k, 3) {
+        vec d;
+        e += g.interpolate(cell, w, f[k], m_slope, v, deriv ? &d : NULL) * factors[k];
+        if (deriv) {
+            d *= factors[k];
+            *deriv += d;
+        }
+    }
+    return e;
+}
+
+sz ad4cache::layout_bytes() const {
+    sz bytes = 0;
+    VINA_FOR_IN(t, m_interleaved) bytes += m_interleaved[t].size() * sizeof(fl);
+    return bytes;
+}
+
+void ad4cache::interleave() {
+    const grid& ge = m_grids[AD_TYPE_SIZE];
+    const grid& gd = m_grids[AD_TYPE_SIZE + 1];
+    m_interleaved.clear();
+    if (!ge.initialized() || !gd.initialized()) return;
+
+    m_interleaved.resize(AD_TYPE_SIZE);
+    VINA_FOR(t, AD_TYPE_SIZE) {
+        const grid& g = m_grids[t];
+        if (!g.initialized()) continue;
+        VINA_CHECK(g.m_data.m_data.size() == ge.m_data.m_data.size());
+        VINA_CHECK(g.m_data.m_data.size() == gd.m_data.m_data.size());
+
+        const sz n = g.m_data.m_data.size();
+        flv& data = m_interleaved[t];
+        data.resize(3 * n);
+        VINA_FOR(i, n) {
+            data[3 * i] = g.m_data.m_data[i];
+            data[3 * i + 1] = ge.m_data.m_data[i];
+            data[3 * i + 2] = gd.m_data.m_data[i];
+        }
+    }
+}
+
 fl ad4cache::eval(const model& m, fl v) const {
     fl e = 0;
     sz nat = num_atom_types(atom_type::AD);
@@ -163,17 +227,8 @@ fl ad4cache::eval(const model& m, fl v) const {
                 break;
         }
 
-        // HB + vdW
-        const grid& g = m_grids[t];
-        e += g.evaluate(m.coords[i], m_slope, v);
-
-        // elec
-        const grid& ge = m_grids[AD_TYPE_SIZE];
-        e += ge.evaluate(m.coords[i], m_slope, v) * a.charge;
-
-        // desolv
-        const grid& gd = m_grids[AD_TYPE_SIZE + 1];
-        e += gd.evaluate(m.coords[i], m_slope, v) * std::abs(a.charge);
+        // HB + vdW, elec, desolv
+        e += eval_atom(t, m.coords[i], a.charge, v, NULL);
     }
     return e;
 }
@@ -201,17 +256,8 @@ fl ad4cache::eval_intra(model& m, fl v) const {
                 break;
         }
 
-        // HB + vdW
-        const grid& g = m_grids[t];
-        e += g.evaluate(m.coords[i], m_slope, v);
-
-        // elec
-        const grid& ge = m_grids[AD_TYPE_SIZE];
-        e += ge.evaluate(m.coords[i], m_slope, v) * a.charge;
-
-        // desolv
-        const grid& gd = m_grids[AD_TYPE_SIZE + 1];
-        e += gd.evaluate(m.coords[i], m_slope, v) * std::abs(a.charge);
+        // HB + vdW, elec, desolv
+        e += eval_atom(t, m.coords[i], a.charge, v, NULL);
     }
     return e;
 }
@@ -239,23 +285,8 @@ fl ad4cache::eval_deriv(model& m, fl v) const {  // sets m.minus_forces
                 break;
         }
 
-        // HB + vdW
-        vec deriv;
-        const grid& g = m_grids[t];
-        e += g.evaluate(m.coords[i], m_slope, v, deriv);
-        m.minus_forces[i] = deriv;
-
-        // elec
-        const grid& ge = m_grids[AD_TYPE_SIZE];
-        e += ge.evaluate(m.coords[i], m_slope, v, deriv) * a.charge;
-        deriv *= a.charge;
-        m.minus_forces[i] += deriv;
-
-        // desolv
-        const grid& gd = m_grids[AD_TYPE_SIZE + 1];
-        e += gd.evaluate(m.coords[i], m_slope, v, deriv) * std::abs(a.charge);
-        deriv *= std::abs(a.charge);
-        m.minus_forces[i] += deriv;
+        // HB + vdW, elec, desolv
+        e += eval_atom(t, m.coords[i], a.charge, v, &m.minus_forces[i]);
     }
     return e;
 }
@@ -426,6 +457,216 @@ void ad4cache::read(const std::string& map_prefix) {
 
     // Store in Ad4cache object
     m_gd = gds[0];
+    m_interleaved.clear();
+}
+
+// Radial lookups sampled every 1 / ad4_table_resolution Angstrom, as AutoGrid does
+const fl ad4_table_resolution = 100;
+
+// nearest sample of a table of n, as AutoGrid rounds r rather than truncating it
+inline sz ad4_table_index(fl r, sz n) {
+    return (std::min)(sz(r * ad4_table_resolution + 0.5), n - 1);
+}
+
+struct ad4_receptor_atom {
+    vec coords;
+    sz t;
+    fl charge;
+    fl volume;
+    fl solvation;  // solvation parameter + solvation_q * |charge|
+};
+
+struct ad4_populate_aux {
+    const std::vector<ad4_receptor_atom>* atoms;
+    const szv_grid* nb_grid;  // indexes atoms within the non-bonded cutoff
+    const szv* needed;        // ligand AD types
+    const szv* receptor_types;   // receptor AD type -> row in vdw_hb, max_sz if absent
+    const std::vector<flv>* vdw_hb;  // [row * needed.size() + j][k], weighted
+    const flv* gauss;                // weighted desolvation gaussian
+    const flv* elec;                 // weighted 332 / (r * diel(r)), capped
+    flv probe_volume;                // per needed type
+    flv probe_solvation;             // per needed type
+    fl solvation_q;
+    fl nb_cutoff_sqr;
+    fl elec_r_max;
+    std::vector<grid>* grids;
+
+    void operator()(sz z) const {
+        const szv& types = *needed;
+        flv affinities(types.size());
+        grid& ge = (*grids)[AD_TYPE_SIZE];
+        grid& gd = (*grids)[AD_TYPE_SIZE + 1];
+
+        VINA_FOR(x, ge.m_data.dim0()) {
+            VINA_FOR(y, ge.m_data.dim1()) {
+                const vec probe_coords = ge.index_to_argument(x, y, z);
+                std::fill(affinities.begin(), affinities.end(), 0);
+                fl e_elec = 0;
+                fl e_dsolv = 0;
+
+                // electrostatics: all receptor atoms, dielectric frozen past the table end
+                VINA_FOR_IN(i, *atoms) {
+                    const ad4_receptor_atom& a = (*atoms)[i];
+                    const fl r = std::sqrt(vec_distance_sqr(a.coords, probe_coords));
+                    if (r < elec_r_max)
+                        e_elec += a.charge * (*elec)[ad4_table_index(r, elec->size())];
+                    else
+                        e_elec += a.charge * elec->back() * elec_r_max / r;
+                }
+
+                // vdW + H-bond + desolvation: atoms within the non-bonded cutoff
+                const szv& possibilities = nb_grid->possibilities(probe_coords);
+                VINA_FOR_IN(possibilities_i, possibilities) {
+                    const ad4_receptor_atom& a = (*atoms)[possibilities[possibilities_i]];
+                    const fl r2 = vec_distance_sqr(a.coords, probe_coords);
+                    if (r2 >= nb_cutoff_sqr) continue;
+                    const sz k = ad4_table_index(std::sqrt(r2), gauss->size());
+                    const fl g = (*gauss)[k];
+                    const sz row = (*receptor_types)[a.t] * types.size();
+                    e_dsolv += solvation_q * a.volume * g;
+                    VINA_FOR_IN(j, types) {
+                        affinities[j] += (*vdw_hb)[row + j][k]
+                                         + (probe_solvation[j] * a.volume
+                                            + a.solvation * probe_volume[j])
+                                               * g;
+                    }
+                }
+
+                VINA_FOR_IN(j, types)
+                (*grids)[types[j]].m_data(x, y, z) = affinities[j];
+                ge.m_data(x, y, z) = e_elec;
+                gd.m_data(x, y, z) = e_dsolv;
+            }
+        }
+    }
+};
+
+void ad4cache::populate(const model& m, const ScoringFunction& sf, const szv& atom_types_needed,
+                        sz num_threads) {
+    VINA_CHECK(sf.m_sf_choice == SF_AD42);
+    VINA_CHECK(num_threads > 0);
+    // potentials and weights in the order set up by ScoringFunction for SF_AD42
+    ad4_vdw* vdw = static_cast<ad4_vdw*>(sf.m_potentials[0]);
+    ad4_hb* hb = static_cast<ad4_hb*>(sf.m_potentials[1]);
+    ad4_electrostatic* elec = static_cast<ad4_electrostatic*>(sf.m_potentials[2]);
+    ad4_solvation* solv = static_cast<ad4_solvation*>(sf.m_potentials[3]);
+    const flv& weights = sf.m_weights;
+
+    szv needed;
+    bool got_C_already = false;
+    VINA_FOR_IN(i, atom_types_needed) {
+        sz t = atom_types_needed[i];
+        switch (t) {
+            case AD_TYPE_G0:
+            case AD_TYPE_G1:
+            case AD_TYPE_G2:
+            case AD_TYPE_G3:
+                continue;
+            case AD_TYPE_CG0:
+            case AD_TYPE_CG1:
+            case AD_TYPE_CG2:
+            case AD_TYPE_CG3:
+                if (got_C_already) continue;
+                t = AD_TYPE_C;
+                got_C_already = true;
+                break;
+        }
+        if (t >= AD_TYPE_SIZE || has(needed, t)) continue;
+        needed.push_back(t);
+    }
+
+    VINA_FOR_IN(j, needed) m_grids[needed[j]].init(m_gd);
+    m_grids[AD_TYPE_SIZE].init(m_gd);
+    m_grids[AD_TYPE_SIZE + 1].init(m_gd);
+    m_interleaved.clear();
+
+    // AutoGrid applies the non-bonded cutoff to vdW, H-bond and desolvation, not to electrostatics
+    const fl nb_cutoff = vdw->get_cutoff();
+    const fl elec_r_max = elec->get_cutoff();
+    const sz n_nb = sz(nb_cutoff * ad4_table_resolution) + 1;
+    const sz n_elec = sz(elec_r_max * ad4_table_resolution) + 1;
+
+    std::vector<ad4_receptor_atom> atoms;
+    szv receptor_types(AD_TYPE_SIZE, max_sz);
+    szv present;
+    VINA_FOR_IN(i, m.grid_atoms) {
+        const atom& a = m.grid_atoms[i];
+        ad4_receptor_atom ra;
+        ra.coords = a.coords;
+        ra.t = a.ad;
+        ra.charge = a.charge;
+        if (a.ad < AD_TYPE_SIZE) {
+            ra.volume = weights[3] * solv->volume(a);
+            ra.solvation = solv->solvation_parameter(a)
+                           + (solv->charge_dependent ? solv->solvation_q : 0) * std::abs(a.charge);
+            if (receptor_types[a.ad] == max_sz) {
+                receptor_types[a.ad] = present.size();
+                present.push_back(a.ad);
+            }
+        } else {  // keeps indices aligned with m.grid_atoms; szv_grid skips these
+            ra.t = 0;
+            ra.charge = 0;
+            ra.volume = 0;
+            ra.solvation = 0;
+        }
+        atoms.push_back(ra);
+    }
+
+    atom probe;
+    atom other;
+    flv probe_volume(needed.size());
+    flv probe_solvation(needed.size());
+    std::vector<flv> vdw_hb(present.size() * needed.size(), flv(n_nb, 0));
+    VINA_FOR_IN(j, needed) {
+        probe.ad = needed[j];
+        probe.charge = 0;
+        probe_volume[j] = weights[3] * solv->volume(probe);
+        probe_solvation[j] = solv->solvation_parameter(probe);
+        VINA_FOR_IN(row, present) {
+            other.ad = present[row];
+            flv& table = vdw_hb[row * needed.size() + j];
+            VINA_FOR(k, n_nb) {
+                const fl r = k / ad4_table_resolution;
+                table[k] = weights[0] * vdw->eval(other, probe, r)
+                           + weights[1] * hb->eval(other, probe, r);
+            }
+        }
+    }
+
+    flv gauss(n_nb, 0);
+    VINA_FOR(k, n_nb) {
+        const fl r = k / ad4_table_resolution;
+        gauss[k] = std::exp(-0.5 * sqr(r / solv->desolvation_sigma));
+    }
+
+    flv elec_table(n_elec, 0);
+    probe.charge = 1;
+    other.charge = 1;
+    VINA_FOR(k, n_elec) {
+        // evaluate just inside each bin so the last one is still within the potential's cutoff
+        const fl r = (std::min)(k / ad4_table_resolution, elec_r_max - epsilon_fl * elec_r_max);
+        elec_table[k] = weights[2] * elec->eval(other, probe, r);
+    }
+
+    const szv_grid nb_grid(m, szv_grid_dims(m_gd), sqr(nb_cutoff));
+
+    ad4_populate_aux aux;
+    aux.atoms = &atoms;
+    aux.nb_grid = &nb_grid;
+    aux.needed = &needed;
+    aux.receptor_types = &receptor_types;
+    aux.vdw_hb = &vdw_hb;
+    aux.gauss = &gauss;
+    aux.elec = &elec_table;
+    aux.probe_volume = probe_volume;
+    aux.probe_solvation = probe_solvation;
+    aux.solvation_q = solv->charge_dependent ? solv->solvation_q : 0;
+    aux.nb_cutoff_sqr = sqr(nb_cutoff);
+    aux.elec_r_max = elec_r_max;
+    aux.grids = &m_grids;
+
+    parallel_for<ad4_populate_aux, true> slabs(&aux, num_threads);
+    slabs.run(m_grids[AD_TYPE_SIZE].m_data.dim2());
 }
 
 void ad4cache::write(const std::string& out_prefix, const szv& atom_types,
@@ -39,10 +39,13 @@
 #include "szv_grid.h"
 #include "common.h"
 #include "bias.h"
+#include "scoring_function.h"
 
 struct ad4cache : public igrid {
 public:
     ad4cache(fl slope = 1e6) : m_slope(slope), m_grids(AD_TYPE_SIZE + 2) {}
+    ad4cache(const grid_dims& gd, fl slope = 1e6)
+        : m_gd(gd), m_slope(slope), m_grids(AD_TYPE_SIZE + 2) {}
     fl eval(const model& m, fl v) const;  // needs m.coords // clean up
     fl eval_intra(model& m, fl v) const;  // needs m.coords, sets m.minus_forces // clean up
     fl eval_deriv(model& m, fl v) const;  // needs m.coords, sets m.minus_forces // clean up
@@ -59,19 +62,34 @@ public:
     bool is_atom_type_grid_initialized(sz t) const { return m_grids[t].initialized(); }
     bool are_atom_types_grid_initialized(szv atom_types) const;
     void read(const std::string& str);
+    // AutoGrid-style affinity, electrostatics and desolvation maps from the receptor grid atoms,
+    // computed over z slabs with num_threads threads
+    void populate(const model& m, const ScoringFunction& sf, const szv& atom_types_needed,
+                  sz num_threads = 1);
     void write(const std::string& out_prefix, const szv& atom_types,
                const std::string& gpf_filename = "NULL", const std::string& fld_filename = "NULL",
                const std::string& receptor_filename = "NULL");
     // add for gpu
     float get_slope() const;
     void set_bias(const std::vector<bias_element> bias_list);
-    std::vector<grid> get_grids() const;
+    sz num_grids() const { return m_grids.size(); }
+    grid_view get_grid(sz i) const { return grid_view(m_grids[i]); }
+    std::vector<grid> clone_grids() const { return m_grids; }
     int get_atu() const;
     std::vector<grid> m_grids;
+    // optional (type, elec, dsolv) per-voxel layout, so that one atom touches one cache line
+    // per corner; must be rebuilt after m_grids change
+    void interleave();
+    bool is_interleaved() const { return !m_interleaved.empty(); }
+    sz layout_bytes() const;  // of the interleaved layout
 
 private:
+    // type + charge * elec + |charge| * dsolv, interpolation weights computed once
+    fl eval_atom(sz t, const vec& coords, fl charge, fl v, vec* deriv) const;
+
     grid_dims m_gd;
-    fl m_slope;  // does not get (de-)serialized
+    fl m_slope;                      // does not get (de-)serialized
+    std::vector<flv> m_interleaved;  // indexed by AD type, empty if not interleaved
 };
 
 #endif
\ No newline at end of file
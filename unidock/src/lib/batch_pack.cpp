@@ -0,0 +1,240 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#include "batch_pack.h"
+#include "parallel.h"
+
+namespace {
+sz count_nodes(const tree<segment>& t) {
+    sz n = 1;
+    VINA_FOR_IN(i, t.children) n += count_nodes(t.children[i]);
+    return n;
+}
+
+template <typename T> T* at(std::vector<T>& v, sz i, sz width) { return v.data() + i * width; }
+
+template <typename T> const T* at(const std::vector<T>& v, sz i, sz width) {
+    return v.data() + i * width;
+}
+
+void store_vec(const vec& v, float* out) {
+    VINA_FOR(i, 3) out[i] = float(v[i]);
+}
+
+void store_frame(const frame& f, packed_batch& b, sz node) {
+    store_vec(f.get_origin(), at(b.node_origin, node, 3));
+    VINA_FOR(i, 9) at(b.node_orientation_m, node, 9)[i] = float(f.get_orientation_m().data[i]);
+    float* q = at(b.node_orientation_q, node, 4);
+    q[0] = float(f.orientation().R_component_1());
+    q[1] = float(f.orientation().R_component_2());
+    q[2] = float(f.orientation().R_component_3());
+    q[3] = float(f.orientation().R_component_4());
+}
+
+// Writes t and its subtree depth-first starting at the ligand-local index next, the same
+// numbering the device tree code expects
+void store_node(const tree<segment>& t, int parent, int& next, sz node_base, packed_batch& b) {
+    const int self = next++;
+    const sz node = node_base + self;
+    b.node_parent[node] = parent;
+    at(b.node_atom_range, node, 2)[0] = int(t.node.begin);
+    at(b.node_atom_range, node, 2)[1] = int(t.node.end);
+    store_frame(t.node, b, node);
+    store_vec(t.node.get_axis(), at(b.node_axis, node, 3));
+    store_vec(t.node.relative_axis, at(b.node_relative_axis, node, 3));
+    store_vec(t.node.relative_origin, at(b.node_relative_origin, node, 3));
+    VINA_FOR_IN(i, t.children) store_node(t.children[i], self, next, node_base, b);
+}
+
+struct pack_aux {
+    const std::vector<model>* models;
+    packed_batch* batch;
+
+    void operator()(sz l) const {
+        const model& m = (*models)[l];
+        packed_batch& b = *batch;
+        if (m.ligands.empty()) {
+            b.ligand_begin[l] = 0;
+            b.ligand_end[l] = 0;
+            b.num_movable_atoms[l] = -1;
+            return;
+        }
+        const sz atom_base = b.atom_offsets[l];
+        VINA_FOR_IN(i, m.atoms) {
+            const atom& a = m.atoms[i];
+            int* t = at(b.atom_types, atom_base + i, 4);
+            t[0] = int(a.el);
+            t[1] = int(a.ad);
+            t[2] = int(a.xs);
+            t[3] = int(a.sy);
+            store_vec(a.coords, at(b.atom_coords, atom_base + i, 3));
+            store_vec(m.coords[i], at(b.coords, atom_base + i, 3));
+            store_vec(m.minus_forces[i], at(b.minus_forces, atom_base + i, 3));
+        }
+
+        const ligand& lig = m.ligands[0];
+        const sz pair_base = b.pair_offsets[l];
+        VINA_FOR_IN(i, lig.pairs) {
+            b.pair_type_pair_index[pair_base + i] = int(lig.pairs[i].type_pair_index);
+            b.pair_a[pair_base + i] = int(lig.pairs[i].a);
+            b.pair_b[pair_base + i] = int(lig.pairs[i].b);
+        }
+        // the kernels have no constant term, constant pairs are scored like the others
+        const sz constant_base = pair_base + lig.pairs.size();
+        VINA_FOR_IN(i, lig.constant_pairs) {
+            const fixed_pair& fp = lig.constant_pairs[i];
+            b.pair_type_pair_index[constant_base + i] = int(fp.type_pair_index);
+            b.pair_a[constant_base + i] = int(fp.a);
+            b.pair_b[constant_base + i] = int(fp.b);
+        }
+
+        const sz node_base = b.node_offsets[l];
+        b.node_parent[node_base] = -1;
+        at(b.node_atom_range, node_base, 2)[0] = int(lig.node.begin);
+        at(b.node_atom_range, node_base, 2)[1] = int(lig.node.end);
+        store_frame(lig.node, b, node_base);
+        VINA_FOR(i, 3) {
+            at(b.node_axis, node_base, 3)[i] = 0;
+            at(b.node_relative_axis, node_base, 3)[i] = 0;
+            at(b.node_relative_origin, node_base, 3)[i] = 0;
+        }
+        int next = 1;
+        VINA_FOR_IN(i, lig.children) store_node(lig.children[i], 0, next, node_base, b);
+        assert(sz(next) == b.num_nodes(l));
+
+        b.ligand_begin[l] = int(lig.begin);
+        b.ligand_end[l] = int(lig.end);
+        b.num_movable_atoms[l] = int(m.num_movable_atoms());
+    }
+};
+}  // namespace
+
+sz count_nodes(const ligand& lig) {
+    sz n = 1;  // root
+    VINA_FOR_IN(i, lig.children) n += count_nodes(lig.children[i]);
+    return n;
+}
+
+void packed_batch::clear() {
+    atom_offsets.assign(1, 0);
+    pair_offsets.assign(1, 0);
+    node_offsets.assign(1, 0);
+    atom_types.clear();
+    atom_coords.clear();
+    coords.clear();
+    minus_forces.clear();
+    pair_type_pair_index.clear();
+    pair_a.clear();
+    pair_b.clear();
+    node_atom_range.clear();
+    node_parent.clear();
+    node_origin.clear();
+    node_orientation_m.clear();
+    node_orientation_q.clear();
+    node_axis.clear();
+    node_relative_axis.clear();
+    node_relative_origin.clear();
+    ligand_begin.clear();
+    ligand_end.clear();
+    num_movable_atoms.clear();
+}
+
+void packed_batch::pack(const std::vector<model>& models, sz num_threads) {
+    clear();
+    const sz n = models.size();
+
+    // Sizes first, so every ligand can be written into its own slice concurrently
+    VINA_FOR(l, n) {
+        const model& m = models[l];
+        sz atoms = 0, pairs = 0, nodes = 0;
+        if (!m.ligands.empty()) {
+            VINA_CHECK(m.ligands.size() == 1);   // one ligand per model
+            VINA_CHECK(m.num_other_pairs() == 0);  // flex - flex pairs are not supported
+            VINA_CHECK(m.coords.size() == m.atoms.size());
+            VINA_CHECK(m.minus_forces.size() == m.atoms.size());
+            atoms = m.atoms.size();
+            pairs = m.ligands[0].pairs.size() + m.ligands[0].constant_pairs.size();
+            nodes = count_nodes(m.ligands[0]);
+        }
+        atom_offsets.push_back(atom_offsets.back() + int(atoms));
+        pair_offsets.push_back(pair_offsets.back() + int(pairs));
+        node_offsets.push_back(node_offsets.back() + int(nodes));
+    }
+
+    const sz total_atoms = atom_offsets.back();
+    const sz total_pairs = pair_offsets.back();
+    const sz total_nodes = node_offsets.back();
+    atom_types.resize(4 * total_atoms);
+    atom_coords.resize(3 * total_atoms);
+    coords.resize(3 * total_atoms);
+    minus_forces.resize(3 * total_atoms);
+    pair_type_pair_index.resize(total_pairs);
+    pair_a.resize(total_pairs);
+    pair_b.resize(total_pairs);
+    node_atom_range.resize(2 * total_nodes);
+    node_parent.resize(total_nodes);
+    node_origin.resize(3 * total_nodes);
+    node_orientation_m.resize(9 * total_nodes);
+    node_orientation_q.resize(4 * total_nodes);
+    node_axis.resize(3 * total_nodes);
+    node_relative_axis.resize(3 * total_nodes);
+    node_relative_origin.resize(3 * total_nodes);
+    ligand_begin.resize(n);
+    ligand_end.resize(n);
+    num_movable_atoms.resize(n);
+
+    pack_aux aux;
+    aux.models = &models;
+    aux.batch = this;
+    if (num_threads > 1 && n > 1) {
+        parallel_for<pack_aux, true> workers(&aux, (std::min)(num_threads, n));
+        workers.run(n);
+    } else {
+        VINA_FOR(l, n) aux(l);
+    }
+}
+
+packed_ligand packed_batch::ligand(sz l) const {
+    packed_ligand v;
+    const sz a = atom_offsets[l];
+    const sz p = pair_offsets[l];
+    const sz k = node_offsets[l];
+    v.num_atoms = num_atoms(l);
+    v.num_pairs = num_pairs(l);
+    v.num_nodes = num_nodes(l);
+    v.atom_types = at(atom_types, a, 4);
+    v.atom_coords = at(atom_coords, a, 3);
+    v.coords = at(coords, a, 3);
+    v.minus_forces = at(minus_forces, a, 3);
+    v.pair_type_pair_index = at(pair_type_pair_index, p, 1);
+    v.pair_a = at(pair_a, p, 1);
+    v.pair_b = at(pair_b, p, 1);
+    v.node_atom_range = at(node_atom_range, k, 2);
+    v.node_parent = at(node_parent, k, 1);
+    v.node_origin = at(node_origin, k, 3);
+    v.node_orientation_m = at(node_orientation_m, k, 9);
+    v.node_orientation_q = at(node_orientation_q, k, 4);
+    v.node_axis = at(node_axis, k, 3);
+    v.node_relative_axis = at(node_relative_axis, k, 3);
+    v.node_relative_origin = at(node_relative_origin, k, 3);
+    v.begin = ligand_begin[l];
+    v.end = ligand_end[l];
+    v.num_movable_atoms = num_movable_atoms[l];
+    return v;
+}
+
+sz packed_batch::bytes() const {
+    const sz ints = atom_offsets.size() + pair_offsets.size() + node_offsets.size()
+                    + atom_types.size() + pair_type_pair_index.size() + pair_a.size()
+                    + pair_b.size() + node_atom_range.size() + node_parent.size()
+                    + ligand_begin.size() + ligand_end.size() + num_movable_atoms.size();
+    const sz floats = atom_coords.size() + coords.size() + minus_forces.size()
+                      + node_origin.size() + node_orientation_m.size()
+                      + node_orientation_q.size() + node_axis.size() + node_relative_axis.size()
+                      + node_relative_origin.size();
+    return ints * sizeof(int) + floats * sizeof(float);
+}
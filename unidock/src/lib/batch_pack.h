@@ -0,0 +1,88 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#ifndef VINA_BATCH_PACK_H
+#define VINA_BATCH_PACK_H
+
+#include "model.h"
+
+// A batch of single-ligand models laid out back to back for the batched Monte Carlo engines.
+// Atoms, intra-ligand pairs and torsion tree nodes of ligand l occupy
+// [x_offsets[l], x_offsets[l + 1]) of their arrays, so a fragment costs only what it uses.
+// Indices stored inside a ligand (pair atoms, node atom ranges and parents) are ligand-local.
+// Element types are int/float so the arrays can be copied to the device verbatim.
+struct packed_ligand;
+
+sz count_nodes(const ligand& lig);  // torsion tree nodes, root included
+
+struct packed_batch {
+public:
+    packed_batch() { clear(); }
+    void clear();
+    // models without a ligand (parsing errors) are kept as empty entries with num_movable_atoms -1
+    void pack(const std::vector<model>& models, sz num_threads = 1);
+    sz num_ligands() const { return ligand_begin.size(); }
+    sz num_atoms(sz l) const { return atom_offsets[l + 1] - atom_offsets[l]; }
+    sz num_pairs(sz l) const { return pair_offsets[l + 1] - pair_offsets[l]; }
+    sz num_nodes(sz l) const { return node_offsets[l + 1] - node_offsets[l]; }
+    packed_ligand ligand(sz l) const;
+    sz bytes() const;  // host memory held by the arrays
+
+    std::vector<int> atom_offsets;  // num_ligands() + 1 entries
+    std::vector<int> pair_offsets;  // num_ligands() + 1 entries
+    std::vector<int> node_offsets;  // num_ligands() + 1 entries
+
+    std::vector<int> atom_types;      // [atom][4] el, ad, xs, sy
+    std::vector<float> atom_coords;   // [atom][3] internal coords (atom::coords)
+    std::vector<float> coords;        // [atom][3] model::coords
+    std::vector<float> minus_forces;  // [atom][3] model::minus_forces
+
+    std::vector<int> pair_type_pair_index;  // [pair]
+    std::vector<int> pair_a;                // [pair]
+    std::vector<int> pair_b;                // [pair]
+
+    // depth-first order, node 0 of every ligand is the root
+    std::vector<int> node_atom_range;           // [node][2] begin, end
+    std::vector<int> node_parent;               // [node], -1 for the root
+    std::vector<float> node_origin;             // [node][3]
+    std::vector<float> node_orientation_m;      // [node][9]
+    std::vector<float> node_orientation_q;      // [node][4]
+    std::vector<float> node_axis;               // [node][3], 0 for the root
+    std::vector<float> node_relative_axis;      // [node][3], 0 for the root
+    std::vector<float> node_relative_origin;    // [node][3], 0 for the root
+
+    std::vector<int> ligand_begin;       // [ligand] ligand::begin
+    std::vector<int> ligand_end;         // [ligand] ligand::end
+    std::vector<int> num_movable_atoms;  // [ligand], -1 if the model has no ligand
+};
+
+// Read-only view of one ligand of a packed_batch, as consumed by a batch engine
+struct packed_ligand {
+    sz num_atoms;
+    sz num_pairs;
+    sz num_nodes;
+    const int* atom_types;
+    const float* atom_coords;
+    const float* coords;
+    const float* minus_forces;
+    const int* pair_type_pair_index;
+    const int* pair_a;
+    const int* pair_b;
+    const int* node_atom_range;
+    const int* node_parent;
+    const float* node_origin;
+    const float* node_orientation_m;
+    const float* node_orientation_q;
+    const float* node_axis;
+    const float* node_relative_axis;
+    const float* node_relative_origin;
+    int begin;
+    int end;
+    int num_movable_atoms;
+};
+
+#endif
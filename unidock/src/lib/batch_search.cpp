@@ -0,0 +1,265 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#include "batch_search.h"
+#include "vina.h"
+#include "parse_pdbqt.h"
+#include "parse_error.h"
+#include "start_sampling.h"
+
+batch_search::batch_search(Vina& v, const std::vector<std::string>& ligand_names,
+                           const std::vector<std::string>& out_names, int exhaustiveness,
+                           int n_poses, double min_rmsd, int max_evals, int how_many,
+                           double energy_range, bool keep_H)
+    : m_v(v),
+      m_ligand_names(ligand_names),
+      m_out_names(out_names),
+      m_exhaustiveness(exhaustiveness),
+      m_n_poses(n_poses),
+      m_min_rmsd(min_rmsd),
+      m_max_evals(max_evals),
+      m_how_many(how_many),
+      m_energy_range(energy_range),
+      m_keep_H(keep_H),
+      m_refine(v.refines_poses()),
+      m_workers(v.m_cpu > 0 ? v.m_cpu : 1),
+      m_ligands(ligand_names.size()),
+      m_next_ligand(0),
+      m_preparing(0),
+      m_in_flight(0),
+      m_write_done(false) {
+    VINA_CHECK(ligand_names.size() == out_names.size());
+    VINA_CHECK(exhaustiveness > 0);
+    // enough ligands in flight to keep every worker on a chain, plus one being prepared
+    m_window = 2 * m_workers / exhaustiveness + 2;
+}
+
+void batch_search::run() {
+    boost::thread writer(&batch_search::write, this);
+    boost::thread_group workers;
+    VINA_FOR(i, m_workers)
+    workers.create_thread([this]() { work(); });
+
+    VINA_FOR_IN(done, m_ligands) {
+        sz l;
+        {
+            boost::mutex::scoped_lock self_lk(m_mutex);
+            while (m_finished.empty()) m_cond.wait(self_lk);
+            l = m_finished.front();
+            m_finished.pop_front();
+        }
+        finish(l);
+        {
+            boost::mutex::scoped_lock self_lk(m_mutex);
+            m_ligands[l].reset();
+            --m_in_flight;
+            m_cond.notify_all();  // m_in_flight modified
+        }
+    }
+    workers.join_all();
+
+    {
+        boost::mutex::scoped_lock write_lk(m_write_mutex);
+        m_write_done = true;
+        m_write_cond.notify_all();
+    }
+    writer.join();
+}
+
+void batch_search::work() {
+    model scratch;  // reused by every chain this worker runs
+    non_cache receptor;  // refinement changes its slope, so each worker has its own
+    if (m_refine) receptor = m_v.m_non_cache;
+    sz l = 0;
+    sz chain = 0;
+    while (next_task(l, chain)) {
+        if (chain == max_sz)
+            prepare(l);
+        else
+            search(l, chain, scratch, receptor);
+    }
+}
+
+bool batch_search::next_task(sz& l, sz& chain) {
+    boost::mutex::scoped_lock self_lk(m_mutex);
+    while (true) {
+        const bool can_prepare = m_next_ligand < m_ligands.size() && m_in_flight < m_window;
+        if (!m_chains.empty() && (m_chains.size() >= m_workers || !can_prepare)) {
+            l = m_chains.front().first;
+            chain = m_chains.front().second;
+            m_chains.pop_front();
+            return true;
+        }
+        if (can_prepare) {
+            l = m_next_ligand++;
+            chain = max_sz;
+            ++m_preparing;
+            ++m_in_flight;
+            return true;
+        }
+        if (m_next_ligand == m_ligands.size() && m_preparing == 0) return false;
+        m_cond.wait(self_lk);
+    }
+}
+
+void batch_search::prepare(sz l) {
+    const std::string& name = m_ligand_names[l];
+    const atom_type::t atom_typing = m_v.m_scoring_function.get_atom_typing();
+    std::unique_ptr<ligand> lig(new ligand);
+    lig->chains_left = 0;
+    lig->ok = false;
+    try {
+        model parsed = parse_ligand_from_file_no_failure(name, atom_typing, m_keep_H);
+        if (parsed.num_ligands() > 0) {
+            lig->m = m_v.m_receptor_initialized ? m_v.m_receptor : model(atom_typing);
+            lig->m.append(parsed);
+
+            // Check that all atom types are in the grid
+            const szv atom_types = lig->m.get_movable_atom_types(atom_typing);
+            if (m_v.m_sf_choice == SF_VINA || m_v.m_sf_choice == SF_VINARDO)
+                lig->ok = m_v.m_grid.are_atom_types_grid_initialized(atom_types);
+            else
+                lig->ok = m_v.m_ad4grid.are_atom_types_grid_initialized(atom_types);
+        }
+    } catch (file_error& e) {
+        std::cerr << "ERROR: Could not open \"" << e.name.string() << "\" for reading.\n";
+    } catch (struct_parse_error& e) {
+        std::cerr << e.what() << "Ligand name:" << name << "\n\n";
+    }
+
+    if (lig->ok) {
+        lig->p = m_v.precalculate_ligand(lig->m);
+        lig->mc = m_v.cpu_monte_carlo(lig->m, m_n_poses, m_min_rmsd, m_max_evals);
+        if (lig->mc.spread_starts && !lig->mc.start) {
+            // the stream past the last chain of this ligand
+            rng generator(static_cast<rng::result_type>(m_v.m_seed), l, m_exhaustiveness);
+            if (m_v.m_sf_choice == SF_VINA || m_v.m_sf_choice == SF_VINARDO)
+                lig->starts = spread_starts(lig->m, m_v.m_grid, m_v.m_grid.corner1(),
+                                            m_v.m_grid.corner2(), m_exhaustiveness, generator,
+                                            lig->mc.max_start_energy);
+            else
+                lig->starts = spread_starts(lig->m, m_v.m_ad4grid, m_v.m_ad4grid.corner1(),
+                                            m_v.m_ad4grid.corner2(), m_exhaustiveness, generator,
+                                            lig->mc.max_start_energy);
+        }
+        lig->chains.resize(m_exhaustiveness);
+        lig->chains_left = m_exhaustiveness;
+    } else {
+        std::cerr << "WARNING: Skipping ligand " << name << ".\n";
+    }
+
+    boost::mutex::scoped_lock self_lk(m_mutex);
+    --m_preparing;
+    if (lig->ok) {
+        VINA_FOR(i, m_exhaustiveness)
+        m_chains.push_back(std::make_pair(l, i));
+    } else {
+        m_finished.push_back(l);
+    }
+    m_ligands[l] = std::move(lig);
+    m_cond.notify_all();  // m_chains or m_finished modified
+}
+
+void batch_search::search(sz l, sz chain, model& scratch, non_cache& receptor) {
+    ligand& lig = *m_ligands[l];  // set before its chains were queued, not moved until finished
+    scratch = lig.m;
+    search_stats& stats = thread_search_stats();
+    stats.clear();
+    rng generator(static_cast<rng::result_type>(m_v.m_seed), l, chain);
+    monte_carlo mc = lig.mc;
+    if (!lig.starts.empty()) mc.start = lig.starts[chain];
+    if (m_v.m_sf_choice == SF_VINA || m_v.m_sf_choice == SF_VINARDO) {
+        mc(scratch, lig.chains[chain], lig.p, m_v.m_grid, m_v.m_grid.corner1(),
+           m_v.m_grid.corner2(), generator);
+    } else {
+        mc(scratch, lig.chains[chain], lig.p, m_v.m_ad4grid, m_v.m_ad4grid.corner1(),
+           m_v.m_ad4grid.corner2(), generator);
+    }
+
+    {
+        boost::mutex::scoped_lock self_lk(m_mutex);
+        lig.stats.merge(stats);
+        if (--lig.chains_left > 0) return;
+    }
+    refine(l, scratch, receptor);  // no other thread touches lig until it is finished
+
+    boost::mutex::scoped_lock self_lk(m_mutex);
+    m_finished.push_back(l);
+    m_cond.notify_all();  // m_finished modified
+}
+
+void batch_search::refine(sz l, model& scratch, non_cache& receptor) {
+    ligand& lig = *m_ligands[l];
+    search_stats& stats = thread_search_stats();
+    stats.clear();
+    // same merge radius as parallel_mc
+    output_container poses;
+    VINA_FOR_IN(i, lig.chains)
+    merge_output_containers(lig.chains[i], poses, 2, lig.mc.num_saved_mins);
+    lig.chains.clear();
+    poses.sort();
+    lig.poses = m_v.remove_redundant(poses, m_min_rmsd);
+
+    if (m_refine) {
+        scratch = lig.m;
+        VINA_FOR_IN(i, lig.poses) Vina::refine_pose(scratch, lig.p, receptor, lig.poses[i]);
+        lig.m = scratch;  // at the last refined pose, as global_search leaves its model
+    }
+    lig.stats.merge(stats);
+}
+
+void batch_search::finish(sz l) {
+    ligand& lig = *m_ligands[l];
+    const std::string& name = m_ligand_names[l];
+    if (!lig.ok) return;
+
+    m_v.m_model = lig.m;
+    m_v.m_precalculated_byatom = lig.p;
+    m_v.m_poses.clear();
+    m_v.m_ligand_initialized = true;
+    m_v.m_search_stats = lig.stats;
+    if (m_v.m_verbosity > 0)
+        std::cout << "\nLigand " << l + 1 << "/" << m_ligands.size() << ": " << name << '\n';
+    m_v.finish_global_search(lig.poses, m_min_rmsd, true);
+    m_stats.merge(m_v.m_search_stats);
+
+    if (m_v.m_poses.empty()) {
+        std::cerr << "WARNING: Could not find any poses for " << name
+                  << ". No poses were written.\n";
+        return;
+    }
+    const std::string& out_name = m_out_names[l];
+    output_file out(out_name, std::string());
+    if (out_name.size() >= 4 && out_name.substr(out_name.size() - 4, 4) == ".sdf")
+        out.second = m_v.get_sdf_poses(m_how_many, m_energy_range);
+    else
+        out.second = m_v.get_poses(m_how_many, m_energy_range);
+
+    boost::mutex::scoped_lock write_lk(m_write_mutex);
+    m_writes.push_back(output_file());
+    m_writes.back().swap(out);
+    m_write_cond.notify_one();
+}
+
+void batch_search::write() {
+    while (true) {
+        output_file out;
+        {
+            boost::mutex::scoped_lock write_lk(m_write_mutex);
+            while (m_writes.empty() && !m_write_done) m_write_cond.wait(write_lk);
+            if (m_writes.empty()) return;
+            out.swap(m_writes.front());
+            m_writes.pop_front();
+        }
+        try {
+            ofile f(make_path(out.first));
+            f << out.second;
+        } catch (file_error& e) {
+            std::cerr << "ERROR: Could not open \"" << e.name.string() << "\" for writing.\n";
+        }
+    }
+}
@@ -0,0 +1,94 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#ifndef VINA_BATCH_SEARCH_H
+#define VINA_BATCH_SEARCH_H
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+#include "monte_carlo.h"
+#include "non_cache.h"
+#include "precalculate.h"
+#include "search_stats.h"
+
+class Vina;
+
+// CPU throughput mode: docks many ligands against the maps of one Vina object. Worker threads
+// take (ligand x Monte Carlo chain) tasks from a shared queue, preparing (parsing, precalculating)
+// the next ligand whenever there are fewer chains queued than workers, so every core stays busy
+// at any exhaustiveness. The worker that runs the last chain of a ligand merges and refines its
+// poses (the costly part of post-processing, against a per-worker copy of the receptor atoms).
+// The calling thread then rescores and formats the ligand through the Vina object, whose model
+// and output state it is the only one to touch, and a writer thread saves the results. Files
+// are written in the order ligands finish; their content depends on neither order nor threads.
+class batch_search {
+public:
+    batch_search(Vina& v, const std::vector<std::string>& ligand_names,
+                 const std::vector<std::string>& out_names, int exhaustiveness, int n_poses,
+                 double min_rmsd, int max_evals, int how_many, double energy_range, bool keep_H);
+    void run();
+    const search_stats& stats() const { return m_stats; }  // summed over all ligands
+
+private:
+    struct ligand {
+        model m;  // receptor + ligand
+        precalculate_byatom p;
+        monte_carlo mc;
+        std::vector<conf> starts;  // one per chain, with monte_carlo::spread_starts
+        std::vector<output_container> chains;
+        output_container poses;  // merged, non-redundant and refined, once chains_left is 0
+        search_stats stats;
+        sz chains_left;
+        bool ok;
+    };
+    typedef std::pair<std::string, std::string> output_file;  // path, content
+
+    void work();
+    bool next_task(sz& ligand, sz& chain);  // false once nothing is left to start
+    void prepare(sz l);
+    void search(sz l, sz chain, model& scratch, non_cache& receptor);
+    void refine(sz l, model& scratch, non_cache& receptor);
+    void finish(sz l);
+    void write();
+
+    Vina& m_v;
+    const std::vector<std::string>& m_ligand_names;
+    const std::vector<std::string>& m_out_names;
+    int m_exhaustiveness;
+    int m_n_poses;
+    double m_min_rmsd;
+    int m_max_evals;
+    int m_how_many;
+    double m_energy_range;
+    bool m_keep_H;
+    bool m_refine;  // Vina::refines_poses()
+    sz m_workers;
+    sz m_window;  // ligands prepared but not yet finished
+
+    boost::mutex m_mutex;  // guards everything below
+    boost::condition m_cond;
+    std::vector<std::unique_ptr<ligand> > m_ligands;
+    sz m_next_ligand;  // next to prepare
+    sz m_preparing;
+    sz m_in_flight;
+    std::deque<std::pair<sz, sz> > m_chains;  // ligand, chain
+    std::deque<sz> m_finished;
+    search_stats m_stats;  // only touched by the calling thread
+
+    boost::mutex m_write_mutex;  // guards the writer queue
+    boost::condition m_write_cond;
+    std::deque<output_file> m_writes;
+    bool m_write_done;
+};
+
+#endif
@@ -24,6 +24,7 @@
 #define VINA_BFGS_H
 
 #include "matrix.h"
+#include "search_stats.h"
 
 typedef triangular_matrix<fl> flmat;
 
@@ -64,7 +65,8 @@ inline bool bfgs_update(flmat& h, const Change& p, const Change& y, const fl alp
 
 template <typename F, typename Conf, typename Change>
 fl line_search(F& f, sz n, const Conf& x, const Change& g, const fl f0, const Change& p,
-               Conf& x_new, Change& g_new, fl& f1, int& evalcount) {  // returns alpha
+               Conf& x_new, Change& g_new, fl& f1, int& evalcount,
+               search_stats& stats) {  // returns alpha
     const fl c0 = 0.0001;
     const unsigned max_trials = 10;
     const fl multiplier = 0.5;
@@ -79,6 +81,7 @@ fl line_search(F& f, sz n, const Conf& x, const Change& g, const fl f0, const Ch
         evalcount++;
         if (f1 - f0 < c0 * alpha * pg)  // FIXME check - div by norm(p) ? no?
             break;
+        ++stats.line_search_backtracks;
         alpha *= multiplier;
     }
     return alpha;
@@ -98,6 +101,8 @@ template <typename F, typename Conf, typename Change>
 fl bfgs(F& f, Conf& x, Change& g, const unsigned max_steps, const fl average_required_improvement,
         const sz over,
         int& evalcount) {  // x is I/O, final value is returned
+    search_stats& stats = thread_search_stats();
+    const int evalcount_orig = evalcount;
     sz n = g.num_floats();
     flmat h(n, 0);
     set_diagonal(h, 1);
@@ -120,7 +125,8 @@ fl bfgs(F& f, Conf& x, Change& g, const unsigned max_steps, const fl average_req
     VINA_U_FOR(step, max_steps) {
         minus_mat_vec_product(h, g, p);
         fl f1 = 0;
-        const fl alpha = line_search(f, n, x, g, f0, p, x_new, g_new, f1, evalcount);
+        const fl alpha = line_search(f, n, x, g, f0, p, x_new, g_new, f1, evalcount, stats);
+        ++stats.bfgs_iterations;
         Change y(g_new);
         subtract_change(y, g, n);
 
@@ -138,6 +144,7 @@ fl bfgs(F& f, Conf& x, Change& g, const unsigned max_steps, const fl average_req
 
         bool h_updated = bfgs_update(h, p, y, alpha);
     }
+    stats.evals += evalcount - evalcount_orig;
     if (!(f0 <= f_orig)) {  // succeeds for nans too
         f0 = f_orig;
         x = x_orig;
@@ -23,6 +23,7 @@
 #include "cache.h"
 #include "model.h"
 #include "precalculate.h"
+#include "parallel.h"
 
 namespace fs = boost::filesystem;
 
@@ -106,7 +107,10 @@ fl cache::eval(const model& m, fl v) const {  // needs m.coords
         }
 
         const grid& g = m_grids[t];
-        e += g.evaluate(m.coords[i], m_slope, v);
+        if (m_windowed)
+            e += g.evaluate(m.coords[i], m_slope, v, m_window, NULL);
+        else
+            e += g.evaluate(m.coords[i], m_slope, v);
     }
     return e;
 }
@@ -144,7 +148,10 @@ fl cache::eval_intra(model& m, fl v) const {
         }
 
         const grid& g = m_grids[t];
-        e += g.evaluate(m.coords[i], m_slope, v);
+        if (m_windowed)
+            e += g.evaluate(m.coords[i], m_slope, v, m_window, NULL);
+        else
+            e += g.evaluate(m.coords[i], m_slope, v);
     }
     return e;
 }
@@ -184,21 +191,25 @@ fl cache::eval_deriv(model& m, fl v) const {  // needs m.coords, sets m.minus_fo
 
         vec deriv;
         const grid& g = m_grids[t];
-        e += g.evaluate(m.coords[i], m_slope, v, deriv);
+        if (m_windowed)
+            e += g.evaluate(m.coords[i], m_slope, v, m_window, &deriv);
+        else
+            e += g.evaluate(m.coords[i], m_slope, v, deriv);
         m.minus_forces[i] = deriv;
     }
     return e;
 }
 
 bool cache::is_in_grid(const model& m, fl margin) const {
+    const grid_dims gd = get_gd();
     VINA_FOR(i, m.num_movable_atoms()) {
         if (m.atoms[i].is_hydrogen()) continue;
 
         const vec& a_coords = m.coords[i];
 
-        VINA_FOR_IN(j, m_gd) {
-            if (m_gd[j].n_voxels > 0) {
-                if (a_coords[j] < m_gd[j].begin - margin || a_coords[j] > m_gd[j].end + margin) {
+        VINA_FOR_IN(j, gd) {
+            if (gd[j].n_voxels > 0) {
+                if (a_coords[j] < gd[j].begin - margin || a_coords[j] > gd[j].end + margin) {
                     return false;
                 }
             }
@@ -208,6 +219,24 @@ bool cache::is_in_grid(const model& m, fl margin) const {
     return true;
 }
 
+grid_dims cache::set_window(const vec& corner1, const vec& corner2) {
+    VINA_FOR_IN(i, m_gd) {
+        const sz n = m_gd[i].n_voxels;
+        VINA_CHECK(n > 0);
+        const fl spacing = m_gd[i].span() / n;
+        // outward to sample points, at least one voxel, inside the grid
+        const fl lo = std::floor((corner1[i] - m_gd[i].begin) / spacing);
+        const fl hi = std::ceil((corner2[i] - m_gd[i].begin) / spacing);
+        m_window.lo[i] = lo <= 0 ? 0 : (std::min)(sz(lo), n - 1);
+        m_window.hi[i] = hi >= n ? n : (std::max)(sz(hi <= 0 ? 0 : hi), m_window.lo[i] + 1);
+        m_window_gd[i].begin = m_gd[i].begin + m_window.lo[i] * spacing;
+        m_window_gd[i].end = m_gd[i].begin + m_window.hi[i] * spacing;
+        m_window_gd[i].n_voxels = m_window.hi[i] - m_window.lo[i];
+    }
+    m_windowed = true;
+    return m_window_gd;
+}
+
 bool cache::are_atom_types_grid_initialized(szv atom_types) const {
     sz nat = num_atom_types(atom_type::XS);
 
@@ -455,12 +484,55 @@ void cache::write(const std::string& out_prefix, const szv& atom_types,
 
 float cache::get_slope() const { return this->m_slope; }
 
-// Attention: new gridding method
-std::vector<grid> cache::get_grids() const { return this->m_grids; }
-
 int cache::get_atu() const { return atom_type::XS; }
 
-void cache::populate_no_bias(const model& m, const precalculate& p, const szv& atom_types_needed) {
+struct cache_populate_aux {
+    const model* m;
+    const precalculate* p;
+    const szv_grid* ig;
+    const szv* needed;
+    std::vector<grid>* grids;
+
+    void operator()(sz z) const {
+        const szv& types = *needed;
+        const sz nat = num_atom_types(atom_type::XS);
+        const fl cutoff_sqr = p->cutoff_sqr();
+        flv affinities(types.size());
+        const grid& g = (*grids)[types.front()];
+
+        VINA_FOR(x, g.m_data.dim0()) {
+            VINA_FOR(y, g.m_data.dim1()) {
+                std::fill(affinities.begin(), affinities.end(), 0);
+                const vec probe_coords = g.index_to_argument(x, y, z);
+                const szv& possibilities = ig->possibilities(probe_coords);
+                VINA_FOR_IN(possibilities_i, possibilities) {
+                    const sz i = possibilities[possibilities_i];
+                    const atom& a = m->grid_atoms[i];
+                    const sz t1 = a.get(atom_type::XS);
+                    if (t1 >= nat) continue;
+                    const fl r2 = vec_distance_sqr(a.coords, probe_coords);
+                    if (r2 <= cutoff_sqr) {
+                        VINA_FOR_IN(j, types) {
+                            const sz t2 = types[j];
+                            assert(t2 < nat);
+                            const sz type_pair_index
+                                = triangular_matrix_index_permissive(nat, t1, t2);
+                            affinities[j] += p->eval_fast(type_pair_index, r2);
+                        }
+                    }
+                }
+                VINA_FOR_IN(j, types) {
+                    sz t = types[j];
+                    assert(t < nat);
+                    (*grids)[t].m_data(x, y, z) = affinities[j];
+                }
+            }
+        }
+    }
+};
+
+void cache::populate_no_bias(const model& m, const precalculate& p, const szv& atom_types_needed,
+                             sz num_threads) {
     szv needed;
     bool got_C_H_already = false;
     bool got_C_P_already = false;
@@ -496,48 +568,20 @@ void cache::populate_no_bias(const model& m, const precalculate& p, const szv& a
         }
     }
     if (needed.empty()) return;
-    flv affinities(needed.size());
-
-    sz nat = num_atom_types(atom_type::XS);
-
-    grid& g = m_grids[needed.front()];
-
-    const fl cutoff_sqr = p.cutoff_sqr();
+    VINA_CHECK(num_threads > 0);
 
     grid_dims gd_reduced = szv_grid_dims(m_gd);
-    szv_grid ig(m, gd_reduced, cutoff_sqr);
+    szv_grid ig(m, gd_reduced, p.cutoff_sqr());
 
-    VINA_FOR(x, g.m_data.dim0()) {
-        VINA_FOR(y, g.m_data.dim1()) {
-            VINA_FOR(z, g.m_data.dim2()) {
-                std::fill(affinities.begin(), affinities.end(), 0);
-                vec probe_coords;
-                probe_coords = g.index_to_argument(x, y, z);
-                const szv& possibilities = ig.possibilities(probe_coords);
-                VINA_FOR_IN(possibilities_i, possibilities) {
-                    const sz i = possibilities[possibilities_i];
-                    const atom& a = m.grid_atoms[i];
-                    const sz t1 = a.get(atom_type::XS);
-                    if (t1 >= nat) continue;
-                    const fl r2 = vec_distance_sqr(a.coords, probe_coords);
-                    if (r2 <= cutoff_sqr) {
-                        VINA_FOR_IN(j, needed) {
-                            const sz t2 = needed[j];
-                            assert(t2 < nat);
-                            const sz type_pair_index
-                                = triangular_matrix_index_permissive(nat, t1, t2);
-                            affinities[j] += p.eval_fast(type_pair_index, r2);
-                        }
-                    }
-                }
-                VINA_FOR_IN(j, needed) {
-                    sz t = needed[j];
-                    assert(t < nat);
-                    m_grids[t].m_data(x, y, z) = affinities[j];
-                }
-            }
-        }
-    }
+    cache_populate_aux aux;
+    aux.m = &m;
+    aux.p = &p;
+    aux.ig = &ig;
+    aux.needed = &needed;
+    aux.grids = &m_grids;
+
+    parallel_for<cache_populate_aux, true> slabs(&aux, num_threads);
+    slabs.run(m_grids[needed.front()].m_data.dim2());
 }
 
 void cache::populate(const model& m, const precalculate& p, const szv& atom_types_needed,
@@ -947,3 +991,85 @@ void cache::compute_bias(const model& m, const std::vector<bias_element> bias_li
         }
     }
 }
+
+void cache::populate_terms(const model& m, const ScoringFunction& sf,
+                           const szv& atom_types_needed) {
+    m_term_grids.clear();
+    VINA_FOR(k, sf.m_num_potentials) {
+        // tabulate potential k alone; precalculate is linear in the weights
+        ScoringFunction term_sf(sf);
+        std::fill(term_sf.m_weights.begin(), term_sf.m_weights.end(), 0);
+        term_sf.m_weights[k] = 1;
+        precalculate p(term_sf);
+
+        cache term(m_gd, m_slope);
+        term.populate_no_bias(m, p, atom_types_needed);
+        m_term_grids.push_back(term.m_grids);
+    }
+    combine_terms(sf.m_weights);
+}
+
+void cache::combine_terms(const flv& weights) {
+    VINA_CHECK(has_terms());
+    VINA_CHECK(weights.size() >= m_term_grids.size());
+    VINA_FOR(t, XS_TYPE_SIZE) {
+        if (!m_term_grids[0][t].initialized()) continue;
+        grid& g = m_grids[t];
+        g = m_term_grids[0][t];
+        flv& data = g.m_data.m_data;
+        VINA_FOR_IN(i, data) data[i] *= weights[0];
+        VINA_RANGE(k, 1, m_term_grids.size()) {
+            const flv& term = m_term_grids[k][t].m_data.m_data;
+            VINA_FOR_IN(i, data) data[i] += weights[k] * term[i];
+        }
+    }
+}
+
+void cache::eval_terms(const model& m, bool flex, energy_terms& out) const {
+    VINA_CHECK(has_terms());
+    sz nat = num_atom_types(atom_type::XS);
+    flv row(m_term_grids.size());
+
+    VINA_FOR(i, m.num_movable_atoms()) {
+        if (m.is_atom_in_ligand(i) == flex) continue;
+        const atom& a = m.atoms[i];
+        sz t = a.get(atom_type::XS);
+
+        if (t >= nat) {
+            continue;
+        }
+        switch (t) {
+            case XS_TYPE_G0:
+            case XS_TYPE_G1:
+            case XS_TYPE_G2:
+            case XS_TYPE_G3:
+                continue;
+            case XS_TYPE_C_H_CG0:
+            case XS_TYPE_C_H_CG1:
+            case XS_TYPE_C_H_CG2:
+            case XS_TYPE_C_H_CG3:
+                t = XS_TYPE_C_H;
+                break;
+            case XS_TYPE_C_P_CG0:
+            case XS_TYPE_C_P_CG1:
+            case XS_TYPE_C_P_CG2:
+            case XS_TYPE_C_P_CG3:
+                t = XS_TYPE_C_P;
+                break;
+        }
+
+        // all term maps of a type share dims, so one cell serves every potential
+        const grid& g = m_term_grids[0][t];
+        grid_cell cell;
+        g.locate(m.coords[i], m_slope, m_windowed ? m_window : g.full_window(), cell);
+        const fl penalty = cell.penalty;
+        cell.penalty = 0;  // added once per atom, after curl
+        const grid_weights w(cell, false);
+        fl f[8];
+        VINA_FOR_IN(k, m_term_grids) {
+            m_term_grids[k][t].gather(cell, f);
+            row[k] = g.interpolate(cell, w, f, m_slope, max_fl, NULL);
+        }
+        out.add(row, penalty);
+    }
+}
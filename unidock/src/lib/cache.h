@@ -38,26 +38,37 @@
 #include "file.h"
 #include "szv_grid.h"
 #include "bias.h"
+#include "energy_terms.h"
 
 struct precalculate;
 struct model;
+class ScoringFunction;
 
 struct cache : public igrid {
 public:
-    cache(fl slope = 1e6) : m_slope(slope), m_grids(XS_TYPE_SIZE) {}
-    cache(const grid_dims& gd, fl slope = 1e6) : m_gd(gd), m_slope(slope), m_grids(XS_TYPE_SIZE) {}
+    cache(fl slope = 1e6) : m_grids(XS_TYPE_SIZE), m_slope(slope), m_windowed(false) {}
+    cache(const grid_dims& gd, fl slope = 1e6)
+        : m_grids(XS_TYPE_SIZE), m_gd(gd), m_slope(slope), m_windowed(false) {}
     fl eval(const model& m, fl v) const;  // needs m.coords // clean up
     fl eval_intra(model& m, fl v) const;  // needs m.coords // clean up
     fl eval_deriv(model& m, fl v) const;  // needs m.coords, sets m.minus_forces // clean up
-    grid_dims get_gd() const { return m_gd; }
+    // the window if one is set, otherwise the whole grid
+    grid_dims get_gd() const { return m_windowed ? m_window_gd : m_gd; }
     vec corner1() const {
-        vec corner(m_gd[0].begin, m_gd[1].begin, m_gd[2].begin);
+        const grid_dims gd = get_gd();
+        vec corner(gd[0].begin, gd[1].begin, gd[2].begin);
         return corner;
     }
     vec corner2() const {
-        vec corner(m_gd[0].end, m_gd[1].end, m_gd[2].end);
+        const grid_dims gd = get_gd();
+        vec corner(gd[0].end, gd[1].end, gd[2].end);
         return corner;
     }
+    // Restricts evaluation to the sample points enclosing [corner1, corner2], clipped to the grid;
+    // returns the window dims. CPU only, the GPU uploads whole grids.
+    grid_dims set_window(const vec& corner1, const vec& corner2);
+    void clear_window() { m_windowed = false; }
+    bool windowed() const { return m_windowed; }
     bool is_in_grid(const model& m, fl margin = 0.0001) const;
     bool is_atom_type_grid_initialized(sz t) const { return m_grids[t].initialized(); }
     bool are_atom_types_grid_initialized(szv atom_types) const;
@@ -69,19 +80,39 @@ public:
                   const std::vector<bias_element> bias_list = std::vector<bias_element>());
     // add for gpu
     float get_slope() const;
-    std::vector<grid> get_grids() const;
+    sz num_grids() const { return m_grids.size(); }
+    grid_view get_grid(sz i) const {
+        VINA_CHECK(!m_windowed);
+        return grid_view(m_grids[i]);
+    }
+    std::vector<grid> clone_grids() const {
+        VINA_CHECK(!m_windowed);
+        return m_grids;
+    }
     int get_atu() const;
     std::vector<grid> m_grids;
     // std::vector<grid> grids;
     // compute bias
-    void populate_no_bias(const model& m, const precalculate& p, const szv& atom_types_needed);
+    // z slabs on num_threads threads
+    void populate_no_bias(const model& m, const precalculate& p, const szv& atom_types_needed,
+                          sz num_threads = 1);
 
     void compute_bias(const model& m,
                       const std::vector<bias_element> bias_list = std::vector<bias_element>());
 
+    // term-decomposed mode: one unweighted map per potential, m_grids is their weighted sum
+    void populate_terms(const model& m, const ScoringFunction& sf, const szv& atom_types_needed);
+    void combine_terms(const flv& weights);  // rebuilds m_grids, drops any bias
+    bool has_terms() const { return !m_term_grids.empty(); }
+    void eval_terms(const model& m, bool flex, energy_terms& out) const;  // ligand or flex atoms
+
 private:
     grid_dims m_gd;
-    fl m_slope;  // does not get (de-)serialized
+    fl m_slope;                                  // does not get (de-)serialized
+    bool m_windowed;                             // set_window, leaves the maps alone
+    grid_window m_window;
+    grid_dims m_window_gd;
+    std::vector<std::vector<grid> > m_term_grids;  // [potential][XS type]
 };
 
 #endif
@@ -364,7 +364,8 @@ struct output_type {
     fl unbound;
     fl total;
     vecv coords;
-    output_type(const conf& c_, fl e_) : c(c_), e(e_) {}
+    sz conformer;  // docked from, see Vina::set_ligand_conformers
+    output_type(const conf& c_, fl e_) : c(c_), e(e_), conformer(0) {}
     // output_type(const conf& c_, fl e_, fl intra_, fl conf_independent_) : c(c_), e(e_),
     // intra(intra_), conf_independent(conf_independent_) {}
 };
@@ -21,6 +21,7 @@
 */
 
 #include "coords.h"
+#include "search_stats.h"
 
 fl rmsd_upper_bound(const vecv& a, const vecv& b) {
     VINA_CHECK(a.size() == b.size());
@@ -57,12 +58,15 @@ void add_to_output_container(output_container& out, const output_type& t, fl min
         && closest_rmsd.second < min_rmsd) {    // have a very similar one
         if (t.e < out[closest_rmsd.first].e) {  // the new one is better, apparently
             out[closest_rmsd.first] = t;        // FIXME? slow
+            ++thread_search_stats().output_replacements;
         }
     } else {  // nothing similar
         if (out.size() < max_size)
             out.push_back(new output_type(t));  // the last one had the worst energy - replacing
-        else if (!out.empty() && t.e < out.back().e)  // FIXME? - just changed
-            out.back() = t;                           // FIXME? slow
+        else if (!out.empty() && t.e < out.back().e) {  // FIXME? - just changed
+            out.back() = t;                             // FIXME? slow
+            ++thread_search_stats().output_replacements;
+        }
     }
     out.sort();
 }
@@ -0,0 +1,37 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#ifndef VINA_ENERGY_TERMS_H
+#define VINA_ENERGY_TERMS_H
+
+#include "curl.h"
+
+// Unweighted per-potential energies of one pose, one row per atom (grid) or atom pair.
+// Rows are weighted and curled separately so that any weight set reproduces the weighted score.
+struct energy_terms {
+    std::vector<flv> rows;  // [contribution][potential]
+    flv offsets;            // added after curl, e.g. the out-of-grid penalty
+
+    void add(const flv& row, fl offset = 0) {
+        rows.push_back(row);
+        offsets.push_back(offset);
+    }
+    fl eval(const flv& weights, fl v) const {  // weights of the potentials only
+        fl e = 0;
+        VINA_FOR_IN(i, rows) {
+            const flv& row = rows[i];
+            assert(row.size() <= weights.size());
+            fl tmp = 0;
+            VINA_FOR_IN(k, row) tmp += weights[k] * row[k];
+            curl(tmp, v);
+            e += tmp + offsets[i];
+        }
+        return e;
+    }
+};
+
+#endif
@@ -37,28 +37,27 @@ void grid::init(const grid_dims& gd) {
     }
 }
 
-fl grid::evaluate_aux(const vec& location, fl slope, fl v,
-                      vec* deriv) const {  // sets *deriv if not NULL
+void grid::locate(const vec& location, fl slope, const grid_window& w, grid_cell& cell) const {
     vec s = elementwise_product(location - m_init, m_factor);
 
     vec miss(0, 0, 0);
-    boost::array<int, 3> region;
     boost::array<sz, 3> a;
 
     VINA_FOR(i, 3) {
-        if (s[i] < 0) {
-            miss[i] = -s[i];
-            region[i] = -1;
-            a[i] = 0;
+        assert(w.lo[i] < w.hi[i]);
+        assert(w.hi[i] < m_data.dim(i));
+        if (s[i] < w.lo[i]) {
+            miss[i] = w.lo[i] - s[i];
+            cell.region[i] = -1;
+            a[i] = w.lo[i];
             s[i] = 0;
-        } else if (s[i] >= m_dim_fl_minus_1[i]) {
-            miss[i] = s[i] - m_dim_fl_minus_1[i];
-            region[i] = 1;
-            assert(m_data.dim(i) >= 2);
-            a[i] = m_data.dim(i) - 2;
+        } else if (s[i] >= w.hi[i]) {
+            miss[i] = s[i] - w.hi[i];
+            cell.region[i] = 1;
+            a[i] = w.hi[i] - 1;
             s[i] = 1;
         } else {
-            region[i] = 0;  // now that region is boost::array, it's not initialized
+            cell.region[i] = 0;  // now that region is boost::array, it's not initialized
             a[i] = sz(s[i]);
             s[i] -= a[i];
         }
@@ -67,63 +66,75 @@ fl grid::evaluate_aux(const vec& location, fl slope, fl v,
         assert(a[i] >= 0);
         assert(a[i] + 1 < m_data.dim(i));
     }
-    const fl penalty = slope * (miss * m_factor_inv);  // FIXME check that inv_factor is correctly
-                                                       // initialized and serialized
-    assert(penalty > -epsilon_fl);
-
-    const sz x0 = a[0];
-    const sz y0 = a[1];
-    const sz z0 = a[2];
-
-    const sz x1 = x0 + 1;
-    const sz y1 = y0 + 1;
-    const sz z1 = z0 + 1;
-
-    const fl f000 = m_data(x0, y0, z0);
-    const fl f100 = m_data(x1, y0, z0);
-    const fl f010 = m_data(x0, y1, z0);
-    const fl f110 = m_data(x1, y1, z0);
-    const fl f001 = m_data(x0, y0, z1);
-    const fl f101 = m_data(x1, y0, z1);
-    const fl f011 = m_data(x0, y1, z1);
-    const fl f111 = m_data(x1, y1, z1);
-
-    const fl x = s[0];
-    const fl y = s[1];
-    const fl z = s[2];
+    cell.penalty = slope * (miss * m_factor_inv);  // FIXME check that inv_factor is correctly
+                                                   // initialized and serialized
+    assert(cell.penalty > -epsilon_fl);
+
+    const sz dx = 1;
+    const sz dy = m_data.dim0();
+    const sz dz = m_data.dim0() * m_data.dim1();
+    const sz base = a[0] + dy * a[1] + dz * a[2];
+
+    cell.corners[0] = base;
+    cell.corners[1] = base + dx;
+    cell.corners[2] = base + dy;
+    cell.corners[3] = base + dx + dy;
+    cell.corners[4] = base + dz;
+    cell.corners[5] = base + dx + dz;
+    cell.corners[6] = base + dy + dz;
+    cell.corners[7] = base + dx + dy + dz;
+
+    cell.x = s[0];
+    cell.y = s[1];
+    cell.z = s[2];
+}
 
+grid_weights::grid_weights(const grid_cell& cell, bool with_deriv) {
+    const fl x = cell.x;
+    const fl y = cell.y;
+    const fl z = cell.z;
     const fl mx = 1 - x;
     const fl my = 1 - y;
     const fl mz = 1 - z;
+    // corners f000, f100, f010, f110, f001, f101, f011, f111
+    const fl wx[8] = {mx, x, mx, x, mx, x, mx, x};
+    const fl wy[8] = {my, my, y, y, my, my, y, y};
+    const fl wz[8] = {mz, mz, mz, mz, z, z, z, z};
+    VINA_FOR(i, 8) w[i] = wx[i] * wy[i] * wz[i];
+    if (!with_deriv) return;
+    const fl dwx[8] = {-1, 1, -1, 1, -1, 1, -1, 1};  // derivatives of wx, wy and wz
+    const fl dwy[8] = {-1, -1, 1, 1, -1, -1, 1, 1};
+    const fl dwz[8] = {-1, -1, -1, -1, 1, 1, 1, 1};
+    VINA_FOR(i, 8) {
+        d[0][i] = dwx[i] * wy[i] * wz[i];
+        d[1][i] = wx[i] * dwy[i] * wz[i];
+        d[2][i] = wx[i] * wy[i] * dwz[i];
+    }
+}
 
-    fl f = f000 * mx * my * mz + f100 * x * my * mz + f010 * mx * y * mz + f110 * x * y * mz
-           + f001 * mx * my * z + f101 * x * my * z + f011 * mx * y * z + f111 * x * y * z;
-
-    if (deriv) {  // valid pointer
-        const fl x_g = f000 * (-1) * my * mz + f100 * 1 * my * mz + f010 * (-1) * y * mz
-                       + f110 * 1 * y * mz + f001 * (-1) * my * z + f101 * 1 * my * z
-                       + f011 * (-1) * y * z + f111 * 1 * y * z;
-
-        const fl y_g = f000 * mx * (-1) * mz + f100 * x * (-1) * mz + f010 * mx * 1 * mz
-                       + f110 * x * 1 * mz + f001 * mx * (-1) * z + f101 * x * (-1) * z
-                       + f011 * mx * 1 * z + f111 * x * 1 * z;
-
-        const fl z_g = f000 * mx * my * (-1) + f100 * x * my * (-1) + f010 * mx * y * (-1)
-                       + f110 * x * y * (-1) + f001 * mx * my * 1 + f101 * x * my * 1
-                       + f011 * mx * y * 1 + f111 * x * y * 1;
-
-        vec gradient(x_g, y_g, z_g);
-        curl(f, gradient, v);
-        vec gradient_everywhere;
-
+fl grid::interpolate(const grid_cell& cell, const grid_weights& w, const fl* f, fl slope, fl v,
+                     vec* deriv) const {
+    fl e = 0;
+    VINA_FOR(i, 8) e += w.w[i] * f[i];
+    if (deriv) {
+        vec gradient(0, 0, 0);
+        VINA_FOR(i, 8) VINA_FOR(j, 3) gradient[j] += w.d[j][i] * f[i];
+        curl(e, gradient, v);
         VINA_FOR(i, 3) {
-            gradient_everywhere[i] = ((region[i] == 0) ? gradient[i] : 0);
-            (*deriv)[i] = m_factor[i] * gradient_everywhere[i] + slope * region[i];
+            const fl inside = (cell.region[i] == 0) ? gradient[i] : 0;
+            (*deriv)[i] = m_factor[i] * inside + slope * cell.region[i];
         }
-
-        return f + penalty;
     } else {
-        curl(f, v);
-        return f + penalty;
+        curl(e, v);
     }
+    return e + cell.penalty;
+}
+
+fl grid::evaluate_aux(const vec& location, fl slope, fl v,
+                      vec* deriv) const {  // sets *deriv if not NULL
+    grid_cell cell;
+    locate(location, slope, cell);
+    fl f[8];
+    gather(cell, f);
+    return interpolate(cell, grid_weights(cell, deriv != NULL), f, slope, v, deriv);
 }
@@ -28,6 +28,30 @@
 #include "curl.h"
 #include "file.h"
 
+#include <boost/array.hpp>
+
+struct grid_cell {  // interpolation state at one location, shared by maps with the same dims
+    boost::array<sz, 8> corners;  // linear indices of f000, f100, f010, f110, f001, f101, f011, f111
+    boost::array<int, 3> region;
+    fl x, y, z;
+    fl penalty;
+};
+
+// Trilinear weights of a cell's corners, and their x, y, z derivatives if asked for: computed once
+// per location, then applied to every map read through the cell
+struct grid_weights {
+    fl w[8];
+    fl d[3][8];
+    grid_weights(const grid_cell& cell, bool with_deriv);
+};
+
+// Sample points [lo, hi] of a grid on each axis, evaluated as a grid of their own: the out-of-box
+// penalty applies at the window boundary. Nothing is copied.
+struct grid_window {
+    boost::array<sz, 3> lo;
+    boost::array<sz, 3> hi;  // > lo
+};
+
 class grid {  // FIXME rm 'm_', consistent with my new style
 public:
     vec m_init;          // DSM was private
@@ -53,6 +77,34 @@ public:
     fl evaluate(const vec& location, fl slope, fl c, vec& deriv) const {
         return evaluate_aux(location, slope, c, &deriv);
     }  // sets deriv
+    fl evaluate(const vec& location, fl slope, fl c, const grid_window& w,
+                vec* deriv) const {  // sets *deriv if not NULL
+        grid_cell cell;
+        locate(location, slope, w, cell);
+        fl f[8];
+        gather(cell, f);
+        return interpolate(cell, grid_weights(cell, deriv != NULL), f, slope, c, deriv);
+    }
+    grid_window full_window() const {
+        grid_window w;
+        VINA_FOR(i, 3) {
+            w.lo[i] = 0;
+            w.hi[i] = m_data.dim(i) - 1;
+        }
+        return w;
+    }
+    // locate once, then read any number of maps of identical dims through the same cell
+    void locate(const vec& location, fl slope, grid_cell& cell) const {
+        locate(location, slope, full_window(), cell);
+    }
+    void locate(const vec& location, fl slope, const grid_window& w, grid_cell& cell) const;
+    void gather(const grid_cell& cell, fl* f) const {
+        VINA_FOR(i, 8) f[i] = m_data.m_data[cell.corners[i]];
+    }
+    // corner values f read through cell, with its weights w (computed with_deriv if deriv is not
+    // NULL); sets *deriv if not NULL
+    fl interpolate(const grid_cell& cell, const grid_weights& w, const fl* f, fl slope, fl v,
+                   vec* deriv) const;
     // add to public
     vec m_factor;
     vec m_dim_fl_minus_1;
@@ -71,4 +123,28 @@ private:
     }
 };
 
+// Read-only view of a grid: metadata is copied, samples stay with the grid and are valid while it
+// lives unchanged. Samples are x-fastest, index i + m_i * (j + m_j * k) as in array3d.
+struct grid_view {
+    vec m_init;
+    vec m_range;
+    vec m_factor;
+    vec m_dim_fl_minus_1;
+    vec m_factor_inv;
+    sz m_i, m_j, m_k;  // all 0 if the grid is not initialized
+    const fl* m_data;
+    grid_view(const grid& g)
+        : m_init(g.m_init),
+          m_range(g.m_range),
+          m_factor(g.m_factor),
+          m_dim_fl_minus_1(g.m_dim_fl_minus_1),
+          m_factor_inv(g.m_factor_inv),
+          m_i(g.m_data.dim0()),
+          m_j(g.m_data.dim1()),
+          m_k(g.m_data.dim2()),
+          m_data(g.m_data.m_data.empty() ? NULL : &g.m_data.m_data[0]) {}
+    sz size() const { return m_i * m_j * m_k; }
+    bool initialized() const { return m_i > 0 && m_j > 0 && m_k > 0; }
+};
+
 #endif
@@ -36,7 +36,10 @@ struct igrid {  // grids interface (that cache, etc. conform to)
     virtual int get_atu() const = 0;
     virtual float get_slope() const = 0;
     virtual grid_dims get_gd() const = 0;
-    virtual std::vector<grid> get_grids() const = 0;
+    virtual sz num_grids() const = 0;
+    virtual grid_view get_grid(sz i) const = 0;  // no copy, see grid_view
+    virtual std::vector<grid> clone_grids() const = 0;  // deep copy, for callers that modify it
+    virtual sz layout_bytes() const { return 0; }  // host memory held besides the grids
 };
 
 #endif
@@ -0,0 +1,231 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#include <cctype>
+#include <cerrno>
+#include <sstream>
+#include <poll.h>
+#include <unistd.h>
+
+#include "ligand_source.h"
+#include "parse_pdbqt.h"
+#include "phase_report.h"
+
+ligand_file_source::ligand_file_source(const std::vector<std::string>& names, atom_type::t atype,
+                                       bool keep_H, sz chunk_size)
+    : m_names(names),
+      m_atype(atype),
+      m_keep_H(keep_H),
+      m_chunk_size(chunk_size),
+      m_parsed(0),
+      m_chunk_pos(0) {}
+
+bool ligand_file_source::next(named_model& out) {
+    if (m_chunk_pos == m_chunk.size()) {
+        if (m_parsed == m_names.size()) return false;
+        const sz begin = m_parsed;
+        const sz end = (std::min)(begin + m_chunk_size, m_names.size());
+        m_chunk.clear();
+        m_chunk.resize(end - begin);
+        {
+            scoped_phase phase("ligand_parse");
+#pragma omp parallel for
+            for (int i = int(begin); i < int(end); ++i) {
+                m_chunk[i - begin]
+                    = parse_ligand_from_file_no_failure(m_names[i], m_atype, m_keep_H);
+            }
+            phase_count("ligands", end - begin);
+        }
+        m_parsed = end;
+        m_chunk_pos = 0;
+    }
+    out.first = m_names[m_parsed - m_chunk.size() + m_chunk_pos];
+    out.second = std::move(m_chunk[m_chunk_pos]);
+    ++m_chunk_pos;
+    return true;
+}
+
+ligand_stream::ligand_stream(int fd, bool sdf, atom_type::t atype, bool keep_H,
+                             sz num_parsers, sz capacity)
+    : m_fd(fd),
+      m_sdf(sdf),
+      m_atype(atype),
+      m_keep_H(keep_H),
+      m_capacity(capacity > 0 ? capacity : 1),
+      m_read(0),
+      m_delivered(0),
+      m_eof(false),
+      m_error(0),
+      m_stopping(false) {
+    m_threads.create_thread([this]() { read(); });
+    VINA_FOR(i, (std::max)(num_parsers, sz(1)))
+    m_threads.create_thread([this]() { parse(); });
+}
+
+ligand_stream::~ligand_stream() {
+    {
+        boost::mutex::scoped_lock self_lk(m_mutex);
+        m_stopping = true;
+        m_cond.notify_all();  // m_stopping modified
+    }
+    m_threads.join_all();  // the reader sees m_stopping within one poll interval
+}
+
+bool ligand_stream::next(named_model& out) {
+    scoped_phase phase("ligand_parse");  // time spent waiting for the producer or the parsers
+    boost::mutex::scoped_lock self_lk(m_mutex);
+    while (m_finished.find(m_delivered) == m_finished.end() && !(m_eof && m_delivered == m_read))
+        m_cond.wait(self_lk);
+    std::map<sz, named_model>::iterator it = m_finished.find(m_delivered);
+    if (it == m_finished.end()) {
+        if (m_error != 0) throw stream_error(m_error);
+        return false;
+    }
+    out = std::move(it->second);
+    m_finished.erase(it);
+    ++m_delivered;
+    m_cond.notify_all();  // room for the reader
+    phase_count("ligands", 1);
+    return true;
+}
+
+void ligand_stream::read() {
+    const int poll_ms = 100;
+    std::string buffer;  // input past the last complete line
+    std::string content;
+    char chunk[1 << 16];
+    bool stopping = false;
+    bool eof = false;
+    int error = 0;
+    while (!eof) {
+        {
+            boost::mutex::scoped_lock self_lk(m_mutex);
+            if (m_stopping) {
+                stopping = true;
+                break;
+            }
+        }
+        pollfd p;
+        p.fd = m_fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        const int ready = poll(&p, 1, poll_ms);
+        if (ready < 0 && errno != EINTR) {
+            error = errno;
+            break;
+        }
+        if (ready <= 0) continue;  // check m_stopping again
+        const ssize_t n = ::read(m_fd, chunk, sizeof(chunk));
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            error = errno;
+            break;
+        }
+        if (n == 0) {
+            eof = true;
+            if (!buffer.empty()) buffer += '\n';  // the last line may lack its newline
+        }
+        buffer.append(chunk, n);
+        sz begin = 0;
+        for (sz end = buffer.find('\n'); !stopping && end != std::string::npos;
+             end = buffer.find('\n', begin)) {
+            stopping = !read_line(buffer.substr(begin, end - begin), content);
+            begin = end + 1;
+        }
+        if (stopping) break;
+        buffer.erase(0, begin);
+    }
+    // the last record may lack its delimiter, unless the input was cut short
+    if (!stopping && error == 0) push(content);
+
+    boost::mutex::scoped_lock self_lk(m_mutex);
+    m_error = error;
+    m_eof = true;
+    m_cond.notify_all();  // m_eof modified
+}
+
+bool ligand_stream::read_line(const std::string& line, std::string& content) {
+    if (m_sdf ? starts_with(line, "$$$$")
+              : starts_with(line, "MODEL") || starts_with(line, "ENDMDL"))
+        return push(content);
+    content += line;
+    content += '\n';
+    return true;
+}
+
+bool ligand_stream::push(std::string& content) {
+    if (content.find_first_not_of(" \t\r\n") == std::string::npos) {
+        content.clear();
+        return true;
+    }
+    record r;
+    {
+        boost::mutex::scoped_lock self_lk(m_mutex);
+        while (!m_stopping && m_read - m_delivered >= m_capacity) m_cond.wait(self_lk);
+        if (m_stopping) return false;
+        r.index = m_read;
+    }
+    r.name = record_name(content, r.index);
+    r.content.swap(content);
+    content.clear();
+
+    boost::mutex::scoped_lock self_lk(m_mutex);
+    m_records.push_back(std::move(r));
+    ++m_read;
+    m_cond.notify_all();  // m_records modified
+    return true;
+}
+
+void ligand_stream::parse() {
+    while (true) {
+        record r;
+        {
+            boost::mutex::scoped_lock self_lk(m_mutex);
+            while (!m_stopping && !m_eof && m_records.empty()) m_cond.wait(self_lk);
+            if (m_stopping || m_records.empty()) return;
+            r = std::move(m_records.front());
+            m_records.pop_front();
+        }
+        named_model parsed(r.name, parse_ligand_from_string_no_failure(r.content, m_sdf, r.name,
+                                                                        m_atype, m_keep_H));
+
+        boost::mutex::scoped_lock self_lk(m_mutex);
+        m_finished[r.index] = std::move(parsed);
+        m_cond.notify_all();  // m_finished modified
+    }
+}
+
+std::string ligand_stream::record_name(const std::string& content, sz index) {
+    std::string name;
+    if (m_sdf) {
+        name = content.substr(0, content.find('\n'));  // title line
+    } else {
+        const sz tag = content.find("Name =");
+        if (tag != std::string::npos) {
+            const sz begin = tag + 6;
+            name = content.substr(begin, content.find('\n', begin) - begin);
+        }
+    }
+    // keep it usable as a file name
+    const sz first = name.find_first_not_of(" \t\r");
+    if (first == std::string::npos)
+        name.clear();
+    else
+        name = name.substr(first, name.find_last_not_of(" \t\r") + 1 - first);
+    VINA_FOR_IN(i, name) {
+        const char ch = name[i];
+        if (!std::isalnum(static_cast<unsigned char>(ch)) && ch != '-' && ch != '_' && ch != '.')
+            name[i] = '_';
+    }
+    if (name.empty() || m_names.count(name)) {
+        std::ostringstream unique;
+        unique << (name.empty() ? "ligand" : name) << '_' << index + 1;
+        name = unique.str();
+    }
+    m_names.insert(name);
+    return name + (m_sdf ? ".sdf" : ".pdbqt");
+}
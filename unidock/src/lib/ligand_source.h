@@ -0,0 +1,100 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#ifndef VINA_LIGAND_SOURCE_H
+#define VINA_LIGAND_SOURCE_H
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+#include "model.h"
+
+typedef std::pair<std::string, model> named_model;  // input name, parsed ligand
+
+struct stream_error {  // reading the input failed before its end
+    int errnum;
+    explicit stream_error(int errnum_) : errnum(errnum_) {}
+};
+
+// Ligands for the GPU batch loop, handed out one at a time in input order. A ligand that failed
+// to parse comes out as a model without ligands, as parse_ligand_from_file_no_failure returns.
+class ligand_source {
+public:
+    virtual ~ligand_source() {}
+    virtual bool next(named_model& out) = 0;  // false once exhausted
+};
+
+// Ligand files, parsed in parallel chunks
+class ligand_file_source : public ligand_source {
+public:
+    ligand_file_source(const std::vector<std::string>& names, atom_type::t atype, bool keep_H,
+                       sz chunk_size = 1000000);  // ~20GB for 100,000 lig obj
+    bool next(named_model& out);
+
+private:
+    const std::vector<std::string>& m_names;
+    atom_type::t m_atype;
+    bool m_keep_H;
+    sz m_chunk_size;
+    sz m_parsed;  // names parsed so far
+    std::vector<model> m_chunk;
+    sz m_chunk_pos;
+};
+
+// $$$$-separated SDF or MODEL/ENDMDL-delimited PDBQT records read from a file descriptor (stdin, a
+// named pipe) by a reader thread and parsed by a pool, so docking starts while the producer is
+// still writing. Each ligand is named after its SDF title or PDBQT "REMARK Name =" line, made
+// unique, with the extension of the format (e.g. "CHEMBL25.sdf"). The reader polls instead of
+// blocking in a read, so destroying the stream before the end of the input does not wait for the
+// producer; fd stays open and owned by the caller. If reading fails, next() throws stream_error
+// once the records read before are handed out.
+class ligand_stream : public ligand_source {
+public:
+    ligand_stream(int fd, bool sdf, atom_type::t atype, bool keep_H, sz num_parsers,
+                  sz capacity = 4096);  // records read ahead of the consumer
+    ~ligand_stream();
+    bool next(named_model& out);
+
+private:
+    struct record {
+        sz index;
+        std::string name;
+        std::string content;
+    };
+
+    void read();
+    bool read_line(const std::string& line, std::string& content);  // reader only, as push
+    void parse();
+    bool push(std::string& content);  // reader only, false once stopping
+    std::string record_name(const std::string& content, sz index);
+
+    int m_fd;
+    bool m_sdf;
+    atom_type::t m_atype;
+    bool m_keep_H;
+    sz m_capacity;
+    std::set<std::string> m_names;  // reader only
+
+    boost::mutex m_mutex;  // guards everything below
+    boost::condition m_cond;
+    std::deque<record> m_records;          // read, not parsed yet
+    std::map<sz, named_model> m_finished;  // parsed, by index
+    sz m_read;
+    sz m_delivered;
+    bool m_eof;
+    int m_error;  // errno of a failed read or poll, 0 if none
+    bool m_stopping;
+    boost::thread_group m_threads;
+};
+
+#endif
@@ -0,0 +1,682 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#include "lockstep_mc.h"
+#include <algorithm>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include "bfgs.h"
+#include "coords.h"
+#include "curl.h"
+#include "mutate.h"
+
+namespace {
+
+const sz W = lockstep_width;
+
+// the map cache::eval_deriv reads for an XS type, max_sz for none
+sz grid_type(sz t) {
+    if (t >= num_atom_types(atom_type::XS)) return max_sz;
+    switch (t) {
+        case XS_TYPE_G0:
+        case XS_TYPE_G1:
+        case XS_TYPE_G2:
+        case XS_TYPE_G3:
+            return max_sz;
+        case XS_TYPE_C_H_CG0:
+        case XS_TYPE_C_H_CG1:
+        case XS_TYPE_C_H_CG2:
+        case XS_TYPE_C_H_CG3:
+            return XS_TYPE_C_H;
+        case XS_TYPE_C_P_CG0:
+        case XS_TYPE_C_P_CG1:
+        case XS_TYPE_C_P_CG2:
+        case XS_TYPE_C_P_CG3:
+            return XS_TYPE_C_P;
+    }
+    return t;
+}
+
+// curl() as a factor: e *= t, deriv *= t * t
+inline fl curl_factor(fl e, fl v) {
+    const fl t = v / (v + e);  // unconditional, so that the lane loops stay branch-free
+    return (not_max(v) & (e > 0)) ? ((v < epsilon_fl) ? 0 : t) : 1;
+}
+
+// grid::locate along one axis of a whole map, s in samples from its corner, with clamps in place
+// of its branches
+inline void locate_axis(fl s, int hi, fl& x, int& a, fl& miss, fl& region) {
+    a = int((std::min)((std::max)(s, fl(0)), fl(hi - 1)));
+    x = (std::min)((std::max)(s - a, fl(0)), fl(1));
+    miss = (std::max)(-s, fl(0)) + (std::max)(s - hi, fl(0));
+    region = fl(s >= hi) - fl(s < 0);
+}
+
+// quaternion_to_r3 into lane l of r[0..8]
+inline void set_rotation(fl a, fl b, fl c, fl d, fl* const* r, sz l) {
+    const fl aa = a * a, ab = a * b, ac = a * c, ad = a * d;
+    const fl bb = b * b, bc = b * c, bd = b * d;
+    const fl cc = c * c, cd = c * d, dd = d * d;
+    r[0][l] = aa + bb - cc - dd;
+    r[1][l] = 2 * (-ad + bc);
+    r[2][l] = 2 * (ac + bd);
+    r[3][l] = 2 * (ad + bc);
+    r[4][l] = aa - bb + cc - dd;
+    r[5][l] = 2 * (-ab + cd);
+    r[6][l] = 2 * (-ac + bd);
+    r[7][l] = 2 * (ab + cd);
+    r[8][l] = aa - bb - cc + dd;
+}
+
+}  // namespace
+
+lockstep_model::lockstep_model(const model& m, const precalculate_byatom& p, const cache& c)
+    : m_slope(c.get_slope()),
+      m_factor(p.m_factor),
+      m_cutoff_sqr(p.cutoff_sqr()),
+      m_max_cutoff_sqr(p.max_cutoff_sqr()) {
+    const ligand& lig = m.ligands[0];
+    m_parent.push_back(max_sz);
+    m_begin.push_back(lig.node.begin);
+    m_end.push_back(lig.node.end);
+    m_relative_origin.push_back(zero_vec);
+    m_relative_axis.push_back(zero_vec);
+    add_branches(lig.children, 0);
+
+    const sz n = m.num_movable_atoms();
+    m_grid_of.assign(n, max_sz);
+    szv types;
+    VINA_FOR(d, 3) m_local[d].resize(n);
+    VINA_FOR(i, n) {
+        VINA_FOR(d, 3) m_local[d][i] = m.atoms[i].coords[d];
+        const sz t = grid_type(m.atoms[i].get(atom_type::XS));
+        if (t == max_sz) continue;
+        const sz k = std::find(types.begin(), types.end(), t) - types.begin();
+        if (k == types.size()) {
+            types.push_back(t);
+            m_grids.push_back(c.get_grid(t));
+        }
+        m_grid_of[i] = k;
+    }
+
+    m_pairs = lig.pairs;
+    m_glue_pairs = m.glue_pairs;
+    VINA_FOR_IN(i, m_pairs)
+    m_pair_tables.push_back(&p.m_data(m_pairs[i].a, m_pairs[i].b).smooth[0]);
+    VINA_FOR_IN(i, m_glue_pairs)
+    m_glue_tables.push_back(&p.m_data(m_glue_pairs[i].a, m_glue_pairs[i].b).smooth[0]);
+    VINA_FOR_IN(i, lig.constant_pairs) {
+        const fixed_pair& ip = lig.constant_pairs[i];
+        m_constant_pairs.push_back(p.eval_fast(ip.a, ip.b, ip.r2));
+    }
+
+    const sz nodes = m_parent.size();
+    VINA_FOR(d, 3) {
+        m_position[d].assign(W, 0);
+        m_origin[d].assign(nodes * W, 0);
+        m_axis[d].assign(nodes * W, 0);
+        m_coords[d].assign(n * W, 0);
+        m_minus_forces[d].assign(n * W, 0);
+        m_force[d].assign(nodes * W, 0);
+        m_torque[d].assign(nodes * W, 0);
+    }
+    VINA_FOR(d, 4) {
+        m_orientation[d].assign(W, d == 0 ? 1 : 0);  // lanes never given a conf stay valid
+        m_q[d].assign(nodes * W, 0);
+    }
+    VINA_FOR(d, 9) m_rotation[d].assign(nodes * W, 0);
+    m_torsions.assign((nodes - 1) * W, 0);
+}
+
+bool lockstep_model::supported(const model& m, const precalculate_byatom& p, const igrid& ig) {
+    const cache* c = dynamic_cast<const cache*>(&ig);
+    return c && !c->windowed() && !p.analytic() && m.ligands.size() == 1 && m.flex.empty()
+           && m.inter_pairs.empty() && m.other_pairs.empty()
+           && m.num_movable_atoms() == m.atoms.size();
+}
+
+void lockstep_model::add_branches(const branches& b, sz parent) {
+    VINA_FOR_IN(i, b) {
+        const sz k = m_parent.size();
+        m_parent.push_back(parent);
+        m_begin.push_back(b[i].node.begin);
+        m_end.push_back(b[i].node.end);
+        m_relative_origin.push_back(b[i].node.relative_origin);
+        m_relative_axis.push_back(b[i].node.relative_axis);
+        add_branches(b[i].children, k);
+    }
+}
+
+void lockstep_model::set(const conf* const* c) {
+    VINA_FOR(l, W) {
+        if (!c[l]) continue;
+        const ligand_conf& lc = c[l]->ligands[0];
+        VINA_FOR(d, 3) m_position[d][l] = lc.rigid.position[d];
+        m_orientation[0][l] = lc.rigid.orientation.R_component_1();
+        m_orientation[1][l] = lc.rigid.orientation.R_component_2();
+        m_orientation[2][l] = lc.rigid.orientation.R_component_3();
+        m_orientation[3][l] = lc.rigid.orientation.R_component_4();
+        VINA_FOR_IN(k, lc.torsions) m_torsions[k * W + l] = lc.torsions[k];
+    }
+
+    fl* rotation[9];
+    VINA_FOR(d, 9) rotation[d] = &m_rotation[d][0];
+#pragma omp simd
+    for (sz l = 0; l < W; ++l) {
+        m_origin[0][l] = m_position[0][l];
+        m_origin[1][l] = m_position[1][l];
+        m_origin[2][l] = m_position[2][l];
+        const fl a = m_orientation[0][l], b = m_orientation[1][l];
+        const fl c = m_orientation[2][l], d = m_orientation[3][l];
+        m_q[0][l] = a;
+        m_q[1][l] = b;
+        m_q[2][l] = c;
+        m_q[3][l] = d;
+        set_rotation(a, b, c, d, rotation, l);
+    }
+
+    // segment::set_conf, parents first
+    VINA_RANGE(k, 1, m_parent.size()) {
+        const sz pk = m_parent[k] * W;
+        const sz nk = k * W;
+        const fl* const t = &m_torsions[(k - 1) * W];
+        const vec& ro = m_relative_origin[k];
+        const vec& ra = m_relative_axis[k];
+        fl half_cos[lockstep_width];
+        fl half_sin[lockstep_width];
+        VINA_FOR(l, W) {  // no vector sin and cos without -ffast-math
+            half_cos[l] = std::cos(t[l] / 2);
+            half_sin[l] = std::sin(t[l] / 2);
+        }
+        const fl* r[9];
+        fl* out[9];
+        VINA_FOR(d, 9) {
+            r[d] = &m_rotation[d][pk];
+            out[d] = &m_rotation[d][nk];
+        }
+#pragma omp simd
+        for (sz l = 0; l < W; ++l) {
+            const fl r0 = r[0][l], r1 = r[1][l], r2 = r[2][l], r3 = r[3][l], r4 = r[4][l];
+            const fl r5 = r[5][l], r6 = r[6][l], r7 = r[7][l], r8 = r[8][l];
+            m_origin[0][nk + l] = m_origin[0][pk + l] + r0 * ro[0] + r1 * ro[1] + r2 * ro[2];
+            m_origin[1][nk + l] = m_origin[1][pk + l] + r3 * ro[0] + r4 * ro[1] + r5 * ro[2];
+            m_origin[2][nk + l] = m_origin[2][pk + l] + r6 * ro[0] + r7 * ro[1] + r8 * ro[2];
+            const fl ax = r0 * ra[0] + r1 * ra[1] + r2 * ra[2];
+            const fl ay = r3 * ra[0] + r4 * ra[1] + r5 * ra[2];
+            const fl az = r6 * ra[0] + r7 * ra[1] + r8 * ra[2];
+            m_axis[0][nk + l] = ax;
+            m_axis[1][nk + l] = ay;
+            m_axis[2][nk + l] = az;
+
+            // angle_to_quaternion(axis, torsion) * parent orientation
+            const fl ta = half_cos[l];
+            const fl s = half_sin[l];
+            const fl tb = s * ax, tc = s * ay, td = s * az;
+            const fl pa = m_q[0][pk + l], pb = m_q[1][pk + l];
+            const fl pc = m_q[2][pk + l], pd = m_q[3][pk + l];
+            fl a = ta * pa - tb * pb - tc * pc - td * pd;
+            fl b = ta * pb + tb * pa + tc * pd - td * pc;
+            fl c = ta * pc - tb * pd + tc * pa + td * pb;
+            fl d = ta * pd + tb * pc - tc * pb + td * pa;
+
+            // quaternion_normalize_approx
+            const fl norm_sqr = a * a + b * b + c * c + d * d;
+            const fl inv_norm = 1 / std::sqrt(norm_sqr);
+            const fl scale = (std::abs(norm_sqr - 1) < fl(1e-6)) ? 1 : inv_norm;
+            a *= scale;
+            b *= scale;
+            c *= scale;
+            d *= scale;
+            m_q[0][nk + l] = a;
+            m_q[1][nk + l] = b;
+            m_q[2][nk + l] = c;
+            m_q[3][nk + l] = d;
+            set_rotation(a, b, c, d, out, l);
+        }
+    }
+
+    // set_coords
+    VINA_FOR_IN(k, m_parent) {
+        const sz nk = k * W;
+        const fl* r[9];
+        VINA_FOR(d, 9) r[d] = &m_rotation[d][nk];
+        VINA_RANGE(i, m_begin[k], m_end[k]) {
+            const fl x = m_local[0][i], y = m_local[1][i], z = m_local[2][i];
+            fl* const cx = &m_coords[0][i * W];
+            fl* const cy = &m_coords[1][i * W];
+            fl* const cz = &m_coords[2][i * W];
+#pragma omp simd
+            for (sz l = 0; l < W; ++l) {
+                cx[l] = m_origin[0][nk + l] + r[0][l] * x + r[1][l] * y + r[2][l] * z;
+                cy[l] = m_origin[1][nk + l] + r[3][l] * x + r[4][l] * y + r[5][l] * z;
+                cz[l] = m_origin[2][nk + l] + r[6][l] * x + r[7][l] * y + r[8][l] * z;
+            }
+        }
+    }
+}
+
+void lockstep_model::eval_grid(const fl* v, fl* e) {
+    const fl slope = m_slope;
+    VINA_FOR_IN(i, m_grid_of) {
+        fl* const fx = &m_minus_forces[0][i * W];
+        fl* const fy = &m_minus_forces[1][i * W];
+        fl* const fz = &m_minus_forces[2][i * W];
+        if (m_grid_of[i] == max_sz) {
+            std::fill(fx, fx + W, fl(0));
+            std::fill(fy, fy + W, fl(0));
+            std::fill(fz, fz + W, fl(0));
+            continue;
+        }
+        const grid_view& g = m_grids[m_grid_of[i]];
+        const fl* const data = g.m_data;
+        const int dy = int(g.m_i);
+        const int dz = int(g.m_i * g.m_j);
+        const int hi_x = int(g.m_i) - 1, hi_y = int(g.m_j) - 1, hi_z = int(g.m_k) - 1;
+        const fl init_x = g.m_init[0], init_y = g.m_init[1], init_z = g.m_init[2];
+        const fl factor_x = g.m_factor[0], factor_y = g.m_factor[1], factor_z = g.m_factor[2];
+        const fl inv_x = g.m_factor_inv[0], inv_y = g.m_factor_inv[1], inv_z = g.m_factor_inv[2];
+        const fl* const cx = &m_coords[0][i * W];
+        const fl* const cy = &m_coords[1][i * W];
+        const fl* const cz = &m_coords[2][i * W];
+#pragma omp simd
+        for (sz l = 0; l < W; ++l) {
+            fl x, y, z, miss_x, miss_y, miss_z, region_x, region_y, region_z;
+            int ax, ay, az;
+            locate_axis((cx[l] - init_x) * factor_x, hi_x, x, ax, miss_x, region_x);
+            locate_axis((cy[l] - init_y) * factor_y, hi_y, y, ay, miss_y, region_y);
+            locate_axis((cz[l] - init_z) * factor_z, hi_z, z, az, miss_z, region_z);
+            const fl penalty = slope * (miss_x * inv_x + miss_y * inv_y + miss_z * inv_z);
+
+            const int base = ax + dy * ay + dz * az;
+            const fl f000 = data[base], f100 = data[base + 1];
+            const fl f010 = data[base + dy], f110 = data[base + 1 + dy];
+            const fl f001 = data[base + dz], f101 = data[base + 1 + dz];
+            const fl f011 = data[base + dy + dz], f111 = data[base + 1 + dy + dz];
+
+            // grid::interpolate
+            const fl mx = 1 - x, my = 1 - y, mz = 1 - z;
+            fl energy = f000 * mx * my * mz + f100 * x * my * mz + f010 * mx * y * mz
+                        + f110 * x * y * mz + f001 * mx * my * z + f101 * x * my * z
+                        + f011 * mx * y * z + f111 * x * y * z;
+            fl gx = -f000 * my * mz + f100 * my * mz - f010 * y * mz + f110 * y * mz
+                    - f001 * my * z + f101 * my * z - f011 * y * z + f111 * y * z;
+            fl gy = -f000 * mx * mz - f100 * x * mz + f010 * mx * mz + f110 * x * mz
+                    - f001 * mx * z - f101 * x * z + f011 * mx * z + f111 * x * z;
+            fl gz = -f000 * mx * my - f100 * x * my - f010 * mx * y - f110 * x * y
+                    + f001 * mx * my + f101 * x * my + f011 * mx * y + f111 * x * y;
+            const fl t = curl_factor(energy, v[l]);
+            energy *= t;
+            gx *= t * t;
+            gy *= t * t;
+            gz *= t * t;
+
+            fx[l] = factor_x * (region_x == 0 ? gx : 0) + slope * region_x;
+            fy[l] = factor_y * (region_y == 0 ? gy : 0) + slope * region_y;
+            fz[l] = factor_z * (region_z == 0 ? gz : 0) + slope * region_z;
+            e[l] += energy + penalty;
+        }
+    }
+}
+
+void lockstep_model::eval_pairs(const std::vector<const pr*>& tables,
+                                const interacting_pairs& pairs, fl cutoff_sqr, const fl* v,
+                                fl* e) {
+    const fl factor = m_factor;
+    VINA_FOR_IN(i, pairs) {
+        const sz a = pairs[i].a * W;
+        const sz b = pairs[i].b * W;
+        const pr* const table = tables[i];
+#pragma omp simd
+        for (sz l = 0; l < W; ++l) {
+            const fl dx = m_coords[0][b + l] - m_coords[0][a + l];  // a -> b
+            const fl dy = m_coords[1][b + l] - m_coords[1][a + l];
+            const fl dz = m_coords[2][b + l] - m_coords[2][a + l];
+            const fl r2 = dx * dx + dy * dy + dz * dz;
+            const bool inside = r2 < cutoff_sqr;
+            // clamped to keep the lookup in the table, see precalculate_byatom
+            const fl r2_factored = factor * (std::min)(r2, cutoff_sqr);
+            const int i1 = int(r2_factored);
+            const fl rem = r2_factored - i1;
+            const pr& p1 = table[i1];
+            const pr& p2 = table[i1 + 1];
+            fl energy = p1.first + rem * (p2.first - p1.first);
+            fl dor = p1.second + rem * (p2.second - p1.second);
+            const fl t = curl_factor(energy, v[l]);
+            const fl curled_energy = energy * t;
+            const fl curled_dor = dor * t * t;
+            energy = inside ? curled_energy : 0;
+            dor = inside ? curled_dor : 0;
+            e[l] += energy;
+            m_minus_forces[0][a + l] -= dor * dx;
+            m_minus_forces[1][a + l] -= dor * dy;
+            m_minus_forces[2][a + l] -= dor * dz;
+            m_minus_forces[0][b + l] += dor * dx;
+            m_minus_forces[1][b + l] += dor * dy;
+            m_minus_forces[2][b + l] += dor * dz;
+        }
+    }
+}
+
+void lockstep_model::derivative() {
+    VINA_FOR(d, 3) {
+        std::fill(m_force[d].begin(), m_force[d].end(), fl(0));
+        std::fill(m_torque[d].begin(), m_torque[d].end(), fl(0));
+    }
+    // children come after their parents, so node k is complete when it is reached
+    for (sz k = m_parent.size(); k-- > 0;) {
+        const sz nk = k * W;
+        fl* const fx = &m_force[0][nk];
+        fl* const fy = &m_force[1][nk];
+        fl* const fz = &m_force[2][nk];
+        fl* const tx = &m_torque[0][nk];
+        fl* const ty = &m_torque[1][nk];
+        fl* const tz = &m_torque[2][nk];
+        const fl* const ox = &m_origin[0][nk];
+        const fl* const oy = &m_origin[1][nk];
+        const fl* const oz = &m_origin[2][nk];
+        VINA_RANGE(i, m_begin[k], m_end[k]) {
+            const sz ni = i * W;
+#pragma omp simd
+            for (sz l = 0; l < W; ++l) {
+                const fl px = m_minus_forces[0][ni + l], py = m_minus_forces[1][ni + l];
+                const fl pz = m_minus_forces[2][ni + l];
+                const fl rx = m_coords[0][ni + l] - ox[l];
+                const fl ry = m_coords[1][ni + l] - oy[l];
+                const fl rz = m_coords[2][ni + l] - oz[l];
+                fx[l] += px;
+                fy[l] += py;
+                fz[l] += pz;
+                tx[l] += ry * pz - rz * py;
+                ty[l] += rz * px - rx * pz;
+                tz[l] += rx * py - ry * px;
+            }
+        }
+        if (k == 0) break;
+        const sz pk = m_parent[k] * W;
+#pragma omp simd
+        for (sz l = 0; l < W; ++l) {
+            const fl rx = ox[l] - m_origin[0][pk + l];
+            const fl ry = oy[l] - m_origin[1][pk + l];
+            const fl rz = oz[l] - m_origin[2][pk + l];
+            m_torque[0][pk + l] += ry * fz[l] - rz * fy[l] + tx[l];
+            m_torque[1][pk + l] += rz * fx[l] - rx * fz[l] + ty[l];
+            m_torque[2][pk + l] += rx * fy[l] - ry * fx[l] + tz[l];
+            m_force[0][pk + l] += fx[l];
+            m_force[1][pk + l] += fy[l];
+            m_force[2][pk + l] += fz[l];
+        }
+    }
+}
+
+void lockstep_model::eval_deriv(const conf* const* c, const vec* const* v, fl* e,
+                                change* const* g) {
+    set(c);
+    search_timer timer;
+    fl lane_v[3][lockstep_width];
+    VINA_FOR(l, W) VINA_FOR(d, 3) lane_v[d][l] = c[l] ? (*v[l])[d] : max_fl;
+    fl energy[lockstep_width] = {};
+    eval_grid(lane_v[1], energy);
+    timer.lap_grid();
+
+    eval_pairs(m_pair_tables, m_pairs, m_cutoff_sqr, lane_v[0], energy);
+    VINA_FOR_IN(i, m_constant_pairs)
+    VINA_FOR(l, W) {
+        fl tmp = m_constant_pairs[i];
+        curl(tmp, lane_v[0][l]);
+        energy[l] += tmp;
+    }
+    if (!m_glue_pairs.empty())
+        eval_pairs(m_glue_tables, m_glue_pairs, m_max_cutoff_sqr, lane_v[2], energy);
+    timer.lap_intra();
+
+    derivative();
+    VINA_FOR(l, W) {
+        if (!c[l]) continue;
+        e[l] = energy[l];
+        ligand_change& lc = g[l]->ligands[0];
+        VINA_FOR(d, 3) {
+            lc.rigid.position[d] = m_force[d][l];
+            lc.rigid.orientation[d] = m_torque[d][l];
+        }
+        VINA_FOR_IN(k, lc.torsions) {
+            const sz nk = (k + 1) * W + l;
+            lc.torsions[k] = m_torque[0][nk] * m_axis[0][nk] + m_torque[1][nk] * m_axis[1][nk]
+                             + m_torque[2][nk] * m_axis[2][nk];
+        }
+    }
+}
+
+namespace {
+
+// bfgs() of one lane as a state machine, fed one evaluation at a time so that a lane whose
+// optimization ends can go on with its chain while the others are still running
+struct lane_bfgs {
+    output_type* x;
+    const vec* v;
+    unsigned max_steps;
+    sz n;
+    flmat h;
+    conf x_new;
+    conf x_orig;
+    change g;
+    change g_new;
+    change p;
+    change y;
+    fl f0;
+    fl f1;
+    fl f_orig;
+    fl alpha;
+    fl pg;
+    unsigned step;
+    unsigned trial;
+    int evals;
+    bool started;
+    lane_bfgs(const conf_size& s)
+        : x(NULL), v(NULL), max_steps(0), x_new(s), x_orig(s), g(s), g_new(s), p(s), y(s), f0(0),
+          f1(0), f_orig(0), alpha(1), pg(0), step(0), trial(0), evals(0), started(false) {
+        n = g.num_floats();
+    }
+
+    // quasi_newton on x_, which must outlive the optimization
+    void start(output_type& x_, const vec& v_, unsigned max_steps_) {
+        x = &x_;
+        v = &v_;
+        max_steps = max_steps_;
+        evals = 0;
+        started = false;
+    }
+    // the conf to evaluate next, and where its gradient goes
+    const conf& request() const { return started ? x_new : x->c; }
+    change& result() { return started ? g_new : g; }
+
+    // takes the energy of request(); false once bfgs() would have returned, with x->e set
+    bool next(fl e, search_stats& stats) {
+        ++evals;
+        if (!started) {
+            started = true;
+            f0 = f_orig = e;
+            x_orig = x->c;
+            h = flmat(n, 0);
+            set_diagonal(h, 1);
+            step = 0;
+            if (max_steps == 0) return finish(stats);
+            start_iteration();
+            return true;
+        }
+        f1 = e;
+        return line_search_step(stats) || finish(stats);
+    }
+
+private:
+    // first line search trial of a bfgs() iteration
+    void start_iteration() {
+        minus_mat_vec_product(h, g, p);
+        pg = scalar_product(p, g, n);
+        alpha = 1;
+        trial = 0;
+        x_new = x->c;
+        x_new.increment(p, alpha);
+    }
+
+    // line_search() on the evaluation of x_new, then the rest of the bfgs() iteration when the
+    // search is over; false when bfgs() would break out of its loop
+    bool line_search_step(search_stats& stats) {
+        const fl c0 = 0.0001;
+        const unsigned max_trials = 10;
+        const fl multiplier = 0.5;
+        ++trial;
+        if (!(f1 - f0 < c0 * alpha * pg)) {
+            ++stats.line_search_backtracks;
+            alpha *= multiplier;
+            if (trial < max_trials) {
+                x_new = x->c;
+                x_new.increment(p, alpha);
+                return true;
+            }
+        }
+        ++stats.bfgs_iterations;
+        y = g_new;
+        subtract_change(y, g, n);
+        f0 = f1;
+        x->c = x_new;
+        if (!(std::sqrt(scalar_product(g, g, n)) >= 1e-5)) return false;  // breaks for nans too
+        g = g_new;
+        if (step == 0) {
+            const fl yy = scalar_product(y, y, n);
+            if (std::abs(yy) > epsilon_fl) set_diagonal(h, alpha * scalar_product(y, p, n) / yy);
+        }
+        bfgs_update(h, p, y, alpha);
+        ++step;
+        if (step == max_steps) return false;
+        start_iteration();
+        return true;
+    }
+
+    bool finish(search_stats& stats) {
+        if (!(f0 <= f_orig)) {  // succeeds for nans too
+            f0 = f_orig;
+            x->c = x_orig;
+        }
+        x->e = f0;
+        stats.evals += evals;
+        return false;
+    }
+};
+
+// monte_carlo::operator() (CPU) of one chain, stopped wherever it needs an evaluation
+struct lane_chain {
+    const monte_carlo* mc;
+    const vec* corner1;
+    const vec* corner2;
+    lockstep_chain chain;
+    const conf* start;
+    model m;  // as in a one-chain search: mutate_conf reads its gyration radii
+    lane_bfgs bfgs;
+    output_type tmp;
+    output_type candidate;
+    fl best_e;
+    unsigned evalcount;
+    unsigned step;
+    bool refining;
+    bool running;
+    lane_chain(const monte_carlo& mc_, const model& m_, const vec& corner1_, const vec& corner2_,
+               const lockstep_chain& chain_)
+        : mc(&mc_), corner1(&corner1_), corner2(&corner2_), chain(chain_),
+          start(chain_.start ? chain_.start : mc_.start.get_ptr()), m(m_), bfgs(m_.get_size()),
+          tmp(m_.get_size(), 0), candidate(tmp), best_e(max_fl), evalcount(0), step(0),
+          refining(false), running(true) {
+        if (start)
+            tmp.c = *start;
+        else
+            tmp.c.randomize(*corner1, *corner2, *chain.generator);
+        begin_step();
+    }
+
+    // the Monte Carlo step that follows the optimization which just ended
+    void end_optimization(search_stats& stats) {
+        evalcount += bfgs.evals;
+        if (refining) {
+            m.set(tmp.c);
+            tmp.coords = m.get_heavy_atom_movable_coords();
+            add_to_output_container(*chain.out, tmp, mc->min_rmsd,
+                                    mc->num_saved_mins);  // 20 - max size
+            if (tmp.e < best_e) best_e = tmp.e;
+        } else {
+            const bool accepted
+                = step == 0 || metropolis_accept(tmp.e, candidate.e, mc->temperature,
+                                                 *chain.generator);
+            if (step > 0) {
+                ++stats.metropolis_trials;
+                if (accepted) ++stats.metropolis_accepts;
+            }
+            if (accepted) {
+                tmp = candidate;
+                // FIXME only for very promising ones
+                if (tmp.e < best_e || chain.out->size() < mc->num_saved_mins) {
+                    refining = true;
+                    bfgs.start(tmp, authentic_v, mc->local_steps);
+                    return;
+                }
+            }
+            m.set(accepted ? tmp.c : candidate.c);
+        }
+        ++step;
+        begin_step();
+    }
+
+private:
+    static const vec authentic_v;  // FIXME? this is here to avoid max_fl/max_fl
+
+    void begin_step() {
+        refining = false;
+        if (step == mc->global_steps || ((mc->max_evals > 0) & (evalcount > mc->max_evals))) {
+            running = false;
+            return;
+        }
+        candidate = tmp;
+        if (step > 0 || !start)  // a warm start is first minimized as given
+            mutate_conf(candidate.c, m, mc->mutation_amplitude, *chain.generator);
+        bfgs.start(candidate, mc->hunt_cap, mc->local_steps);
+    }
+};
+
+const vec lane_chain::authentic_v(1000, 1000, 1000);
+
+}  // namespace
+
+void lockstep_monte_carlo(const monte_carlo& mc, const model& m, const precalculate_byatom& p,
+                          const cache& c, const vec& corner1, const vec& corner2,
+                          const std::vector<lockstep_chain>& chains) {
+    VINA_CHECK(chains.size() <= W);
+    search_stats& stats = thread_search_stats();
+    lockstep_model lm(m, p, c);
+    boost::ptr_vector<lane_chain> lanes;
+    VINA_FOR_IN(l, chains) lanes.push_back(new lane_chain(mc, m, corner1, corner2, chains[l]));
+
+    const conf* request[lockstep_width] = {};
+    const vec* v[lockstep_width] = {};
+    change* result[lockstep_width] = {};
+    fl e[lockstep_width];
+    while (true) {
+        bool any = false;
+        VINA_FOR_IN(l, lanes) {
+            lane_bfgs& b = lanes[l].bfgs;
+            request[l] = lanes[l].running ? &b.request() : NULL;
+            v[l] = b.v;
+            result[l] = &b.result();
+            any = any || lanes[l].running;
+        }
+        if (!any) break;
+        lm.eval_deriv(request, v, e, result);
+        VINA_FOR_IN(l, lanes) {
+            if (request[l] && !lanes[l].bfgs.next(e[l], stats)) lanes[l].end_optimization(stats);
+        }
+    }
+    VINA_FOR_IN(l, chains) {
+        VINA_CHECK(!chains[l].out->empty());
+        VINA_CHECK(chains[l].out->front().e <= chains[l].out->back().e);  // sorted
+    }
+}
@@ -0,0 +1,94 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#ifndef VINA_LOCKSTEP_MC_H
+#define VINA_LOCKSTEP_MC_H
+
+#include "monte_carlo.h"
+#include "cache.h"
+
+// Chains of a lockstep group: one per float lane of the widest vector unit the build targets
+#if defined(__AVX512F__)
+const sz lockstep_width = 16;
+#else
+const sz lockstep_width = 8;
+#endif
+
+// lockstep_width poses of one model. Per-pose state is stored chain-major, [item * lockstep_width
+// + lane], so that model::set, the grid interpolation and the intramolecular pairs run over the
+// lanes in SIMD registers while the topology, pair lists, tables and maps are shared. It covers
+// the usual CPU search, one ligand against a rigid receptor with tabulated pairs and whole maps;
+// supported() tells, other setups go through model.
+class lockstep_model {
+public:
+    lockstep_model(const model& m, const precalculate_byatom& p, const cache& c);
+    static bool supported(const model& m, const precalculate_byatom& p, const igrid& ig);
+    // model::set then model::eval_deriv with v[l] for each lane l whose c[l] is not NULL. Masked
+    // lanes are still computed, from the last conf they were given, but their e and g are left
+    // alone.
+    void eval_deriv(const conf* const* c, const vec* const* v, fl* e, change* const* g);
+
+private:
+    void add_branches(const branches& b, sz parent);
+    void set(const conf* const* c);
+    void eval_grid(const fl* v, fl* e);  // sets m_minus_forces
+    void eval_pairs(const std::vector<const pr*>& tables, const interacting_pairs& pairs,
+                    fl cutoff_sqr, const fl* v, fl* e);  // adds to m_minus_forces
+    void derivative();  // m_force and m_torque from m_minus_forces
+
+    // torsion tree in pre-order, node 0 is the rigid root and node k > 0 has torsion k - 1
+    szv m_parent;
+    szv m_begin;
+    szv m_end;
+    vecv m_relative_origin;
+    vecv m_relative_axis;
+    flv m_local[3];  // [atom] coords in the frame of its node
+
+    std::vector<grid_view> m_grids;
+    szv m_grid_of;  // [atom] index in m_grids, max_sz if the atom has no map
+    fl m_slope;
+
+    interacting_pairs m_pairs;
+    interacting_pairs m_glue_pairs;
+    std::vector<const pr*> m_pair_tables;  // precalculate_element::smooth of each pair
+    std::vector<const pr*> m_glue_tables;
+    flv m_constant_pairs;  // uncurled energies of ligand::constant_pairs
+    fl m_factor;
+    fl m_cutoff_sqr;
+    fl m_max_cutoff_sqr;
+
+    // per lane
+    flv m_position[3];  // [lane]
+    flv m_orientation[4];
+    flv m_torsions;      // [torsion * lockstep_width + lane]
+    flv m_origin[3];     // [node * lockstep_width + lane]
+    flv m_q[4];          // node orientations
+    flv m_rotation[9];   // their matrices, row-major
+    flv m_axis[3];       // torsion axes in the lab frame
+    flv m_coords[3];     // [atom * lockstep_width + lane]
+    flv m_minus_forces[3];
+    flv m_force[3];      // [node * lockstep_width + lane], sums over the node and its subtree
+    flv m_torque[3];
+};
+
+// one chain of a lockstep group, as parallel_mc runs them
+struct lockstep_chain {
+    rng* generator;
+    output_container* out;
+    const conf* start;  // NULL for monte_carlo::start
+};
+
+// monte_carlo::operator() (CPU) for up to lockstep_width chains at once: every chain keeps its own
+// random stream, Metropolis state and poses, and the evaluations of all chains go through one
+// lockstep_model. Chains do not wait for each other: a lane whose optimization ends goes on with
+// its next step (or refinement) at the following evaluation, and is masked off once its chain is
+// over.
+void lockstep_monte_carlo(const monte_carlo& mc, const model& m, const precalculate_byatom& p,
+                          const cache& c, const vec& corner1, const vec& corner2,
+                          const std::vector<lockstep_chain>& chains);
+
+#endif
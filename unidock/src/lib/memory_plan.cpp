@@ -0,0 +1,163 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#include "memory_plan.h"
+#include "batch_pack.h"
+#include "precalculate.h"
+#include "search_stats.h"
+
+namespace {
+sz tree_bytes(const tree<segment>& t) {
+    sz bytes = sizeof(t);
+    VINA_FOR_IN(i, t.children) bytes += tree_bytes(t.children[i]);
+    return bytes;
+}
+
+template <typename T> sz children_bytes(const T& body) {
+    sz bytes = 0;
+    VINA_FOR_IN(i, body.children) bytes += tree_bytes(body.children[i]);
+    return bytes;
+}
+
+sz atoms_bytes(const atomv& atoms) {
+    sz bytes = atoms.size() * sizeof(atom);
+    VINA_FOR_IN(i, atoms) bytes += atoms[i].bonds.size() * sizeof(bond);
+    return bytes;
+}
+
+sz context_bytes(const context& c) {
+    sz bytes = c.size() * sizeof(parsed_line);
+    VINA_FOR_IN(i, c) bytes += c[i].first.size();
+    return bytes;
+}
+
+sz pairs_bytes(const interacting_pairs& pairs) { return pairs.size() * sizeof(interacting_pair); }
+
+sz grid_bytes(const igrid& grids) {
+    sz bytes = grids.layout_bytes();
+    VINA_FOR(i, grids.num_grids()) bytes += grids.get_grid(i).size() * sizeof(fl);
+    return bytes;
+}
+}  // namespace
+
+sz model_bytes(const model& m) {
+    sz bytes = sizeof(model) + atoms_bytes(m.atoms) + atoms_bytes(m.grid_atoms)
+               + (m.coords.size() + m.minus_forces.size()) * sizeof(vec)
+               + context_bytes(m.flex_context) + pairs_bytes(m.other_pairs)
+               + pairs_bytes(m.inter_pairs) + pairs_bytes(m.glue_pairs)
+               + m.bias_list.size() * sizeof(bias_element);
+    VINA_FOR_IN(i, m.ligands) {
+        const ligand& lig = m.ligands[i];
+        bytes += sizeof(ligand) + children_bytes(lig) + pairs_bytes(lig.pairs)
+                 + lig.constant_pairs.size() * sizeof(fixed_pair) + context_bytes(lig.cont)
+                 + lig.hydrogens.size() * sizeof(united_hydrogen);
+    }
+    VINA_FOR_IN(i, m.flex) bytes += sizeof(residue) + children_bytes(m.flex[i]);
+    return bytes;
+}
+
+sz output_type_bytes(sz num_atoms, sz num_torsions) {
+    return sizeof(output_type) + sizeof(ligand_conf) + num_torsions * sizeof(fl)
+           + num_atoms * sizeof(vec);
+}
+
+batch_memory_planner::batch_memory_planner(const model& receptor, const igrid& grids,
+                                           const ScoringFunction& sf, sz exhaustiveness,
+                                           sz num_modes, bool multi_bias,
+                                           const gpu_search_sizes& gpu,
+                                           const memory_footprint& budget)
+    : m_receptor_atoms(receptor.atoms.size()),
+      m_receptor_bytes(model_bytes(receptor)),
+      m_table_size(sz(32 * sqr(sf.get_max_cutoff())) + 3),  // as precalculate_byatom::m_n
+      m_exhaustiveness(exhaustiveness),
+      m_num_modes(num_modes),
+      m_multi_bias(multi_bias),
+      m_grid_bytes(0),
+      m_target_bytes(0),
+      m_target_receptor_bytes(0),
+      m_gpu(gpu),
+      m_budget(budget),
+      m_max_tables(0) {
+    m_grid_bytes = grid_bytes(grids);
+    clear();
+}
+
+void batch_memory_planner::add_target(const model& receptor, const igrid& grids) {
+    const sz receptor_bytes = model_bytes(receptor);
+    m_target_bytes += receptor_bytes + grid_bytes(grids);
+    m_target_receptor_bytes = (std::max)(m_target_receptor_bytes, receptor_bytes);
+    clear();
+}
+
+memory_footprint batch_memory_planner::fixed(sz max_tables) const {
+    memory_footprint f;
+    // monte_carlo pinned staging: one pose, the maps and the tables of the largest ligand
+    f.host = sizeof(output_type_cuda_t) + sizeof(ig_cuda_t) + sizeof(p_cuda_t)
+             + max_tables * sizeof(p_m_data_cuda_t);
+    f.host += m_receptor_bytes + m_grid_bytes;  // the copy of the Vina object docking the batch
+    f.host += m_target_bytes;
+    f.device = m_gpu.local_memory + 7 * sizeof(float);  // best_e, hunt_cap, authentic_v
+    if (m_multi_bias)
+        f.host += m_grid_bytes;  // the biased copy of the maps
+    else
+        f.device += sizeof(ig_cuda_t);
+    f.device += 3 * sizeof(int);  // last entry of the packed offsets
+    return f;
+}
+
+memory_footprint batch_memory_planner::ligand(const model& lig) const {
+    const sz atoms = m_receptor_atoms + lig.atoms.size();
+    const sz tables = atoms * (atoms + 1) / 2;  // triangular_matrix of the ligand and flex atoms
+    sz pairs = 0, nodes = 0;
+    if (!lig.ligands.empty()) {
+        pairs = lig.ligands[0].pairs.size() + lig.ligands[0].constant_pairs.size();
+        nodes = count_nodes(lig.ligands[0]);
+    }
+    const sz pose = output_type_bytes(lig.atoms.size(), nodes > 0 ? nodes - 1 : 0);
+
+    memory_footprint f;
+    // the copy appended to the receptor, the tables, a result per thread, then the poses kept by
+    // the search and by the Vina object
+    const sz docked = model_bytes(lig) - sizeof(model) + sizeof(precalculate_byatom)
+                      + tables * (sizeof(precalculate_element)
+                                  + m_table_size * (sizeof(fl) + sizeof(pr)))
+                      + m_exhaustiveness * (sizeof(output_type_cuda_t) + pose)
+                      + 2 * (sizeof(output_container) + m_num_modes * pose) + sizeof(search_stats);
+    f.host = model_bytes(lig) + m_receptor_bytes + docked;  // with the parsed ligand
+    // a target reuses the tables of the first search, as a copy
+    if (m_target_receptor_bytes > 0) f.host += m_target_receptor_bytes + docked;
+
+    f.device = m_exhaustiveness
+               * (SIZE_OF_MOLEC_STRUC + m_gpu.rng_state + sizeof(output_type_cuda_t)
+                  + sizeof(search_stats_cuda_t));
+    f.device += sizeof(p_cuda_t) + tables * sizeof(precalculate_element_cuda_t);
+    // packed_batch_cuda_t: offsets, atom, pair and node arrays, ligand begin, end and atoms
+    f.device += (3 + 4 * atoms + 3 * pairs + 3 * nodes + 3) * sizeof(int)
+                + (9 * atoms + 25 * nodes) * sizeof(float);
+    if (m_multi_bias) f.device += sizeof(ig_cuda_t);
+    return f;
+}
+
+bool batch_memory_planner::add(const model& lig) {
+    if (m_plan.num_ligands >= MAX_LIGAND_NUM) return false;  // Vina::m_data_list_gpu is fixed
+    const memory_footprint f = ligand(lig);
+    const sz atoms = m_receptor_atoms + lig.atoms.size();
+    const sz max_tables = (std::max)(m_max_tables, atoms * (atoms + 1) / 2);
+    if (m_plan.num_ligands > 0 && !(fixed(max_tables) + m_plan.ligands + f).fits(m_budget))
+        return false;
+    m_max_tables = max_tables;
+    m_plan.ligands += f;
+    m_plan.fixed = fixed(max_tables);
+    ++m_plan.num_ligands;
+    return true;
+}
+
+void batch_memory_planner::clear() {
+    m_max_tables = 0;
+    m_plan = batch_memory_plan();
+    m_plan.fixed = fixed(0);
+}
@@ -0,0 +1,92 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#ifndef VINA_MEMORY_PLAN_H
+#define VINA_MEMORY_PLAN_H
+
+#include "model.h"
+#include "igrid.h"
+#include "scoring_function.h"
+
+// Sizes of the GPU batch search buffers, counted from the structures Vina::global_search_gpu
+// and its monte_carlo allocate for the ligands of the batch (monte_carlo.cu, precalculate.cu).
+// Host bytes are the payload of the containers, allocator overhead is not included.
+struct memory_footprint {
+    sz host;
+    sz device;
+    memory_footprint() : host(0), device(0) {}
+    memory_footprint(sz host_, sz device_) : host(host_), device(device_) {}
+    memory_footprint& operator+=(const memory_footprint& x) {
+        host += x.host;
+        device += x.device;
+        return *this;
+    }
+    bool fits(const memory_footprint& budget) const {
+        return host <= budget.host && device <= budget.device;
+    }
+};
+
+inline memory_footprint operator+(memory_footprint a, const memory_footprint& b) { return a += b; }
+
+// Sizes only the device compiler and the device know
+struct gpu_search_sizes {
+    sz rng_state;     // per search thread
+    sz local_memory;  // kernel stacks of all the threads the device keeps resident
+    gpu_search_sizes() : rng_state(0), local_memory(0) {}
+};
+
+gpu_search_sizes query_gpu_search_sizes();  // monte_carlo.cu, for the current device
+
+sz model_bytes(const model& m);
+sz output_type_bytes(sz num_atoms, sz num_torsions);
+
+struct batch_memory_plan {
+    memory_footprint fixed;    // per batch, whatever its ligands
+    memory_footprint ligands;  // summed over its ligands
+    sz num_ligands;
+    batch_memory_plan() : num_ligands(0) {}
+    memory_footprint total() const { return fixed + ligands; }
+};
+
+// Fills a batch with parsed ligands until the next one would exceed either budget, or the batch
+// has MAX_LIGAND_NUM ligands, the most the GPU search takes at once. The batch
+// holds every ligand appended to a copy of the receptor, its precalculated pair tables on both
+// sides, exhaustiveness search threads and the output poses; the maps are on the device once,
+// or once per ligand with a per-ligand bias. Extra targets (--ensemble, --sites) keep their
+// receptor and maps on the host, and the one docking the batch after the first search holds a
+// second copy of the batch.
+struct batch_memory_planner {
+    batch_memory_planner(const model& receptor, const igrid& grids, const ScoringFunction& sf,
+                         sz exhaustiveness, sz num_modes, bool multi_bias,
+                         const gpu_search_sizes& gpu, const memory_footprint& budget);
+    memory_footprint ligand(const model& lig) const;
+    // lig joins the batch if it fits, or if the batch is empty: a ligand is never left behind
+    bool add(const model& lig);
+    // a target docking every batch after the first search, before the first add
+    void add_target(const model& receptor, const igrid& grids);
+    void clear();
+    const batch_memory_plan& plan() const { return m_plan; }
+    const memory_footprint& budget() const { return m_budget; }
+
+private:
+    sz m_receptor_atoms;  // movable, flex residues
+    sz m_receptor_bytes;  // copied into every model of the batch
+    sz m_table_size;      // precalculate_byatom::m_n
+    sz m_exhaustiveness;
+    sz m_num_modes;
+    bool m_multi_bias;
+    sz m_grid_bytes;  // host maps, copied with the Vina object and once more for a bias
+    sz m_target_bytes;           // receptors and maps of the targets
+    sz m_target_receptor_bytes;  // the largest target receptor, 0 without targets
+    gpu_search_sizes m_gpu;
+    memory_footprint m_budget;
+    batch_memory_plan m_plan;
+    sz m_max_tables;  // pair tables of the largest ligand so far
+    memory_footprint fixed(sz max_tables) const;
+};
+
+#endif
@@ -27,6 +27,7 @@
 #include "curl.h"
 #include "precalculate.h"
 #include "utils.h"
+#include "search_stats.h"
 
 template <typename T> atom_range get_atom_range(const T& t) {
     atom_range tmp = t.node;
@@ -80,6 +81,32 @@ void ligand::set_range() {
     end = tmp.end;
 }
 
+// Orthonormal frame with its origin at o, first axis towards a and b in the first two axes' plane
+void united_hydrogen_frame(const vec& o, const vec& a, const vec& b, vec& e1, vec& e2, vec& e3) {
+    e1 = a - o;
+    e1 = e1 / e1.norm();
+    e2 = b - o;
+    e2 = e2 - (e2 * e1) * e1;
+    e2 = e2 / e2.norm();
+    e3 = cross_product(e1, e2);
+}
+
+united_hydrogen::united_hydrogen(sz line_, sz parent_, sz a_, sz b_, const vec& h,
+                                 const vec& parent_coords, const vec& a_coords,
+                                 const vec& b_coords)
+    : line(line_), parent(parent_), a(a_), b(b_) {
+    vec e1, e2, e3;
+    united_hydrogen_frame(parent_coords, a_coords, b_coords, e1, e2, e3);
+    const vec d = h - parent_coords;
+    local = vec(d * e1, d * e2, d * e3);
+}
+
+vec united_hydrogen::place(const vecv& coords) const {
+    vec e1, e2, e3;
+    united_hydrogen_frame(coords[parent], coords[a], coords[b], e1, e2, e3);
+    return coords[parent] + local[0] * e1 + local[1] * e2 + local[2] * e3;
+}
+
 /////////////////// begin MODEL::APPEND /////////////////////////
 
 // FIXME hairy code - needs to be extensively commented, asserted, reviewed and tested
@@ -142,13 +169,22 @@ public:
         transform_ranges(lig, *this);
         VINA_FOR_IN(i, lig.pairs)
         this->update(lig.pairs[i]);
+        VINA_FOR_IN(i, lig.constant_pairs)
+        this->update(lig.constant_pairs[i]);
         VINA_FOR_IN(i, lig.cont)
         this->update(lig.cont[i]);  // parsed_line update, below
+        VINA_FOR_IN(i, lig.hydrogens)
+        this->update(lig.hydrogens[i]);
     }
     void update(residue& r) const { transform_ranges(r, *this); }
     void update(parsed_line& p) const {
         if (p.second) p.second = operator()(p.second.get());
     }
+    void update(united_hydrogen& h) const {
+        h.parent = operator()(h.parent);
+        h.a = operator()(h.a);
+        h.b = operator()(h.b);
+    }
     void update(atom& a) const {
         VINA_FOR_IN(i, a.bonds) {
             bond& b = a.bonds[i];
@@ -625,6 +661,102 @@ void model::initialize(const distance_type_matrix& mobility) {
     initialize_pairs(mobility);
 }
 
+// Rigid body of a ligand torsion tree, origin and axis are those of the bond to its parent
+struct torsion_body {
+    sz parent;  // max_sz for the root
+    sz depth;
+    vec origin;  // on the axis, so fixed relative to both this body and its parent
+    vec axis;
+};
+
+void add_torsion_bodies(const branches& children, sz parent, std::vector<torsion_body>& bodies,
+                        szv& body_of) {
+    VINA_FOR_IN(i, children) {
+        const segment& s = children[i].node;
+        torsion_body b = {parent, bodies[parent].depth + 1, s.get_origin(), s.get_axis()};
+        const sz k = bodies.size();
+        bodies.push_back(b);
+        VINA_RANGE(j, s.begin, s.end) body_of[j] = k;
+        add_torsion_bodies(children[i].children, k, bodies, body_of);
+    }
+}
+
+// Range of |p - x| over all rotations of x about the line through o along the unit vector u
+void rotation_distance_range(const vec& p, const vec& x, const vec& o, const vec& u, fl& lo,
+                             fl& hi) {
+    const vec dp = p - o;
+    const vec dx = x - o;
+    const fl zp = dp * u;
+    const fl zx = dx * u;
+    const fl rp = std::sqrt((std::max)(fl(0), sqr(dp) - sqr(zp)));
+    const fl rx = std::sqrt((std::max)(fl(0), sqr(dx) - sqr(zx)));
+    lo = std::sqrt(sqr(zp - zx) + sqr(rp - rx));
+    hi = std::sqrt(sqr(zp - zx) + sqr(rp + rx));
+}
+
+// Bounds on the distance of atoms a and b over all torsions of the path between their bodies:
+// exact across one rotatable bond, then extended by the triangle inequality through the axis
+// origins of the following bonds, each of which is fixed in the bodies on both its sides
+void pair_distance_range(sz a, sz b, const std::vector<torsion_body>& bodies, const szv& body_of,
+                         const vecv& coords, fl& lo, fl& hi) {
+    szv from_a, from_b;  // bodies below the common ancestor, each standing for its parent bond
+    sz x = body_of[a];
+    sz y = body_of[b];
+    while (x != y) {
+        if (bodies[x].depth >= bodies[y].depth) {
+            from_a.push_back(x);
+            x = bodies[x].parent;
+        } else {
+            from_b.push_back(y);
+            y = bodies[y].parent;
+        }
+    }
+    szv path(from_a);
+    path.insert(path.end(), from_b.rbegin(), from_b.rend());
+    VINA_CHECK(!path.empty());  // different bodies, or the pair would be DISTANCE_FIXED
+
+    const torsion_body& first = bodies[path.front()];
+    if (path.size() == 1) {
+        rotation_distance_range(coords[a], coords[b], first.origin, first.axis, lo, hi);
+        return;
+    }
+    rotation_distance_range(coords[a], bodies[path[1]].origin, first.origin, first.axis, lo, hi);
+    VINA_RANGE(i, 1, path.size()) {
+        const vec& next = (i + 1 < path.size()) ? bodies[path[i + 1]].origin : coords[b];
+        const fl d = std::sqrt(vec_distance_sqr(bodies[path[i]].origin, next));
+        lo = (std::max)((std::max)(fl(0), lo - d), d - hi);
+        hi += d;
+    }
+}
+
+void model::prune_ligand_pairs(fl cutoff_sqr) {
+    const fl constant_tolerance = 1e-3;  // Angstrom, distance range of a constant pair
+    VINA_FOR_IN(l, ligands) {
+        ligand& lig = ligands[l];
+        std::vector<torsion_body> bodies;
+        szv body_of(atoms.size(), max_sz);
+        const torsion_body root = {max_sz, 0, lig.node.get_origin(), zero_vec};
+        bodies.push_back(root);
+        VINA_RANGE(j, lig.node.begin, lig.node.end) body_of[j] = 0;
+        add_torsion_bodies(lig.children, 0, bodies, body_of);
+
+        interacting_pairs kept;
+        VINA_FOR_IN(i, lig.pairs) {
+            const interacting_pair& ip = lig.pairs[i];
+            fl lo, hi;
+            pair_distance_range(ip.a, ip.b, bodies, body_of, coords, lo, hi);
+            if (sqr(lo) >= cutoff_sqr) continue;  // never within the cutoff
+            if (hi - lo < constant_tolerance) {
+                const fl r2 = vec_distance_sqr(coords[ip.a], coords[ip.b]);
+                if (r2 < cutoff_sqr) lig.constant_pairs.push_back(fixed_pair(ip, r2));
+                continue;
+            }
+            kept.push_back(ip);
+        }
+        lig.pairs = kept;
+    }
+}
+
 ///////////////////  end  MODEL::INITIALIZE /////////////////////////
 
 sz model::num_internal_pairs() const {
@@ -783,13 +915,17 @@ void model::write_context(const context& c, ofile& out) const {
     }
 }
 
-void model::write_sdf_context(const context& c, ofile& out) const {
+void model::write_sdf_context(const context& c, ofile& out,
+                              const united_hydrogens& hydrogens) const {
     verify_bond_lengths();
+    sz h = 0;
     VINA_FOR_IN(i, c) {
         const std::string& str = c[i].first;
         // TODO: sort by number_sdf
         if (c[i].second) {
             out << coords_to_sdf_string(coords[c[i].second.get()], str) << '\n';
+        } else if (h < hydrogens.size() && hydrogens[h].line == i) {
+            out << coords_to_sdf_string(hydrogens[h++].place(coords), str) << '\n';
         } else
             out << str << '\n';
     }
@@ -807,13 +943,17 @@ void model::write_context(const context& c, std::ostringstream& out) const {
     }
 }
 
-void model::write_sdf_context(const context& c, std::ostringstream& out) const {
+void model::write_sdf_context(const context& c, std::ostringstream& out,
+                              const united_hydrogens& hydrogens) const {
     verify_bond_lengths();
 
+    sz h = 0;
     VINA_FOR_IN(i, c) {
         const std::string& str = c[i].first;
         if (c[i].second)
             out << coords_to_sdf_string(coords[c[i].second.get()], str) << '\n';
+        else if (h < hydrogens.size() && hydrogens[h].line == i)
+            out << coords_to_sdf_string(hydrogens[h++].place(coords), str) << '\n';
         else
             out << str << '\n';
     }
@@ -842,7 +982,7 @@ std::string model::write_sdf_model(sz model_number, const std::string& remark) {
 
     // TODO: sort by number_sdf
     VINA_FOR_IN(i, ligands)
-    write_sdf_context(ligands[i].cont, out);
+    write_sdf_context(ligands[i].cont, out, ligands[i].hydrogens);
     if (num_flex() > 0)  // otherwise remark is written in vain
         write_sdf_context(flex_context, out);
 
@@ -879,6 +1019,7 @@ fl eval_interacting_pairs(const precalculate_byatom& p, fl v, const interacting_
     if (with_max_cutoff) {
         cutoff_sqr = p.max_cutoff_sqr();
     }
+    if (p.analytic()) return p.get_analytic().eval(v, pairs, coords, cutoff_sqr);
 
     VINA_FOR_IN(i, pairs) {
         const interacting_pair& ip = pairs[i];
@@ -901,6 +1042,7 @@ fl eval_interacting_pairs_deriv(const precalculate_byatom& p, fl v, const intera
     if (with_max_cutoff) {
         cutoff_sqr = p.max_cutoff_sqr();
     }
+    if (p.analytic()) return p.get_analytic().eval_deriv(v, pairs, coords, forces, cutoff_sqr);
 
     VINA_FOR_IN(i, pairs) {
         const interacting_pair& ip = pairs[i];
@@ -921,6 +1063,33 @@ fl eval_interacting_pairs_deriv(const precalculate_byatom& p, fl v, const intera
     return e;
 }
 
+fl eval_fixed_pairs(const precalculate_byatom& p, fl v, const fixed_pairs& pairs) {
+    fl e = 0;
+    VINA_FOR_IN(i, pairs) {  // all within the cutoff, see model::prune_ligand_pairs
+        const fixed_pair& ip = pairs[i];
+        fl tmp = p.analytic() ? p.get_analytic().eval(ip.a, ip.b, ip.r2).first
+                              : p.eval_fast(ip.a, ip.b, ip.r2);
+        curl(tmp, v);
+        e += tmp;
+    }
+    return e;
+}
+
+void eval_interacting_pairs_terms(const ScoringFunction& sf, const interacting_pairs& pairs,
+                                  const atomv& atoms, const vecv& coords, fl cutoff_sqr,
+                                  energy_terms& out) {
+    flv row(sf.m_num_potentials);
+    VINA_FOR_IN(i, pairs) {
+        const interacting_pair& ip = pairs[i];
+        fl r2 = vec_distance_sqr(coords[ip.a], coords[ip.b]);
+        if (r2 < cutoff_sqr) {
+            const fl r = std::sqrt(r2);
+            VINA_FOR_IN(k, row) row[k] = sf.m_potentials[k]->eval(atoms[ip.a], atoms[ip.b], r);
+            out.add(row);
+        }
+    }
+}
+
 fl model::evalo(const precalculate_byatom& p, const vec& v) const {  // clean up
     fl e = eval_interacting_pairs(p, v[2], other_pairs, coords);
     return e;
@@ -933,21 +1102,27 @@ fl model::eval_inter(const precalculate_byatom& p, const vec& v) const {  // cle
 
 fl model::evali(const precalculate_byatom& p, const vec& v) const {  // clean up
     fl e = 0;
-    VINA_FOR_IN(i, ligands)
-    e += eval_interacting_pairs(p, v[0], ligands[i].pairs,
-                                coords);  // probably might was well use coords here
+    VINA_FOR_IN(i, ligands) {
+        e += eval_interacting_pairs(p, v[0], ligands[i].pairs,
+                                    coords);  // probably might was well use coords here
+        e += eval_fixed_pairs(p, v[0], ligands[i].constant_pairs);
+    }
     return e;
 }
 
 fl model::eval_deriv(const precalculate_byatom& p, const igrid& ig, const vec& v,
                      change& g) {  // clean up
+    search_timer timer;
     // INTER ligand - grid
     fl e = ig.eval_deriv(*this, v[1]);  // sets minus_forces, except inflex
+    timer.lap_grid();
 
     // INTRA ligand_i - ligand_i
-    VINA_FOR_IN(i, ligands)
-    e += eval_interacting_pairs_deriv(p, v[0], ligands[i].pairs, coords,
-                                      minus_forces);  // adds to minus_forces
+    VINA_FOR_IN(i, ligands) {
+        e += eval_interacting_pairs_deriv(p, v[0], ligands[i].pairs, coords,
+                                          minus_forces);  // adds to minus_forces
+        e += eval_fixed_pairs(p, v[0], ligands[i].constant_pairs);  // no forces
+    }
 
     // INTER ligand_i - ligand_j and ligand_i - flex_i
     if (!inter_pairs.empty())
@@ -961,6 +1136,7 @@ fl model::eval_deriv(const precalculate_byatom& p, const igrid& ig, const vec& v
     if (!glue_pairs.empty())
         e += eval_interacting_pairs_deriv(p, v[2], glue_pairs, coords, minus_forces,
                                           true);  // adds to minus_forces
+    timer.lap_intra();
 
     // calculate derivatives
     ligands.derivative(coords, minus_forces, g.ligands);
@@ -974,11 +1150,13 @@ fl model::eval_intramolecular(const precalculate_byatom& p, const igrid& ig, con
     const fl cutoff_sqr = p.cutoff_sqr();
 
     // internal for each ligand
-    VINA_FOR_IN(i, ligands)
-    e += eval_interacting_pairs(p, v[0], ligands[i].pairs,
-                                coords);  // coords instead of internal coords
-                                          // printf("e1=%f\n", e);
-                                          // flex - rigid
+    VINA_FOR_IN(i, ligands) {
+        e += eval_interacting_pairs(p, v[0], ligands[i].pairs,
+                                    coords);  // coords instead of internal coords
+        e += eval_fixed_pairs(p, v[0], ligands[i].constant_pairs);
+    }
+    // printf("e1=%f\n", e);
+    // flex - rigid
     e += ig.eval_intra(*this, v[1]);
     // printf("e2=%f\n", e);
 
@@ -987,7 +1165,8 @@ fl model::eval_intramolecular(const precalculate_byatom& p, const igrid& ig, con
         const interacting_pair& pair = other_pairs[i];
         fl r2 = vec_distance_sqr(coords[pair.a], coords[pair.b]);
         if (r2 < cutoff_sqr) {
-            fl this_e = p.eval_fast(pair.a, pair.b, r2);
+            fl this_e = p.analytic() ? p.get_analytic().eval(pair.a, pair.b, r2).first
+                                     : p.eval_fast(pair.a, pair.b, r2);
             curl(this_e, v[2]);
             e += this_e;
         }
@@ -997,7 +1176,8 @@ fl model::eval_intramolecular(const precalculate_byatom& p, const igrid& ig, con
     VINA_FOR_IN(i, glue_pairs) {
         const interacting_pair& pair = glue_pairs[i];
         fl r2 = vec_distance_sqr(coords[pair.a], coords[pair.b]);
-        fl this_e = p.eval_fast(pair.a, pair.b, r2);
+        fl this_e = p.analytic() ? p.get_analytic().eval(pair.a, pair.b, r2).first
+                                 : p.eval_fast(pair.a, pair.b, r2);
         curl(this_e, v[2]);
         e += this_e;
     }
@@ -1256,8 +1436,11 @@ fl model::clash_penalty_aux(const interacting_pairs& pairs) const {
 
 fl model::clash_penalty() const {
     fl e = 0;
-    VINA_FOR_IN(i, ligands)
-    e += clash_penalty_aux(ligands[i].pairs);
+    VINA_FOR_IN(i, ligands) {
+        const fixed_pairs& constant = ligands[i].constant_pairs;
+        e += clash_penalty_aux(ligands[i].pairs);
+        e += clash_penalty_aux(interacting_pairs(constant.begin(), constant.end()));
+    }
     e += clash_penalty_aux(other_pairs);
     return e;
 }
@@ -31,6 +31,7 @@
 #include "igrid.h"
 #include "grid_dim.h"
 #include "bias.h"
+#include "energy_terms.h"
 
 struct interacting_pair {
     sz type_pair_index;
@@ -42,14 +43,39 @@ struct interacting_pair {
 
 typedef std::vector<interacting_pair> interacting_pairs;
 
+// Pair no torsion can move relative to each other, scored from its stored squared distance
+struct fixed_pair : public interacting_pair {
+    fl r2;
+    fixed_pair(const interacting_pair& ip, fl r2_) : interacting_pair(ip), r2(r2_) {}
+};
+
+typedef std::vector<fixed_pair> fixed_pairs;
+
 typedef std::pair<std::string, boost::optional<sz> > parsed_line;
 typedef std::vector<parsed_line> context;
 
+// Nonpolar hydrogen left out of the search model of an SDF ligand (united-atom compaction) and
+// placed back from the atoms it is rigidly attached to when the pose is written
+struct united_hydrogen {
+    sz line;    // of the hydrogen in the ligand context
+    sz parent;  // heavy atom the hydrogen is bonded to
+    sz a;       // parent, a and b span the frame, all in the rigid body of the hydrogen
+    sz b;
+    vec local;  // hydrogen in that frame
+    united_hydrogen(sz line_, sz parent_, sz a_, sz b_, const vec& h, const vec& parent_coords,
+                    const vec& a_coords, const vec& b_coords);
+    vec place(const vecv& coords) const;
+};
+
+typedef std::vector<united_hydrogen> united_hydrogens;
+
 struct ligand : public flexible_body, atom_range {
     unsigned degrees_of_freedom;  // can be different from the apparent number of rotatable bonds,
                                   // because of the disabled torsions
     interacting_pairs pairs;
+    fixed_pairs constant_pairs;  // their energy does not depend on the conformation
     context cont;
+    united_hydrogens hydrogens;  // in context order
     ligand(const flexible_body& f, unsigned degrees_of_freedom_)
         : flexible_body(f), atom_range(0, 0), degrees_of_freedom(degrees_of_freedom_) {}
     void set_range();
@@ -66,12 +92,18 @@ struct cache;                // forward declaration
 struct szv_grid;             // forward declaration
 struct pdbqt_initializer;    // forward declaration - only declared in parse_pdbqt.cpp
 struct precalculate_byatom;  // forward declaration
+class ScoringFunction;       // forward declaration
 
 fl eval_interacting_pairs(const precalculate_byatom& p, fl v, const interacting_pairs& pairs,
                           const vecv& coords, const bool with_max_cutoff = false);
 fl eval_interacting_pairs_deriv(const precalculate_byatom& p, fl v, const interacting_pairs& pairs,
                                 const vecv& coords, vecv& forces,
                                 const bool with_max_cutoff = false);
+fl eval_fixed_pairs(const precalculate_byatom& p, fl v, const fixed_pairs& pairs);
+// one unweighted row per pair closer than sqrt(cutoff_sqr), see energy_terms
+void eval_interacting_pairs_terms(const ScoringFunction& sf, const interacting_pairs& pairs,
+                                  const atomv& atoms, const vecv& coords, fl cutoff_sqr,
+                                  energy_terms& out);
 
 struct model {
 public:
@@ -130,7 +162,7 @@ public:
     }
     void write_sdf_structure(ofile& out) const {
         VINA_FOR_IN(i, ligands)
-        write_sdf_context(ligands[i].cont, out);
+        write_sdf_context(ligands[i].cont, out, ligands[i].hydrogens);
         if (num_flex() > 0)  // otherwise remark is written in vain
             write_sdf_context(flex_context, out);
     }
@@ -200,6 +232,10 @@ public:
     fl eval_inter(const precalculate_byatom& p, const vec& v) const;
     fl eval_deriv(const precalculate_byatom& p, const igrid& ig, const vec& v, change& g);
     fl eval_intramolecular(const precalculate_byatom& p, const igrid& ig, const vec& v);
+    // Drops ligand pairs the torsion tree can never bring within the cutoff and moves the ones it
+    // cannot move at all to constant_pairs. Needs coords consistent with the tree (as parsed or
+    // after set); the dropped pairs are gone for good, so use the smallest cutoff evaluated.
+    void prune_ligand_pairs(fl cutoff_sqr);
 
     fl rmsd_lower_bound(const model& m) const;          // uses coords
     fl rmsd_upper_bound(const model& m) const;          // uses coords
@@ -245,9 +281,11 @@ private:
     friend struct pdbqt_initializer;
 
     void write_context(const context& c, std::ostringstream& out) const;
-    void write_sdf_context(const context& c, std::ostringstream& out) const;
+    void write_sdf_context(const context& c, std::ostringstream& out,
+                           const united_hydrogens& hydrogens = united_hydrogens()) const;
     void write_context(const context& c, ofile& out) const;
-    void write_sdf_context(const context& c, ofile& out) const;
+    void write_sdf_context(const context& c, ofile& out,
+                           const united_hydrogens& hydrogens = united_hydrogens()) const;
     void write_context(const context& c, ofile& out, const std::string& remark) const {
         out << remark;
     }
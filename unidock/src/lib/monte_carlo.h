@@ -28,6 +28,7 @@
 #include "kernel.h"
 #include "grid.h"
 #include "precalculate.h"
+#include "search_stats.h"
 
 struct monte_carlo {
     unsigned max_evals;
@@ -41,6 +42,11 @@ struct monte_carlo {
     unsigned threads_per_ligand;
     unsigned num_of_ligands;
     bool local_only;
+    boost::optional<conf> start;  // CPU chains start here instead of at random (warm_start.h)
+    // without a start, the chains of a search start from spread_starts (start_sampling.h) rather
+    // than at random, redrawn above max_start_energy
+    bool spread_starts;
+    fl max_start_energy;
     unsigned thread = 2048;  // for CUDA parallel option, num_of_ligands * threads_per_ligand
     // T = 600K, R = 2cal/(K*mol) -> temperature = RT = 1.2;  global_steps = 50*lig_atoms = 2500
     monte_carlo()
@@ -51,7 +57,9 @@ struct monte_carlo {
           hunt_cap(10, 1.5, 10),
           min_rmsd(0.5),
           num_saved_mins(50),
-          mutation_amplitude(2) {}
+          mutation_amplitude(2),
+          spread_starts(false),
+          max_start_energy(max_fl) {}
 
     output_type operator()(model& m, const precalculate_byatom& p, const igrid& ig,
                            const vec& corner1, const vec& corner2, rng& generator) const;
@@ -62,8 +70,12 @@ struct monte_carlo {
                     std::vector<precalculate_byatom>& p, triangular_matrix_cuda_t* m_data_list_gpu,
                     const igrid& ig, const vec& corner1, const vec& corner2, rng& generator,
                     int verbosity, unsigned long long seed,
-                    std::vector<std::vector<bias_element> >& bias_batch_list) const;
+                    std::vector<std::vector<bias_element> >& bias_batch_list,
+                    std::vector<search_stats>* stats = NULL) const;  // one per ligand
     std::vector<output_type> cuda_to_vina(output_type_cuda_t* results_p, int thread) const;
 };
 
+// Metropolis criterion of the CPU chains
+bool metropolis_accept(fl old_f, fl new_f, fl temperature, rng& generator);
+
 #endif
@@ -27,10 +27,19 @@ non_cache::non_cache(const model& m, const grid_dims& gd_, const precalculate* p
                      std::vector<bias_element> bias_list_)
     : sgrid(m, szv_grid_dims(gd_), p_->cutoff_sqr()),
       gd(gd_),
+      full_gd(gd_),
       p(p_),
       slope(slope_),
       bias_list(bias_list_) {}
 
+void non_cache::set_window(const grid_dims& window) {
+    gd = window;
+    VINA_FOR_IN(i, gd) {  // sgrid only knows the atoms near the full box
+        gd[i].begin = (std::max)(gd[i].begin, full_gd[i].begin);
+        gd[i].end = (std::min)(gd[i].end, full_gd[i].end);
+    }
+}
+
 fl non_cache::eval(const model& m, fl v) const {  // clean up
     fl e = 0;
     const fl cutoff_sqr = p->cutoff_sqr();
@@ -929,8 +938,13 @@ fl non_cache::eval_intra(model& m, fl v) const {  // clean up
     return e;
 }
 
-// add to make get_grids() work
-std::vector<grid> non_cache::get_grids() const {
+// add to make the igrid grid access work
+grid_view non_cache::get_grid(sz /* i */) const {
+    assert(false);  // This function should not be called!
+    return grid_view(grid());
+}
+
+std::vector<grid> non_cache::clone_grids() const {
     assert(false);  // This function should not be called!
     std::vector<grid> g;
     return g;
@@ -35,18 +35,24 @@ struct non_cache : public igrid {
     virtual fl eval(const model& m, fl v) const;  // needs m.coords // clean up
     virtual fl eval_intra(model& m, fl v) const;
     virtual fl eval_deriv(model& m, fl v) const;  // needs m.coords, sets m.minus_forces // clean up
-    std::vector<grid> get_grids() const;
+    sz num_grids() const { return 0; }  // computed on the fly, no grids to view
+    grid_view get_grid(sz i) const;
+    std::vector<grid> clone_grids() const;
     int get_atu() const;
     float get_slope() const;
     bool within(const model& m, fl margin = 0.0001) const;
     fl slope;
     std::vector<bias_element> bias_list;
     grid_dims get_gd() const { return gd; }
+    // penalty box, clipped to the one the receptor atoms were indexed for (cache::set_window)
+    void set_window(const grid_dims& window);
+    void clear_window() { gd = full_gd; }
 
 private:
     szv_grid sgrid;
     grid_dims gd;
-    const precalculate* p;
+    grid_dims full_gd;
+    const precalculate* p;  // built once per receptor, faster than analytic_pairs here
 };
 
 #endif
@@ -0,0 +1,201 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#include "pair_kernels.h"
+#include <cstring>
+#include "curl.h"
+
+namespace {
+
+const sz block_size = 64;  // pairs per packed block, kept on the stack
+
+// exp(x) for the x <= 0 of the Gaussian terms without a library call, so that the block loop
+// vectorizes: 2^k from the exponent bits, e^y for |y| <= ln(2) / 2 from its Taylor series;
+// relative error below 1e-5, 0 where 2^k underflows
+inline fl exp_nonpositive(fl x) {
+    const fl t = x * fl(1.442695041);  // log2(e)
+    const int k = int(t - fl(0.5));    // rounded, t <= 0
+    const fl y = (t - fl(k)) * fl(0.6931471806);
+    const fl p = 1 + y * (1 + y * (fl(1.0 / 2) + y * (fl(1.0 / 6) + y * (fl(1.0 / 24)
+                 + y * (fl(1.0 / 120) + y * fl(1.0 / 720))))));
+    const int bits = (k < -126) ? 0 : (k + 127) << 23;
+    fl scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+// slope_step(bad, good, x) for bad > good, and its derivative in x
+inline fl step_down(fl bad, fl good, fl x, fl& deriv) {
+    const fl t = (bad - x) / (bad - good);
+    deriv = ((t > 0) & (t < 1)) ? -1 / (bad - good) : 0;
+    return (std::min)((std::max)(t, fl(0)), fl(1));
+}
+
+// Weighted sum of the terms at surface distance d, with dE/dd in deriv. Weights are in
+// ScoringFunction order; hydrophobic and hbond are 0 or 1 depending on the pair types.
+struct vina_pair_terms {
+    enum { glue = 5 };  // linearattraction
+    static fl radius(sz xs) { return xs_radius(xs); }
+    static inline fl eval(const fl* w, fl d, fl hydrophobic, fl hbond, fl& deriv) {
+        const fl gauss1 = exp_nonpositive(-sqr(d * fl(2)));
+        const fl gauss2 = exp_nonpositive(-sqr((d - 3) * fl(0.5)));
+        const fl repulsion = fl(0.5) * (d - std::abs(d));  // min(d, 0)
+        fl hydrophobic_deriv, hbond_deriv;
+        const fl hydrophobic_step = step_down(fl(1.5), fl(0.5), d, hydrophobic_deriv);
+        const fl hbond_step = step_down(0, fl(-0.7), d, hbond_deriv);
+        deriv = w[0] * -8 * d * gauss1 + w[1] * fl(-0.5) * (d - 3) * gauss2 + w[2] * 2 * repulsion
+                + hydrophobic * w[3] * hydrophobic_deriv + hbond * w[4] * hbond_deriv;
+        return w[0] * gauss1 + w[1] * gauss2 + w[2] * sqr(repulsion)
+               + hydrophobic * w[3] * hydrophobic_step + hbond * w[4] * hbond_step;
+    }
+};
+
+struct vinardo_pair_terms {
+    enum { glue = 4 };  // linearattraction
+    static fl radius(sz xs) { return xs_vinardo_radius(xs); }
+    static inline fl eval(const fl* w, fl d, fl hydrophobic, fl hbond, fl& deriv) {
+        const fl gauss = exp_nonpositive(-sqr(d * fl(1.25)));
+        const fl repulsion = fl(0.5) * (d - std::abs(d));  // min(d, 0)
+        fl hydrophobic_deriv, hbond_deriv;
+        const fl hydrophobic_step = step_down(fl(2.5), 0, d, hydrophobic_deriv);
+        const fl hbond_step = step_down(0, fl(-0.6), d, hbond_deriv);
+        deriv = w[0] * fl(-3.125) * d * gauss + w[1] * 2 * repulsion
+                + hydrophobic * w[2] * hydrophobic_deriv + hbond * w[3] * hbond_deriv;
+        return w[0] * gauss + w[1] * sqr(repulsion) + hydrophobic * w[2] * hydrophobic_step
+               + hbond * w[3] * hbond_step;
+    }
+};
+
+// energy of a pair at distance r, with (dE/dr)/r in dor
+template <typename Terms>
+inline fl pair_energy(const fl* w, fl r, fl optimal, fl hydrophobic, fl hbond, fl glued,
+                      fl& dor) {
+    fl deriv;
+    const fl e = Terms::eval(w, r - optimal, hydrophobic, hbond, deriv);
+    deriv += glued * w[Terms::glue];
+    dor = deriv / (std::max)(r, epsilon_fl);  // forces vanish with r anyway
+    return e + glued * w[Terms::glue] * r;
+}
+
+}  // namespace
+
+analytic_pairs::analytic_pairs(const ScoringFunction& sf, const atomv& atoms)
+    : m_sf_choice(sf.m_sf_choice),
+      m_weights(sf.m_weights.begin(), sf.m_weights.begin() + sf.m_num_potentials),
+      m_radius(atoms.size(), 0),
+      m_not_glue(atoms.size(), 1),
+      m_typed(atoms.size(), 0),
+      m_hydrophobic(atoms.size(), 0),
+      m_donor(atoms.size(), 0),
+      m_acceptor(atoms.size(), 0),
+      m_glue(atoms.size(), 0) {
+    VINA_CHECK(supported(sf));
+    VINA_FOR_IN(i, atoms) {
+        const sz xs = atoms[i].xs;
+        if (xs >= XS_TYPE_SIZE) continue;
+        m_typed[i] = 1;
+        m_radius[i] = (m_sf_choice == SF_VINA) ? vina_pair_terms::radius(xs)
+                                               : vinardo_pair_terms::radius(xs);
+        if (is_glue_type(xs)) m_not_glue[i] = 0;
+        if (xs_is_hydrophobic(xs)) m_hydrophobic[i] = 1;
+        if (xs_is_donor(xs)) m_donor[i] = 1;
+        if (xs_is_acceptor(xs)) m_acceptor[i] = 1;
+        VINA_FOR(k, 4) {  // G0 .. G3
+            const sz g = XS_TYPE_G0 + 3 * k;
+            if (xs == g)
+                m_glue[i] = int(k) + 1;
+            else if (is_glued(g, xs))
+                m_glue[i] = -int(k) - 1;
+        }
+    }
+}
+
+template <typename Terms, bool Deriv>
+fl analytic_pairs::eval_blocks(fl v, const interacting_pairs& pairs, const vecv& coords,
+                               vecv* forces, fl cutoff_sqr) const {
+    const fl* w = &m_weights[0];
+    fl e = 0;
+    for (sz begin = 0; begin < pairs.size(); begin += block_size) {
+        const sz n = (std::min)(block_size, pairs.size() - begin);
+        fl dx[block_size], dy[block_size], dz[block_size];
+        fl optimal[block_size], scale[block_size], hydrophobic[block_size], hbond[block_size];
+        fl glued[block_size], energy[block_size], dor[block_size];
+
+        // gather
+        VINA_FOR(k, n) {
+            const interacting_pair& ip = pairs[begin + k];
+            const sz a = ip.a;
+            const sz b = ip.b;
+            dx[k] = coords[b][0] - coords[a][0];  // a -> b
+            dy[k] = coords[b][1] - coords[a][1];
+            dz[k] = coords[b][2] - coords[a][2];
+            optimal[k] = (m_radius[a] + m_radius[b]) * m_not_glue[a] * m_not_glue[b];
+            scale[k] = m_typed[a] * m_typed[b];
+            hydrophobic[k] = m_hydrophobic[a] * m_hydrophobic[b];
+            hbond[k] = (std::min)(m_donor[a] * m_acceptor[b] + m_acceptor[a] * m_donor[b], fl(1));
+            glued[k] = (m_glue[a] != 0 && m_glue[a] + m_glue[b] == 0) ? 1 : 0;
+        }
+
+        // evaluate, no branches on the pair
+#pragma omp simd
+        for (sz k = 0; k < n; ++k) {
+            const fl r2 = dx[k] * dx[k] + dy[k] * dy[k] + dz[k] * dz[k];
+            const fl inside = fl(r2 < cutoff_sqr) * scale[k];
+            fl pair_dor;
+            energy[k] = inside
+                        * pair_energy<Terms>(w, std::sqrt(r2), optimal[k], hydrophobic[k],
+                                             hbond[k], glued[k], pair_dor);
+            dor[k] = inside * pair_dor;
+        }
+
+        // curl and scatter
+        VINA_FOR(k, n) {
+            fl tmp = energy[k];
+            if (Deriv) {
+                vec force(dor[k] * dx[k], dor[k] * dy[k], dor[k] * dz[k]);
+                curl(tmp, force, v);
+                const interacting_pair& ip = pairs[begin + k];
+                (*forces)[ip.a] -= force;
+                (*forces)[ip.b] += force;
+            } else {
+                curl(tmp, v);
+            }
+            e += tmp;
+        }
+    }
+    return e;
+}
+
+fl analytic_pairs::eval(fl v, const interacting_pairs& pairs, const vecv& coords,
+                        fl cutoff_sqr) const {
+    if (m_sf_choice == SF_VINA)
+        return eval_blocks<vina_pair_terms, false>(v, pairs, coords, NULL, cutoff_sqr);
+    return eval_blocks<vinardo_pair_terms, false>(v, pairs, coords, NULL, cutoff_sqr);
+}
+
+fl analytic_pairs::eval_deriv(fl v, const interacting_pairs& pairs, const vecv& coords,
+                              vecv& forces, fl cutoff_sqr) const {
+    if (m_sf_choice == SF_VINA)
+        return eval_blocks<vina_pair_terms, true>(v, pairs, coords, &forces, cutoff_sqr);
+    return eval_blocks<vinardo_pair_terms, true>(v, pairs, coords, &forces, cutoff_sqr);
+}
+
+pr analytic_pairs::eval(sz a, sz b, fl r2) const {
+    const fl optimal = (m_radius[a] + m_radius[b]) * m_not_glue[a] * m_not_glue[b];
+    const fl hydrophobic = m_hydrophobic[a] * m_hydrophobic[b];
+    const fl hbond = (std::min)(m_donor[a] * m_acceptor[b] + m_acceptor[a] * m_donor[b], fl(1));
+    const fl glued = (m_glue[a] != 0 && m_glue[a] + m_glue[b] == 0) ? 1 : 0;
+    const fl scale = m_typed[a] * m_typed[b];
+    const fl* w = &m_weights[0];
+    const fl r = std::sqrt(r2);
+    fl dor;
+    const fl e = (m_sf_choice == SF_VINA)
+                     ? pair_energy<vina_pair_terms>(w, r, optimal, hydrophobic, hbond, glued, dor)
+                     : pair_energy<vinardo_pair_terms>(w, r, optimal, hydrophobic, hbond, glued,
+                                                       dor);
+    return pr(scale * e, scale * dor);
+}
@@ -0,0 +1,60 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#ifndef VINA_PAIR_KERNELS_H
+#define VINA_PAIR_KERNELS_H
+
+#include "model.h"
+#include "scoring_function.h"
+
+// Analytic alternative to the precalculate_byatom tables for Vina and Vinardo pair energies.
+// The term set and its constants are fixed at compile time by vina_pair_terms and
+// vinardo_pair_terms (see potentials.h for the forms they unroll); the weights are those of the
+// ScoringFunction the kernel was built from. Pairs are evaluated in blocks: coordinates and
+// atom properties are gathered into packed arrays, energies and derivatives are computed in a
+// branch-free loop the compiler can vectorize, and curl and forces are applied afterwards.
+//
+// An evaluation costs more than a table lookup (9.4 vs 3.6 us for the 1iep ligand in the CMake
+// Release build, SSE2), but no precalculate_byatom table has to be built per ligand (136 ms vs
+// 3 us). It is the faster path below about 20,000 pair evaluations per ligand: score_only and
+// local_only batches, not global searches. non_cache keeps the per-type precalculate tables: they
+// are built once per receptor and shared by every ligand, so there is no setup to save there and
+// the kernels would only make refinement slower.
+struct analytic_pairs {
+public:
+    analytic_pairs() : m_sf_choice(-1) {}
+    analytic_pairs(const ScoringFunction& sf, const atomv& atoms);
+    static bool supported(const ScoringFunction& sf) {
+        return sf.m_sf_choice == SF_VINA || sf.m_sf_choice == SF_VINARDO;
+    }
+    bool empty() const { return m_sf_choice < 0; }
+
+    // same contracts as eval_interacting_pairs and eval_interacting_pairs_deriv
+    fl eval(fl v, const interacting_pairs& pairs, const vecv& coords, fl cutoff_sqr) const;
+    fl eval_deriv(fl v, const interacting_pairs& pairs, const vecv& coords, vecv& forces,
+                  fl cutoff_sqr) const;
+    // energy and (dE/dr)/r of one pair at squared distance r2, no cutoff, no curl
+    pr eval(sz a, sz b, fl r2) const;
+
+private:
+    template <typename Terms, bool Deriv>
+    fl eval_blocks(fl v, const interacting_pairs& pairs, const vecv& coords, vecv* forces,
+                   fl cutoff_sqr) const;
+
+    int m_sf_choice;
+    flv m_weights;  // potential weights of the scoring function, glue last
+    // per atom, as 0/1 factors so that pair properties are products
+    flv m_radius;
+    flv m_not_glue;     // optimal distance is 0 if either atom is a glue atom
+    flv m_typed;        // XS typed; untyped atoms score 0
+    flv m_hydrophobic;  // xs_is_hydrophobic
+    flv m_donor;        // xs_is_donor
+    flv m_acceptor;     // xs_is_acceptor
+    std::vector<int> m_glue;  // k + 1 for glue atom Gk, -(k + 1) for its closure carbons, else 0
+};
+
+#endif
@@ -23,30 +23,81 @@
 #include "parallel.h"
 #include "parallel_mc.h"
 #include "coords.h"
+#include "lockstep_mc.h"
 #include "parallel_progress.h"
+#include "start_sampling.h"
 
 struct parallel_mc_task {
     model m;
+    const monte_carlo* mc;
+    sz conformer;
+    const conf* start;  // instead of mc->start, from spread_starts
     output_container out;
     rng generator;
-    parallel_mc_task(const model& m_, int seed)
-        : m(m_), generator(static_cast<rng::result_type>(seed)) {}
+    search_stats stats;
+    parallel_mc_task(const model& m_, const monte_carlo* mc_, sz conformer_, const rng& generator_)
+        : m(m_), mc(mc_), conformer(conformer_), start(NULL), generator(generator_) {}
 };
 
 typedef boost::ptr_vector<parallel_mc_task> parallel_mc_task_container;
 
 struct parallel_mc_aux {
-    const monte_carlo* mc;
     const precalculate_byatom* p;
     const igrid* ig;
     const vec* corner1;
     const vec* corner2;
     // parallel_progress* pg; // not used for CUDA
-    parallel_mc_aux(const monte_carlo* mc_, const precalculate_byatom* p_, const igrid* ig_,
-                    const vec* corner1_, const vec* corner2_)
-        : mc(mc_), p(p_), ig(ig_), corner1(corner1_), corner2(corner2_) {}
+    parallel_mc_aux(const precalculate_byatom* p_, const igrid* ig_, const vec* corner1_,
+                    const vec* corner2_)
+        : p(p_), ig(ig_), corner1(corner1_), corner2(corner2_) {}
     void operator()(parallel_mc_task& t) const {
-        (*mc)(t.m, t.out, *p, *ig, *corner1, *corner2, t.generator);
+        search_stats& stats = thread_search_stats();
+        stats.clear();
+        if (t.start) {
+            monte_carlo mc = *t.mc;
+            mc.start = *t.start;
+            mc(t.m, t.out, *p, *ig, *corner1, *corner2, t.generator);
+        } else {
+            (*t.mc)(t.m, t.out, *p, *ig, *corner1, *corner2, t.generator);
+        }
+        VINA_FOR_IN(i, t.out) t.out[i].conformer = t.conformer;
+        t.stats = stats;
+    }
+};
+
+// chains [begin, end) of a task container, run by one lockstep_monte_carlo
+struct parallel_mc_group {
+    parallel_mc_task_container* tasks;
+    sz begin;
+    sz end;
+    parallel_mc_group(parallel_mc_task_container* tasks_, sz begin_, sz end_)
+        : tasks(tasks_), begin(begin_), end(end_) {}
+};
+
+typedef std::vector<parallel_mc_group> parallel_mc_group_container;
+
+struct parallel_mc_lockstep_aux {
+    const precalculate_byatom* p;
+    const cache* c;
+    const vec* corner1;
+    const vec* corner2;
+    parallel_mc_lockstep_aux(const precalculate_byatom* p_, const cache* c_, const vec* corner1_,
+                             const vec* corner2_)
+        : p(p_), c(c_), corner1(corner1_), corner2(corner2_) {}
+    void operator()(parallel_mc_group& group) const {
+        search_stats& stats = thread_search_stats();
+        stats.clear();
+        parallel_mc_task_container& tasks = *group.tasks;
+        std::vector<lockstep_chain> chains;
+        VINA_RANGE(i, group.begin, group.end) {
+            lockstep_chain chain = {&tasks[i].generator, &tasks[i].out, tasks[i].start};
+            chains.push_back(chain);
+        }
+        parallel_mc_task& first = tasks[group.begin];
+        lockstep_monte_carlo(*first.mc, first.m, *p, *c, *corner1, *corner2, chains);
+        VINA_RANGE(i, group.begin, group.end)
+        VINA_FOR_IN(j, tasks[i].out) tasks[i].out[j].conformer = tasks[i].conformer;
+        first.stats = stats;  // for the whole group
     }
 };
 
@@ -65,15 +116,72 @@ void merge_output_containers(const parallel_mc_task_container& many, output_cont
     out.sort();
 }
 
+// runs the chains and merges their poses, with the output parameters of the first chain. With
+// lockstep, the chains (all of one model and monte_carlo) run lockstep_width at a time. With
+// spread_starts, the chains start from spread_starts of m, drawn from generator's stream past the
+// last chain.
+void run_parallel_mc(parallel_mc_task_container& task_container, sz num_threads, bool lockstep,
+                     output_container& out, const precalculate_byatom& p, const igrid& ig,
+                     const vec& corner1, const vec& corner2, const model& m, rng& generator,
+                     search_stats* stats) {
+    const monte_carlo& first = *task_container.front().mc;
+    std::vector<conf> starts;
+    if (first.spread_starts && !first.start) {
+        rng starts_generator = generator.stream(task_container.size());
+        starts = spread_starts(m, ig, corner1, corner2, task_container.size(), starts_generator,
+                               first.max_start_energy);
+        const conf_size s = m.get_size();
+        VINA_FOR_IN(i, task_container) {
+            const conf_size t = task_container[i].m.get_size();
+            if (t.ligands == s.ligands && t.flex == s.flex)  // conformers may differ in torsions
+                task_container[i].start = &starts[i];
+        }
+    }
+    if (lockstep) {
+        parallel_mc_group_container groups;
+        for (sz i = 0; i < task_container.size(); i += lockstep_width)
+            groups.push_back(parallel_mc_group(
+                &task_container, i, (std::min)(i + lockstep_width, task_container.size())));
+        parallel_mc_lockstep_aux parallel_mc_aux_instance(
+            &p, dynamic_cast<const cache*>(&ig), &corner1, &corner2);
+        parallel_iter<parallel_mc_lockstep_aux, parallel_mc_group_container, parallel_mc_group,
+                      true>
+            parallel_iter_instance(&parallel_mc_aux_instance, num_threads);
+        parallel_iter_instance.run(groups);
+    } else {
+        parallel_mc_aux parallel_mc_aux_instance(&p, &ig, &corner1, &corner2);
+        parallel_iter<parallel_mc_aux, parallel_mc_task_container, parallel_mc_task, true>
+            parallel_iter_instance(&parallel_mc_aux_instance, num_threads);
+        parallel_iter_instance.run(task_container);
+    }
+    merge_output_containers(task_container, out, first.min_rmsd, first.num_saved_mins);
+    if (stats) {
+        VINA_FOR_IN(i, task_container) { stats->merge(task_container[i].stats); }
+    }
+}
+
 void parallel_mc::operator()(const model& m, output_container& out, const precalculate_byatom& p,
                              const igrid& ig, const vec& corner1, const vec& corner2,
-                             rng& generator) const {
-    parallel_mc_aux parallel_mc_aux_instance(&mc, &p, &ig, &corner1, &corner2);
+                             rng& generator, search_stats* stats) const {
     parallel_mc_task_container task_container;
     VINA_FOR(i, num_tasks)
-    task_container.push_back(new parallel_mc_task(m, random_int(0, 1000000, generator)));
-    parallel_iter<parallel_mc_aux, parallel_mc_task_container, parallel_mc_task, true>
-        parallel_iter_instance(&parallel_mc_aux_instance, num_threads);
-    parallel_iter_instance.run(task_container);
-    merge_output_containers(task_container, out, mc.min_rmsd, mc.num_saved_mins);
+    task_container.push_back(
+        new parallel_mc_task(m, &mc, 0, generator.stream(i)));  // one stream per chain
+    run_parallel_mc(task_container, num_threads, lockstep && lockstep_model::supported(m, p, ig),
+                    out, p, ig, corner1, corner2, m, generator, stats);
+}
+
+void parallel_mc::operator()(const std::vector<model>& conformers,
+                             const std::vector<monte_carlo>& mcs, output_container& out,
+                             const precalculate_byatom& p, const igrid& ig, const vec& corner1,
+                             const vec& corner2, rng& generator, search_stats* stats) const {
+    VINA_CHECK(!conformers.empty() && conformers.size() == mcs.size());
+    parallel_mc_task_container task_container;
+    VINA_FOR(i, num_tasks) {
+        const sz k = i % conformers.size();
+        task_container.push_back(
+            new parallel_mc_task(conformers[k], &mcs[k], k, generator.stream(i)));
+    }
+    run_parallel_mc(task_container, num_threads, false, out, p, ig, corner1, corner2,
+                    conformers[0], generator, stats);
 }
@@ -24,15 +24,30 @@
 #define VINA_PARALLEL_MC_H
 
 #include "monte_carlo.h"
+#include "search_stats.h"
 
 struct parallel_mc {
     monte_carlo mc;
     sz num_tasks;
     sz num_threads;
     bool display_progress;
-    parallel_mc() : num_tasks(8), num_threads(1) {}
+    bool lockstep;  // chains in groups of lockstep_width per thread, when lockstep_mc.h allows
+    parallel_mc() : num_tasks(8), num_threads(1), lockstep(false) {}
+    // stats, if given, receives the sum over all chains
     void operator()(const model& m, output_container& out, const precalculate_byatom& p,
-                    const igrid& ig, const vec& corner1, const vec& corner2, rng& generator) const;
+                    const igrid& ig, const vec& corner1, const vec& corner2, rng& generator,
+                    search_stats* stats = NULL) const;
+    // one ligand docked from its conformers (same atoms, see Vina::set_ligand_conformers):
+    // chain i searches conformers[i % size] with mcs[i % size], and its poses are tagged with
+    // that conformer before the merge
+    void operator()(const std::vector<model>& conformers, const std::vector<monte_carlo>& mcs,
+                    output_container& out, const precalculate_byatom& p, const igrid& ig,
+                    const vec& corner1, const vec& corner2, rng& generator,
+                    search_stats* stats = NULL) const;
 };
 
+// adds the poses of in to out, as parallel_mc does for each chain
+void merge_output_containers(const output_container& in, output_container& out, fl min_rmsd,
+                             sz max_size);
+
 #endif
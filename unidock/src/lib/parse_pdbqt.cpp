@@ -25,6 +25,7 @@
 #include <sstream>  // in parse_two_unsigneds
 #include <cctype>   // isspace
 #include <exception>
+#include <algorithm>
 #include <boost/utility.hpp>  // for noncopyable
 #include <boost/optional.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -568,11 +569,11 @@ void postprocess_residue(non_rigid_parsed& nr, parsing_struct& p, context& c) {
 }
 
 // dkoes, stream version
-void parse_pdbqt_ligand(std::istream& in, non_rigid_parsed& nr, context& c) {
+void parse_pdbqt_ligand(std::istream& in, non_rigid_parsed& nr, context& c, bool keep_H = true) {
     parsing_struct p;
     boost::optional<unsigned> torsdof;
 
-    parse_pdbqt_aux(in, p, c, torsdof, false);
+    parse_pdbqt_aux(in, p, c, torsdof, false, keep_H);
 
     if (p.atoms.empty()) throw struct_parse_error("No atoms in this ligand.");
     if (!torsdof) throw struct_parse_error("Missing TORSDOF keyword.");
@@ -611,8 +612,90 @@ void parse_pdbqt_ligand(const path& name, non_rigid_parsed& nr, context& c, bool
     VINA_CHECK(nr.atoms_atoms_bonds.dim() == nr.atoms.size());
 }
 
+// Candidate frame atoms for the hydrogens of fragment frag: its heavy atoms and the far ends of
+// its torsions, which sit on the rotation axes and so move rigidly with it
+std::vector<int> sdf_rigid_heavy_atoms(const parsing_struct& p, const std::vector<int>& frag_of,
+                                       const std::vector<std::vector<int> >& torsions, int frag) {
+    std::vector<int> atoms;
+    VINA_RANGE(i, 1, frag_of.size()) {
+        if (ad_is_hydrogen(p.atoms[i - 1].a.ad)) continue;
+        if (frag < 0 || frag_of[i] == frag) atoms.push_back(int(i));
+    }
+    if (frag < 0) return atoms;
+    VINA_FOR_IN(j, torsions) {
+        if (frag_of[torsions[j][0]] == frag) atoms.push_back(torsions[j][1]);
+        if (frag_of[torsions[j][1]] == frag) atoms.push_back(torsions[j][0]);
+    }
+    return atoms;
+}
+
+// United-atom compaction: marks the nonpolar hydrogens that can be placed back from three atoms
+// of their rigid body, merges their charges into their carbons and records how to place them.
+// Hydrogens missing from the fragment info (already merged by the preparation tool) are never in
+// the model, they are only recorded. Frame atoms are context indices until the model is built.
+std::vector<bool> compact_sdf_hydrogens(parsing_struct& p,
+                                        const std::vector<std::vector<int> >& neighbors,
+                                        const std::vector<std::vector<int> >& frags,
+                                        const std::vector<std::vector<int> >& torsions,
+                                        bool keep_H, united_hydrogens& hydrogens) {
+    const sz atom_num = p.atoms.size();
+    std::vector<int> frag_of(atom_num + 1, -1);
+    VINA_FOR_IN(i, frags)
+    VINA_FOR_IN(j, frags[i]) frag_of[frags[i][j]] = int(i);
+
+    std::vector<bool> compacted(atom_num + 1, false);
+    VINA_RANGE(h, 1, atom_num + 1) {
+        if (!ad_is_hydrogen(p.atoms[h - 1].a.ad) || neighbors[h].size() != 1) continue;
+        const int parent = neighbors[h][0];
+        const parsed_atom& pa = p.atoms[parent - 1].a;
+        const bool merged = !frags.empty() && frag_of[h] < 0;
+        if (!frags.empty() && frag_of[parent] < 0) continue;
+        if (!merged) {
+            if (keep_H || p.atoms[h - 1].a.ad != AD_TYPE_H) continue;
+            if (pa.ad != AD_TYPE_C && pa.ad != AD_TYPE_A) continue;  // polar, typed H by mistake
+            if (!frags.empty() && frag_of[h] != frag_of[parent]) continue;
+        }
+
+        const std::vector<int> rigid
+            = sdf_rigid_heavy_atoms(p, frag_of, torsions, frags.empty() ? -1 : frag_of[parent]);
+        int a = 0;
+        fl a_dist = max_fl;
+        VINA_FOR_IN(i, rigid) {
+            if (rigid[i] == parent) continue;
+            const fl d = vec_distance_sqr(p.atoms[rigid[i] - 1].a.coords, pa.coords);
+            if (d < a_dist) {
+                a = rigid[i];
+                a_dist = d;
+            }
+        }
+        if (a == 0) continue;
+        const vec pa_dir = p.atoms[a - 1].a.coords - pa.coords;
+        int b = 0;
+        fl b_sin = 0.2;  // reject nearly collinear frames
+        VINA_FOR_IN(i, rigid) {
+            if (rigid[i] == parent || rigid[i] == a) continue;
+            const vec pb_dir = p.atoms[rigid[i] - 1].a.coords - pa.coords;
+            const fl sine = cross_product(pa_dir, pb_dir).norm() / (pa_dir.norm() * pb_dir.norm());
+            if (sine > b_sin) {
+                b = rigid[i];
+                b_sin = sine;
+            }
+        }
+        if (b == 0) continue;
+
+        compacted[h] = true;
+        if (!merged) p.atoms[parent - 1].a.charge += p.atoms[h - 1].a.charge;
+        hydrogens.push_back(united_hydrogen(
+            p.atoms[h - 1].context_index, p.atoms[parent - 1].context_index,
+            p.atoms[a - 1].context_index, p.atoms[b - 1].context_index, p.atoms[h - 1].a.coords,
+            pa.coords, p.atoms[a - 1].a.coords, p.atoms[b - 1].a.coords));
+    }
+    return compacted;
+}
+
 void parse_sdf_aux(std::istream& in, parsing_struct& new_p, parsing_struct& p, context& c,
-                   unsigned& torsdof, bool residue, bool keep_H = true) {
+                   unsigned& torsdof, united_hydrogens& hydrogens, bool residue,
+                   bool keep_H = true) {
     std::string str;
     // sdf header has three lines
     for (int i = 0; i < 3; ++i) {
@@ -638,10 +721,17 @@ void parse_sdf_aux(std::istream& in, parsing_struct& new_p, parsing_struct& p, c
         p.add(a, c, true);
     }
 
+    std::vector<std::vector<int> > neighbors(atom_num + 1);
     for (int i = 0; i < bond_num; ++i) {
         std::getline(in, str);
         add_context(c, str);
         // std::cout << "read sdf bond line:" << str << std::endl;
+        int first = checked_convert_substring<int>(str, 1, 3, "Bond atom");
+        int second = checked_convert_substring<int>(str, 4, 6, "Bond atom");
+        if (first < 1 || first > atom_num || second < 1 || second > atom_num)
+            throw struct_parse_error("Bond atom out of range.", str);
+        neighbors[first].push_back(second);
+        neighbors[second].push_back(first);
     }
 
     // read property
@@ -744,11 +834,14 @@ void parse_sdf_aux(std::istream& in, parsing_struct& new_p, parsing_struct& p, c
     // print_zero();
     // similar to parse_pdbqt_root
 
+    const std::vector<bool> compacted
+        = compact_sdf_hydrogens(p, neighbors, frags, torsions, keep_H, hydrogens);
+
     if (!keep_H) {
         for (int i = 0; i < frags.size(); ++i) {
             std::vector<int> new_frag_nonH;
             for (int j = 0; j < frags[i].size(); ++j) {
-                if (p.atoms[frags[i][j] - 1].a.ad != AD_TYPE_H) {
+                if (!compacted[frags[i][j]]) {
                     new_frag_nonH.push_back(frags[i][j]);
                     // std::cout << "atom num=" << frags[i][j] << " , AD type = " <<
                     // p.atoms[frags[i][j]-1].a.ad << std::endl;
@@ -772,7 +865,8 @@ void parse_sdf_aux(std::istream& in, parsing_struct& new_p, parsing_struct& p, c
     if (frags.size() == 0) {
         std::cerr << "No fragment info, using rigid docking" << std::endl;
         torsdof = 0;
-        new_p = p;
+        VINA_FOR_IN(i, p.atoms)
+        if (!compacted[i + 1]) new_p.add(p.atoms[i].a, p.atoms[i].context_index, true);
         return;  // do not use new p
     }
     // print_zero();
@@ -865,14 +959,14 @@ void parse_sdf_aux(std::istream& in, parsing_struct& new_p, parsing_struct& p, c
     }
 }
 
-void parse_sdf_ligand(const path& name, non_rigid_parsed& nr, context& c, bool keep_H = true) {
-    ifile in(name);
+void parse_sdf_ligand(std::istream& in, non_rigid_parsed& nr, context& c, bool keep_H = true) {
     parsing_struct* p = new parsing_struct();
     parsing_struct* new_p = new parsing_struct();
     unsigned int torsdof;
+    united_hydrogens hydrogens;
 
     // transfer_parsing_struct
-    parse_sdf_aux(in, *new_p, *p, c, torsdof, false, keep_H);
+    parse_sdf_aux(in, *new_p, *p, c, torsdof, hydrogens, false, keep_H);
     // free(p);
 
     // print_zero();
@@ -887,9 +981,24 @@ void parse_sdf_ligand(const path& name, non_rigid_parsed& nr, context& c, bool k
         }
     }
 
+    VINA_FOR_IN(i, hydrogens) {  // context indices -> atom indices
+        united_hydrogen h = hydrogens[i];
+        if (!c[h.parent].second || !c[h.a].second || !c[h.b].second)
+            continue;  // frame atom outside the tree, the line keeps its input coordinates
+        h.parent = c[h.parent].second.get();
+        h.a = c[h.a].second.get();
+        h.b = c[h.b].second.get();
+        nr.ligands.back().hydrogens.push_back(h);
+    }
+
     VINA_CHECK(nr.atoms_atoms_bonds.dim() == nr.atoms.size());
 }
 
+void parse_sdf_ligand(const path& name, non_rigid_parsed& nr, context& c, bool keep_H = true) {
+    ifile in(name);
+    parse_sdf_ligand(in, nr, c, keep_H);
+}
+
 void parse_pdbqt_residue(std::istream& in, parsing_struct& p, context& c) {
     boost::optional<unsigned> dummy;
     parse_pdbqt_aux(in, p, c, dummy, true);
@@ -1075,12 +1184,37 @@ model parse_ligand_pdbqt_from_file(const std::string& name,
     return tmp.m;
 }
 
+// Model of a parsed ligand, or an empty model if it exceeds the GPU kernel limits
+model ligand_model_no_failure(non_rigid_parsed& nrp, context& c, const std::string& name,
+                              atom_type::t atype) {
+    pdbqt_initializer tmp(atype);
+    tmp.initialize_from_nrp(nrp, c, true);
+    tmp.initialize(nrp.mobility_matrix());
+    assert(tmp.m.ligands.count_torsions().size() == 1);
+    if (tmp.m.ligands.count_torsions()[0] > MAX_NUM_OF_LIG_TORSION) {
+        std::cerr << "Ligand " << name << " exceed max torsion counts. "
+                  << tmp.m.ligands.count_torsions()[0] << std::endl;
+        model m(atype);
+        assert(m.num_ligands() == 0);
+        return m;
+    }
+    if (tmp.m.atoms.size() > MAX_NUM_OF_ATOMS) {
+        std::cerr << "Ligand " << name << " exceed max atom counts. " << tmp.m.atoms.size()
+                  << std::endl;
+        model m(atype);
+        assert(m.num_ligands() == 0);
+        return m;
+    }
+    return tmp.m;
+}
+
 model parse_ligand_from_file_no_failure(const std::string& name, atom_type::t atype,
                                         bool keep_H) {  // can throw parse_error
     DEBUG_PRINTF("ligand name: %s\n", name.c_str());    // debug
     // std::cout << name.substr(name.length()-5,5) << std::endl;
+    // keep_H only applies to SDF, PDBQT hydrogens cannot be placed back without bonds
     if (strcmp("pdbqt", name.substr(name.length() - 5, 5).c_str()) == 0) {
-        return parse_ligand_pdbqt_from_file_no_failure(name, atype, keep_H);
+        return parse_ligand_pdbqt_from_file_no_failure(name, atype, true);
     } else if (strcmp("sdf", name.substr(name.length() - 3, 3).c_str()) == 0) {
         return parse_ligand_sdf_from_file_no_failure(name, atype, keep_H);
     }
@@ -1102,25 +1236,7 @@ model parse_ligand_pdbqt_from_file_no_failure(const std::string& name, atom_type
         return m;  // return empty model as failure, ligand.size = 0
     }
 
-    pdbqt_initializer tmp(atype);
-    tmp.initialize_from_nrp(nrp, c, true);
-    tmp.initialize(nrp.mobility_matrix());
-    assert(tmp.m.ligands.count_torsions().size() == 1);
-    if (tmp.m.ligands.count_torsions()[0] > MAX_NUM_OF_LIG_TORSION) {
-        std::cerr << "Ligand " << name << " exceed max torsion counts. "
-                  << tmp.m.ligands.count_torsions()[0] << std::endl;
-        model m(atype);
-        assert(m.num_ligands() == 0);
-        return m;
-    }
-    if (tmp.m.atoms.size() > MAX_NUM_OF_ATOMS) {
-        std::cerr << "Ligand " << name << " exceed max atom counts. " << tmp.m.atoms.size()
-                  << std::endl;
-        model m(atype);
-        assert(m.num_ligands() == 0);
-        return m;
-    }
-    return tmp.m;
+    return ligand_model_no_failure(nrp, c, name, atype);
 }
 
 model parse_ligand_sdf_from_file_no_failure(const std::string& name, atom_type::t atype,
@@ -1138,30 +1254,7 @@ model parse_ligand_sdf_from_file_no_failure(const std::string& name, atom_type::
     }
 
     // the rest is the same
-    pdbqt_initializer tmp(atype);
-    tmp.initialize_from_nrp(nrp, c, true);
-    tmp.initialize(nrp.mobility_matrix());
-    assert(tmp.m.ligands.count_torsions().size() == 1);
-    // // debug
-    // for (int i = 0;i < tmp.m.atoms.size(); ++i){
-    //     printf("atom type of model ad=%lu, xs=%lu, numsdf=%d\n", tmp.m.atoms[i].ad,
-    //     tmp.m.atoms[i].xs, tmp.m.atoms[i].number_sdf);
-    // }
-    if (tmp.m.ligands.count_torsions()[0] > MAX_NUM_OF_LIG_TORSION) {
-        std::cerr << "Ligand " << name << " exceed max torsion counts. "
-                  << tmp.m.ligands.count_torsions()[0] << std::endl;
-        model m(atype);
-        assert(m.num_ligands() == 0);
-        return m;
-    }
-    if (tmp.m.atoms.size() > MAX_NUM_OF_ATOMS) {
-        std::cerr << "Ligand " << name << " exceed max atom counts. " << tmp.m.atoms.size()
-                  << std::endl;
-        model m(atype);
-        assert(m.num_ligands() == 0);
-        return m;
-    }
-    return tmp.m;
+    return ligand_model_no_failure(nrp, c, name, atype);
 
     // assert(m.ligands.count_torsions().size()==1);
     // if(m.ligands.count_torsions()[0] > MAX_NUM_OF_LIG_TORSION)
@@ -1173,6 +1266,88 @@ model parse_ligand_sdf_from_file_no_failure(const std::string& name, atom_type::
     // return m;
 }
 
+model parse_ligand_from_string_no_failure(const std::string& content, bool sdf,
+                                          const std::string& name, atom_type::t atype,
+                                          bool keep_H) {
+    non_rigid_parsed nrp;
+    context c;
+
+    try {
+        std::stringstream molstream(content);
+        if (sdf)
+            parse_sdf_ligand(molstream, nrp, c, keep_H);
+        else
+            parse_pdbqt_ligand(molstream, nrp, c, true);  // as parse_ligand_from_file_no_failure
+    } catch (struct_parse_error& e) {
+        std::cerr << e.what() << "Ligand name:" << name << "\n\n";
+        model m(atype);
+        assert(m.num_ligands() == 0);
+        return m;  // return empty model as failure, ligand.size = 0
+    }
+    return ligand_model_no_failure(nrp, c, name, atype);
+}
+
+namespace {
+// (bonded atom, rotatable) of atom i, in a geometry-independent order
+std::vector<std::pair<sz, bool> > sorted_bonds(const atom& a) {
+    std::vector<std::pair<sz, bool> > tmp;
+    VINA_FOR_IN(i, a.bonds)
+    tmp.push_back(std::make_pair(a.bonds[i].connected_atom_index.i, a.bonds[i].rotatable));
+    std::sort(tmp.begin(), tmp.end());
+    return tmp;
+}
+
+// same atoms in the same order, bonded alike, under the same torsion tree
+bool same_topology(const model& a, const model& b) {
+    if (a.atoms.size() != b.atoms.size() || a.num_movable_atoms() != b.num_movable_atoms()
+        || a.get_size().ligands != b.get_size().ligands)
+        return false;
+    VINA_FOR_IN(i, a.atoms) {
+        const atom& x = a.atoms[i];
+        const atom& y = b.atoms[i];
+        if (x.el != y.el || x.ad != y.ad || x.xs != y.xs || sorted_bonds(x) != sorted_bonds(y))
+            return false;
+    }
+    return true;
+}
+}  // namespace
+
+std::vector<model> parse_ligand_conformers_from_file_no_failure(const std::string& name,
+                                                                atom_type::t atype,
+                                                                bool keep_H) {
+    std::vector<model> conformers;
+    const bool sdf = name.size() >= 3 && name.substr(name.size() - 3) == "sdf";
+    if (!sdf && !(name.size() >= 5 && name.substr(name.size() - 5) == "pdbqt")) return conformers;
+
+    std::stringstream in(get_file_contents(name));
+    std::vector<std::string> records(1);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (sdf ? starts_with(line, "$$$$")
+                : starts_with(line, "MODEL") || starts_with(line, "ENDMDL")) {
+            if (records.back().find_first_not_of(" \t\r\n") != std::string::npos)
+                records.push_back(std::string());
+        } else {
+            records.back() += line;
+            records.back() += '\n';
+        }
+    }
+    if (records.back().find_first_not_of(" \t\r\n") == std::string::npos) records.pop_back();
+
+    VINA_FOR_IN(i, records) {
+        model m = parse_ligand_from_string_no_failure(records[i], sdf, name, atype, keep_H);
+        if (m.num_ligands() == 0 || (i > 0 && !same_topology(conformers.front(), m))) {
+            if (i > 0)
+                std::cerr << "WARNING: Record " << i + 1 << " of " << name
+                          << " is not a conformer of the first one, only the first " << i
+                          << " are used.\n";
+            break;
+        }
+        conformers.push_back(m);
+    }
+    return conformers;
+}
+
 model parse_ligand_pdbqt_from_string(const std::string& string_name,
                                      atom_type::t atype) {  // can throw parse_error
     non_rigid_parsed nrp;
@@ -1213,37 +1388,16 @@ model parse_ligand_pdbqt_from_string_no_failure(const std::string& string_name,
     return tmp.m;
 }
 
-model parse_receptor_pdbqt(const std::string& rigid_name, const std::string& flex_name,
-                           atom_type::t atype) {
+model parse_receptor_pdbqt_no_failure(const std::string& rigid_name, const std::string& flex_name,
+                                      atom_type::t atype) {
     // Parse PDBQT receptor with flex residues
-    // if (rigid_name.empty() && flex_name.empty()) {
-    //    // CONDITION 1
-    //    std::cerr << "ERROR: No (rigid) receptor or flexible residues were specified.\n";
-    //    exit(EXIT_FAILURE);
-    //}
-
     rigid r;
     non_rigid_parsed nrp;
     context c;
     pdbqt_initializer tmp(atype);
 
-    if (!rigid_name.empty()) {
-        try {
-            parse_pdbqt_rigid(make_path(rigid_name), r);
-        } catch (struct_parse_error& e) {
-            std::cerr << e.what() << '\n';
-            exit(EXIT_FAILURE);
-        }
-    }
-
-    if (!flex_name.empty()) {
-        try {
-            parse_pdbqt_flex(make_path(flex_name), nrp, c);
-        } catch (struct_parse_error& e) {
-            std::cerr << e.what() << '\n';
-            exit(EXIT_FAILURE);
-        }
-    }
+    if (!rigid_name.empty()) parse_pdbqt_rigid(make_path(rigid_name), r);
+    if (!flex_name.empty()) parse_pdbqt_flex(make_path(flex_name), nrp, c);
 
     if (!rigid_name.empty()) {
         tmp.initialize_from_rigid(r);
@@ -1261,6 +1415,21 @@ model parse_receptor_pdbqt(const std::string& rigid_name, const std::string& fle
     return tmp.m;
 }
 
+model parse_receptor_pdbqt(const std::string& rigid_name, const std::string& flex_name,
+                           atom_type::t atype) {
+    // if (rigid_name.empty() && flex_name.empty()) {
+    //    // CONDITION 1
+    //    std::cerr << "ERROR: No (rigid) receptor or flexible residues were specified.\n";
+    //    exit(EXIT_FAILURE);
+    //}
+    try {
+        return parse_receptor_pdbqt_no_failure(rigid_name, flex_name, atype);
+    } catch (struct_parse_error& e) {
+        std::cerr << e.what() << '\n';
+        exit(EXIT_FAILURE);
+    }
+}
+
 model parse_receptor_pdb(const std::string& rigid_name, const std::string& flex_name,
                          atom_type::t atype) {
     // Parse PDBQT receptor with flex residues
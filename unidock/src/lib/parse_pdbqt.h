@@ -30,6 +30,10 @@
 model parse_receptor_pdbqt(const std::string &rigid = std::string(),
                            const std::string &flex = std::string(),
                            atom_type::t atype = atom_type::XS);  // can throw struct_parse_error
+// as parse_receptor_pdbqt, but throws struct_parse_error instead of exiting
+model parse_receptor_pdbqt_no_failure(const std::string &rigid = std::string(),
+                                      const std::string &flex = std::string(),
+                                      atom_type::t atype = atom_type::XS);
 model parse_receptor_pdb(const std::string &rigid = std::string(),
                          const std::string &flex = std::string(),
                          atom_type::t atype = atom_type::XS);  // can throw struct_parse_error
@@ -38,11 +42,24 @@ model parse_ligand_pdbqt_from_file(const std::string &name, atom_type::t atype,
                                    bool keep_H = false);  // can throw struct_parse_error
 model parse_ligand_pdbqt_from_file_no_failure(const std::string &name, atom_type::t atype,
                                               bool keep_H = false);  // can throw struct_parse_error
+// PDBQT or SDF by extension, keep_H (nonpolar hydrogens in the search model) only applies to SDF
 model parse_ligand_from_file_no_failure(const std::string &name, atom_type::t atype,
                                         bool keep_H = false);  // can throw struct_parse_error
 model parse_ligand_sdf_from_file_no_failure(const std::string &name, atom_type::t atype,
                                             bool keep_H = false);  // can throw struct_parse_error
 
+// one SDF or PDBQT record held in memory, name is only used in messages
+model parse_ligand_from_string_no_failure(const std::string &content, bool sdf,
+                                          const std::string &name, atom_type::t atype,
+                                          bool keep_H = false);  // can return empty model
+
+// conformers of one ligand: the $$$$-separated SDF records or MODEL/ENDMDL-delimited PDBQT models
+// of the file, stopping (with a warning) at the first one whose atoms, bonds or torsion tree
+// differ from the first record; empty if the first record can't be parsed
+std::vector<model> parse_ligand_conformers_from_file_no_failure(const std::string &name,
+                                                                atom_type::t atype,
+                                                                bool keep_H = false);
+
 model parse_ligand_pdbqt_from_string(const std::string &string_name,
                                      atom_type::t atype);  // can exit with code EXIT_FAILURE
 model parse_ligand_pdbqt_from_string_no_failure(
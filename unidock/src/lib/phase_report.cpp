@@ -0,0 +1,179 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#include "phase_report.h"
+
+#include <sys/resource.h>
+
+namespace {
+// Peak resident set (VmHWM) since start or the last reset, in kB
+sz read_peak_rss_kb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (line.compare(0, 6, "VmHWM:") == 0) return sz(std::atol(line.c_str() + 6));
+    struct rusage usage;  // not Linux: lifetime peak only
+    if (getrusage(RUSAGE_SELF, &usage) == 0) return sz(usage.ru_maxrss);
+    return 0;
+}
+
+// Linux >= 4.0 resets VmHWM to the current RSS on "5"
+bool reset_peak_rss() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    if (!clear_refs) return false;
+    clear_refs << "5";
+    clear_refs.flush();
+    return bool(clear_refs);
+}
+
+void write_stats(std::ostream& out, const phase_stats& s) {
+    out << "{\"calls\": " << s.calls << ", \"seconds\": " << s.seconds
+        << ", \"peak_rss_kb\": " << s.peak_rss_kb;
+    if (!s.counters.empty()) {
+        out << ", \"counters\": {";
+        for (std::map<std::string, double>::const_iterator it = s.counters.begin();
+             it != s.counters.end(); ++it) {
+            if (it != s.counters.begin()) out << ", ";
+            out << '"' << it->first << "\": " << it->second;
+        }
+        out << '}';
+    }
+    out << '}';
+}
+
+void write_table(std::ostream& out, const phase_table& t, const std::string& indent) {
+    out << '{';
+    for (phase_table::const_iterator it = t.begin(); it != t.end(); ++it) {
+        out << (it == t.begin() ? "\n" : ",\n") << indent << "  \"" << it->first << "\": ";
+        write_stats(out, it->second);
+    }
+    if (!t.empty()) out << '\n' << indent;
+    out << '}';
+}
+}  // namespace
+
+void phase_stats::merge(const phase_stats& other) {
+    calls += other.calls;
+    seconds += other.seconds;
+    peak_rss_kb = (std::max)(peak_rss_kb, other.peak_rss_kb);
+    for (std::map<std::string, double>::const_iterator it = other.counters.begin();
+         it != other.counters.end(); ++it)
+        counters[it->first] += it->second;
+}
+
+phase_report& phase_report::get() {
+    static phase_report report;
+    return report;
+}
+
+phase_report::phase_report()
+    : m_enabled(false),
+      m_peak_resettable(false),
+      m_peak_rss_kb(0),
+      m_start(clock::now()),
+      m_in_batch(false) {}
+
+void phase_report::enable() {
+    boost::mutex::scoped_lock lk(m_mutex);
+    m_enabled = true;
+    m_start = clock::now();
+}
+
+// A new phase resets the kernel's peak counter, so the peak seen so far is first folded into
+// every phase that is still open
+void phase_report::open(const std::string& name) {
+    const sz peak = read_peak_rss_kb();
+    VINA_FOR_IN(i, m_open) m_open[i].peak_rss_kb = (std::max)(m_open[i].peak_rss_kb, peak);
+    m_peak_rss_kb = (std::max)(m_peak_rss_kb, peak);
+    m_peak_resettable = reset_peak_rss();
+    frame f;
+    f.name = name;
+    f.start = clock::now();
+    f.peak_rss_kb = read_peak_rss_kb();
+    m_open.push_back(f);
+}
+
+phase_stats phase_report::close() {
+    frame& f = m_open.back();
+    phase_stats s;
+    s.calls = 1;
+    s.seconds = std::chrono::duration<double>(clock::now() - f.start).count();
+    s.peak_rss_kb = (std::max)(f.peak_rss_kb, read_peak_rss_kb());
+    s.counters.swap(f.counters);
+    m_peak_rss_kb = (std::max)(m_peak_rss_kb, s.peak_rss_kb);
+    m_open.pop_back();
+    if (!m_open.empty())
+        m_open.back().peak_rss_kb = (std::max)(m_open.back().peak_rss_kb, s.peak_rss_kb);
+    return s;
+}
+
+void phase_report::begin_phase(const std::string& name) {
+    boost::mutex::scoped_lock lk(m_mutex);
+    open(name);
+}
+
+void phase_report::end_phase() {
+    boost::mutex::scoped_lock lk(m_mutex);
+    if (m_open.empty()) return;
+    const std::string name = m_open.back().name;
+    const phase_stats s = close();
+    m_phases[name].merge(s);
+    if (m_in_batch) m_batches.back().phases[name].merge(s);
+}
+
+void phase_report::count(const std::string& name, double value) {
+    boost::mutex::scoped_lock lk(m_mutex);
+    if (m_open.empty()) return;
+    m_open.back().counters[name] += value;
+}
+
+void phase_report::begin_batch(sz id, sz size) {
+    boost::mutex::scoped_lock lk(m_mutex);
+    batch_stats b;
+    b.id = id;
+    b.size = size;
+    m_batches.push_back(b);
+    m_in_batch = true;
+    open("batch");
+}
+
+void phase_report::end_batch() {
+    boost::mutex::scoped_lock lk(m_mutex);
+    if (!m_in_batch) return;
+    m_batches.back().total = close();
+    m_in_batch = false;
+}
+
+void phase_report::write(std::ostream& out) const {
+    boost::mutex::scoped_lock lk(m_mutex);
+    out << "{\n  \"wall_seconds\": "
+        << std::chrono::duration<double>(clock::now() - m_start).count()
+        << ",\n  \"peak_rss_kb\": " << (std::max)(m_peak_rss_kb, read_peak_rss_kb())
+        << ",\n  \"per_phase_peak_rss\": " << (m_peak_resettable ? "true" : "false")
+        << ",\n  \"phases\": ";
+    write_table(out, m_phases, "  ");
+    out << ",\n  \"batches\": [";
+    VINA_FOR_IN(i, m_batches) {
+        const batch_stats& b = m_batches[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"id\": " << b.id << ", \"size\": " << b.size
+            << ", \"seconds\": " << b.total.seconds << ", \"peak_rss_kb\": " << b.total.peak_rss_kb
+            << ",\n     \"phases\": ";
+        write_table(out, b.phases, "     ");
+        out << '}';
+    }
+    if (!m_batches.empty()) out << "\n  ";
+    out << "]\n}\n";
+}
+
+void phase_report::write(const std::string& path) const {
+    std::ofstream out(path.c_str());
+    if (!out) {
+        std::cerr << "ERROR: Cannot write timing report " << path << ".\n";
+        return;
+    }
+    write(out);
+}
@@ -0,0 +1,106 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#ifndef VINA_PHASE_REPORT_H
+#define VINA_PHASE_REPORT_H
+
+#include <map>
+#include <chrono>
+#include <boost/thread/mutex.hpp>
+
+#include "common.h"
+
+// Wall time, calls, counters and peak RSS per named phase (receptor_parse, grid_build,
+// ligand_parse, precalculate, search, refinement, rescoring, output_write), for the whole run and
+// per batch, written as JSON. Disabled unless enable() is called; a disabled scoped_phase costs one
+// load and branch. Phases nest and are meant to be opened from the driving thread.
+struct phase_stats {
+    sz calls;
+    double seconds;
+    sz peak_rss_kb;  // highest resident set while the phase was open
+    std::map<std::string, double> counters;
+    phase_stats() : calls(0), seconds(0), peak_rss_kb(0) {}
+    void merge(const phase_stats& other);
+};
+
+typedef std::map<std::string, phase_stats> phase_table;
+
+struct batch_stats {
+    sz id;
+    sz size;
+    phase_stats total;
+    phase_table phases;
+};
+
+class phase_report {
+public:
+    static phase_report& get();  // process-wide
+    bool enabled() const { return m_enabled; }
+    void enable();
+
+    void begin_phase(const std::string& name);
+    void end_phase();
+    void count(const std::string& name, double value);  // added to the innermost open phase
+    void begin_batch(sz id, sz size);
+    void end_batch();
+
+    void write(std::ostream& out) const;  // JSON
+    void write(const std::string& path) const;
+
+private:
+    typedef std::chrono::steady_clock clock;
+    struct frame {
+        std::string name;
+        clock::time_point start;
+        sz peak_rss_kb;
+        std::map<std::string, double> counters;
+    };
+
+    phase_report();
+    void open(const std::string& name);
+    phase_stats close();
+
+    bool m_enabled;
+    bool m_peak_resettable;  // /proc/self/clear_refs accepted, so peaks are per phase
+    sz m_peak_rss_kb;        // whole run, across resets
+    clock::time_point m_start;
+    mutable boost::mutex m_mutex;
+    std::vector<frame> m_open;
+    phase_table m_phases;
+    std::vector<batch_stats> m_batches;
+    bool m_in_batch;
+};
+
+struct scoped_phase {
+    explicit scoped_phase(const char* name) : m_active(phase_report::get().enabled()) {
+        if (m_active) phase_report::get().begin_phase(name);
+    }
+    ~scoped_phase() {
+        if (m_active) phase_report::get().end_phase();
+    }
+
+private:
+    bool m_active;
+};
+
+struct scoped_batch {
+    scoped_batch(sz id, sz size) : m_active(phase_report::get().enabled()) {
+        if (m_active) phase_report::get().begin_batch(id, size);
+    }
+    ~scoped_batch() {
+        if (m_active) phase_report::get().end_batch();
+    }
+
+private:
+    bool m_active;
+};
+
+inline void phase_count(const char* name, double value) {
+    if (phase_report::get().enabled()) phase_report::get().count(name, value);
+}
+
+#endif
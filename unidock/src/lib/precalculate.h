@@ -26,6 +26,7 @@
 #include "scoring_function.h"
 #include "matrix.h"
 #include "kernel.h"
+#include "pair_kernels.h"
 
 #ifdef DEBUG
 #    define DEBUG_PRINTF printf
@@ -277,6 +278,17 @@ public:
     fl cutoff_sqr() const { return m_cutoff_sqr; }
     fl max_cutoff_sqr() const { return m_max_cutoff_sqr; }
     sz get_factor() const { return m_factor; }
+    // Vina and Vinardo only: scores pairs analytically (see pair_kernels.h), no tables are built
+    void init_analytic(const ScoringFunction &sf, const model &model) {
+        m_factor = 32;
+        m_cutoff_sqr = sqr(sf.get_cutoff());
+        m_max_cutoff_sqr = sqr(sf.get_max_cutoff());
+        m_n = 0;
+        m_data = triangular_matrix<precalculate_element>();
+        m_analytic = analytic_pairs(sf, model.get_atoms());
+    }
+    bool analytic() const { return !m_analytic.empty(); }
+    const analytic_pairs &get_analytic() const { return m_analytic; }
     void widen(fl left, fl right) {
         flv rs = calculate_rs();
         VINA_FOR(t1, m_data.dim())
@@ -287,6 +299,7 @@ public:
     fl m_factor;
 
     triangular_matrix<precalculate_element> m_data;
+    analytic_pairs m_analytic;
 
     // set public for GPU
     fl m_cutoff_sqr;
@@ -319,4 +332,10 @@ void precalculate_parallel(triangular_matrix_cuda_t *m_data_list_cpu,
                            const ScoringFunction &m_scoring_function,
                            std::vector<model> &m_model_gpu, const flv &common_rs, const int thread);
 
+// Uploads tables already on the host (copied back by an earlier GPU search) instead of
+// recomputing them, e.g. for the same ligands docked against another receptor
+void precalculate_upload(triangular_matrix_cuda_t *m_data_list_cpu,
+                         const std::vector<precalculate_byatom> &m_precalculated_byatom_gpu,
+                         const int thread);
+
 #endif
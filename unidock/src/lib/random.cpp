@@ -24,28 +24,70 @@
 
 #include "random.h"
 
+void rng::refill() {
+    // Philox4x32 with 10 rounds, as in Random123 and cuRAND
+    const boost::uint32_t M0 = 0xD2511F53u;
+    const boost::uint32_t M1 = 0xCD9E8D57u;
+    const boost::uint32_t W0 = 0x9E3779B9u;
+    const boost::uint32_t W1 = 0xBB67AE85u;
+
+    const boost::uint64_t stream = (boost::uint64_t(m_ligand) << 32) | boost::uint32_t(m_chain);
+    boost::uint32_t ctr[4] = {boost::uint32_t(m_draw), boost::uint32_t(m_draw >> 32),
+                              boost::uint32_t(stream), boost::uint32_t(stream >> 32)};
+    boost::uint32_t key[2] = {m_key[0], m_key[1]};
+    VINA_FOR(round, 10) {
+        if (round > 0) {
+            key[0] += W0;
+            key[1] += W1;
+        }
+        const boost::uint64_t p0 = boost::uint64_t(M0) * ctr[0];
+        const boost::uint64_t p1 = boost::uint64_t(M1) * ctr[2];
+        const boost::uint32_t c1 = ctr[1];
+        const boost::uint32_t c3 = ctr[3];
+        ctr[0] = boost::uint32_t(p1 >> 32) ^ c1 ^ key[0];
+        ctr[1] = boost::uint32_t(p1);
+        ctr[2] = boost::uint32_t(p0 >> 32) ^ c3 ^ key[1];
+        ctr[3] = boost::uint32_t(p0);
+    }
+    VINA_FOR(i, 4) m_block[i] = ctr[i];
+    ++m_draw;
+    m_next = 0;
+}
+
+// (0, 1], like curand_uniform
+inline fl random_unit(rng& generator) {
+    const fl two_pow_32_inv = 2.3283064e-10f;
+    return generator() * two_pow_32_inv + two_pow_32_inv / 2;
+}
+
 fl random_fl(fl a, fl b, rng& generator) {  // expects a < b, returns rand in [a, b]
-    assert(a < b);                          // BOOST also asserts a < b
-    typedef boost::uniform_real<fl> distr;
-    boost::variate_generator<rng&, distr> r(generator, distr(a, b));
-    fl tmp = r();
+    assert(a < b);
+    fl tmp = a + (b - a) * random_unit(generator);
+    if (tmp > b) tmp = b;  // rounding
     assert(tmp >= a);
     assert(tmp <= b);
     return tmp;
 }
 
 fl random_normal(fl mean, fl sigma, rng& generator) {  // expects sigma >= 0
-    assert(sigma >= 0);                                // BOOST asserts this as well
-    typedef boost::normal_distribution<fl> distr;
-    boost::variate_generator<rng&, distr> r(generator, distr(mean, sigma));
-    return r();
+    assert(sigma >= 0);
+    // Box-Muller, as curand_normal
+    const fl u1 = random_unit(generator);
+    const fl u2 = random_unit(generator);
+    return mean + sigma * std::sqrt(-2 * std::log(u1)) * std::cos(2 * pi * u2);
 }
 
 int random_int(int a, int b, rng& generator) {  // expects a <= b, returns rand in [a, b]
-    assert(a <= b);                             // BOOST asserts this as well
-    typedef boost::uniform_int<int> distr;
-    boost::variate_generator<rng&, distr> r(generator, distr(a, b));
-    int tmp = r();
+    assert(a <= b);
+    // unbiased multiply-shift with rejection (Lemire)
+    const boost::uint32_t range = boost::uint32_t(b) - boost::uint32_t(a) + 1;
+    if (range == 0) return int(generator());  // the full 32-bit range
+    boost::uint64_t m = boost::uint64_t(generator()) * range;
+    if (boost::uint32_t(m) < range) {
+        const boost::uint32_t threshold = (0u - range) % range;
+        while (boost::uint32_t(m) < threshold) m = boost::uint64_t(generator()) * range;
+    }
+    int tmp = int(boost::uint32_t(a) + boost::uint32_t(m >> 32));
     assert(tmp >= a);
     assert(tmp <= b);
     return tmp;
@@ -24,10 +24,41 @@
 #define VINA_RANDOM_H
 
 #include <random>
-#include <boost/random.hpp>
+#include <boost/cstdint.hpp>
 #include "common.h"
 
-typedef boost::mt19937 rng;
+// Philox4x32-10 counter-based generator with the stream layout of curandStatePhilox4_32_10_t:
+// the key is the seed and the counter is (draw index, stream). Streams are identified by
+// (ligand, chain), so a chain draws the same numbers whatever the thread count or batch.
+class rng {
+public:
+    typedef boost::uint32_t result_type;
+    rng(boost::uint64_t seed = 0, sz ligand = 0, sz chain = 0)
+        : m_seed(seed), m_ligand(ligand), m_chain(chain), m_draw(0), m_next(4) {
+        m_key[0] = boost::uint32_t(seed);
+        m_key[1] = boost::uint32_t(seed >> 32);
+    }
+    rng stream(sz ligand, sz chain) const { return rng(m_seed, ligand, chain); }
+    rng stream(sz chain) const { return rng(m_seed, m_ligand, chain); }
+    result_type operator()() {
+        if (m_next == 4) refill();
+        return m_block[m_next++];
+    }
+    static result_type min() { return 0; }
+    static result_type max() { return 0xFFFFFFFFu; }
+    boost::uint64_t seed() const { return m_seed; }
+
+private:
+    void refill();
+
+    boost::uint64_t m_seed;
+    sz m_ligand;
+    sz m_chain;
+    boost::uint64_t m_draw;  // index of the next 4-word block
+    boost::uint32_t m_key[2];
+    boost::uint32_t m_block[4];
+    sz m_next;  // next word of m_block, 4 when used up
+};
 
 fl random_fl(fl a, fl b, rng& generator);             // expects a < b, returns rand in [a, b]
 fl random_normal(fl mean, fl sigma, rng& generator);  // expects sigma >= 0
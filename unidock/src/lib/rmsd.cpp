@@ -0,0 +1,118 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#include "rmsd.h"
+#include <algorithm>
+
+// Groups are padded to whole blocks of this many floats (AVX width), so loops have no remainder
+const sz rmsd_lanes = 8;
+// Padding coordinate, far enough from any atom never to be a nearest neighbour
+const fl rmsd_padding = 1e6;
+
+rmsd_engine::rmsd_engine(const model& m)
+    : m_num_heavy(0), m_num_movable(m.num_movable_atoms()), m_num_poses(0) {
+    std::vector<szv> groups(EL_TYPE_SIZE + 1);  // + 1 for unassigned, matching same_element
+    VINA_FOR(i, m_num_movable) {
+        const atom& a = m.atoms[i];
+        if (a.el == EL_TYPE_H || a.is_hydrogen()) continue;
+        groups[(std::min)(a.el, sz(EL_TYPE_SIZE))].push_back(i);
+        ++m_num_heavy;
+    }
+    VINA_FOR_IN(g, groups) {
+        if (groups[g].empty()) continue;
+        m_group_begin.push_back(m_atoms.size());
+        VINA_FOR_IN(i, groups[g]) m_atoms.push_back(groups[g][i]);
+        while (m_atoms.size() % rmsd_lanes != 0) m_atoms.push_back(max_sz);
+    }
+    m_group_begin.push_back(m_atoms.size());
+    m_best.resize(m_atoms.size());
+}
+
+sz rmsd_engine::add(const vecv& coords) {
+    VINA_CHECK(coords.size() >= m_num_movable);
+    VINA_FOR_IN(slot, m_atoms) {
+        const sz i = m_atoms[slot];
+        m_x.push_back(i == max_sz ? rmsd_padding : coords[i][0]);
+        m_y.push_back(i == max_sz ? rmsd_padding : coords[i][1]);
+        m_z.push_back(i == max_sz ? rmsd_padding : coords[i][2]);
+    }
+    return m_num_poses++;
+}
+
+fl rmsd_engine::lower_bound_asymmetric(sz a, sz b) const {
+    const sz stride = m_atoms.size();
+    const fl* ax = &m_x[a * stride];
+    const fl* ay = &m_y[a * stride];
+    const fl* az = &m_z[a * stride];
+    const fl* bx = &m_x[b * stride];
+    const fl* by = &m_y[b * stride];
+    const fl* bz = &m_z[b * stride];
+    fl* best = m_best.data();  // squared distance from each atom of a to its nearest match in b
+    std::fill(best, best + stride, max_fl);
+    VINA_RANGE(g, 0, m_group_begin.size() - 1) {
+        const sz begin = m_group_begin[g];
+        const sz end = m_group_begin[g + 1];
+        VINA_RANGE(j, begin, end) {
+            if (m_atoms[j] == max_sz) break;  // padding is at the end of the group
+            const fl x = bx[j];
+            const fl y = by[j];
+            const fl z = bz[j];
+            // one atom of b against the whole group of a: branch-free, vectorized by the compiler
+            VINA_RANGE(i, begin, end) {
+                const fl dx = ax[i] - x;
+                const fl dy = ay[i] - y;
+                const fl dz = az[i] - z;
+                const fl r2 = dx * dx + dy * dy + dz * dz;
+                best[i] = (r2 < best[i]) ? r2 : best[i];
+            }
+        }
+    }
+    fl sum = 0;
+    VINA_FOR(i, stride)
+    if (m_atoms[i] != max_sz) sum += best[i];
+    return (m_num_heavy == 0) ? 0 : std::sqrt(sum / m_num_heavy);
+}
+
+fl rmsd_engine::lower_bound(sz a, sz b) const {
+    assert(a < m_num_poses && b < m_num_poses);
+    return (std::max)(lower_bound_asymmetric(a, b), lower_bound_asymmetric(b, a));
+}
+
+fl rmsd_engine::upper_bound(sz a, sz b) const {
+    assert(a < m_num_poses && b < m_num_poses);
+    const sz stride = m_atoms.size();
+    const fl* ax = &m_x[a * stride];
+    const fl* ay = &m_y[a * stride];
+    const fl* az = &m_z[a * stride];
+    const fl* bx = &m_x[b * stride];
+    const fl* by = &m_y[b * stride];
+    const fl* bz = &m_z[b * stride];
+    fl sums[rmsd_lanes] = {0};
+    // the stride is whole blocks; padding slots are equal in both poses and add nothing
+    for (sz i = 0; i < stride; i += rmsd_lanes) {
+        VINA_FOR(l, rmsd_lanes) {
+            const fl dx = bx[i + l] - ax[i + l];
+            const fl dy = by[i + l] - ay[i + l];
+            const fl dz = bz[i + l] - az[i + l];
+            sums[l] += dx * dx + dy * dy + dz * dz;
+        }
+    }
+    fl sum = 0;
+    VINA_FOR(l, rmsd_lanes) sum += sums[l];
+    return (m_num_heavy == 0) ? 0 : std::sqrt(sum / m_num_heavy);
+}
+
+void rmsd_engine::matrix(bool lower, flv& out) const {
+    out.assign(m_num_poses * m_num_poses, 0);
+    VINA_FOR(a, m_num_poses) {
+        VINA_RANGE(b, a + 1, m_num_poses) {
+            const fl r = lower ? lower_bound(a, b) : upper_bound(a, b);
+            out[a * m_num_poses + b] = r;
+            out[b * m_num_poses + a] = r;
+        }
+    }
+}
@@ -0,0 +1,38 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#ifndef VINA_RMSD_H
+#define VINA_RMSD_H
+
+#include "model.h"
+
+// Pose RMSDs over the movable heavy atoms of one model. Atoms are grouped by element once, and
+// pose coordinates are stored as structure of arrays, each group padded to whole SIMD blocks.
+// Bounds reuse one scratch buffer, so an engine is not to be shared between threads.
+struct rmsd_engine {
+public:
+    rmsd_engine(const model& m);
+    sz add(const vecv& coords);  // movable atom coords (model::coords), returns the pose index
+    sz num_poses() const { return m_num_poses; }
+    fl lower_bound(sz a, sz b) const;  // same as model::rmsd_lower_bound
+    fl upper_bound(sz a, sz b) const;  // same as model::rmsd_upper_bound
+    // all pairs, num_poses() x num_poses() row-major and symmetric
+    void matrix(bool lower, flv& out) const;
+
+private:
+    fl lower_bound_asymmetric(sz a, sz b) const;
+
+    szv m_atoms;        // [slot] movable atom index, max_sz for padding
+    szv m_group_begin;  // slots of element group g are [m_group_begin[g], m_group_begin[g + 1])
+    sz m_num_heavy;
+    sz m_num_movable;
+    sz m_num_poses;
+    flv m_x, m_y, m_z;  // [pose * m_atoms.size() + slot]
+    mutable flv m_best;  // [slot] scratch of lower_bound_asymmetric
+};
+
+#endif
@@ -0,0 +1,59 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#include "search_stats.h"
+#include "phase_report.h"
+
+bool search_stats::m_timing = false;
+
+void search_stats::clear() {
+    evals = 0;
+    bfgs_iterations = 0;
+    line_search_backtracks = 0;
+    metropolis_trials = 0;
+    metropolis_accepts = 0;
+    output_replacements = 0;
+    grid_seconds = 0;
+    intra_seconds = 0;
+}
+
+void search_stats::merge(const search_stats& other) {
+    evals += other.evals;
+    bfgs_iterations += other.bfgs_iterations;
+    line_search_backtracks += other.line_search_backtracks;
+    metropolis_trials += other.metropolis_trials;
+    metropolis_accepts += other.metropolis_accepts;
+    output_replacements += other.output_replacements;
+    grid_seconds += other.grid_seconds;
+    intra_seconds += other.intra_seconds;
+}
+
+void search_stats::write(std::ostream& out, const std::string& prefix) const {
+    out << prefix << "evals=" << evals << " bfgs_iterations=" << bfgs_iterations
+        << " line_search_backtracks=" << line_search_backtracks
+        << " metropolis_acceptance=" << acceptance_ratio() << " (" << metropolis_accepts << '/'
+        << metropolis_trials << ")"
+        << " output_replacements=" << output_replacements;
+    if (timing_enabled() && grid_seconds + intra_seconds > 0)
+        out << " grid_seconds=" << grid_seconds << " intra_seconds=" << intra_seconds;
+    out << '\n';
+}
+
+void search_stats::count_phase() const {
+    if (!phase_report::get().enabled()) return;
+    phase_count("evals", evals);
+    phase_count("bfgs_iterations", bfgs_iterations);
+    phase_count("line_search_backtracks", line_search_backtracks);
+    phase_count("metropolis_trials", metropolis_trials);
+    phase_count("metropolis_accepts", metropolis_accepts);
+    phase_count("output_replacements", output_replacements);
+}
+
+search_stats& thread_search_stats() {
+    static thread_local search_stats stats;
+    return stats;
+}
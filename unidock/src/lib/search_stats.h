@@ -0,0 +1,73 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#ifndef VINA_SEARCH_STATS_H
+#define VINA_SEARCH_STATS_H
+
+#include <chrono>
+#include <ostream>
+
+#include "common.h"
+
+// Per-ligand search telemetry. The CPU engine counts into thread_search_stats() while it runs;
+// parallel_mc takes one snapshot per Monte Carlo chain and sums them for the ligand. The GPU
+// kernel keeps the same counters per thread (search_stats_cuda_t), without the timings.
+struct search_stats {
+    unsigned long long evals;  // energy + derivative evaluations
+    unsigned long long bfgs_iterations;
+    unsigned long long line_search_backtracks;  // line search trials that were rejected
+    unsigned long long metropolis_trials;       // every step after the first of a chain
+    unsigned long long metropolis_accepts;
+    unsigned long long output_replacements;  // add_to_output_container overwrote a stored pose
+    double grid_seconds;                     // only with timing enabled, CPU engine only
+    double intra_seconds;
+
+    search_stats() { clear(); }
+    void clear();
+    void merge(const search_stats& other);
+    fl acceptance_ratio() const {
+        return metropolis_trials > 0 ? fl(metropolis_accepts) / metropolis_trials : 0;
+    }
+    // "key=value ..." on one line after prefix, e.g. "REMARK SEARCH STATS: "
+    void write(std::ostream& out, const std::string& prefix) const;
+    void count_phase() const;  // adds the counters to the innermost open phase_report phase
+
+    static bool timing_enabled() { return m_timing; }
+    static void enable_timing() { m_timing = true; }
+
+private:
+    static bool m_timing;
+};
+
+search_stats& thread_search_stats();
+
+// Splits model::eval_deriv into grid and intramolecular wall time; inert unless timing is on
+class search_timer {
+public:
+    search_timer() : m_active(search_stats::timing_enabled()) {
+        if (m_active) m_last = clock::now();
+    }
+    void lap_grid() {
+        if (m_active) thread_search_stats().grid_seconds += lap();
+    }
+    void lap_intra() {
+        if (m_active) thread_search_stats().intra_seconds += lap();
+    }
+
+private:
+    typedef std::chrono::steady_clock clock;
+    double lap() {
+        const clock::time_point now = clock::now();
+        const double seconds = std::chrono::duration<double>(now - m_last).count();
+        m_last = now;
+        return seconds;
+    }
+    bool m_active;
+    clock::time_point m_last;
+};
+
+#endif
@@ -0,0 +1,103 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#include "start_sampling.h"
+
+namespace {
+const sz halton_bases[6] = {2, 3, 5, 7, 11, 13};  // position x, y, z, then orientation
+
+// Halton sequence with a random shift modulo 1 (Cranley-Patterson), so seeds differ
+struct shifted_halton {
+    fl shift[6];
+    explicit shifted_halton(rng& generator) {
+        VINA_FOR(d, 6) shift[d] = random_fl(0, 1, generator);
+    }
+    fl operator()(sz i, sz d) const {
+        const fl x = radical_inverse(i, halton_bases[d]) + shift[d];
+        return x < 1 ? x : x - 1;
+    }
+};
+
+void set_rigid(const shifted_halton& h, sz i, const vec& corner1, const vec& corner2,
+               rigid_conf& r) {
+    VINA_FOR(d, 3) r.position[d] = corner1[d] + h(i, d) * (corner2[d] - corner1[d]);
+    // Shoemake's subgroup algorithm: uniform on the unit quaternions, hence on SO(3)
+    const fl u = h(i, 3);
+    const fl a = 2 * pi * h(i, 4);
+    const fl b = 2 * pi * h(i, 5);
+    const fl s1 = std::sqrt(1 - u);
+    const fl s2 = std::sqrt(u);
+    r.orientation = qt(s2 * std::cos(b), s1 * std::sin(a), s1 * std::cos(a), s2 * std::sin(b));
+}
+
+std::vector<fl*> torsions_of(conf& c) {
+    std::vector<fl*> tmp;
+    VINA_FOR_IN(i, c.ligands)
+    VINA_FOR_IN(j, c.ligands[i].torsions) tmp.push_back(&c.ligands[i].torsions[j]);
+    VINA_FOR_IN(i, c.flex)
+    VINA_FOR_IN(j, c.flex[i].torsions) tmp.push_back(&c.flex[i].torsions[j]);
+    return tmp;
+}
+
+// Fisher-Yates with the search generator, the same on every platform unlike std::shuffle
+szv random_permutation(sz n, rng& generator) {
+    szv tmp(n);
+    VINA_FOR(i, n) tmp[i] = i;
+    for (sz i = n; i > 1; --i) std::swap(tmp[i - 1], tmp[random_sz(0, i - 1, generator)]);
+    return tmp;
+}
+}  // namespace
+
+fl radical_inverse(sz i, sz base) {
+    fl x = 0;
+    fl f = fl(1) / base;
+    for (; i > 0; i /= base, f /= base) x += f * (i % base);
+    return x;
+}
+
+std::vector<conf> spread_starts(const model& m, const igrid& ig, const vec& corner1,
+                                const vec& corner2, sz n, rng& generator, fl max_energy,
+                                sz max_retries) {
+    std::vector<conf> starts(n, m.get_initial_conf());
+    if (n == 0) return starts;
+    std::vector<shifted_halton> halton;
+    VINA_FOR_IN(l, starts[0].ligands) halton.push_back(shifted_halton(generator));
+    VINA_FOR(i, n)
+    VINA_FOR_IN(l, halton)
+    set_rigid(halton[l], i + 1, corner1, corner2, starts[i].ligands[l].rigid);
+
+    std::vector<szv> strata(torsions_of(starts[0]).size());
+    VINA_FOR_IN(t, strata) strata[t] = random_permutation(n, generator);
+    VINA_FOR(i, n) {
+        const std::vector<fl*> torsions = torsions_of(starts[i]);
+        VINA_FOR_IN(t, torsions)
+        *torsions[t] = -pi + 2 * pi * (strata[t][i] + random_fl(0, 1, generator)) / n;
+    }
+
+    if (max_energy < max_fl) {
+        model tmp = m;
+        sz next = n + 1;  // first Halton point not taken by a chain
+        VINA_FOR(i, n) {
+            tmp.set(starts[i]);
+            fl best_e = ig.eval(tmp, 1000);  // the cap of authentic_v in the searches
+            conf candidate = starts[i];
+            VINA_FOR(retry, max_retries) {
+                if (best_e <= max_energy) break;
+                VINA_FOR_IN(l, halton)
+                set_rigid(halton[l], next, corner1, corner2, candidate.ligands[l].rigid);
+                ++next;
+                tmp.set(candidate);
+                const fl e = ig.eval(tmp, 1000);
+                if (e < best_e) {
+                    best_e = e;
+                    starts[i] = candidate;
+                }
+            }
+        }
+    }
+    return starts;
+}
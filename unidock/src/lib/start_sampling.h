@@ -0,0 +1,27 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#ifndef VINA_START_SAMPLING_H
+#define VINA_START_SAMPLING_H
+
+#include "model.h"
+#include "igrid.h"
+#include "random.h"
+
+// Starting confs for n Monte Carlo chains, spread evenly instead of drawn one by one with
+// conf::randomize. Positions and orientations (uniform on SO(3)) of chain i are point i + 1 of a
+// randomly shifted Halton sequence, and every torsion is stratified into n strata that the chains
+// take in a random order (Latin hypercube). With max_energy below max_fl, a start whose grid
+// energy exceeds it is moved to the next unused Halton point, at most max_retries times, keeping
+// the lowest one seen.
+std::vector<conf> spread_starts(const model& m, const igrid& ig, const vec& corner1,
+                                const vec& corner2, sz n, rng& generator,
+                                fl max_energy = max_fl, sz max_retries = 8);
+
+fl radical_inverse(sz i, sz base);  // i-th point of the van der Corput sequence in base, in [0, 1)
+
+#endif
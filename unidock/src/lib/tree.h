@@ -112,7 +112,7 @@ struct axis_frame : public atom_frame {
         axis = (1 / nrm) * diff;
     }
     void set_derivative(const vecp& force_torque, fl& c) const { c = force_torque.second * axis; }
-    vec get_axis() { return axis; }
+    vec get_axis() const { return axis; }
 
 protected:
     vec axis;
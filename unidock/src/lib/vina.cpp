@@ -24,6 +24,8 @@
 #include "scoring_function.h"
 #include "precalculate.h"
 #include "omp.h"
+#include "phase_report.h"
+#include "batch_search.h"
 
 void Vina::cite() {
     const std::string cite_message
@@ -64,8 +66,8 @@ void Vina::set_receptor(const std::string& rigid_name, const std::string& flex_n
     // Read the receptor PDBQT file
     /* CONDITIONS:
             - 1. AD4/Vina rigid  NO, flex  NO: FAIL
-            - 2. AD4      rigid YES, flex YES: FAIL
-            - 3. AD4      rigid YES, flex  NO: FAIL
+            - 2. AD4      rigid YES, flex YES: SUCCESS (need to compute or read maps later)
+            - 3. AD4      rigid YES, flex  NO: SUCCESS (need to compute or read maps later)
             - 4. AD4      rigid  NO, flex YES: SUCCESS (need to read maps later)
             - 5. Vina     rigid YES, flex YES: SUCCESS
             - 6. Vina     rigid YES, flex  NO: SUCCESS
@@ -75,22 +77,21 @@ void Vina::set_receptor(const std::string& rigid_name, const std::string& flex_n
         // CONDITION 1
         std::cerr << "ERROR: No (rigid) receptor or flexible residues were specified. (vina.cpp)\n";
         exit(EXIT_FAILURE);
-    } else if (m_sf_choice == SF_AD42 && !rigid_name.empty()) {
-        // CONDITIONS 2, 3
-        std::cerr << "ERROR: Only flexible residues allowed with the AD4 scoring function. No "
-                     "(rigid) receptor.\n";
-        exit(EXIT_FAILURE);
     }
 
-    // CONDITIONS 4, 5, 6, 7 (rigid_name and flex_name are empty strings per default)
+    // CONDITIONS 2, 3, 4, 5, 6, 7 (rigid_name and flex_name are empty strings per default)
+    scoped_phase phase("receptor_parse");
     if (rigid_name.find("pdbqt") || flex_name.find("pdbqt")) {
-        m_receptor
-            = parse_receptor_pdbqt(rigid_name, flex_name, m_scoring_function.get_atom_typing());
+        set_receptor(
+            parse_receptor_pdbqt(rigid_name, flex_name, m_scoring_function.get_atom_typing()));
     } else if (rigid_name.find("pdb") && (!rigid_name.find("pdbqt"))) {
-        m_receptor
-            = parse_receptor_pdb(rigid_name, flex_name, m_scoring_function.get_atom_typing());
+        set_receptor(
+            parse_receptor_pdb(rigid_name, flex_name, m_scoring_function.get_atom_typing()));
     }
+}
 
+void Vina::set_receptor(const model& receptor) {
+    m_receptor = receptor;
     m_model = m_receptor;
     m_receptor_initialized = true;
     // If we are reading another receptor we should not consider the ligand and the map as
@@ -107,6 +108,7 @@ void Vina::set_ligand_from_string(const std::string& ligand_string) {
     }
 
     atom_type::t atom_typing = m_scoring_function.get_atom_typing();
+    m_conformers.clear();
 
     if (!m_receptor_initialized) {
         // This situation will happen if we don't need a receptor and we are using affinity maps
@@ -119,10 +121,18 @@ void Vina::set_ligand_from_string(const std::string& ligand_string) {
     }
 
     // ... and add ligand to the model
-    m_model.append(parse_ligand_pdbqt_from_string(ligand_string, atom_typing));
+    {
+        scoped_phase phase("ligand_parse");
+        m_model.append(parse_ligand_pdbqt_from_string(ligand_string, atom_typing));
+        m_model.prune_ligand_pairs(sqr(m_scoring_function.get_cutoff()));
+    }
 
     // Because we precalculate ligand atoms interactions
-    precalculate_byatom precalculated_byatom(m_scoring_function, m_model);
+    precalculate_byatom precalculated_byatom;
+    {
+        scoped_phase phase("precalculate");
+        precalculated_byatom = precalculate_ligand(m_model);
+    }
 
     // Check that all atom types are in the grid (if initialized)
     if (m_map_initialized) {
@@ -150,6 +160,7 @@ void Vina::set_ligand_from_string(const std::vector<std::string>& ligand_string)
     }
 
     atom_type::t atom_typing = m_scoring_function.get_atom_typing();
+    m_conformers.clear();
 
     if (!m_receptor_initialized) {
         // This situation will happen if we don't need a receptor and we are using affinity maps
@@ -161,11 +172,19 @@ void Vina::set_ligand_from_string(const std::vector<std::string>& ligand_string)
         m_model = m_receptor;
     }
 
-    VINA_RANGE(i, 0, ligand_string.size())
-    m_model.append(parse_ligand_pdbqt_from_string(ligand_string[i], atom_typing));
+    {
+        scoped_phase phase("ligand_parse");
+        VINA_RANGE(i, 0, ligand_string.size())
+        m_model.append(parse_ligand_pdbqt_from_string(ligand_string[i], atom_typing));
+        m_model.prune_ligand_pairs(sqr(m_scoring_function.get_cutoff()));
+    }
 
     // Because we precalculate ligand atoms interactions
-    precalculate_byatom precalculated_byatom(m_scoring_function, m_model);
+    precalculate_byatom precalculated_byatom;
+    {
+        scoped_phase phase("precalculate");
+        precalculated_byatom = precalculate_ligand(m_model);
+    }
 
     // Check that all atom types are in the grid (if initialized)
     if (m_map_initialized) {
@@ -200,27 +219,37 @@ void Vina::set_ligand_from_string_gpu(const std::vector<std::string>& ligand_str
         model m(atom_typing);
         m_receptor = m;
     }
-    m_model_gpu.resize(
-        ligand_string.size(),
-        m_receptor);  // Initialize current model with receptor and reinitialize poses
+    // Initialize current models with receptor, dropping the ligands of a previous call
+    m_model_gpu.clear();
+    m_model_gpu.resize(ligand_string.size(), m_receptor);
+    m_precalculated_byatom_gpu.clear();
     m_precalculated_byatom_gpu.resize(ligand_string.size());
 
-// Read ligand info and delete broken input
+    // Read ligand info and delete broken input
+    phase_count("ligands", ligand_string.size());
+    {
+        scoped_phase phase("ligand_parse");
 #pragma omp parallel for
-    for (int i = 0; i < ligand_string.size(); ++i) {
-        m_model_gpu[i].append(
-            parse_ligand_pdbqt_from_string_no_failure(ligand_string[i], atom_typing));
-        m_precalculated_byatom_gpu[i].init_without_calculation(m_scoring_function, m_model_gpu[i]);
+        for (int i = 0; i < ligand_string.size(); ++i) {
+            m_model_gpu[i].append(
+                parse_ligand_pdbqt_from_string_no_failure(ligand_string[i], atom_typing));
+            m_model_gpu[i].prune_ligand_pairs(sqr(m_scoring_function.get_cutoff()));
+            m_precalculated_byatom_gpu[i].init_without_calculation(m_scoring_function,
+                                                                   m_model_gpu[i]);
+        }
     }
 
-    // calculate common rs data
-    flv common_rs = m_precalculated_byatom_gpu[0].calculate_rs();
+    {
+        scoped_phase phase("precalculate");
+        // calculate common rs data
+        flv common_rs = m_precalculated_byatom_gpu[0].calculate_rs();
 
-    // Because we precalculate ligand atoms interactions, which should be done in parallel
-    int precalculate_thread_num = ligand_string.size();
+        // Because we precalculate ligand atoms interactions, which should be done in parallel
+        int precalculate_thread_num = ligand_string.size();
 
-    precalculate_parallel(m_data_list_gpu, m_precalculated_byatom_gpu, m_scoring_function,
-                          m_model_gpu, common_rs, precalculate_thread_num);
+        precalculate_parallel(m_data_list_gpu, m_precalculated_byatom_gpu, m_scoring_function,
+                              m_model_gpu, common_rs, precalculate_thread_num);
+    }
 
     VINA_RANGE(i, 0, ligand_string.size()) {
         // Check that all atom types are in the grid (if initialized)
@@ -237,13 +266,15 @@ void Vina::set_ligand_from_string_gpu(const std::vector<std::string>& ligand_str
 
     // Initialize poses container
     output_container poses;
+    m_poses_gpu.clear();
     m_poses_gpu.resize(ligand_string.size(), poses);
 
     // Store in Vina object
     m_ligand_initialized = true;
 }
 
-void Vina::set_ligand_from_object_gpu(const std::vector<model>& ligands) {
+void Vina::set_ligand_from_object_gpu(const std::vector<model>& ligands,
+                                      const std::vector<precalculate_byatom>* precalculated) {
     // Read ligand PDBQT strings and add them to the model
     if (ligands.empty()) {
         std::cerr << "ERROR: Empty ligand list.\n";
@@ -257,29 +288,45 @@ void Vina::set_ligand_from_object_gpu(const std::vector<model>& ligands) {
         model m(atom_typing);
         m_receptor = m;
     }
-    m_model_gpu.resize(
-        ligands.size(),
-        m_receptor);  // Initialize current model with receptor and reinitialize poses
+    // Initialize current models with receptor, dropping the ligands of a previous call
+    m_model_gpu.clear();
+    m_model_gpu.resize(ligands.size(), m_receptor);
+    m_precalculated_byatom_gpu.clear();
     m_precalculated_byatom_gpu.resize(ligands.size());
 
-// Read ligand info and initialize precalculated_byatom
+    // Read ligand info and initialize precalculated_byatom
+    scoped_phase phase("precalculate");
 #pragma omp parallel for
     for (int i = 0; i < ligands.size(); ++i) {
         m_model_gpu[i].append(ligands[i]);
+        m_model_gpu[i].prune_ligand_pairs(sqr(m_scoring_function.get_cutoff()));
         if (multi_bias) {
             m_model_gpu[i].bias_list = bias_batch_list[i];
         }
-        m_precalculated_byatom_gpu[i].init_without_calculation(m_scoring_function, m_model_gpu[i]);
+        if (!precalculated)
+            m_precalculated_byatom_gpu[i].init_without_calculation(m_scoring_function,
+                                                                   m_model_gpu[i]);
     }
 
-    // calculate common rs data
-    flv common_rs = m_precalculated_byatom_gpu[0].calculate_rs();
-
     // Because we precalculate ligand atoms interactions, which should be done in parallel
     int precalculate_thread_num = ligands.size();
 
-    precalculate_parallel(m_data_list_gpu, m_precalculated_byatom_gpu, m_scoring_function,
-                          m_model_gpu, common_rs, precalculate_thread_num);
+    if (precalculated) {
+        // The tables only cover the ligand and flex atoms, the rigid receptor is in the maps
+        VINA_CHECK(precalculated->size() == ligands.size());
+        VINA_FOR_IN(i, ligands) {
+            const sz n = m_model_gpu[i].num_atoms();
+            VINA_CHECK((*precalculated)[i].m_data.m_data.size() == n * (n + 1) / 2);
+        }
+        m_precalculated_byatom_gpu = *precalculated;
+        precalculate_upload(m_data_list_gpu, m_precalculated_byatom_gpu, precalculate_thread_num);
+    } else {
+        // calculate common rs data
+        flv common_rs = m_precalculated_byatom_gpu[0].calculate_rs();
+
+        precalculate_parallel(m_data_list_gpu, m_precalculated_byatom_gpu, m_scoring_function,
+                              m_model_gpu, common_rs, precalculate_thread_num);
+    }
 
     VINA_RANGE(i, 0, ligands.size()) {
         // Check that all atom types are in the grid (if initialized)
@@ -296,12 +343,22 @@ void Vina::set_ligand_from_object_gpu(const std::vector<model>& ligands) {
 
     // Initialize poses container
     output_container poses;
+    m_poses_gpu.clear();
     m_poses_gpu.resize(ligands.size(), poses);
 
     // Store in Vina object
     m_ligand_initialized = true;
 }
 
+void Vina::clear_ligands_gpu() {
+    std::vector<model>().swap(m_model_gpu);
+    std::vector<precalculate_byatom>().swap(m_precalculated_byatom_gpu);
+    std::vector<output_container>().swap(m_poses_gpu);
+    std::vector<search_stats>().swap(m_search_stats_gpu);
+    bias_batch_list.clear();
+    m_ligand_initialized = false;
+}
+
 void Vina::set_ligand_from_object(const std::vector<model>& ligands) {
     // Read ligand PDBQT strings and add them to the model
     if (ligands.empty()) {
@@ -310,6 +367,7 @@ void Vina::set_ligand_from_object(const std::vector<model>& ligands) {
     }
 
     atom_type::t atom_typing = m_scoring_function.get_atom_typing();
+    m_conformers.clear();
 
     if (!m_receptor_initialized) {
         // This situation will happen if we don't need a receptor and we are using affinity maps
@@ -323,9 +381,14 @@ void Vina::set_ligand_from_object(const std::vector<model>& ligands) {
 
     VINA_RANGE(i, 0, ligands.size())
     m_model.append(ligands[i]);
+    m_model.prune_ligand_pairs(sqr(m_scoring_function.get_cutoff()));
 
     // Because we precalculate ligand atoms interactions
-    precalculate_byatom precalculated_byatom(m_scoring_function, m_model);
+    precalculate_byatom precalculated_byatom;
+    {
+        scoped_phase phase("precalculate");
+        precalculated_byatom = precalculate_ligand(m_model);
+    }
 
     // Check that all atom types are in the grid (if initialized)
     if (m_map_initialized) {
@@ -345,6 +408,34 @@ void Vina::set_ligand_from_object(const std::vector<model>& ligands) {
     m_ligand_initialized = true;
 }
 
+void Vina::set_ligand_conformers(const std::vector<model>& conformers) {
+    if (conformers.empty()) {
+        std::cerr << "ERROR: Cannot read ligand conformers. Conformer list is empty.\n";
+        exit(EXIT_FAILURE);
+    }
+
+    // Types, tables and type checks come from the first conformer, they hold for all of them
+    set_ligand_from_object(std::vector<model>(1, conformers[0]));
+    if (conformers.size() == 1) return;
+
+    // Pair lists are pruned per conformer: which pairs can come within the cutoff, or stay at a
+    // constant distance, depends on the internal geometry (e.g. a ring pucker)
+    m_conformers.push_back(m_model);
+    VINA_RANGE(i, 1, conformers.size()) {
+        model m = m_receptor;
+        m.append(conformers[i]);
+        m.prune_ligand_pairs(sqr(m_scoring_function.get_cutoff()));
+        m_conformers.push_back(m);
+    }
+    m_conformer = 0;
+}
+
+void Vina::use_conformer(sz k) {
+    if (m_conformers.empty() || k == m_conformer) return;
+    m_model = m_conformers[k];
+    m_conformer = k;
+}
+
 void Vina::set_ligand_from_file(const std::string& ligand_name) {
     set_ligand_from_string(get_file_contents(ligand_name));
 }
@@ -352,8 +443,11 @@ void Vina::set_ligand_from_file(const std::string& ligand_name) {
 void Vina::set_ligand_from_file(const std::vector<std::string>& ligand_name) {
     std::vector<std::string> ligand_string;
 
-    VINA_RANGE(i, 0, ligand_name.size())
-    ligand_string.push_back(get_file_contents(ligand_name[i]));
+    {
+        scoped_phase phase("ligand_parse");
+        VINA_RANGE(i, 0, ligand_name.size())
+        ligand_string.push_back(get_file_contents(ligand_name[i]));
+    }
 
     set_ligand_from_string(ligand_string);
 }
@@ -361,8 +455,11 @@ void Vina::set_ligand_from_file(const std::vector<std::string>& ligand_name) {
 void Vina::set_ligand_from_file_gpu(const std::vector<std::string>& ligand_name) {
     std::vector<std::string> ligand_string;
 
-    VINA_RANGE(i, 0, ligand_name.size())
-    ligand_string.push_back(get_file_contents(ligand_name[i]));
+    {
+        scoped_phase phase("ligand_parse");
+        VINA_RANGE(i, 0, ligand_name.size())
+        ligand_string.push_back(get_file_contents(ligand_name[i]));
+    }
 
     set_ligand_from_string_gpu(ligand_string);
 }
@@ -456,6 +553,17 @@ void Vina::set_forcefield() {
     ScoringFunction scoring_function(m_sf_choice, m_weights);
     // Store in Vina object
     m_scoring_function = scoring_function;
+
+    // Term grids are reweighted in place instead of being recomputed
+    if (m_map_initialized && m_grid.has_terms()) {
+        m_grid.combine_terms(m_weights);
+        if (bias_list.size() > 0) m_grid.compute_bias(m_model, bias_list);
+        precalculate precalculated_sf(m_scoring_function);
+        m_precalculated_sf = precalculated_sf;
+        if (m_ligand_initialized) {
+            m_precalculated_byatom = precalculate_ligand(m_model);
+        }
+    }
 }
 
 std::vector<double> Vina::grid_dimensions_from_ligand(double buffer_size) {
@@ -488,10 +596,35 @@ std::vector<double> Vina::grid_dimensions_from_ligand(double buffer_size) {
     return box_dimensions;
 }
 
+void Vina::set_autobox_window(double buffer_size) {
+    if (!m_ligand_initialized) {
+        std::cerr << "ERROR: Cannot set the grid window. Ligand(s) was(ere) not initialized.\n";
+        exit(EXIT_FAILURE);
+    } else if (!m_map_initialized) {
+        std::cerr << "ERROR: Cannot set the grid window. Affinity maps were not initialized.\n";
+        exit(EXIT_FAILURE);
+    } else if (m_sf_choice == SF_AD42) {
+        std::cerr << "ERROR: Grid windows need Vina or Vinardo affinity maps.\n";
+        exit(EXIT_FAILURE);
+    }
+
+    const std::vector<double> dim = grid_dimensions_from_ligand(buffer_size);
+    const vec center(dim[0], dim[1], dim[2]);
+    const vec half_span(dim[3] / 2, dim[4] / 2, dim[5] / 2);
+    const grid_dims window = m_grid.set_window(center - half_span, center + half_span);
+    if (m_receptor_initialized && !m_no_refine) m_non_cache.set_window(window);
+}
+
+void Vina::clear_grid_window() {
+    m_grid.clear_window();
+    m_non_cache.clear_window();
+}
+
 // set vina and vinardo bias
 void Vina::compute_vina_maps(double center_x, double center_y, double center_z, double size_x,
                              double size_y, double size_z, double granularity,
                              bool force_even_voxels) {
+    scoped_phase phase("grid_build");
     // Setup the search box
     // Check first that the receptor was added
     if (m_sf_choice == SF_AD42) {
@@ -551,7 +684,10 @@ void Vina::compute_vina_maps(double center_x, double center_y, double center_z,
 
     // Compute the Vina grids and set bias
     cache grid(gd, slope);
-    grid.populate_no_bias(m_model, precalculated_sf, atom_types);
+    if (term_grids)
+        grid.populate_terms(m_model, m_scoring_function, atom_types);
+    else
+        grid.populate_no_bias(m_model, precalculated_sf, atom_types, m_cpu > 0 ? m_cpu : 1);
     if (bias_list.size() > 0) grid.compute_bias(m_model, bias_list);
 
     done(m_verbosity, 0);
@@ -567,7 +703,70 @@ void Vina::compute_vina_maps(double center_x, double center_y, double center_z,
     m_map_initialized = true;
 }
 
+void Vina::compute_ad4_maps(double center_x, double center_y, double center_z, double size_x,
+                            double size_y, double size_z, double granularity,
+                            bool force_even_voxels) {
+    scoped_phase phase("grid_build");
+    // Setup the search box
+    // Check first that the receptor was added
+    if (m_sf_choice != SF_AD42) {
+        std::cerr << "ERROR: Cannot compute AD4.2 maps using the Vina or Vinardo scoring "
+                     "function.\n";
+        exit(EXIT_FAILURE);
+    } else if (!m_receptor_initialized || m_receptor.grid_atoms.empty()) {
+        std::cerr << "ERROR: Cannot compute AD4.2 maps. The (rigid) receptor was not "
+                     "initialized.\n";
+        exit(EXIT_FAILURE);
+    } else if (size_x <= 0 || size_y <= 0 || size_z <= 0) {
+        std::cerr << "ERROR: Grid box dimensions must be greater than 0 Angstrom.\n";
+        exit(EXIT_FAILURE);
+    } else if (size_x * size_y * size_z > 27e3) {
+        std::cerr << "WARNING: Search space volume is greater than 27000 Angstrom^3 (See FAQ)\n";
+    }
+
+    grid_dims gd;
+    vec span(size_x, size_y, size_z);
+    vec center(center_x, center_y, center_z);
+    const fl slope = 1e6;  // FIXME: too large? used to be 100
+    szv atom_types;
+    atom_type::t atom_typing = m_scoring_function.get_atom_typing();
+
+    // Same as Vina maps: only the ligand atom types if a ligand was defined before
+    if (m_ligand_initialized)
+        atom_types = m_model.get_movable_atom_types(atom_typing);
+    else
+        atom_types = m_scoring_function.get_atom_types();
+
+    // Grid dimensions
+    VINA_FOR_IN(i, gd) {
+        gd[i].n_voxels = sz(std::ceil(span[i] / granularity));
+
+        // If odd n_voxels increment by 1
+        if (force_even_voxels && (gd[i].n_voxels % 2 == 1))
+            // because sample points (npts) == n_voxels + 1
+            gd[i].n_voxels += 1;
+
+        fl real_span = granularity * gd[i].n_voxels;
+        gd[i].begin = center[i] - real_span / 2;
+        gd[i].end = gd[i].begin + real_span;
+    }
+
+    doing("Computing AD4.2 grid", m_verbosity, 0);
+
+    ad4cache grid(gd, slope);
+    grid.populate(m_receptor, m_scoring_function, atom_types, m_cpu > 0 ? m_cpu : 1);
+    if (bias_list.size() > 0) grid.set_bias(bias_list);
+    if (interleave_ad4_maps && !gpu) grid.interleave();
+
+    done(m_verbosity, 0);
+
+    // Store in Vina object
+    m_ad4grid = grid;
+    m_map_initialized = true;
+}
+
 void Vina::load_maps(std::string maps) {
+    scoped_phase phase("grid_build");
     const fl slope = 1e6;  // FIXME: too large? used to be 100
     grid_dims gd;
 
@@ -587,6 +786,7 @@ void Vina::load_maps(std::string maps) {
             grid.set_bias(bias_list);
             done(m_verbosity, 0);
         }
+        if (interleave_ad4_maps && !gpu) grid.interleave();
         m_ad4grid = grid;
     }
 
@@ -609,6 +809,7 @@ void Vina::load_maps(std::string maps) {
 
 void Vina::write_maps(const std::string& map_prefix, const std::string& gpf_filename,
                       const std::string& fld_filename, const std::string& receptor_filename) {
+    scoped_phase phase("output_write");
     if (!m_map_initialized) {
         std::cerr << "ERROR: Cannot write affinity maps. Affinity maps were not initialized.\n";
         exit(EXIT_FAILURE);
@@ -666,6 +867,7 @@ std::vector<std::vector<double> > Vina::get_poses_coordinates(int how_many, doub
                 break;  // check energy_range sanity FIXME
 
             // Push the current pose to model
+            use_conformer(m_poses[i].conformer);
             m_model.set(m_poses[i].c);
             coordinates.push_back(m_model.get_ligand_coords());
 
@@ -673,6 +875,7 @@ std::vector<std::vector<double> > Vina::get_poses_coordinates(int how_many, doub
         }
 
         // Push back the best conf in model
+        use_conformer(m_poses[0].conformer);
         m_model.set(m_poses[0].c);
     } else {
         std::cerr << "WARNING: Could not find any pose coordinaates.\n";
@@ -744,6 +947,8 @@ std::string Vina::vina_remarks(output_type& pose, fl lb, fl ub) {
                << pose.conf_independent << "\n";
     remark << "REMARK UNBOUND:          " << std::setw(12) << std::setprecision(3) << pose.unbound
            << "\n";
+    if (!m_conformers.empty())
+        remark << "REMARK CONFORMER:        " << std::setw(12) << pose.conformer + 1 << "\n";
 
     return remark.str();
 }
@@ -765,11 +970,26 @@ std::string Vina::sdf_remarks(output_type& pose, fl lb, fl ub) {
         remark << "CONF_INDEPENDENT: " << std::setw(12) << std::setprecision(3)
                << pose.conf_independent << "\n";
     remark << "UNBOUND:          " << std::setw(12) << std::setprecision(3) << pose.unbound << "\n";
+    if (!m_conformers.empty())
+        remark << "CONFORMER:        " << std::setw(12) << pose.conformer + 1 << "\n";
     remark << '\n';
 
     return remark.str();
 }
 
+std::string Vina::search_remarks(const search_stats& stats, bool sdf) {
+    std::ostringstream remark;
+
+    if (sdf) {
+        stats.write(remark, "> <Uni-Dock SEARCH STATS> \n");
+        remark << '\n';
+    } else {
+        stats.write(remark, "REMARK SEARCH STATS: ");
+    }
+
+    return remark.str();
+}
+
 std::string Vina::get_poses(int how_many, double energy_range) {
     int n = 0;
     double best_energy = 0;
@@ -801,16 +1021,19 @@ std::string Vina::get_poses(int how_many, double energy_range) {
                 break;  // check energy_range sanity FIXME
 
             // Push the current pose to model
+            use_conformer(m_poses[i].conformer);
             m_model.set(m_poses[i].c);
 
             // Write conf
             remarks = vina_remarks(m_poses[i], m_poses[i].lb, m_poses[i].ub);
+            if (n == 0 && search_telemetry) remarks += search_remarks(m_search_stats, false);
             out << m_model.write_model(n + 1, remarks);
 
             n++;
         }
 
         // Push back the best conf in model
+        use_conformer(m_poses[0].conformer);
         m_model.set(m_poses[0].c);
 
     } else {
@@ -851,16 +1074,19 @@ std::string Vina::get_sdf_poses(int how_many, double energy_range) {
                 break;  // check energy_range sanity FIXME
 
             // Push the current pose to model
+            use_conformer(m_poses[i].conformer);
             m_model.set(m_poses[i].c);
 
             // Write conf
             remarks = sdf_remarks(m_poses[i], m_poses[i].lb, m_poses[i].ub);
+            if (n == 0 && search_telemetry) remarks += search_remarks(m_search_stats, true);
             out << m_model.write_sdf_model(n + 1, remarks);
 
             n++;
         }
 
         // Push back the best conf in model
+        use_conformer(m_poses[0].conformer);
         m_model.set(m_poses[0].c);
 
     } else {
@@ -907,6 +1133,8 @@ std::string Vina::get_poses_gpu(int ligand_id, int how_many, double energy_range
             // Write conf
             remarks = vina_remarks(m_poses_gpu[ligand_id][i], m_poses_gpu[ligand_id][i].lb,
                                    m_poses_gpu[ligand_id][i].ub);
+            if (n == 0 && search_telemetry && sz(ligand_id) < m_search_stats_gpu.size())
+                remarks += search_remarks(m_search_stats_gpu[ligand_id], false);
             out << m_model_gpu[ligand_id].write_model(n + 1, remarks);
 
             n++;
@@ -960,6 +1188,8 @@ std::string Vina::get_sdf_poses_gpu(int ligand_id, int how_many, double energy_r
             // Write conf
             remarks = sdf_remarks(m_poses_gpu[ligand_id][i], m_poses_gpu[ligand_id][i].lb,
                                   m_poses_gpu[ligand_id][i].ub);
+            if (n == 0 && search_telemetry && sz(ligand_id) < m_search_stats_gpu.size())
+                remarks += search_remarks(m_search_stats_gpu[ligand_id], true);
             out << m_model_gpu[ligand_id].write_sdf_model(n + 1, remarks);
 
             n++;
@@ -977,6 +1207,7 @@ std::string Vina::get_sdf_poses_gpu(int ligand_id, int how_many, double energy_r
 }
 
 void Vina::write_poses(const std::string& output_name, int how_many, double energy_range) {
+    scoped_phase phase("output_write");
     std::string out;
 
     if (!m_poses.empty()) {
@@ -998,6 +1229,7 @@ void Vina::write_poses(const std::string& output_name, int how_many, double ener
  */
 void Vina::write_poses_gpu(const std::vector<std::string>& gpu_output_name, int how_many,
                            double energy_range) {
+    scoped_phase phase("output_write");
     assert(gpu_output_name.size() == m_poses_gpu.size());
     std::string out;
     VINA_RANGE(i, 0, gpu_output_name.size()) {
@@ -1017,6 +1249,7 @@ void Vina::write_poses_gpu(const std::vector<std::string>& gpu_output_name, int
 }
 
 void Vina::write_pose(const std::string& output_name, const std::string& remark) {
+    scoped_phase phase("output_write");
     std::ostringstream format_remark;
     format_remark.setf(std::ios::fixed, std::ios::floatfield);
     format_remark.setf(std::ios::showpoint);
@@ -1102,6 +1335,7 @@ void Vina::show_score(const std::vector<double> energies) {
 }
 
 void Vina::write_score(const std::vector<double> energies, const std::string input_name) {
+    scoped_phase phase("output_write");
     ofile f(make_path(default_score_output(input_name)));
     f << "REMARK " << get_filename(input_name) << ' ' << std::fixed << std::setprecision(3)
       << energies[0] << " (kcal/mol)\n";
@@ -1134,6 +1368,7 @@ void Vina::write_score(const std::vector<double> energies, const std::string inp
 
 void Vina::write_score_to_file(const std::vector<double> energies, const std::string out_dir,
                                const std::string score_file, const std::string input_name) {
+    scoped_phase phase("output_write");
     ofile f(make_path(out_dir + '/' + score_file),
             std::ofstream::out | std::ofstream::app);  // separator() not needed
     f << "REMARK " << get_filename(input_name) << ' ' << std::fixed << std::setprecision(3)
@@ -1343,6 +1578,7 @@ std::vector<double> Vina::score() {
         exit(EXIT_FAILURE);
     }
 
+    scoped_phase phase("rescoring");
     double intramolecular_energy = 0;
     const vec authentic_v(1000, 1000, 1000);
 
@@ -1355,6 +1591,109 @@ std::vector<double> Vina::score() {
     return energies;
 }
 
+std::vector<std::vector<std::vector<double> > > Vina::score_weight_sets(
+    const std::vector<flv>& weight_sets) {
+    if (!m_ligand_initialized) {
+        std::cerr << "ERROR: Cannot score the pose. Ligand(s) was(ere) not initialized.\n";
+        exit(EXIT_FAILURE);
+    } else if (!m_map_initialized) {
+        std::cerr << "ERROR: Cannot score the pose. Affinity maps were not initialized.\n";
+        exit(EXIT_FAILURE);
+    } else if (m_sf_choice == SF_AD42 || !m_grid.has_terms()) {
+        std::cerr << "ERROR: Scoring with several weight sets needs Vina or Vinardo term grids "
+                     "(enable_term_grids before compute_vina_maps).\n";
+        exit(EXIT_FAILURE);
+    }
+    VINA_FOR_IN(w, weight_sets) {
+        if (weight_sets[w].size() != m_weights.size()) {
+            std::cerr << "ERROR: Weight set " << w << " has " << weight_sets[w].size()
+                      << " weights, expected " << m_weights.size() << ".\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    std::vector<std::vector<std::vector<double> > > all_energies;
+    if (m_poses.empty()) {
+        all_energies.push_back(score_weight_sets_pose(weight_sets));
+        return all_energies;
+    }
+    VINA_FOR_IN(i, m_poses) {
+        use_conformer(m_poses[i].conformer);
+        m_model.set(m_poses[i].c);
+        all_energies.push_back(score_weight_sets_pose(weight_sets));
+    }
+
+    // Push back the best conf in model
+    use_conformer(m_poses[0].conformer);
+    m_model.set(m_poses[0].c);
+    return all_energies;
+}
+
+std::vector<std::vector<double> > Vina::score_weight_sets_pose(
+    const std::vector<flv>& weight_sets) {
+    // Score the current conf in the model once per weight set
+    // The unweighted energy of every potential is computed once, then combined per weight set
+    if (!m_grid.is_in_grid(m_model)) {
+        std::cerr << "ERROR: The ligand is outside the grid box. Increase the size of the grid box "
+                     "or center it accordingly around the ligand.\n";
+        exit(EXIT_FAILURE);
+    }
+
+    const vec authentic_v(1000, 1000, 1000);
+    const fl cutoff_sqr = sqr(m_scoring_function.get_cutoff());
+    energy_terms lig_grids_terms, flex_grids_terms, inter_pairs_terms, intra_pairs_terms,
+        lig_intra_terms, glue_terms;
+
+    m_grid.eval_terms(m_model, false, lig_grids_terms);  // ligand -- grid
+    m_grid.eval_terms(m_model, true, flex_grids_terms);  // flex -- grid
+    eval_interacting_pairs_terms(m_scoring_function, m_model.inter_pairs, m_model.atoms,
+                                 m_model.coords, cutoff_sqr, inter_pairs_terms);  // ligand -- flex
+    eval_interacting_pairs_terms(m_scoring_function, m_model.other_pairs, m_model.atoms,
+                                 m_model.coords, cutoff_sqr, intra_pairs_terms);  // flex -- flex
+    VINA_FOR_IN(i, m_model.ligands) {
+        const ligand& lig = m_model.ligands[i];
+        const interacting_pairs constant(lig.constant_pairs.begin(), lig.constant_pairs.end());
+        eval_interacting_pairs_terms(m_scoring_function, lig.pairs, m_model.atoms, m_model.coords,
+                                     cutoff_sqr, lig_intra_terms);  // ligand_i -- ligand_i
+        eval_interacting_pairs_terms(m_scoring_function, constant, m_model.atoms, m_model.coords,
+                                     cutoff_sqr, lig_intra_terms);
+    }
+    eval_interacting_pairs_terms(m_scoring_function, m_model.glue_pairs, m_model.atoms,
+                                 m_model.coords, max_fl, glue_terms);  // no cutoff
+
+    std::vector<std::vector<double> > all_energies;
+    ScoringFunction scoring_function(m_scoring_function);  // shares the potentials
+    VINA_FOR_IN(w, weight_sets) {
+        const flv& weights = weight_sets[w];
+        scoring_function.m_weights = weights;
+
+        double lig_grids = lig_grids_terms.eval(weights, authentic_v[1]);
+        double flex_grids = flex_grids_terms.eval(weights, authentic_v[1]);
+        double inter_pairs = inter_pairs_terms.eval(weights, authentic_v[2]);
+        double intra_pairs = intra_pairs_terms.eval(weights, authentic_v[2]);
+        double lig_intra = lig_intra_terms.eval(weights, authentic_v[0]);
+        // same as model::eval_intramolecular, so that inter + intra - intramolecular == inter
+        double intramolecular_energy
+            = lig_intra + flex_grids + intra_pairs + glue_terms.eval(weights, authentic_v[2]);
+        double inter = lig_grids + inter_pairs;
+        double intra = flex_grids + intra_pairs + lig_intra;
+        double total
+            = scoring_function.conf_independent(m_model, inter + intra - intramolecular_energy);
+
+        std::vector<double> energies;
+        energies.push_back(total);
+        energies.push_back(lig_grids);
+        energies.push_back(inter_pairs);
+        energies.push_back(flex_grids);
+        energies.push_back(intra_pairs);
+        energies.push_back(lig_intra);
+        energies.push_back(total - (inter + intra - intramolecular_energy));
+        energies.push_back(intramolecular_energy);
+        all_energies.push_back(energies);
+    }
+    return all_energies;
+}
+
 std::vector<double> Vina::score_gpu(int i) {
     // Score the current conf in the model
     // Check if ff and ligand were initialized
@@ -1408,6 +1747,7 @@ std::vector<double> Vina::optimize(output_type& out, int max_steps) {
     }
 
     doing("Performing local search", m_verbosity, 0);
+    scoped_phase phase("refinement");
     // Try 5 five times to optimize locally the conformation
     VINA_FOR(p, 5) {
         if (m_sf_choice == SF_VINA || m_sf_choice == SF_VINARDO) {
@@ -1452,6 +1792,7 @@ std::vector<double> Vina::optimize(int max_steps) {
         // But it is really that useful to minimize after docking?
         e = m_poses[0].e;
         c = m_poses[0].c;
+        use_conformer(m_poses[0].conformer);
     } else {
         c = m_model.get_initial_conf();
     }
@@ -1511,46 +1852,149 @@ void Vina::global_search(const int exhaustiveness, const int n_poses, const doub
     if (exhaustiveness < m_cpu) {
         std::cerr << "WARNING: At low exhaustiveness, it may be impossible to utilize all CPUs.\n";
     }
+    if (exhaustiveness < int(m_conformers.size())) {
+        std::cerr << "WARNING: Only the first " << exhaustiveness << " of the "
+                  << m_conformers.size()
+                  << " conformers are searched, one per Monte Carlo chain.\n";
+    }
 
-    double e = 0;
-    double intramolecular_energy = 0;
-    const vec authentic_v(1000, 1000, 1000);
-    model best_model;
-    boost::optional<model> ref;
     output_container poses;
     std::stringstream sstm;
     rng generator(static_cast<rng::result_type>(m_seed));
 
     // Setup Monte-Carlo search
     parallel_mc parallelmc;
-    sz heuristic = m_model.num_movable_atoms() + 10 * m_model.get_size().num_degrees_of_freedom();
-    parallelmc.mc.global_steps
-        = unsigned(70 * 3 * (50 + heuristic) / 2);  // 2 * 70 -> 8 * 20 // FIXME
-    parallelmc.mc.local_steps = unsigned((25 + m_model.num_movable_atoms()) / 3);
-    parallelmc.mc.max_evals = max_evals;
-    parallelmc.mc.min_rmsd = min_rmsd;
-    parallelmc.mc.num_saved_mins = n_poses;
-    parallelmc.mc.hunt_cap = vec(10, 10, 10);
+    std::vector<monte_carlo> mcs;  // one per conformer, if the ligand was given several
+    VINA_FOR_IN(k, m_conformers)
+    mcs.push_back(cpu_monte_carlo(m_conformers[k], n_poses, min_rmsd, max_evals));
+    parallelmc.mc = mcs.empty() ? cpu_monte_carlo(m_model, n_poses, min_rmsd, max_evals) : mcs[0];
     parallelmc.num_tasks = exhaustiveness;
     parallelmc.num_threads = m_cpu;
+    parallelmc.lockstep = lockstep_chains;
     parallelmc.display_progress = (m_verbosity > 0);
 
     // Docking search
     sstm << "Performing docking (random seed: " << m_seed << ")";
 
     doing(sstm.str(), m_verbosity, 0);
-    if (m_sf_choice == SF_VINA || m_sf_choice == SF_VINARDO) {
-        parallelmc(m_model, poses, m_precalculated_byatom, m_grid, m_grid.corner1(),
-                   m_grid.corner2(), generator);
-    } else {
-        parallelmc(m_model, poses, m_precalculated_byatom, m_ad4grid, m_ad4grid.corner1(),
-                   m_ad4grid.corner2(), generator);
+    m_search_stats.clear();
+    {
+        scoped_phase phase("search");
+        if (m_sf_choice == SF_VINA || m_sf_choice == SF_VINARDO) {
+            if (mcs.empty())
+                parallelmc(m_model, poses, m_precalculated_byatom, m_grid, m_grid.corner1(),
+                           m_grid.corner2(), generator, &m_search_stats);
+            else
+                parallelmc(m_conformers, mcs, poses, m_precalculated_byatom, m_grid,
+                           m_grid.corner1(), m_grid.corner2(), generator, &m_search_stats);
+        } else {
+            if (mcs.empty())
+                parallelmc(m_model, poses, m_precalculated_byatom, m_ad4grid, m_ad4grid.corner1(),
+                           m_ad4grid.corner2(), generator, &m_search_stats);
+            else
+                parallelmc(m_conformers, mcs, poses, m_precalculated_byatom, m_ad4grid,
+                           m_ad4grid.corner1(), m_ad4grid.corner2(), generator, &m_search_stats);
+        }
+        m_search_stats.count_phase();
     }
     done(m_verbosity, 1);
 
+    finish_global_search(poses, min_rmsd);
+}
+
+void Vina::enable_analytic_pairs() {
+    if (!analytic_pairs::supported(m_scoring_function)) {
+        std::cerr << "ERROR: Analytic pair scoring is only available with vina and vinardo.\n";
+        exit(EXIT_FAILURE);
+    }
+    use_analytic_pairs = true;
+}
+
+void Vina::set_warm_start(const std::string& reference_name, double steps_fraction) {
+    if (steps_fraction <= 0 || steps_fraction > 1) {
+        std::cerr << "ERROR: The warm start steps fraction must be in (0, 1].\n";
+        exit(EXIT_FAILURE);
+    }
+    const model reference = parse_ligand_from_file_no_failure(
+        reference_name, m_scoring_function.get_atom_typing(), true);
+    if (reference.num_ligands() == 0) {
+        std::cerr << "ERROR: Could not read the warm start reference " << reference_name << ".\n";
+        exit(EXIT_FAILURE);
+    }
+    m_warm_start = warm_start(reference);
+    m_warm_steps = steps_fraction;
+}
+
+precalculate_byatom Vina::precalculate_ligand(const model& m) const {
+    if (!use_analytic_pairs) return precalculate_byatom(m_scoring_function, m);
+    precalculate_byatom p;
+    p.init_analytic(m_scoring_function, m);
+    return p;
+}
+
+monte_carlo Vina::cpu_monte_carlo(const model& m, const int n_poses, const double min_rmsd,
+                                  const int max_evals) const {
+    monte_carlo mc;
+    sz heuristic = m.num_movable_atoms() + 10 * m.get_size().num_degrees_of_freedom();
+    mc.global_steps = unsigned(70 * 3 * (50 + heuristic) / 2);  // 2 * 70 -> 8 * 20 // FIXME
+    mc.local_steps = unsigned((25 + m.num_movable_atoms()) / 3);
+    mc.max_evals = max_evals;
+    mc.min_rmsd = min_rmsd;
+    mc.num_saved_mins = n_poses;
+    mc.hunt_cap = vec(10, 10, 10);
+    mc.spread_starts = spread_starts;
+    mc.max_start_energy = m_max_start_energy;
+    if (!m_warm_start.empty()) {
+        conf start;
+        sz matched = 0;
+        if (m_warm_start.initial_conf(m, start, matched)) {
+            mc.start = start;
+            mc.global_steps = (std::max)(1u, unsigned(mc.global_steps * m_warm_steps));
+        } else {
+            std::cerr << "WARNING: Only " << matched
+                      << " heavy atoms in common with the warm start reference, starting from "
+                         "random poses.\n";
+        }
+        if (m_verbosity > 1)
+            std::cout << "Warm start: " << matched << " of " << m_warm_start.reference_atoms()
+                      << " reference heavy atoms matched\n";
+    }
+    return mc;
+}
+
+bool Vina::refines_poses() const {
+    return (m_sf_choice == SF_VINA || m_sf_choice == SF_VINARDO) && !m_no_refine
+           && m_receptor_initialized;
+}
+
+void Vina::refine_pose(model& m, const precalculate_byatom& p, non_cache& nc,
+                       output_type& pose) {
+    change g(m.get_size());
+    quasi_newton quasi_newton_par;
+    const vec authentic_v(1000, 1000, 1000);
+    int evalcount = 0;
+    const fl slope = 1e6;
+    quasi_newton_par.max_steps = unsigned((25 + m.num_movable_atoms()) / 3);
+    VINA_FOR(i, 5) {
+        nc.slope = 100 * std::pow(10.0, 2.0 * i);
+        quasi_newton_par(m, p, nc, pose, g, authentic_v, evalcount);
+        if (nc.within(m)) break;
+    }
+    pose.coords = m.get_heavy_atom_movable_coords();
+    if (!nc.within(m)) pose.e = max_fl;
+    nc.slope = slope;
+}
+
+// Refines, rescores and ranks the raw search output for m_model, then stores it in m_poses
+void Vina::finish_global_search(output_container& poses, const double min_rmsd, bool refined) {
+    double intramolecular_energy = 0;
+    const vec authentic_v(1000, 1000, 1000);
+    model best_model;
+    boost::optional<model> ref;
+
     // Docking post-processing and rescoring
     DEBUG_PRINTF("num_output_poses before remove=%lu\n", poses.size());
-    poses = remove_redundant(poses, min_rmsd);
+    if (!refined) poses = remove_redundant(poses, min_rmsd);
     DEBUG_PRINTF("num_output_poses=%lu\n", poses.size());
     DEBUG_PRINTF("energy=%lf\n", poses[0].e);
 
@@ -1560,26 +2004,15 @@ void Vina::global_search(const int exhaustiveness, const int n_poses, const doub
         // case g is non strictly increasing
         if (m_sf_choice == SF_VINA || m_sf_choice == SF_VINARDO) {
             // Refine poses if no_refine is false and got receptor
-            if (!m_no_refine && m_receptor_initialized) {
-                change g(m_model.get_size());
-                quasi_newton quasi_newton_par;
-                const vec authentic_v(1000, 1000, 1000);
-                int evalcount = 0;
-                const fl slope = 1e6;
-                m_non_cache.slope = slope;
-                quasi_newton_par.max_steps = unsigned((25 + m_model.num_movable_atoms()) / 3);
+            if (!refined && refines_poses()) {
+                scoped_phase phase("refinement");
+                search_stats& refine_stats = thread_search_stats();
+                refine_stats.clear();
                 VINA_FOR_IN(i, poses) {
-                    const fl slope_orig = m_non_cache.slope;
-                    VINA_FOR(p, 5) {
-                        m_non_cache.slope = 100 * std::pow(10.0, 2.0 * p);
-                        quasi_newton_par(m_model, m_precalculated_byatom, m_non_cache, poses[i], g,
-                                         authentic_v, evalcount);
-                        if (m_non_cache.within(m_model)) break;
-                    }
-                    poses[i].coords = m_model.get_heavy_atom_movable_coords();
-                    if (!m_non_cache.within(m_model)) poses[i].e = max_fl;
-                    m_non_cache.slope = slope;
+                    use_conformer(poses[i].conformer);
+                    refine_pose(m_model, m_precalculated_byatom, m_non_cache, poses[i]);
                 }
+                m_search_stats.merge(refine_stats);
             }
             if (m_no_refine || !m_receptor_initialized)
                 intramolecular_energy
@@ -1588,24 +2021,28 @@ void Vina::global_search(const int exhaustiveness, const int n_poses, const doub
                 intramolecular_energy
                     = m_model.eval_intramolecular(m_precalculated_byatom, m_non_cache, authentic_v);
         }
-        VINA_FOR_IN(i, poses) {
-            if (m_verbosity > 1) std::cout << "ENERGY FROM SEARCH: " << poses[i].e << "\n";
+        {
+            scoped_phase phase("rescoring");
+            VINA_FOR_IN(i, poses) {
+                if (m_verbosity > 1) std::cout << "ENERGY FROM SEARCH: " << poses[i].e << "\n";
 
-            m_model.set(poses[i].c);
+                use_conformer(poses[i].conformer);
+                m_model.set(poses[i].c);
 
-            // For AD42 intramolecular_energy is equal to 0
-            std::vector<double> energies = score(intramolecular_energy);
-            // Store energy components in current pose
-            poses[i].e = energies[0];  // specific to each scoring function
-            poses[i].inter = energies[1] + energies[2];
-            poses[i].intra = energies[3] + energies[4] + energies[5];
-            poses[i].total = poses[i].inter + poses[i].intra;  // cost function for optimization
-            poses[i].conf_independent = energies[6];           // "torsion"
-            poses[i].unbound = energies[7];                    // specific to each scoring function
-
-            if (m_verbosity > 1) {
-                std::cout << "FINAL ENERGY: \n";
-                show_score(energies);
+                // For AD42 intramolecular_energy is equal to 0
+                std::vector<double> energies = score(intramolecular_energy);
+                // Store energy components in current pose
+                poses[i].e = energies[0];  // specific to each scoring function
+                poses[i].inter = energies[1] + energies[2];
+                poses[i].intra = energies[3] + energies[4] + energies[5];
+                poses[i].total = poses[i].inter + poses[i].intra;  // cost function for optimization
+                poses[i].conf_independent = energies[6];           // "torsion"
+                poses[i].unbound = energies[7];  // specific to each scoring function
+
+                if (m_verbosity > 1) {
+                    std::cout << "FINAL ENERGY: \n";
+                    show_score(energies);
+                }
             }
         }
 
@@ -1614,6 +2051,7 @@ void Vina::global_search(const int exhaustiveness, const int n_poses, const doub
 
         // Now compute RMSD from the best model
         // Necessary to do it in two pass for AD4 scoring function
+        use_conformer(poses[0].conformer);
         m_model.set(poses[0].c);
         best_model = m_model;
 
@@ -1624,13 +2062,19 @@ void Vina::global_search(const int exhaustiveness, const int n_poses, const doub
             std::cout << "-----+------------+----------+----------\n";
         }
 
+        // Get RMSD between each pose and best_model (pose 0 of the engine)
+        const model& r = ref ? ref.get() : best_model;
+        rmsd_engine rmsd(m_model);
+        rmsd.add(r.coords);
         VINA_FOR_IN(i, poses) {
+            use_conformer(poses[i].conformer);
             m_model.set(poses[i].c);
+            rmsd.add(m_model.coords);
+        }
 
-            // Get RMSD between current pose and best_model
-            const model& r = ref ? ref.get() : best_model;
-            poses[i].lb = m_model.rmsd_lower_bound(r);
-            poses[i].ub = m_model.rmsd_upper_bound(r);
+        VINA_FOR_IN(i, poses) {
+            poses[i].lb = rmsd.lower_bound(0, i + 1);
+            poses[i].ub = rmsd.upper_bound(0, i + 1);
 
             if (m_verbosity > 0) {
                 std::cout << std::setw(4) << i + 1 << "    " << std::setw(9) << std::setprecision(4)
@@ -1641,6 +2085,7 @@ void Vina::global_search(const int exhaustiveness, const int n_poses, const doub
         }
 
         // Clean up by putting back the best pose in model
+        use_conformer(poses[0].conformer);
         m_model.set(poses[0].c);
     } else {
         std::cerr
@@ -1653,6 +2098,34 @@ void Vina::global_search(const int exhaustiveness, const int n_poses, const doub
     m_poses = poses;
 }
 
+void Vina::global_search_batch(const std::vector<std::string>& ligand_names,
+                               const std::vector<std::string>& out_names, const int exhaustiveness,
+                               const int n_poses, const double min_rmsd, const int max_evals,
+                               const int how_many, const double energy_range, const bool keep_H) {
+    // Check if ff and box were initialized, ligands are read by the batch workers
+    if (!m_map_initialized) {
+        std::cerr << "ERROR: Cannot do the global search. Affinity maps were not initialized.\n";
+        exit(EXIT_FAILURE);
+    } else if (exhaustiveness < 1) {
+        std::cerr << "ERROR: Exhaustiveness must be 1 or greater";
+        exit(EXIT_FAILURE);
+    }
+
+    std::stringstream sstm;
+    sstm << "Performing batch docking of " << ligand_names.size()
+         << " ligands (random seed: " << m_seed << ")";
+    doing(sstm.str(), m_verbosity, 0);
+    batch_search batch(*this, ligand_names, out_names, exhaustiveness, n_poses, min_rmsd,
+                       max_evals, how_many, energy_range, keep_H);
+    {
+        scoped_phase phase("search");
+        batch.run();
+        batch.stats().count_phase();
+        phase_count("ligands", ligand_names.size());
+    }
+    done(m_verbosity, 1);
+}
+
 void Vina::global_search_gpu(const int exhaustiveness, const int n_poses, const double min_rmsd,
                              const int max_evals, const int max_step, int num_of_ligands,
                              unsigned long long seed, const int refine_step,
@@ -1711,17 +2184,25 @@ void Vina::global_search_gpu(const int exhaustiveness, const int n_poses, const
     mc.num_of_ligands = num_of_ligands;
     mc.thread = exhaustiveness * num_of_ligands;
     mc.local_only = local_only;
+    mc.spread_starts = spread_starts;
+    mc.max_start_energy = m_max_start_energy;
 
     // Docking search
     sstm << "Performing docking (random seed: " << m_seed << ")";
     doing(sstm.str(), m_verbosity, 0);
     auto start = std::chrono::system_clock::now();
-    if (m_sf_choice == SF_VINA || m_sf_choice == SF_VINARDO) {
-        mc(m_model_gpu, poses_gpu, m_precalculated_byatom_gpu, m_data_list_gpu, m_grid,
-           m_grid.corner1(), m_grid.corner2(), generator, m_verbosity, seed, bias_batch_list);
-    } else {
-        mc(m_model_gpu, poses_gpu, m_precalculated_byatom_gpu, m_data_list_gpu, m_ad4grid,
-           m_ad4grid.corner1(), m_ad4grid.corner2(), generator, m_verbosity, seed, bias_batch_list);
+    {
+        scoped_phase phase("search");
+        if (m_sf_choice == SF_VINA || m_sf_choice == SF_VINARDO) {
+            mc(m_model_gpu, poses_gpu, m_precalculated_byatom_gpu, m_data_list_gpu, m_grid,
+               m_grid.corner1(), m_grid.corner2(), generator, m_verbosity, seed, bias_batch_list,
+               &m_search_stats_gpu);
+        } else {
+            mc(m_model_gpu, poses_gpu, m_precalculated_byatom_gpu, m_data_list_gpu, m_ad4grid,
+               m_ad4grid.corner1(), m_ad4grid.corner2(), generator, m_verbosity, seed,
+               bias_batch_list, &m_search_stats_gpu);
+        }
+        VINA_FOR_IN(l, m_search_stats_gpu) { m_search_stats_gpu[l].count_phase(); }
     }
     auto end = std::chrono::system_clock::now();
     std::cout << "Kernel running time: "
@@ -1746,6 +2227,9 @@ void Vina::global_search_gpu(const int exhaustiveness, const int n_poses, const
             if (m_sf_choice == SF_VINA || m_sf_choice == SF_VINARDO) {
                 // Refine poses if no_refine is false and got receptor
                 if (!m_no_refine & m_receptor_initialized) {
+                    scoped_phase phase("refinement");
+                    search_stats& refine_stats = thread_search_stats();
+                    refine_stats.clear();
                     change g(m_model_gpu[l].get_size());
                     quasi_newton quasi_newton_par;
                     const vec authentic_v(1000, 1000, 1000);
@@ -1768,6 +2252,7 @@ void Vina::global_search_gpu(const int exhaustiveness, const int n_poses, const
                         if (!m_non_cache.within(m_model_gpu[l])) poses[i].e = max_fl;
                         m_non_cache.slope = slope;
                     }
+                    m_search_stats_gpu[l].merge(refine_stats);
                 }
                 poses.sort();
                 // probably for bug very negative score
@@ -1781,28 +2266,33 @@ void Vina::global_search_gpu(const int exhaustiveness, const int n_poses, const
                         m_precalculated_byatom_gpu[l], m_non_cache, authentic_v);
             }
 
-            for (int i = 0; i < poses.size(); ++i) {
-                if (m_verbosity > 1) std::cout << "ENERGY FROM SEARCH: " << poses[i].e << "\n";
-
-                m_model_gpu[l].set(poses[i].c);
-
-                // For AD42 intramolecular_energy is equal to 0
-                // m_model = m_model_gpu[l]; // Vina::score() will use m_model and
-                // m_precalculated_byatom m_precalculated_byatom = m_precalculated_byatom_gpu[l];
-                DEBUG_PRINTF("intramolecular_energy=%f\n", intramolecular_energy);
-                std::vector<double> energies = score_gpu(l, intramolecular_energy);
-                // DEBUG_PRINTF("energies.size()=%d\n", energies.size());
-                // Store energy components in current pose
-                poses[i].e = energies[0];  // specific to each scoring function
-                poses[i].inter = energies[1] + energies[2];
-                poses[i].intra = energies[3] + energies[4] + energies[5];
-                poses[i].total = poses[i].inter + poses[i].intra;  // cost function for optimization
-                poses[i].conf_independent = energies[6];           // "torsion"
-                poses[i].unbound = energies[7];  // specific to each scoring function
-
-                if (m_verbosity > 1) {
-                    std::cout << "FINAL ENERGY: \n";
-                    show_score(energies);
+            {
+                scoped_phase phase("rescoring");
+                for (int i = 0; i < poses.size(); ++i) {
+                    if (m_verbosity > 1) std::cout << "ENERGY FROM SEARCH: " << poses[i].e << "\n";
+
+                    m_model_gpu[l].set(poses[i].c);
+
+                    // For AD42 intramolecular_energy is equal to 0
+                    // m_model = m_model_gpu[l]; // Vina::score() will use m_model and
+                    // m_precalculated_byatom m_precalculated_byatom =
+                    // m_precalculated_byatom_gpu[l];
+                    DEBUG_PRINTF("intramolecular_energy=%f\n", intramolecular_energy);
+                    std::vector<double> energies = score_gpu(l, intramolecular_energy);
+                    // DEBUG_PRINTF("energies.size()=%d\n", energies.size());
+                    // Store energy components in current pose
+                    poses[i].e = energies[0];  // specific to each scoring function
+                    poses[i].inter = energies[1] + energies[2];
+                    poses[i].intra = energies[3] + energies[4] + energies[5];
+                    poses[i].total
+                        = poses[i].inter + poses[i].intra;  // cost function for optimization
+                    poses[i].conf_independent = energies[6];           // "torsion"
+                    poses[i].unbound = energies[7];  // specific to each scoring function
+
+                    if (m_verbosity > 1) {
+                        std::cout << "FINAL ENERGY: \n";
+                        show_score(energies);
+                    }
                 }
             }
 
@@ -1821,13 +2311,18 @@ void Vina::global_search_gpu(const int exhaustiveness, const int n_poses, const
                 std::cout << "-----+------------+----------+----------\n";
             }
 
+            // Get RMSD between each pose and best_model (pose 0 of the engine)
+            const model& r = ref ? ref.get() : best_model;
+            rmsd_engine rmsd(m_model_gpu[l]);
+            rmsd.add(r.coords);
             VINA_FOR_IN(i, poses) {
                 m_model_gpu[l].set(poses[i].c);
+                rmsd.add(m_model_gpu[l].coords);
+            }
 
-                // Get RMSD between current pose and best_model
-                const model& r = ref ? ref.get() : best_model;
-                poses[i].lb = m_model_gpu[l].rmsd_lower_bound(r);
-                poses[i].ub = m_model_gpu[l].rmsd_upper_bound(r);
+            VINA_FOR_IN(i, poses) {
+                poses[i].lb = rmsd.lower_bound(0, i + 1);
+                poses[i].ub = rmsd.upper_bound(0, i + 1);
 
                 if (m_verbosity > 0) {
                     std::cout << std::setw(4) << i + 1 << "    " << std::setw(9)
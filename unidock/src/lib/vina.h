@@ -55,6 +55,9 @@
 #include "scoring_function.h"
 #include "precalculate.h"
 #include "bias.h"
+#include "rmsd.h"
+#include "search_stats.h"
+#include "warm_start.h"
 
 #ifdef DEBUG
 #    define DEBUG_PRINTF printf
@@ -75,6 +78,15 @@ public:
         m_no_refine = no_refine;
         m_progress_callback = progress_callback;
         gpu = false;
+        term_grids = false;
+        search_telemetry = false;
+        use_analytic_pairs = false;
+        lockstep_chains = false;
+        interleave_ad4_maps = false;
+        m_warm_steps = 1;
+        spread_starts = false;
+        m_max_start_energy = max_fl;
+        m_conformer = 0;
 
         // Look for the number of cpu
         if (cpu <= 0) {
@@ -115,14 +127,24 @@ public:
     int seed() { return m_seed; }
     void set_receptor(const std::string& rigid_name = std::string(),
                       const std::string& flex_name = std::string());
+    void set_receptor(const model& receptor);
     void set_ligand_from_string(const std::string& ligand_string);
     void set_ligand_from_string(const std::vector<std::string>& ligand_string);
     void set_ligand_from_string_gpu(const std::vector<std::string>& ligand_string);
     void set_ligand_from_file(const std::string& ligand_name);
     void set_ligand_from_file(const std::vector<std::string>& ligand_name);
     void set_ligand_from_file_gpu(const std::vector<std::string>& ligand_name);
-    void set_ligand_from_object_gpu(const std::vector<model>& ligands);
+    // precalculated: tables of the same ligands from an earlier GPU search (rigid receptor only)
+    void set_ligand_from_object_gpu(const std::vector<model>& ligands,
+                                    const std::vector<precalculate_byatom>* precalculated = NULL);
+    // frees the ligands, tables, poses and bias of the last set_ligand_from_object_gpu, keeping
+    // the receptor and maps for the next batch
+    void clear_ligands_gpu();
     void set_ligand_from_object(const std::vector<model>& ligands);
+    // one ligand docked from several conformers (see parse_ligand_conformers_from_file_no_failure)
+    // on the CPU: they share the precalculated tables, each Monte Carlo chain searches one of them
+    // and their poses are merged into a single list
+    void set_ligand_conformers(const std::vector<model>& conformers);
     // void set_ligand(OpenBabel::OBMol* mol);
     // void set_ligand(std::vector<OpenBabel::OBMol*> mol);
     void set_vina_weights(double weight_gauss1 = -0.035579, double weight_gauss2 = -0.005156,
@@ -136,12 +158,24 @@ public:
                          double weight_ad4_elec = 0.1406, double weight_ad4_dsolv = 0.1322,
                          double weight_glue = 50, double weight_ad4_rot = 0.2983);
     std::vector<double> grid_dimensions_from_ligand(double buffer_size = 4);
+    // Scores and optimizes the current ligand on a window of the maps around it (its autobox),
+    // nothing is recomputed; cleared by clear_grid_window
+    void set_autobox_window(double buffer_size = 4);
+    void clear_grid_window();
     void compute_vina_maps(double center_x, double center_y, double center_z, double size_x,
                            double size_y, double size_z, double granularity = 0.5,
                            bool force_even_voxels = false);
+    void compute_ad4_maps(double center_x, double center_y, double center_z, double size_x,
+                          double size_y, double size_z, double granularity = 0.375,
+                          bool force_even_voxels = false);
     void load_maps(std::string maps);
     void randomize(const int max_steps = 10000);
     std::vector<double> score();
+    // score() of every output pose (the current pose before a search) for each weight set (laid
+    // out as m_weights), the terms of a pose evaluated once for all sets. Needs term grids, which
+    // stand in for the receptor as with no_refine. Indexed [pose][weight set].
+    std::vector<std::vector<std::vector<double> > > score_weight_sets(
+        const std::vector<flv>& weight_sets);
     std::vector<double> optimize(const int max_steps = 0);
     void global_search(const int exhaustiveness = 8, const int n_poses = 20,
                        const double min_rmsd = 1.0, const int max_evals = 0);
@@ -150,11 +184,45 @@ public:
                            const int max_step = 0, int num_of_ligands = 1,
                            unsigned long long seed = 181129, const int refine_step = 5,
                            const bool local_only = false);
+    // docks every ligand file against the current maps, writing out_names[i] for ligand i
+    // (see batch_search.h)
+    void global_search_batch(const std::vector<std::string>& ligand_names,
+                             const std::vector<std::string>& out_names,
+                             const int exhaustiveness = 8, const int n_poses = 20,
+                             const double min_rmsd = 1.0, const int max_evals = 0,
+                             const int how_many = 9, const double energy_range = 3.0,
+                             const bool keep_H = true);
     std::string get_poses(int how_many = 9, double energy_range = 3.0);
     std::string get_sdf_poses(int how_many = 9, double energy_range = 3.0);
     std::string get_poses_gpu(int ligand_id, int how_many = 9, double energy_range = 3.0);
     std::string get_sdf_poses_gpu(int ligand_id, int how_many = 9, double energy_range = 3.0);
     void enable_gpu() { gpu = true; }
+    void enable_term_grids() { term_grids = true; }  // before compute_vina_maps
+    // CPU AD4 scoring reads (type, elec, dsolv) of a voxel together from a second copy of the
+    // maps, three times the host memory of the type maps; before compute_ad4_maps or load_maps,
+    // and not for the GPU, which never reads it
+    void enable_interleaved_ad4_maps() { interleave_ad4_maps = true; }
+    // CPU pair energies from pair_kernels.h instead of tables (vina and vinardo), before the
+    // ligand is set
+    void enable_analytic_pairs();
+    // CPU searches (global_search, global_search_batch) start from each ligand's fit onto
+    // reference_name, a known pose of a close analogue (see warm_start.h), and run steps_fraction
+    // of the usual Monte Carlo steps; ligands sharing too little with it start cold
+    void set_warm_start(const std::string& reference_name, double steps_fraction = 0.1);
+    // global_search runs its chains lockstep_width at a time per thread (see lockstep_mc.h)
+    void enable_lockstep_chains() { lockstep_chains = true; }
+    // searches start their chains spread over the box, orientations and torsions (see
+    // start_sampling.h) instead of at random, redrawing starts whose grid energy exceeds
+    // max_start_energy
+    void enable_spread_starts(double max_start_energy = max_fl) {
+        spread_starts = true;
+        m_max_start_energy = max_start_energy;
+    }
+    // writes search_stats with the poses; also times grid vs. intramolecular evaluation
+    void enable_search_telemetry() {
+        search_telemetry = true;
+        search_stats::enable_timing();
+    }
     std::vector<std::vector<double> > get_poses_coordinates(int how_many = 9,
                                                             double energy_range = 3.0);
     std::vector<std::vector<double> > get_poses_energies(int how_many = 9,
@@ -181,8 +249,24 @@ public:
     // gpu model vector and poses vector
     bool gpu;
     bool multi_bias;
+    bool term_grids;  // keep one map per potential so weights can change without recomputing
+    bool use_analytic_pairs;
+    bool lockstep_chains;
+    bool interleave_ad4_maps;
+    warm_start m_warm_start;
+    double m_warm_steps;  // fraction of global_steps for warm-started ligands
+    bool spread_starts;
+    double m_max_start_energy;
+    // receptor and ligand for each conformer given to set_ligand_conformers (empty for one), the
+    // one of index m_conformer being in m_model
+    std::vector<model> m_conformers;
+    sz m_conformer;
     std::vector<model> m_model_gpu;  // list of m_model for gpu parallelism
     std::vector<output_container> m_poses_gpu;
+    // search telemetry of the last global_search / global_search_gpu (one per ligand)
+    bool search_telemetry;
+    search_stats m_search_stats;
+    std::vector<search_stats> m_search_stats_gpu;
     // OpenBabel::OBMol m_mol;
     bool m_receptor_initialized;
     bool m_ligand_initialized;
@@ -215,10 +299,24 @@ public:
 
     std::string vina_remarks(output_type& pose, fl lb, fl ub);
     std::string sdf_remarks(output_type& pose, fl lb, fl ub);
+    std::string search_remarks(const search_stats& stats, bool sdf);
     output_container remove_redundant(const output_container& in, fl min_rmsd);
+    precalculate_byatom precalculate_ligand(const model& m) const;
+    monte_carlo cpu_monte_carlo(const model& m, const int n_poses, const double min_rmsd,
+                                const int max_evals) const;
+    // refined: poses are already non-redundant and refined, as batch_search workers leave them
+    void finish_global_search(output_container& poses, const double min_rmsd,
+                              bool refined = false);
+    bool refines_poses() const;  // finish_global_search refines against the receptor atoms
+    // Refines pose of m against the receptor atoms of nc, raising nc.slope until the pose is
+    // inside the box; e becomes max_fl if it never is. Leaves m at the refined pose.
+    static void refine_pose(model& m, const precalculate_byatom& p, non_cache& nc,
+                            output_type& pose);
+    void use_conformer(sz k);  // for a pose of output_type::conformer k
 
     void set_forcefield();
     std::vector<double> score(double intramolecular_energy);
+    std::vector<std::vector<double> > score_weight_sets_pose(const std::vector<flv>& weight_sets);
     std::vector<double> score_gpu(int i);
     std::vector<double> score_gpu(int i, double intramolecular_energy);
     std::vector<double> optimize(output_type& out, const int max_steps = 0);
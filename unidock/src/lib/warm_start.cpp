@@ -0,0 +1,346 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#include "warm_start.h"
+#include <map>
+#include <string>
+
+namespace {
+
+struct heavy_graph {
+    szv atoms;  // model index per node
+    szv el;
+    std::vector<std::vector<bool> > bonded;
+};
+
+heavy_graph heavy_atoms(const model& m) {
+    VINA_CHECK(m.num_ligands() > 0);
+    const ligand& lig = m.ligands[0];
+    heavy_graph g;
+    szv node(m.atoms.size(), max_sz);
+    VINA_RANGE(i, lig.begin, lig.end) {
+        if (m.atoms[i].is_hydrogen()) continue;
+        node[i] = g.atoms.size();
+        g.atoms.push_back(i);
+        g.el.push_back(m.atoms[i].el);
+    }
+    g.bonded.assign(g.atoms.size(), std::vector<bool>(g.atoms.size(), false));
+    VINA_FOR_IN(k, g.atoms) {
+        const atom& a = m.atoms[g.atoms[k]];
+        VINA_FOR_IN(j, a.bonds) {
+            const atom_index& b = a.bonds[j].connected_atom_index;
+            if (!b.in_grid && b.i < node.size() && node[b.i] != max_sz)
+                g.bonded[k][node[b.i]] = true;
+        }
+    }
+    return g;
+}
+
+// Maximum common connected induced substructure of two labelled graphs. Atoms of a are decided
+// one at a time (matched to an atom of b, or left out) among those bonded to the matched part;
+// the bound groups the undecided atoms of both graphs by element and by their bonds to the
+// matched part, since only atoms of the same group can still be matched to each other.
+class mcs_search {
+public:
+    mcs_search(const szv& el_a, const std::vector<std::vector<bool> >& bonded_a, const szv& el_b,
+               const std::vector<std::vector<bool> >& bonded_b, unsigned max_nodes)
+        : m_el_a(el_a),
+          m_bonded_a(bonded_a),
+          m_el_b(el_b),
+          m_bonded_b(bonded_b),
+          m_max_nodes(max_nodes),
+          m_nodes(0),
+          m_ab(el_a.size(), max_sz),
+          m_ba(el_b.size(), max_sz),
+          m_out(el_a.size(), false) {}
+
+    warm_start::atom_map run() {
+        VINA_FOR_IN(i, m_el_a) {
+            VINA_FOR_IN(j, m_el_b) {
+                if (m_el_a[i] != m_el_b[j]) continue;
+                match(i, j);
+                extend();
+                unmatch(i);
+            }
+            m_out[i] = true;  // every substructure with i has been seen
+        }
+        return m_best;
+    }
+
+private:
+    void match(sz a, sz b) {
+        m_ab[a] = b;
+        m_ba[b] = a;
+        m_matched.push_back(a);
+    }
+    void unmatch(sz a) {
+        m_ba[m_ab[a]] = max_sz;
+        m_ab[a] = max_sz;
+        m_matched.pop_back();
+    }
+    bool consistent(sz a, sz b) const {
+        VINA_FOR_IN(i, m_matched) {
+            const sz w = m_matched[i];
+            if (m_bonded_a[a][w] != m_bonded_b[b][m_ab[w]]) return false;
+        }
+        return true;
+    }
+    std::string group(sz el, const std::vector<bool>& bonded, bool in_b) const {
+        std::string key(1, char(el));
+        VINA_FOR_IN(i, m_matched) {
+            const sz w = in_b ? m_ab[m_matched[i]] : m_matched[i];
+            key += bonded[w] ? '1' : '0';
+        }
+        return key;
+    }
+    sz bound() const {
+        std::map<std::string, std::pair<sz, sz> > groups;
+        VINA_FOR_IN(i, m_el_a)
+        if (m_ab[i] == max_sz && !m_out[i]) ++groups[group(m_el_a[i], m_bonded_a[i], false)].first;
+        VINA_FOR_IN(i, m_el_b)
+        if (m_ba[i] == max_sz) ++groups[group(m_el_b[i], m_bonded_b[i], true)].second;
+        sz tmp = 0;
+        for (std::map<std::string, std::pair<sz, sz> >::const_iterator it = groups.begin();
+             it != groups.end(); ++it)
+            tmp += (std::min)(it->second.first, it->second.second);
+        return tmp;
+    }
+    void extend() {
+        if (m_nodes >= m_max_nodes) return;
+        ++m_nodes;
+        if (m_matched.size() > m_best.size()) {
+            m_best.clear();
+            VINA_FOR_IN(i, m_matched)
+            m_best.push_back(std::make_pair(m_matched[i], m_ab[m_matched[i]]));
+        }
+        if (m_matched.size() + bound() <= m_best.size()) return;
+
+        sz a = max_sz;  // next atom to decide, bonded to the matched part
+        VINA_FOR_IN(i, m_el_a) {
+            if (m_ab[i] != max_sz || m_out[i]) continue;
+            VINA_FOR_IN(k, m_matched) {
+                if (m_bonded_a[i][m_matched[k]]) {
+                    a = i;
+                    break;
+                }
+            }
+            if (a != max_sz) break;
+        }
+        if (a == max_sz) return;
+        VINA_FOR_IN(b, m_el_b) {
+            if (m_ba[b] != max_sz || m_el_b[b] != m_el_a[a] || !consistent(a, b)) continue;
+            match(a, b);
+            extend();
+            unmatch(a);
+        }
+        m_out[a] = true;
+        extend();
+        m_out[a] = false;
+    }
+
+    const szv& m_el_a;
+    const std::vector<std::vector<bool> >& m_bonded_a;
+    const szv& m_el_b;
+    const std::vector<std::vector<bool> >& m_bonded_b;
+    unsigned m_max_nodes;
+    unsigned m_nodes;
+    szv m_ab;  // max_sz if unmatched
+    szv m_ba;
+    std::vector<bool> m_out;  // atoms of a left out
+    szv m_matched;            // atoms of a, in matching order
+    warm_start::atom_map m_best;
+};
+
+// The atoms of the rotatable bond (on the axis) belong to the parent segment
+typedef std::pair<atom_range, const segment*> torsion_atoms;  // parent atoms, turned segment
+
+void collect_torsions(const branch& b, const atom_range& parent, std::vector<torsion_atoms>& out) {
+    out.push_back(torsion_atoms(parent, &b.node));  // in conf order
+    VINA_FOR_IN(i, b.children)
+    collect_torsions(b.children[i], b.node, out);
+}
+
+// heavy atom bonded to a, matched and other than not_this, or max_sz
+sz matched_neighbor(const model& m, const szv& ref, sz a, sz not_this) {
+    const std::vector<bond>& bonds = m.atoms[a].bonds;
+    VINA_FOR_IN(i, bonds) {
+        const atom_index& n = bonds[i].connected_atom_index;
+        if (!n.in_grid && n.i < ref.size() && ref[n.i] != max_sz && n.i != not_this) return n.i;
+    }
+    return max_sz;
+}
+
+fl dihedral(const vec& a, const vec& b, const vec& c, const vec& d) {
+    const vec b1 = b - a;
+    const vec b2 = c - b;
+    const vec b3 = d - c;
+    const vec n1 = cross_product(b1, b2);
+    const vec n2 = cross_product(b2, b3);
+    const vec m1 = cross_product(n1, (1 / std::sqrt(sqr(b2))) * b2);
+    return std::atan2(m1 * n2, n1 * n2);
+}
+
+// eigenvector of the largest eigenvalue of a symmetric 4x4 matrix, by cyclic Jacobi rotations
+void largest_eigenvector(double a[4][4], double out[4]) {
+    double v[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+    VINA_FOR(sweep, 50) {
+        double off = 0;
+        VINA_FOR(p, 4)
+        VINA_RANGE(q, p + 1, 4) off += a[p][q] * a[p][q];
+        if (off < 1e-24) break;
+        VINA_FOR(p, 4) {
+            VINA_RANGE(q, p + 1, 4) {
+                if (a[p][q] == 0) continue;
+                const double theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+                const double t
+                    = (theta >= 0 ? 1 : -1) / (std::abs(theta) + std::sqrt(theta * theta + 1));
+                const double c = 1 / std::sqrt(t * t + 1);
+                const double s = t * c;
+                VINA_FOR(k, 4) {
+                    const double kp = a[k][p];
+                    const double kq = a[k][q];
+                    a[k][p] = c * kp - s * kq;
+                    a[k][q] = s * kp + c * kq;
+                }
+                VINA_FOR(k, 4) {
+                    const double pk = a[p][k];
+                    const double qk = a[q][k];
+                    a[p][k] = c * pk - s * qk;
+                    a[q][k] = s * pk + c * qk;
+                }
+                VINA_FOR(k, 4) {
+                    const double kp = v[k][p];
+                    const double kq = v[k][q];
+                    v[k][p] = c * kp - s * kq;
+                    v[k][q] = s * kp + c * kq;
+                }
+            }
+        }
+    }
+    sz best = 0;
+    VINA_RANGE(i, 1, 4)
+    if (a[i][i] > a[best][best]) best = i;
+    VINA_FOR(k, 4) out[k] = v[k][best];
+}
+
+// rotation taking the centered x onto the centered y in the least-squares sense (Horn, 1987)
+qt superposition(const vecv& x, const vecv& y, vec& x_center, vec& y_center) {
+    x_center = zero_vec;
+    y_center = zero_vec;
+    VINA_FOR_IN(i, x) {
+        x_center += x[i];
+        y_center += y[i];
+    }
+    x_center = (1 / fl(x.size())) * x_center;
+    y_center = (1 / fl(y.size())) * y_center;
+    double s[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+    VINA_FOR_IN(i, x) {
+        const vec dx = x[i] - x_center;
+        const vec dy = y[i] - y_center;
+        VINA_FOR(j, 3)
+        VINA_FOR(k, 3) s[j][k] += dx[j] * dy[k];
+    }
+    double n[4][4] = {
+        {s[0][0] + s[1][1] + s[2][2], s[1][2] - s[2][1], s[2][0] - s[0][2], s[0][1] - s[1][0]},
+        {s[1][2] - s[2][1], s[0][0] - s[1][1] - s[2][2], s[0][1] + s[1][0], s[2][0] + s[0][2]},
+        {s[2][0] - s[0][2], s[0][1] + s[1][0], -s[0][0] + s[1][1] - s[2][2], s[1][2] + s[2][1]},
+        {s[0][1] - s[1][0], s[2][0] + s[0][2], s[1][2] + s[2][1], -s[0][0] - s[1][1] + s[2][2]}};
+    double q[4];
+    largest_eigenvector(n, q);
+    qt tmp(q[0], q[1], q[2], q[3]);
+    quaternion_normalize(tmp);
+    return tmp;
+}
+
+}  // namespace
+
+warm_start::warm_start(const model& reference) : max_nodes(200000), min_matched(3) {
+    const heavy_graph g = heavy_atoms(reference);
+    m_el = g.el;
+    m_bonded = g.bonded;
+    VINA_FOR_IN(i, g.atoms) m_coords.push_back(reference.coords[g.atoms[i]]);
+}
+
+warm_start::atom_map warm_start::match(const model& m) const {
+    const heavy_graph g = heavy_atoms(m);
+    atom_map tmp = mcs_search(g.el, g.bonded, m_el, m_bonded, max_nodes).run();
+    VINA_FOR_IN(i, tmp) tmp[i].first = g.atoms[tmp[i].first];
+    return tmp;
+}
+
+bool warm_start::initial_conf(const model& m_, conf& c, sz& matched) const {
+    const atom_map pairs = match(m_);
+    matched = pairs.size();
+    if (matched < min_matched) return false;
+
+    model m = m_;
+    const ligand& lig = m.ligands[0];
+    szv ref(m.atoms.size(), max_sz);
+    VINA_FOR_IN(i, pairs) ref[pairs[i].first] = pairs[i].second;
+
+    conf start = m.get_initial_conf();
+    const conf initial = start;
+    m.set(initial);
+    const vecv initial_coords = m.coords;
+
+    // Each shared torsion is set from the dihedral of its bond a-b and a bonded heavy atom on
+    // either side; no other torsion moves these four atoms relative to each other.
+    std::vector<torsion_atoms> segments;
+    VINA_FOR_IN(i, lig.children)
+    collect_torsions(lig.children[i], lig.node, segments);
+    flv& torsions = start.ligands[0].torsions;
+    VINA_CHECK(segments.size() == torsions.size());
+    VINA_FOR_IN(t, torsions) {
+        const atom_range& parent = segments[t].first;
+        const segment& turned = *segments[t].second;
+        sz quad[4] = {max_sz, max_sz, max_sz, max_sz};  // a', a, b, b' with a-b the axis
+        VINA_RANGE(i, parent.begin, parent.end) {
+            if (vec_distance_sqr(initial_coords[i], turned.get_origin()) < 1e-6) quad[2] = i;
+        }
+        if (quad[2] == max_sz || ref[quad[2]] == max_sz) continue;
+        const std::vector<bond>& bonds = m.atoms[quad[2]].bonds;
+        VINA_FOR_IN(i, bonds) {
+            const atom_index& a = bonds[i].connected_atom_index;
+            if (a.in_grid) continue;
+            const vec along = initial_coords[quad[2]] - initial_coords[a.i];
+            if (along * turned.get_axis() > 0.99 * std::sqrt(sqr(along))) quad[1] = a.i;
+        }
+        if (quad[1] == max_sz || ref[quad[1]] == max_sz) continue;
+        quad[0] = matched_neighbor(m, ref, quad[1], quad[2]);
+        quad[3] = matched_neighbor(m, ref, quad[2], quad[1]);
+        if (quad[0] == max_sz || quad[3] == max_sz) continue;
+
+        conf turned_conf = initial;
+        turned_conf.ligands[0].torsions[t] = 1;
+        m.set(turned_conf);
+        const fl target = dihedral(m_coords[ref[quad[0]]], m_coords[ref[quad[1]]],
+                                   m_coords[ref[quad[2]]], m_coords[ref[quad[3]]]);
+        const fl before = dihedral(initial_coords[quad[0]], initial_coords[quad[1]],
+                                   initial_coords[quad[2]], initial_coords[quad[3]]);
+        const fl after
+            = dihedral(m.coords[quad[0]], m.coords[quad[1]], m.coords[quad[2]], m.coords[quad[3]]);
+        m.set(initial);  // the segments found above from its frames
+        const fl sign = (normalized_angle(after - before) > 0) ? 1 : -1;
+        torsions[t] = normalized_angle(sign * (target - before));
+    }
+
+    // superimpose the shared atoms, rotating about their center
+    m.set(start);
+    vecv x, y;
+    VINA_FOR_IN(i, pairs) {
+        x.push_back(m.coords[pairs[i].first]);
+        y.push_back(m_coords[pairs[i].second]);
+    }
+    vec x_center, y_center;
+    const qt rotation = superposition(x, y, x_center, y_center);
+    rigid_conf& rigid = start.ligands[0].rigid;
+    rigid.position = y_center + quaternion_to_r3(rotation) * (rigid.position - x_center);
+    rigid.orientation = rotation * rigid.orientation;
+    quaternion_normalize(rigid.orientation);
+    c = start;
+    return true;
+}
@@ -0,0 +1,50 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#ifndef VINA_WARM_START_H
+#define VINA_WARM_START_H
+
+#include <utility>
+#include <vector>
+
+#include "model.h"
+#include "conf.h"
+
+// Warm start for a congeneric series: each ligand is mapped onto a known pose of a close
+// analogue (the reference) through their maximum common substructure, and its search starts
+// from the conf that lays the shared atoms onto that pose. Shared torsions take the dihedrals of
+// the reference, then position and orientation superimpose the shared atoms (Horn's quaternion
+// fit); torsions outside the common part stay as parsed.
+//
+// The substructure is connected, over heavy atoms of the first ligand, with atoms matched by
+// element and bonds preserved both ways. It is found by branch and bound, which is exact for the
+// usual analogue sizes; max_nodes caps the search for large, symmetric ligands, in which case the
+// largest mapping seen is used.
+struct warm_start {
+    // (atom of the ligand, heavy atom of the reference counted in model order)
+    typedef std::vector<std::pair<sz, sz> > atom_map;
+
+    warm_start() : max_nodes(200000), min_matched(3) {}
+    explicit warm_start(const model& reference);  // first ligand, at its coords as parsed
+    bool empty() const { return m_el.empty(); }
+    sz reference_atoms() const { return m_el.size(); }  // heavy atoms
+
+    atom_map match(const model& m) const;
+    // false (c untouched) if fewer than min_matched atoms are shared; only the first ligand of c
+    // is set, its other ligands and flex keep their initial conf
+    bool initial_conf(const model& m, conf& c, sz& matched) const;
+
+    unsigned max_nodes;
+    sz min_matched;
+
+private:
+    szv m_el;  // per heavy atom of the reference
+    vecv m_coords;
+    std::vector<std::vector<bool> > m_bonded;
+};
+
+#endif
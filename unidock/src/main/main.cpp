@@ -24,10 +24,16 @@
 #include <string>
 #include <vector>  // ligand paths
 #include <exception>
+#include <cstring>  // strerror
 #include <boost/program_options.hpp>
 #include "vina.h"
 #include "utils.h"
 #include "scoring_function.h"
+#include "phase_report.h"
+#include "ligand_source.h"
+#include "memory_plan.h"
+#include <fcntl.h>   // open
+#include <unistd.h>  // sysconf, close
 
 #include <cuda.h>
 #include <cuda_runtime.h>
@@ -37,6 +43,14 @@ struct usage_error : public std::runtime_error {
     usage_error(const std::string& message) : std::runtime_error(message) {}
 };
 
+// Writes the phase report on every exit path out of main's try block
+struct phase_report_writer {
+    std::string path;
+    ~phase_report_writer() {
+        if (!path.empty()) phase_report::get().write(path);
+    }
+};
+
 struct options_occurrence {
     bool some;
     bool all;
@@ -67,28 +81,6 @@ void check_occurrence(boost::program_options::variables_map& vm,
     }
 }
 
-int predict_peak_memory(int batch_size, int exhaustiveness, int all_atom2_numbers,
-                        bool use_v100 = true, bool multi_bias = false) {
-    if (!multi_bias) {
-        if (use_v100) {
-            return 1.214869 * batch_size + .0038522 * exhaustiveness * batch_size
-                   + .011978 * all_atom2_numbers + 20017.72;  // this is based on V100, 32G
-        } else {
-            return 1.166067 * batch_size + .0038676 * exhaustiveness * batch_size
-                   + .0119598 * all_atom2_numbers + 5313.848;  // this is based on T4, 16G
-        }
-    } else {
-        if (use_v100) {
-            return 65.214869 * batch_size + .0038522 * exhaustiveness * batch_size
-                   + .011978 * all_atom2_numbers + 20017.72;  // this is based on V100, 32G
-        } else {
-            return 65.166067 * batch_size + .0038676 * exhaustiveness * batch_size
-                   + .0119598 * all_atom2_numbers + 5313.848;  // this is based on T4, 16G
-        }
-    }
-    return 0;
-}
-
 int main(int argc, char* argv[]) {
     using namespace boost::program_options;
     const std::string git_version = VERSION;
@@ -151,13 +143,22 @@ bug reporting, license agreements, and more information.      \n";
         std::string out_maps;
         std::vector<std::string> ligand_names;
         std::string ligand_index;  // path to a text file, containing paths to ligands files
+        std::string ligand_stream_name;  // "-" for stdin
+        std::string stream_format("sdf");
         std::vector<std::string> batch_ligand_names;
         std::vector<std::string> gpu_batch_ligand_names;
+        std::vector<std::string> ensemble_names;  // receptors docked after --receptor
+        std::string sites_name;
+        std::vector<std::string> site_labels;
+        std::vector<std::vector<double> > site_boxes;  // center xyz, size xyz
+        std::string warm_start_name;  // known pose of an analogue of the ligands
+        double warm_steps = 0.1;
         // std::vector<std::string> gpu_batch_ligand_names_sdf;
         bool use_sdf_ligand = false;
         std::string maps;
         std::string sf_name = "vina";
         std::string search_mode;
+        std::string timing_report;
         double center_x;
         double center_y;
         double center_z;
@@ -176,6 +177,7 @@ bug reporting, license agreements, and more information.      \n";
         double buffer_size = 4;
         int max_step = 0;
         int max_gpu_memory = 0;
+        int max_host_memory = 0;
         int refine_step = 5;
 
         // autodock4.2 weights
@@ -206,6 +208,13 @@ bug reporting, license agreements, and more information.      \n";
         bool local_only = false;
         bool no_refine = false;
         bool force_even_voxels = false;
+        bool search_telemetry = false;
+        bool analytic_pairs = false;
+        bool lockstep_chains = false;
+        bool interleave_ad4_maps = false;
+        bool spread_starts = false;
+        double max_start_energy = max_fl;  // no redraw
+        bool conformers = false;  // records of the --ligand file are conformers of one ligand
         bool randomize_only = false;
         bool help = false;
         bool help_advanced = false;
@@ -217,7 +226,7 @@ bug reporting, license agreements, and more information.      \n";
         std::string bias_file;
         bool multi_bias;
         // sdf
-        bool keep_H = true;
+        bool keep_H = false;
 
         // score only in batch
         std::string score_file("scores.txt");
@@ -228,13 +237,22 @@ bug reporting, license agreements, and more information.      \n";
         inputs.add_options()("receptor", value<std::string>(&rigid_name),
                              "rigid part of the receptor (PDBQT or PDB)")(
             "flex", value<std::string>(&flex_name), "flexible side chains, if any (PDBQT or PDB)")(
+            "ensemble", value<std::vector<std::string> >(&ensemble_names)->multitoken(),
+            "more rigid receptor conformations (PDBQT or PDB) docked with the same GPU batches "
+            "and box as --receptor, one output subdirectory of --dir per receptor and the best "
+            "receptor per ligand in best_targets.tsv")(
             "ligand", value<std::vector<std::string> >(&ligand_names)->multitoken(),
             "ligand (PDBQT)")("ligand_index", value<std::string>(&ligand_index),
                               "file containing paths to ligands (PDBQT or SDF")(
             "batch", value<std::vector<std::string> >(&batch_ligand_names)->multitoken(),
-            "batch ligand (PDBQT)")(
+            "batch ligand (PDBQT or SDF), docked on CPU")(
             "gpu_batch", value<std::vector<std::string> >(&gpu_batch_ligand_names)->multitoken(),
-            "gpu batch ligand (PDBQT or SDF)")
+            "gpu batch ligand (PDBQT or SDF)")(
+            "ligand_stream", value<std::string>(&ligand_stream_name),
+            "stream of ligands docked on GPU as they arrive, '-' for stdin or a named pipe: "
+            "$$$$-separated SDF or MODEL/ENDMDL-delimited PDBQT records")(
+            "stream_format", value<std::string>(&stream_format)->default_value(stream_format),
+            "record format of --ligand_stream (sdf or pdbqt)")
             // ("gpu_batch_sdf", value< std::vector<std::string>
             // >(&gpu_batch_ligand_names_sdf)->multitoken(), "gpu batch ligand (SDF)")
 
@@ -251,8 +269,12 @@ bug reporting, license agreements, and more information.      \n";
             "size_x", value<double>(&size_x), "size in the X dimension (Angstrom)")(
             "size_y", value<double>(&size_y), "size in the Y dimension (Angstrom)")(
             "size_z", value<double>(&size_z), "size in the Z dimension (Angstrom)")(
+            "sites", value<std::string>(&sites_name),
+            "file with one search box per line, docked in the same GPU batches instead of "
+            "--center_* and --size_*: name center_x center_y center_z size_x size_y size_z")(
             "autobox", bool_switch(&autobox),
-            "set maps dimensions based on input ligand(s) (for --score_only and --local_only)");
+            "set maps dimensions based on input ligand(s) (for --score_only and --local_only); "
+            "with --batch, each ligand uses a window of the maps computed on the given box");
         // options_description outputs("Output prefixes (optional - by default, input names are
         // stripped of .pdbqt\nare used as prefixes. _001.pdbqt, _002.pdbqt, etc. are appended to
         // the prefixes to produce the output names");
@@ -332,7 +354,9 @@ bug reporting, license agreements, and more information.      \n";
                             "{ligand_name}.pdbqt in batch, content similar to BPF in "
                             "AutoDock-bias")("keep_nonpolar_H",
                                              bool_switch(&keep_H)->default_value(keep_H),
-                                             "keep non polar H in sdf")
+                                             "keep non polar H of sdf ligands in the search "
+                                             "model, by default they are merged into their "
+                                             "carbons and placed back in the output")
 
             ;
         options_description misc("Misc (optional)");
@@ -362,6 +386,37 @@ bug reporting, license agreements, and more information.      \n";
             "max_gpu_memory", value<int>(&max_gpu_memory)->default_value(0),
             "maximum gpu memory to use (default=0, use all available GPU memory to optain maximum "
             "batch size)")(
+            "max_host_memory", value<int>(&max_host_memory)->default_value(0),
+            "maximum host memory (MiB) a GPU batch may hold (default=0, the free physical "
+            "memory)")(
+            "timing_report", value<std::string>(&timing_report),
+            "write per-phase wall time, call counts and peak memory as JSON to this file")(
+            "search_stats", bool_switch(&search_telemetry),
+            "write search telemetry (evaluations, BFGS iterations, line search backtracks, "
+            "Metropolis acceptance, output replacements) with the poses of each ligand")(
+            "analytic_pairs", bool_switch(&analytic_pairs),
+            "score intramolecular pairs analytically instead of from precalculated tables on the "
+            "CPU (vina and vinardo)")(
+            "lockstep_chains", bool_switch(&lockstep_chains),
+            "advance the CPU Monte Carlo chains of a docking several at a time per thread, one per "
+            "SIMD lane (single ligand without flexible residues or --analytic_pairs)")(
+            "interleave_ad4_maps", bool_switch(&interleave_ad4_maps),
+            "keep a copy of the AD4 maps with the type, electrostatic and desolvation values of "
+            "each voxel together, for faster CPU scoring at three times the memory of the type "
+            "maps")(
+            "spread_starts", bool_switch(&spread_starts),
+            "start the Monte Carlo chains of each ligand spread evenly over the box, orientations "
+            "and torsions (Halton and Latin hypercube points) instead of at random")(
+            "max_start_energy", value<double>(&max_start_energy),
+            "with --spread_starts, redraw chain starts whose grid energy (kcal/mol) exceeds this")(
+            "warm_start", value<std::string>(&warm_start_name),
+            "known pose (PDBQT or SDF) of a close analogue: CPU docking (--ligand, --batch) starts "
+            "each ligand from its fit onto the common substructure and runs a shorter search")(
+            "warm_steps", value<double>(&warm_steps)->default_value(warm_steps),
+            "fraction of the Monte Carlo steps run from a warm start")(
+            "conformers", bool_switch(&conformers),
+            "dock the records of the --ligand file (SDF records or PDBQT models with the same "
+            "atoms and bonds) as conformers of one ligand, with a single list of poses")(
             "search_mode", value<std::string>(&search_mode),
             "search mode of vina (fast, balance, detail), using recommended settings of "
             "exhaustiveness and search steps; the higher the computational complexity, the higher "
@@ -437,6 +492,12 @@ bug reporting, license agreements, and more information.      \n";
             std::cout << cite_message << '\n';
         }
 
+        phase_report_writer report_writer;
+        if (vm.count("timing_report")) {
+            phase_report::get().enable();
+            report_writer.path = timing_report;
+        }
+
         if (vm.count("receptor") && vm.count("maps")) {
             std::cerr << "ERROR: Cannot specify both receptor and affinity maps at the same time, "
                          "--flex argument is allowed with receptor or maps.\n";
@@ -456,7 +517,7 @@ bug reporting, license agreements, and more information.      \n";
                 exhaustiveness = 512;
                 max_step = 40;
             }
-        } else if ((vm.count("gpu_batch") || vm.count("ligand_index"))
+        } else if ((vm.count("gpu_batch") || vm.count("ligand_index") || vm.count("ligand_stream"))
                    && !vm.count("exhaustiveness")) {
             exhaustiveness = 384;
             max_step = 40;
@@ -469,13 +530,10 @@ bug reporting, license agreements, and more information.      \n";
                 exit(EXIT_FAILURE);
             }
         } else if (sf_name.compare("ad4") == 0) {
-            if (vm.count("receptor")) {
-                std::cerr << "ERROR: No receptor allowed, only --flex argument with the AD4 "
-                             "scoring function.\n";
-                exit(EXIT_FAILURE);
-            }
-            if (!vm.count("maps")) {
-                std::cerr << desc_simple << "\n\nERROR: Affinity maps are missing.\n";
+            // AD4.2 maps are either read from AutoGrid files or computed from the receptor
+            if (!vm.count("receptor") && !vm.count("maps")) {
+                std::cerr << desc_simple
+                          << "\n\nERROR: The receptor or affinity maps must be specified.\n";
                 exit(EXIT_FAILURE);
             }
         } else {
@@ -484,7 +542,8 @@ bug reporting, license agreements, and more information.      \n";
         }
 
         if (!vm.count("ligand") && !vm.count("batch") && !vm.count("gpu_batch")
-            && !vm.count("ligand_index") && !vm.count("gpu_batch_sdf")) {
+            && !vm.count("ligand_index") && !vm.count("gpu_batch_sdf")
+            && !vm.count("ligand_stream")) {
             std::cerr << desc_simple << "\n\nERROR: Missing ligand(s).\n";
             exit(EXIT_FAILURE);
         } else if (vm.count("ligand") && (vm.count("batch") || vm.count("gpu_batch"))) {
@@ -492,7 +551,8 @@ bug reporting, license agreements, and more information.      \n";
                 << desc_simple
                 << "\n\nERROR: Can't use both --ligand and --batch arguments simultaneously.\n";
             exit(EXIT_FAILURE);
-        } else if ((vm.count("batch") || vm.count("gpu_batch")) && !vm.count("dir")) {
+        } else if ((vm.count("batch") || vm.count("gpu_batch") || vm.count("ligand_stream"))
+                   && !vm.count("dir")) {
             std::cerr << desc_simple
                       << "\n\nERROR: Need to specify an output directory for batch mode.\n";
             exit(EXIT_FAILURE);
@@ -517,6 +577,46 @@ bug reporting, license agreements, and more information.      \n";
             }
         }
 
+        if (vm.count("sites")) {
+            if (vm.count("center_x") || vm.count("center_y") || vm.count("center_z")
+                || vm.count("size_x") || vm.count("size_y") || vm.count("size_z")) {
+                std::cerr << "ERROR: --sites replaces --center_* and --size_*.\n";
+                exit(EXIT_FAILURE);
+            }
+            std::ifstream sites_file(sites_name);
+            if (!sites_file.is_open()) {
+                throw file_error(sites_name, true);
+            }
+            std::string line;
+            sz line_number = 0;
+            while (std::getline(sites_file, line)) {
+                ++line_number;
+                std::istringstream fields(line);
+                std::string label;
+                if (!(fields >> label) || label[0] == '#') continue;
+                std::vector<double> box(6);
+                VINA_FOR_IN(i, box) fields >> box[i];
+                if (!fields) {
+                    std::cerr << "ERROR: Could not read the search box on line " << line_number
+                              << " of " << sites_name << ".\n";
+                    exit(EXIT_FAILURE);
+                }
+                site_labels.push_back(label);
+                site_boxes.push_back(box);
+            }
+            if (site_boxes.empty()) {
+                std::cerr << "ERROR: No search box in " << sites_name << ".\n";
+                exit(EXIT_FAILURE);
+            }
+            // the first site is computed on v, like a box given on the command line
+            center_x = site_boxes[0][0];
+            center_y = site_boxes[0][1];
+            center_z = site_boxes[0][2];
+            size_x = site_boxes[0][3];
+            size_y = site_boxes[0][4];
+            size_z = site_boxes[0][5];
+        }
+
         // read ligands from index file
         // will append to `batch` if used together
         if (vm.count("ligand_index")) {
@@ -559,6 +659,9 @@ bug reporting, license agreements, and more information.      \n";
                           << " A in each dimension (autobox)\n";
                 std::cout << "Grid space : " << grid_spacing << "\n";
             }
+            if (vm.count("sites"))
+                std::cout << "Search sites: " << site_labels.size() << " (" << sites_name
+                          << ")\n";
             std::cout << "Exhaustiveness: " << exhaustiveness << "\n";
             std::cout << "CPU: " << cpu << "\n";
             if (!vm.count("seed")) std::cout << "Seed: " << seed << "\n";
@@ -567,8 +670,40 @@ bug reporting, license agreements, and more information.      \n";
         }
 
         Vina v(sf_name, cpu, seed, verbosity, no_refine);
+        if (search_telemetry) v.enable_search_telemetry();
+        if (analytic_pairs) {
+            if (!score_only && !local_only)
+                std::cerr << "WARNING: --analytic_pairs saves the table build of each ligand but "
+                             "evaluates more slowly, full searches are faster without it.\n";
+            v.enable_analytic_pairs();
+        }
+        if (lockstep_chains) v.enable_lockstep_chains();
+        if (interleave_ad4_maps) {
+            if (sf_name.compare("ad4") != 0 || vm.count("gpu_batch") || vm.count("ligand_index")
+                || vm.count("ligand_stream"))
+                std::cerr << "WARNING: --interleave_ad4_maps only applies to CPU docking with ad4, "
+                             "ignored.\n";
+            else
+                v.enable_interleaved_ad4_maps();
+        }
+        if (spread_starts) v.enable_spread_starts(max_start_energy);
+        if (vm.count("warm_start")) {
+            if (!(vm.count("ligand") || vm.count("batch")) || score_only || local_only
+                || randomize_only) {
+                std::cerr << "ERROR: --warm_start needs a CPU docking search (--ligand or --batch, "
+                             "without --score_only, --local_only or --randomize_only).\n";
+                exit(EXIT_FAILURE);
+            }
+            v.set_warm_start(warm_start_name, warm_steps);
+        }
+        if (conformers
+            && (ligand_names.size() != 1 || score_only || local_only || randomize_only)) {
+            std::cerr << "ERROR: --conformers needs a single --ligand file and a docking search "
+                         "(without --score_only, --local_only or --randomize_only).\n";
+            exit(EXIT_FAILURE);
+        }
 
-        // rigid_name variable can be ignored for AD4
+        // rigid_name is only needed for AD4 when the maps are computed from the receptor
         if (vm.count("receptor") || vm.count("flex")) v.set_receptor(rigid_name, flex_name);
 
         if (vm.count("bias")) {
@@ -583,6 +718,31 @@ bug reporting, license agreements, and more information.      \n";
             bias_file_content.close();
         }
 
+        if (vm.count("ligand_stream")) {
+            if (stream_format != "sdf" && stream_format != "pdbqt") {
+                std::cerr << "ERROR: Stream format must be sdf or pdbqt.\n";
+                exit(EXIT_FAILURE);
+            }
+            if (score_only || multi_bias || vm.count("gpu_batch") || vm.count("ligand_index")) {
+                std::cerr << "ERROR: --ligand_stream can't be combined with --score_only, "
+                             "--multi_bias, --gpu_batch or --ligand_index.\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if (vm.count("ensemble") || vm.count("sites")) {
+            if (!(vm.count("gpu_batch") || vm.count("ligand_index") || vm.count("ligand_stream"))
+                || !vm.count("receptor") || vm.count("maps") || score_only) {
+                std::cerr << "ERROR: --ensemble and --sites need --receptor in GPU batch mode and "
+                             "can't be combined with --maps or --score_only.\n";
+                exit(EXIT_FAILURE);
+            }
+            if (vm.count("ensemble") && vm.count("flex")) {
+                std::cerr << "ERROR: --ensemble can't be combined with --flex.\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+
         v.multi_bias = false;
         if (multi_bias) {
             if (!(vm.count("gpu_batch") || vm.count("ligand_index"))) {
@@ -609,19 +769,39 @@ bug reporting, license agreements, and more information.      \n";
         } else {
             v.set_ad4_weights(weight_ad4_vdw, weight_ad4_hb, weight_ad4_elec, weight_ad4_dsolv,
                               weight_glue, weight_ad4_rot);
-            v.load_maps(maps);
+            if (vm.count("maps")) {
+                v.load_maps(maps);
 
-            // It works, but why would you do this?!
-            if (vm.count("write_maps")) v.write_maps(out_maps);
+                // It works, but why would you do this?!
+                if (vm.count("write_maps")) v.write_maps(out_maps);
+            }
         }
 
         if (vm.count("ligand")) {
             std::vector<model> ligands;
-            VINA_FOR_IN(i, ligand_names) {
-                ligands.emplace_back(parse_ligand_from_file_no_failure(
-                    ligand_names[i], v.m_scoring_function.get_atom_typing(), keep_H));
+            {
+                scoped_phase phase("ligand_parse");
+                if (conformers) {
+                    ligands = parse_ligand_conformers_from_file_no_failure(
+                        ligand_names[0], v.m_scoring_function.get_atom_typing(), keep_H);
+                    if (ligands.empty()) {
+                        std::cerr << "ERROR: Could not read the conformers of " << ligand_names[0]
+                                  << ".\n";
+                        exit(EXIT_FAILURE);
+                    }
+                    if (verbosity > 0) std::cout << "Conformers: " << ligands.size() << "\n";
+                } else {
+                    VINA_FOR_IN(i, ligand_names) {
+                        ligands.emplace_back(parse_ligand_from_file_no_failure(
+                            ligand_names[i], v.m_scoring_function.get_atom_typing(), keep_H));
+                    }
+                }
+                phase_count("ligands", ligand_names.size());
             }
-            v.set_ligand_from_object(ligands);
+            if (conformers)
+                v.set_ligand_conformers(ligands);
+            else
+                v.set_ligand_from_object(ligands);
 
             if (sf_name.compare("vina") == 0 || sf_name.compare("vinardo") == 0) {
                 if (vm.count("maps")) {
@@ -641,6 +821,18 @@ bug reporting, license agreements, and more information.      \n";
 
                     if (vm.count("write_maps")) v.write_maps(out_maps);
                 }
+            } else if (!vm.count("maps")) {
+                // Will compute AD4.2 maps only for the atom types in the ligand(s)
+                if ((score_only || local_only) && autobox) {
+                    std::vector<double> dim = v.grid_dimensions_from_ligand(buffer_size);
+                    v.compute_ad4_maps(dim[0], dim[1], dim[2], dim[3], dim[4], dim[5],
+                                       grid_spacing, force_even_voxels);
+                } else {
+                    v.compute_ad4_maps(center_x, center_y, center_z, size_x, size_y, size_z,
+                                       grid_spacing, force_even_voxels);
+                }
+
+                if (vm.count("write_maps")) v.write_maps(out_maps);
             }
 
             if (randomize_only) {
@@ -661,7 +853,7 @@ bug reporting, license agreements, and more information.      \n";
                 v.global_search(exhaustiveness, num_modes, min_rmsd, max_evals);
                 v.write_poses(out_name, num_modes, energy_range);
             }
-        } else if (vm.count("gpu_batch") || vm.count("ligand_index")) {
+        } else if (vm.count("gpu_batch") || vm.count("ligand_index") || vm.count("ligand_stream")) {
             if (randomize_only) {
                 printf("Not available under gpu_batch mode.\n");
                 return 0;
@@ -677,12 +869,79 @@ bug reporting, license agreements, and more information.      \n";
 
                     if (vm.count("write_maps")) v.write_maps(out_maps);
                 }
+            } else if (!vm.count("maps")) {
+                // Will compute AD4.2 maps for all AD4 atom types
+                v.compute_ad4_maps(center_x, center_y, center_z, size_x, size_y, size_z,
+                                   grid_spacing, force_even_voxels);
+
+                if (vm.count("write_maps")) v.write_maps(out_maps);
             }
 
+            // Extra targets are copies of v with another receptor (--ensemble) and/or another
+            // box (--sites). Results go to --dir/<target name>/ and the best target per ligand to
+            // best_targets.tsv. Targets are built one after another, each map build being
+            // parallel over z slabs, since phases are only opened from this thread; every box
+            // gets its own szv_grid because its cells are laid out over that box.
+            std::vector<std::string> target_labels;
+            std::vector<Vina> targets;  // all but the first, which is v
+            std::ofstream summary;
+            if (vm.count("ensemble") || vm.count("sites")) {
+                ensemble_names.insert(ensemble_names.begin(), rigid_name);
+                VINA_FOR_IN(r, ensemble_names) {
+                    const std::string receptor_label
+                        = make_path(ensemble_names[r]).stem().string();
+                    sz receptor_target = targets.size();  // parsed once, copied for every box
+                    VINA_FOR(s, std::max(site_labels.size(), sz(1))) {
+                        std::string label = vm.count("ensemble") ? receptor_label : "";
+                        if (vm.count("sites"))
+                            label += (label.empty() ? "" : "_") + site_labels[s];
+                        if (std::find(target_labels.begin(), target_labels.end(), label)
+                            != target_labels.end()) {
+                            std::cerr << "ERROR: Target name " << label << " is used twice.\n";
+                            exit(EXIT_FAILURE);
+                        }
+                        target_labels.push_back(label);
+                        boost::filesystem::create_directories(make_path(out_dir + "/" + label));
+                        if (r == 0 && s == 0) continue;
+                        if (s == 0) {
+                            targets.push_back(v);
+                            targets.back().set_receptor(ensemble_names[r]);
+                        } else {
+                            targets.push_back(r == 0 ? v : targets[receptor_target]);
+                        }
+                        const std::vector<double>& box
+                            = site_boxes.empty() ? std::vector<double>{center_x, center_y,
+                                                                       center_z, size_x, size_y,
+                                                                       size_z}
+                                                 : site_boxes[s];
+                        if (sf_name.compare("vina") == 0 || sf_name.compare("vinardo") == 0) {
+                            targets.back().compute_vina_maps(box[0], box[1], box[2], box[3],
+                                                             box[4], box[5], grid_spacing,
+                                                             force_even_voxels);
+                        } else {
+                            targets.back().compute_ad4_maps(box[0], box[1], box[2], box[3],
+                                                            box[4], box[5], grid_spacing,
+                                                            force_even_voxels);
+                        }
+                    }
+                }
+                const std::string summary_name = out_dir + "/best_targets.tsv";
+                summary.open(summary_name.c_str());
+                if (!summary) throw file_error(summary_name, false);
+                summary.setf(std::ios::fixed, std::ios::floatfield);
+                summary.precision(3);
+                summary << "ligand\tbest_target\tbest_affinity";
+                VINA_FOR_IN(t, target_labels) summary << '\t' << target_labels[t];
+                summary << '\n';
+            }
+            const std::string batch_dir
+                = target_labels.empty() ? out_dir : out_dir + "/" + target_labels[0];
+
             // Vina worker[2]{v,v}; // Do CPU works on one worker while GPU works on another
             // bool index = 0; // indicate which worker occupies GPU
             std::vector<std::string> ligand_names{std::move(gpu_batch_ligand_names)};
-            std::cout << "Total ligands: " << ligand_names.size() << std::endl;
+            if (!vm.count("ligand_stream"))
+                std::cout << "Total ligands: " << ligand_names.size() << std::endl;
 
             if (score_only) {
                 VINA_FOR_IN(i, ligand_names) {
@@ -699,113 +958,215 @@ bug reporting, license agreements, and more information.      \n";
                 return 0;
             }
 
-            int receptor_atom_numbers = v.m_receptor.get_atoms().size();
             int deviceCount = 0;
             size_t avail;
             size_t total;
-            float max_memory = 32000;
-            bool use_v100 = true;
-            bool ad4 = false;
-            if (sf_name.compare("ad4") == 0) ad4 = true;
+            const size_t mib = 1024 * 1024;
+            memory_footprint budget(size_t(sysconf(_SC_AVPHYS_PAGES)) * sysconf(_SC_PAGESIZE),
+                                    32000 * mib);
+            gpu_search_sizes gpu_sizes;
             cudaGetDeviceCount(&deviceCount);
             if (deviceCount > 0) {
                 cudaSetDevice(0);
                 cudaMemGetInfo(&avail, &total);
                 printf("Available Memory = %dMiB   Total Memory = %dMiB\n",
                        int(avail / 1024 / 1024), int(total / 1024 / 1024));
-                max_memory = avail / 1024 / 1024 * 0.95;  // leave 5% to prevent error
-            }
-            if (max_memory < 17000) {
-                // using T4 or other 16G global memory GPU
-                use_v100 = false;
-            }
-            if (max_gpu_memory > 0 && max_gpu_memory < max_memory) {
-                max_memory = (float)max_gpu_memory;
-            }
-
-            typedef std::pair<std::string, model> named_model;
-            std::vector<named_model> all_ligands;
-            const int ligand_batch_limit = 1e6;  // ~20GB for 100,000 lig obj
-            int batch_index = 0;
-            while (batch_index < ligand_names.size()) {
-                all_ligands.clear();
-                int next_batch_index
-                    = std::min(int(batch_index + ligand_batch_limit), int(ligand_names.size()));
-#pragma omp parallel for
-                for (int ligand_count = batch_index; ligand_count < next_batch_index;
-                     ++ligand_count) {
-                    auto& ligand = ligand_names[ligand_count];
-                    auto l = parse_ligand_from_file_no_failure(
-                        ligand, v.m_scoring_function.get_atom_typing(), keep_H);
-#pragma omp critical
-                    all_ligands.emplace_back(std::make_pair(ligand, l));
+                budget.device = avail / 100 * 95;  // leave 5% to prevent error
+                gpu_sizes = query_gpu_search_sizes();
+            }
+            if (max_gpu_memory > 0 && max_gpu_memory * mib < budget.device) {
+                budget.device = max_gpu_memory * mib;
+            }
+            if (max_host_memory > 0) budget.host = max_host_memory * mib;
+            const igrid& grids = sf_name.compare("ad4") == 0
+                                     ? static_cast<const igrid&>(v.m_ad4grid)
+                                     : static_cast<const igrid&>(v.m_grid);
+            batch_memory_planner planner(v.m_receptor, grids, v.m_scoring_function, exhaustiveness,
+                                         num_modes, v.multi_bias, gpu_sizes, budget);
+            VINA_FOR_IN(t, targets) {
+                planner.add_target(targets[t].m_receptor,
+                                   sf_name.compare("ad4") == 0
+                                       ? static_cast<const igrid&>(targets[t].m_ad4grid)
+                                       : static_cast<const igrid&>(targets[t].m_grid));
+            }
+
+            // Ligands come in order from the files or the stream; a batch is launched as soon as
+            // the next ligand would take it over the host or device budget, or the input ends
+            int stream_fd = STDIN_FILENO;
+            if (vm.count("ligand_stream") && ligand_stream_name != "-") {
+                stream_fd = open(ligand_stream_name.c_str(), O_RDONLY);
+                if (stream_fd < 0) throw file_error(ligand_stream_name, true);
+            }
+            std::unique_ptr<ligand_source> ligands;  // stops reading before stream_fd is closed
+            if (vm.count("ligand_stream")) {
+                ligands.reset(new ligand_stream(stream_fd, stream_format == "sdf",
+                                                v.m_scoring_function.get_atom_typing(), keep_H,
+                                                v.m_cpu));
+            } else {
+                ligands.reset(new ligand_file_source(
+                    ligand_names, v.m_scoring_function.get_atom_typing(), keep_H));
+            }
+
+            named_model next_ligand;
+            bool more = ligands->next(next_ligand);
+            int batch_id = 0;
+            while (more) {
+                ++batch_id;
+                auto start = std::chrono::system_clock::now();
+                Vina v1(v);  // reuse init'ed maps
+                std::vector<model> batch_ligands;  // ligands in current batch
+                std::vector<std::string> batch_ligand_names;
+                v1.bias_batch_list.clear();
+                planner.clear();
+                while (more && planner.add(next_ligand.second)) {
+                    batch_ligand_names.push_back(next_ligand.first);
+                    batch_ligands.emplace_back(std::move(next_ligand.second));
+                    more = ligands->next(next_ligand);
                 }
-                batch_index = next_batch_index;
-                /*
-                std::sort(all_ligands.begin(), all_ligands.end(),
-                          [](named_model a, named_model b)
-                          { return a.second.get_atoms().size() < b.second.get_atoms().size(); });
-                */
-                DEBUG_PRINTF("%d\n", next_batch_index);
-                int processed_ligands = 0;
-                int batch_id = 0;
-                while (processed_ligands < all_ligands.size()) {
-                    ++batch_id;
-                    auto start = std::chrono::system_clock::now();
-                    Vina v1(v);  // reuse init'ed maps
-                    int batch_size = 0;
-                    int all_atom2_numbers = 0;         // total number of atom^2 in current batch
-                    std::vector<model> batch_ligands;  // ligands in current batch
-                    v1.bias_batch_list.clear();
-                    while (predict_peak_memory(batch_size, exhaustiveness, all_atom2_numbers,
-                                               use_v100, v.multi_bias)
-                               < max_memory
-                           && processed_ligands + batch_size < all_ligands.size()) {
-                        batch_ligands.emplace_back(
-                            all_ligands[processed_ligands + batch_size].second);
-                        int next_atom_numbers
-                            = batch_ligands.back().get_atoms().size() + receptor_atom_numbers;
-                        int next_atom2_numbers
-                            = next_atom_numbers * next_atom_numbers;  // Memory ~ atom numbers^2
-                        all_atom2_numbers += next_atom2_numbers;
-                        batch_size++;
-                    }
-                    DEBUG_PRINTF("batch size=%d, all_atom2_numbers=%d\n", batch_size,
-                                 all_atom2_numbers);
+                const int batch_size = batch_ligands.size();
+                const batch_memory_plan& plan = planner.plan();
+                if (!plan.total().fits(budget)) {
+                    std::cerr << "WARNING: " << batch_ligand_names[0]
+                              << " alone exceeds the memory budget.\n";
+                }
+
+                std::cout << "Batch " << batch_id << " size: " << batch_size << std::endl;
+                printf("Batch %d memory: host %dMiB (%dMiB fixed) of %dMiB, device %dMiB "
+                       "(%dMiB fixed) of %dMiB\n",
+                       batch_id, int(plan.total().host / mib), int(plan.fixed.host / mib),
+                       int(budget.host / mib), int(plan.total().device / mib),
+                       int(plan.fixed.device / mib), int(budget.device / mib));
+                scoped_batch batch_phase(batch_id, batch_size);
+                gpu_out_name = {};
+                VINA_RANGE(i, 0, batch_ligand_names.size()) {
+                    gpu_out_name.push_back(
+                        default_output(get_filename(batch_ligand_names[i]), batch_dir));
+                    if (v1.multi_bias) {
+                        std::ifstream bias_file_content(get_biasname(batch_ligand_names[i]));
+                        if (!bias_file_content.is_open()) {
+                            throw file_error(bias_file, true);
+                        }
 
-                    std::cout << "Batch " << batch_id << " size: " << batch_size << std::endl;
-                    std::vector<std::string> batch_ligand_names;
-                    for (int i = processed_ligands; i < processed_ligands + batch_size; i++) {
-                        batch_ligand_names.push_back(all_ligands[i].first);
+                        // initialize bias object
+                        v1.set_batch_bias(bias_file_content);
+                        bias_file_content.close();
                     }
-                    processed_ligands += batch_size;
-                    gpu_out_name = {};
-                    VINA_RANGE(i, 0, batch_ligand_names.size()) {
-                        gpu_out_name.push_back(
-                            default_output(get_filename(batch_ligand_names[i]), out_dir));
-                        if (v1.multi_bias) {
-                            std::ifstream bias_file_content(get_biasname(batch_ligand_names[i]));
-                            if (!bias_file_content.is_open()) {
-                                throw file_error(bias_file, true);
-                            }
-
-                            // initialize bias object
-                            v1.set_batch_bias(bias_file_content);
-                            bias_file_content.close();
+                }
+                v1.set_ligand_from_object_gpu(batch_ligands);
+                v1.global_search_gpu(exhaustiveness, num_modes, min_rmsd, max_evals, max_step,
+                                     batch_ligand_names.size(), (unsigned long long)seed,
+                                     refine_step, local_only);
+                v1.write_poses_gpu(gpu_out_name, num_modes, energy_range);
+                if (!target_labels.empty()) {
+                    // Same ligands on the other targets: the precalculated tables copied back by
+                    // the first search are uploaded again instead of being recomputed
+                    std::vector<flv> top_energies(target_labels.size(),
+                                                  flv(batch_ligand_names.size(), max_fl));
+                    VINA_FOR_IN(i, batch_ligand_names) {
+                        if (!v1.m_poses_gpu[i].empty())
+                            top_energies[0][i] = v1.m_poses_gpu[i][0].e;
+                    }
+                    VINA_FOR_IN(t, targets) {
+                        Vina& v2 = targets[t];  // docked in place, its maps are not copied
+                        v2.bias_batch_list = v1.bias_batch_list;
+                        v2.set_ligand_from_object_gpu(batch_ligands,
+                                                      &v1.m_precalculated_byatom_gpu);
+                        v2.global_search_gpu(exhaustiveness, num_modes, min_rmsd, max_evals,
+                                             max_step, batch_ligand_names.size(),
+                                             (unsigned long long)seed, refine_step, local_only);
+                        std::vector<std::string> target_out_name;
+                        VINA_FOR_IN(i, batch_ligand_names) {
+                            target_out_name.push_back(
+                                default_output(get_filename(batch_ligand_names[i]),
+                                               out_dir + "/" + target_labels[t + 1]));
+                            if (!v2.m_poses_gpu[i].empty())
+                                top_energies[t + 1][i] = v2.m_poses_gpu[i][0].e;
+                        }
+                        v2.write_poses_gpu(target_out_name, num_modes, energy_range);
+                        v2.clear_ligands_gpu();  // one target at a time holds a batch
+                    }
+                    VINA_FOR_IN(i, batch_ligand_names) {
+                        sz best = 0;
+                        VINA_FOR_IN(t, top_energies) {
+                            if (top_energies[t][i] < top_energies[best][i]) best = t;
+                        }
+                        summary << get_filename(batch_ligand_names[i]);
+                        if (not_max(top_energies[best][i]))
+                            summary << '\t' << target_labels[best] << '\t' << top_energies[best][i];
+                        else
+                            summary << "\tNA\tNA";
+                        VINA_FOR_IN(t, top_energies) {
+                            if (not_max(top_energies[t][i]))
+                                summary << '\t' << top_energies[t][i];
+                            else
+                                summary << "\tNA";
                         }
+                        summary << '\n';
+                    }
+                    summary.flush();
+                }
+                auto end = std::chrono::system_clock::now();
+                std::cout << "Batch " << batch_id << " running time: "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+                                 .count()
+                          << "ms" << std::endl;
+            }
+            ligands.reset();
+            if (stream_fd != STDIN_FILENO) close(stream_fd);
+        } else if (vm.count("batch")) {
+            if (randomize_only) {
+                printf("Not available under batch mode.\n");
+                return 0;
+            }
+            if (sf_name.compare("vina") == 0 || sf_name.compare("vinardo") == 0) {
+                if (vm.count("maps")) {
+                    v.load_maps(maps);
+                } else {
+                    // Will compute maps for all Vina atom types
+                    v.compute_vina_maps(center_x, center_y, center_z, size_x, size_y, size_z,
+                                        grid_spacing, force_even_voxels);
+
+                    if (vm.count("write_maps")) v.write_maps(out_maps);
+                }
+            } else if (!vm.count("maps")) {
+                // Will compute AD4.2 maps for all AD4 atom types
+                v.compute_ad4_maps(center_x, center_y, center_z, size_x, size_y, size_z,
+                                   grid_spacing, force_even_voxels);
+
+                if (vm.count("write_maps")) v.write_maps(out_maps);
+            }
+
+            if (score_only || local_only) {
+                // Placed poses, one after another on the same maps; with --autobox each one
+                // only sees the window of the maps around it
+                VINA_FOR_IN(i, batch_ligand_names) {
+                    std::vector<model> ligands;
+                    ligands.emplace_back(parse_ligand_from_file_no_failure(
+                        batch_ligand_names[i], v.m_scoring_function.get_atom_typing(), keep_H));
+                    v.set_ligand_from_object(ligands);
+                    if (autobox) v.set_autobox_window(buffer_size);
+                    std::vector<double> energies;
+                    if (score_only) {
+                        energies = v.score();
+                        v.show_score(energies);
+                        v.write_score_to_file(energies, out_dir, score_file,
+                                              batch_ligand_names[i]);
+                    } else {
+                        energies = v.optimize();
+                        v.write_pose(default_output(get_filename(batch_ligand_names[i]), out_dir));
+                        v.show_score(energies);
                     }
-                    v1.set_ligand_from_object_gpu(batch_ligands);
-                    v1.global_search_gpu(exhaustiveness, num_modes, min_rmsd, max_evals, max_step,
-                                         batch_ligand_names.size(), (unsigned long long)seed,
-                                         refine_step, local_only);
-                    v1.write_poses_gpu(gpu_out_name, num_modes, energy_range);
-                    auto end = std::chrono::system_clock::now();
-                    std::cout << "Batch " << batch_id << " running time: "
-                              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
-                                     .count()
-                              << "ms" << std::endl;
                 }
+                return 0;
             }
+
+            // search all ligands on cpu, (ligand x chain) tasks over all cpus
+            std::vector<std::string> out_names;
+            VINA_FOR_IN(i, batch_ligand_names) {
+                out_names.push_back(default_output(get_filename(batch_ligand_names[i]), out_dir));
+            }
+            v.global_search_batch(batch_ligand_names, out_names, exhaustiveness, num_modes,
+                                  min_rmsd, max_evals, num_modes, energy_range, keep_H);
         }
     }
 
@@ -819,6 +1180,10 @@ bug reporting, license agreements, and more information.      \n";
     } catch (usage_error& e) {
         std::cerr << "\n\nUsage error: " << e.what() << ".\n";
         return 1;
+    } catch (stream_error& e) {
+        std::cerr << "\n\nError: could not read the ligand stream: " << std::strerror(e.errnum)
+                  << ".\n";
+        return 1;
     }
 #ifdef NDEBUG  // don't catch in debug mode
     catch (std::bad_alloc&) {
@@ -0,0 +1,228 @@
+/*
+
+   This file is part of Uni-Dock, licensed under the GNU Lesser General Public License v3.0.
+   See LICENSE in the unidock directory for details.
+
+*/
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <boost/filesystem.hpp>
+
+#include "vina.h"
+#include "parse_pdbqt.h"
+#include "parse_error.h"
+#include "file.h"
+
+// In-process docking for Python. An Engine keeps the receptor and maps resident; ligands come in
+// as PDBQT blocks and results go out as NumPy arrays that own the C++ buffers, so a screening
+// loop never goes through files. Vina reports misuse with exit(), which would take the
+// interpreter down, so every such condition is checked here first and raised as a Python error.
+namespace py = pybind11;
+
+namespace {
+
+// Moves v into a NumPy array of the given shape; the array frees it
+template <typename T> py::array_t<T> to_numpy(std::vector<T>& v, std::vector<py::ssize_t> shape) {
+    std::vector<T>* owned = new std::vector<T>();
+    owned->swap(v);
+    py::capsule base(owned, [](void* p) { delete static_cast<std::vector<T>*>(p); });
+    return py::array_t<T>(shape, owned->data(), base);
+}
+
+// Poses of a batch, flattened: ligand l owns poses [pose_offsets[l], pose_offsets[l + 1]) and
+// pose p owns atoms [atom_offsets[p], atom_offsets[p + 1])
+struct batch_poses {
+    std::vector<double> coords;    // [atom][3], ligand atoms only
+    std::vector<double> energies;  // [pose][5], as Vina::get_poses_energies
+    std::vector<long long> atom_offsets;
+    std::vector<long long> pose_offsets;
+    batch_poses() : atom_offsets(1, 0), pose_offsets(1, 0) {}
+
+    // same selection as Vina::get_poses: at most how_many, within energy_range of the best
+    void add(model& m, const output_container& poses, int how_many, double energy_range) {
+        VINA_FOR_IN(i, poses) {
+            if (int(i) >= how_many || !not_max(poses[i].e)
+                || poses[i].e > poses[0].e + energy_range)
+                break;
+            m.set(poses[i].c);
+            const std::vector<double> c = m.get_ligand_coords();
+            coords.insert(coords.end(), c.begin(), c.end());
+            atom_offsets.push_back(coords.size() / 3);
+            const double e[] = {poses[i].e, poses[i].inter, poses[i].intra,
+                                poses[i].conf_independent, poses[i].unbound};
+            energies.insert(energies.end(), e, e + 5);
+        }
+        if (!poses.empty()) m.set(poses[0].c);
+        pose_offsets.push_back(atom_offsets.size() - 1);
+    }
+    void skip() { pose_offsets.push_back(atom_offsets.size() - 1); }  // failed ligand, no poses
+
+    py::dict to_dict() {
+        const py::ssize_t n_atoms = coords.size() / 3;
+        const py::ssize_t n_poses = energies.size() / 5;
+        const py::ssize_t n_atom_offsets = atom_offsets.size();
+        const py::ssize_t n_pose_offsets = pose_offsets.size();
+        py::dict d;
+        d["coords"] = to_numpy(coords, {n_atoms, 3});
+        d["energies"] = to_numpy(energies, {n_poses, 5});
+        d["atom_offsets"] = to_numpy(atom_offsets, {n_atom_offsets});
+        d["pose_offsets"] = to_numpy(pose_offsets, {n_pose_offsets});
+        return d;
+    }
+};
+
+class engine {
+public:
+    engine(const std::string& scoring, int cpu, int seed, int verbosity, bool gpu)
+        : m_v(scoring, cpu, seed, verbosity) {
+        if (gpu) m_v.enable_gpu();
+    }
+    void set_receptor(const std::string& rigid, const std::string& flex) {
+        if (rigid.empty() && flex.empty() && m_v.m_sf_choice == SF_VINA)
+            throw py::value_error("no rigid receptor or flexible residues were specified");
+        py::gil_scoped_release release;
+        m_v.set_receptor(
+            parse_receptor_pdbqt_no_failure(rigid, flex, m_v.m_scoring_function.get_atom_typing()));
+    }
+    // maps for every atom type of the scoring function, so any ligand can be docked later
+    void compute_maps(const std::vector<double>& center, const std::vector<double>& size,
+                      double spacing) {
+        if (center.size() != 3 || size.size() != 3)
+            throw py::value_error("center and size need 3 values each");
+        if (size[0] <= 0 || size[1] <= 0 || size[2] <= 0)
+            throw py::value_error("box dimensions must be greater than 0 Angstrom");
+        if (!m_v.m_receptor_initialized
+            || (m_v.m_sf_choice == SF_AD42 && m_v.m_receptor.grid_atoms.empty()))
+            throw py::value_error("set_receptor first");
+        py::gil_scoped_release release;
+        if (m_v.m_sf_choice == SF_AD42)
+            m_v.compute_ad4_maps(center[0], center[1], center[2], size[0], size[1], size[2],
+                                 spacing);
+        else
+            m_v.compute_vina_maps(center[0], center[1], center[2], size[0], size[1], size[2],
+                                  spacing);
+    }
+    void load_maps(const std::string& prefix) {
+        if (!has_maps(prefix)) throw py::value_error("no *.map files with prefix " + prefix);
+        py::gil_scoped_release release;
+        m_v.load_maps(prefix);
+    }
+
+    py::dict dock(const std::vector<std::string>& ligands, int exhaustiveness, int n_poses,
+                  double min_rmsd, int max_evals, double energy_range, int max_step,
+                  int refine_step) {
+        if (!m_v.m_map_initialized) throw py::value_error("compute_maps or load_maps first");
+        if (exhaustiveness < 1) throw py::value_error("exhaustiveness must be 1 or greater");
+        if (m_v.gpu && ligands.size() > MAX_LIGAND_NUM)
+            throw py::value_error("too many ligands for one GPU batch");
+        batch_poses out;
+        if (ligands.empty()) return out.to_dict();
+        {
+            py::gil_scoped_release release;
+            if (m_v.gpu)
+                dock_gpu(ligands, exhaustiveness, n_poses, min_rmsd, max_evals, energy_range,
+                         max_step, refine_step, out);
+            else
+                dock_cpu(ligands, exhaustiveness, n_poses, min_rmsd, max_evals, energy_range,
+                         out);
+        }
+        return out.to_dict();
+    }
+
+private:
+    static bool has_maps(const std::string& prefix) {
+        namespace fs = boost::filesystem;
+        const fs::path p(prefix);
+        const fs::path dir = p.has_parent_path() ? p.parent_path() : fs::path(".");
+        const std::string stem = p.filename().string() + ".";
+        if (!fs::is_directory(dir)) return false;
+        for (fs::directory_iterator it(dir), end; it != end; ++it) {
+            const std::string name = it->path().filename().string();
+            if (name.size() > stem.size() + 4 && name.compare(0, stem.size(), stem) == 0
+                && name.compare(name.size() - 4, 4, ".map") == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // parsed ligand, or an empty model (skipped) if it can't be parsed or has no map for an atom
+    // type: Vina would exit on the latter
+    model parse_ligand(const std::string& ligand) {
+        const atom_type::t atom_typing = m_v.m_scoring_function.get_atom_typing();
+        model m = parse_ligand_pdbqt_from_string_no_failure(ligand, atom_typing);
+        if (m.num_ligands() == 0) return m;
+        const szv atom_types = m.get_movable_atom_types(atom_typing);
+        const bool mapped = m_v.m_sf_choice == SF_AD42
+                                ? m_v.m_ad4grid.are_atom_types_grid_initialized(atom_types)
+                                : m_v.m_grid.are_atom_types_grid_initialized(atom_types);
+        return mapped ? m : model(atom_typing);
+    }
+
+    void dock_cpu(const std::vector<std::string>& ligands, int exhaustiveness, int n_poses,
+                  double min_rmsd, int max_evals, double energy_range, batch_poses& out) {
+        VINA_FOR_IN(i, ligands) {
+            std::vector<model> ligand(1, parse_ligand(ligands[i]));
+            if (ligand[0].num_ligands() == 0) {
+                out.skip();
+                continue;
+            }
+            m_v.set_ligand_from_object(ligand);
+            m_v.global_search(exhaustiveness, n_poses, min_rmsd, max_evals);
+            out.add(m_v.m_model, m_v.m_poses, n_poses, energy_range);
+        }
+    }
+
+    void dock_gpu(const std::vector<std::string>& ligands, int exhaustiveness, int n_poses,
+                  double min_rmsd, int max_evals, double energy_range, int max_step,
+                  int refine_step, batch_poses& out) {
+        // one kernel launch per call, split larger screens on the Python side; Vina replaces the
+        // models and poses of the previous call
+        std::vector<model> models;
+        models.reserve(ligands.size());
+        VINA_FOR_IN(i, ligands) models.push_back(parse_ligand(ligands[i]));
+        m_v.set_ligand_from_object_gpu(models);
+        m_v.global_search_gpu(exhaustiveness, n_poses, min_rmsd, max_evals, max_step,
+                              ligands.size(), (unsigned long long)m_v.seed(), refine_step);
+        VINA_FOR_IN(i, ligands) {
+            if (m_v.m_model_gpu[i].num_ligands() == 0)
+                out.skip();
+            else
+                out.add(m_v.m_model_gpu[i], m_v.m_poses_gpu[i], n_poses, energy_range);
+        }
+    }
+
+    Vina m_v;
+};
+
+}  // namespace
+
+PYBIND11_MODULE(unidock_core, m) {
+    m.doc() = "In-process Uni-Dock: resident receptor and maps, ligands from memory";
+    py::register_exception_translator([](std::exception_ptr p) {
+        try {
+            if (p) std::rethrow_exception(p);
+        } catch (const file_error& e) {
+            PyErr_SetString(PyExc_OSError, ("cannot open " + e.name.string()).c_str());
+        } catch (const struct_parse_error& e) {
+            PyErr_SetString(PyExc_ValueError, e.what());
+        }
+    });
+    py::class_<engine>(m, "Engine")
+        .def(py::init<const std::string&, int, int, int, bool>(), py::arg("scoring") = "vina",
+             py::arg("cpu") = 0, py::arg("seed") = 0, py::arg("verbosity") = 0,
+             py::arg("gpu") = false)
+        .def("set_receptor", &engine::set_receptor, py::arg("rigid"),
+             py::arg("flex") = std::string(), "Parse the receptor PDBQT file(s) once")
+        .def("compute_maps", &engine::compute_maps, py::arg("center"), py::arg("size"),
+             py::arg("spacing") = 0.375, "Compute maps for all atom types in a box")
+        .def("load_maps", &engine::load_maps, py::arg("prefix"))
+        .def("dock", &engine::dock, py::arg("ligands"), py::arg("exhaustiveness") = 8,
+             py::arg("n_poses") = 9, py::arg("min_rmsd") = 1.0, py::arg("max_evals") = 0,
+             py::arg("energy_range") = 3.0, py::arg("max_step") = 0, py::arg("refine_step") = 5,
+             "Dock PDBQT blocks against the resident maps. Returns a dict of NumPy arrays: "
+             "coords [atom, 3], energies [pose, 5] (total, inter, intra, torsion, unbound), "
+             "atom_offsets [pose + 1] and pose_offsets [ligand + 1].");
+}
@@ -0,0 +1,241 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <boost/program_options.hpp>
+
+#include "vina.h"
+#include "phase_report.h"
+#include "parse_pdbqt.h"
+
+// End-to-end CPU docking benchmark: a fixed workload (redocking of the bundled 1iep and 1a30
+// systems plus synthetic chains of controlled size and torsion count) run with fixed seeds and
+// reported as JSON. Bump workload_version whenever a case or parameter changes.
+#ifndef UNIDOCK_TEST_DIR
+#    define UNIDOCK_TEST_DIR "."
+#endif
+
+namespace {
+
+const char* const workload_version = "2";
+const fl redock_success_rmsd = 2.0;  // Angstrom, heavy atoms of the top pose vs. crystal pose
+
+struct docking_case {
+    std::string name;
+    std::string receptor;
+    std::vector<std::string> ligands;  // file names, or PDBQT text if synthetic
+    bool synthetic;
+    bool redock;      // ligand input is the crystal pose
+    bool autobox;     // box from the ligand, otherwise center/size below
+    double center[3];
+    double size;
+};
+
+struct case_result {
+    sz ligands;
+    double seconds;
+    unsigned long long evals;
+    double best_energy;  // of the last ligand
+    double rmsd;         // redocking only
+    case_result() : ligands(0), seconds(0), evals(0), best_energy(0), rmsd(-1) {}
+};
+
+// Zigzag carbon chain with the last `torsions` bonds rotatable, centered on `center`
+std::string synthetic_chain(sz atoms, sz torsions, const double* center) {
+    VINA_CHECK(atoms >= torsions + 3);
+    const sz root_atoms = atoms - torsions - 1;
+    const double step = 1.26;  // 1.54 A bonds at a tetrahedral angle
+    std::ostringstream out;
+    char line[128];
+    VINA_FOR(i, atoms) {
+        if (i == 0) out << "ROOT\n";
+        if (i == root_atoms) out << "ENDROOT\n";
+        if (i >= root_atoms && i < atoms - 1) {
+            std::snprintf(line, sizeof(line), "BRANCH %4lu %4lu\n", (unsigned long)i,
+                          (unsigned long)(i + 1));
+            out << line;
+        }
+        std::snprintf(line, sizeof(line),
+                      "ATOM  %5lu  C   LIG L   1    %8.3f%8.3f%8.3f  1.00  0.00     0.000 C \n",
+                      (unsigned long)(i + 1), center[0] + step * (i - (atoms - 1) / 2.0),
+                      center[1] + (i % 2) * 0.89, center[2]);
+        out << line;
+    }
+    for (sz i = atoms - 1; i > root_atoms; --i) {
+        std::snprintf(line, sizeof(line), "ENDBRANCH %4lu %4lu\n", (unsigned long)(i - 1),
+                      (unsigned long)i);
+        out << line;
+    }
+    out << "TORSDOF " << torsions << '\n';
+    return out.str();
+}
+
+std::vector<docking_case> workload(const std::string& dir) {
+    std::vector<docking_case> cases;
+    docking_case c;
+    c.synthetic = false;
+    c.redock = true;
+
+    c.name = "redock_1iep";
+    c.receptor = dir + "/receptor/1iep_receptor.pdbqt";
+    c.ligands.assign(1, dir + "/ligands/1iep_ligand.pdbqt");
+    c.autobox = false;
+    c.center[0] = 15.19;
+    c.center[1] = 53.903;
+    c.center[2] = 16.917;
+    c.size = 20;
+    cases.push_back(c);
+
+    c.name = "redock_1a30";
+    c.receptor = dir + "/receptor/1a30_protein.pdbqt";
+    c.ligands.assign(1, dir + "/ligands/1a30_ligand.sdf");
+    c.autobox = true;
+    cases.push_back(c);
+
+    // synthetic sets in the 1iep pocket: {atoms, torsions}, 4 ligands each
+    const sz shapes[][2] = {{8, 1}, {16, 4}, {24, 8}};
+    c = cases[0];
+    c.synthetic = true;
+    c.redock = false;
+    c.size = 24;
+    VINA_FOR(s, sizeof(shapes) / sizeof(shapes[0])) {
+        std::ostringstream name;
+        name << "synthetic_" << shapes[s][0] << "atoms_" << shapes[s][1] << "torsions";
+        c.name = name.str();
+        c.ligands.assign(4, synthetic_chain(shapes[s][0], shapes[s][1], c.center));
+        cases.push_back(c);
+    }
+    return cases;
+}
+
+void set_ligand(Vina& v, const docking_case& c, sz i) {
+    if (c.synthetic) {
+        v.set_ligand_from_string(c.ligands[i]);
+    } else {  // PDBQT or SDF
+        std::vector<model> ligand(
+            1, parse_ligand_from_file_no_failure(c.ligands[i],
+                                                 v.m_scoring_function.get_atom_typing()));
+        v.set_ligand_from_object(ligand);
+    }
+}
+
+// The receptor and its maps are set up once per case, outside the timed loop; each ligand is
+// timed from parsing to the end of its search
+case_result run_case(const docking_case& c, sz index, int cpu, int exhaustiveness, int seed,
+                     bool lockstep_chains, bool spread_starts) {
+    scoped_batch batch(index, c.ligands.size());
+    case_result r;
+    Vina v("vina", cpu, seed, 0);
+    if (lockstep_chains) v.enable_lockstep_chains();
+    if (spread_starts) v.enable_spread_starts();
+    v.set_receptor(c.receptor);
+    if (c.autobox) {  // the box of the first ligand, maps for its atom types
+        VINA_CHECK(c.ligands.size() == 1);
+        set_ligand(v, c, 0);
+        std::vector<double> dim = v.grid_dimensions_from_ligand();
+        v.compute_vina_maps(dim[0], dim[1], dim[2], dim[3], dim[4], dim[5]);
+    } else {  // no ligand yet: maps for every atom type
+        v.compute_vina_maps(c.center[0], c.center[1], c.center[2], c.size, c.size, c.size);
+    }
+    VINA_FOR_IN(i, c.ligands) {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        set_ligand(v, c, i);
+        const vecv crystal = v.m_model.get_heavy_atom_movable_coords();
+        v.global_search(exhaustiveness, 9);
+        r.seconds
+            += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ++r.ligands;
+        r.evals += v.m_search_stats.evals;
+        if (v.m_poses.empty()) continue;
+        r.best_energy = v.m_poses[0].e;
+        if (c.redock) r.rmsd = rmsd_upper_bound(crystal, v.m_poses[0].coords);
+    }
+    return r;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    using namespace boost::program_options;
+    std::string out_name;
+    std::string test_dir = UNIDOCK_TEST_DIR;
+    int cpu = 0;
+    int exhaustiveness = 8;
+    int seed = 42;
+    bool lockstep_chains = false;
+    bool spread_starts = false;
+
+    options_description desc("Uni-Dock end-to-end CPU benchmark");
+    desc.add_options()("out", value<std::string>(&out_name), "JSON report (default: stdout)")(
+        "test_dir", value<std::string>(&test_dir), "directory with receptor/ and ligands/")(
+        "cpu", value<int>(&cpu)->default_value(0), "number of CPUs (0: all)")(
+        "exhaustiveness", value<int>(&exhaustiveness)->default_value(8),
+        "exhaustiveness of every search")("seed", value<int>(&seed)->default_value(42),
+                                         "random seed of every search")(
+        "lockstep_chains", bool_switch(&lockstep_chains),
+        "run the chains in lockstep groups (see lockstep_mc.h) instead of one per thread")(
+        "spread_starts", bool_switch(&spread_starts),
+        "start the chains from spread_starts (see start_sampling.h) instead of at random")(
+        "help", "print this");
+    variables_map vm;
+    try {
+        store(parse_command_line(argc, argv, desc), vm);
+        notify(vm);
+    } catch (boost::program_options::error& e) {
+        std::cerr << "Command line parse error: " << e.what() << "\n\n" << desc << '\n';
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << '\n';
+        return 0;
+    }
+
+    phase_report::get().enable();
+    const std::vector<docking_case> cases = workload(test_dir);
+    std::ostringstream out;
+    sz redocked = 0;
+    sz redock_successes = 0;
+    sz total_ligands = 0;
+    double total_seconds = 0;
+    out << "{\n  \"workload_version\": \"" << workload_version << "\",\n  \"cpu\": " << cpu
+        << ",\n  \"exhaustiveness\": " << exhaustiveness << ",\n  \"seed\": " << seed
+        << ",\n  \"lockstep_chains\": " << (lockstep_chains ? "true" : "false")
+        << ",\n  \"spread_starts\": " << (spread_starts ? "true" : "false")
+        << ",\n  \"cases\": [";
+    VINA_FOR_IN(i, cases) {
+        const docking_case& c = cases[i];
+        std::cerr << "Running " << c.name << " (" << c.ligands.size() << " ligands)\n";
+        const case_result r
+            = run_case(c, i, cpu, exhaustiveness, seed, lockstep_chains, spread_starts);
+        total_ligands += r.ligands;
+        total_seconds += r.seconds;
+        out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << c.name
+            << "\", \"ligands\": " << r.ligands << ", \"seconds\": " << r.seconds
+            << ", \"ligands_per_second\": " << r.ligands / r.seconds << ", \"evals\": " << r.evals
+            << ", \"evals_per_second\": " << r.evals / r.seconds
+            << ", \"best_energy\": " << r.best_energy;
+        if (c.redock) {
+            const bool success = r.rmsd >= 0 && r.rmsd < redock_success_rmsd;
+            ++redocked;
+            if (success) ++redock_successes;
+            out << ", \"rmsd\": " << r.rmsd << ", \"success\": " << (success ? "true" : "false");
+        }
+        out << '}';
+    }
+    out << "\n  ],\n  \"ligands_per_second\": " << total_ligands / total_seconds
+        << ",\n  \"redock_success_rate\": " << double(redock_successes) / redocked
+        << ",\n  \"phase_report\": ";
+    phase_report::get().write(out);
+    out << "}\n";
+
+    if (out_name.empty()) {
+        std::cout << out.str();
+    } else {
+        std::ofstream f(out_name.c_str());
+        if (!f) {
+            std::cerr << "ERROR: Cannot write " << out_name << ".\n";
+            return 1;
+        }
+        f << out.str();
+    }
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include <benchmark/benchmark.h>
+
+#include "vina.h"
+#include "bfgs.h"
+#include "lockstep_mc.h"
+#include "parse_pdbqt.h"
+
+// CPU microbenchmarks of the scoring hot paths on the bundled 1iep system. Run from test/ or
+// build with UNIDOCK_TEST_DIR pointing at it (the CMake target does).
+#ifndef UNIDOCK_TEST_DIR
+#    define UNIDOCK_TEST_DIR "."
+#endif
+
+namespace {
+
+const std::string test_dir(UNIDOCK_TEST_DIR);
+const std::string receptor_pdbqt = test_dir + "/receptor/1iep_receptor.pdbqt";
+const std::string ligand_pdbqt = test_dir + "/ligands/1iep_ligand.pdbqt";
+const std::string ligand_sdf = test_dir + "/ligands/1a30_ligand.sdf";
+const vec authentic_v(1000, 1000, 1000);
+
+// Receptor, ligand and 20 A maps, built once and shared read-only by all benchmarks
+struct scoring_fixture {
+    Vina v;
+    scoring_fixture() : v("vina", 1, 42, 0) {
+        v.set_receptor(receptor_pdbqt);
+        v.set_ligand_from_file(ligand_pdbqt);
+        v.compute_vina_maps(15.19, 53.903, 16.917, 20, 20, 20);
+    }
+};
+
+const scoring_fixture& fixture() {
+    static const scoring_fixture f;
+    return f;
+}
+
+struct bfgs_aux {
+    model* m;
+    const precalculate_byatom* p;
+    const igrid* ig;
+    fl operator()(const conf& c, change& g) {
+        m->set(c);
+        return m->eval_deriv(*p, *ig, authentic_v, g);
+    }
+};
+
+void BM_grid_evaluate(benchmark::State& state) {
+    const Vina& v = fixture().v;
+    const model& m = v.m_model;
+    vec deriv;
+    for (auto _ : state) {
+        fl e = 0;
+        VINA_FOR(i, m.num_movable_atoms()) {
+            const sz t = m.atoms[i].get(atom_type::XS);
+            if (t >= v.m_grid.m_grids.size() || !v.m_grid.m_grids[t].initialized()) continue;
+            e += v.m_grid.m_grids[t].evaluate(m.coords[i], 1e6, authentic_v[1], deriv);
+        }
+        benchmark::DoNotOptimize(e);
+    }
+    state.SetItemsProcessed(state.iterations() * m.num_movable_atoms());
+}
+BENCHMARK(BM_grid_evaluate);
+
+void BM_cache_eval_deriv(benchmark::State& state) {
+    const Vina& v = fixture().v;
+    model m = v.m_model;
+    for (auto _ : state) benchmark::DoNotOptimize(v.m_grid.eval_deriv(m, authentic_v[1]));
+}
+BENCHMARK(BM_cache_eval_deriv);
+
+void BM_non_cache_eval_deriv(benchmark::State& state) {
+    const Vina& v = fixture().v;
+    model m = v.m_model;
+    for (auto _ : state) benchmark::DoNotOptimize(v.m_non_cache.eval_deriv(m, authentic_v[1]));
+}
+BENCHMARK(BM_non_cache_eval_deriv);
+
+void BM_model_set(benchmark::State& state) {
+    model m = fixture().v.m_model;
+    const conf c = m.get_initial_conf();
+    for (auto _ : state) {
+        m.set(c);
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_model_set);
+
+void BM_eval_interacting_pairs_deriv(benchmark::State& state) {
+    const Vina& v = fixture().v;
+    model m = v.m_model;
+    const interacting_pairs& pairs = m.ligands[0].pairs;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(eval_interacting_pairs_deriv(
+            v.m_precalculated_byatom, authentic_v[0], pairs, m.coords, m.minus_forces));
+    state.SetItemsProcessed(state.iterations() * pairs.size());
+}
+BENCHMARK(BM_eval_interacting_pairs_deriv);
+
+void BM_eval_interacting_pairs_deriv_analytic(benchmark::State& state) {
+    const Vina& v = fixture().v;
+    model m = v.m_model;
+    precalculate_byatom p;
+    p.init_analytic(v.m_scoring_function, m);
+    const interacting_pairs& pairs = m.ligands[0].pairs;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(
+            eval_interacting_pairs_deriv(p, authentic_v[0], pairs, m.coords, m.minus_forces));
+    state.SetItemsProcessed(state.iterations() * pairs.size());
+}
+BENCHMARK(BM_eval_interacting_pairs_deriv_analytic);
+
+void BM_bfgs(benchmark::State& state) {
+    const Vina& v = fixture().v;
+    model m = v.m_model;
+    bfgs_aux aux = {&m, &v.m_precalculated_byatom, &v.m_grid};
+    const conf start = m.get_initial_conf();
+    const unsigned max_steps = unsigned((25 + m.num_movable_atoms()) / 3);
+    change g(m.get_size());
+    int evalcount = 0;
+    for (auto _ : state) {
+        conf c = start;
+        benchmark::DoNotOptimize(bfgs(aux, c, g, max_steps, 0, 10, evalcount));
+    }
+    state.counters["evals_per_run"] = double(evalcount) / state.iterations();
+}
+BENCHMARK(BM_bfgs)->Unit(benchmark::kMicrosecond);
+
+// lockstep_width random poses in the box, as a lockstep group evaluates them
+std::vector<conf> lane_confs(const model& m) {
+    std::vector<conf> confs(lockstep_width, m.get_initial_conf());
+    rng g(42);
+    VINA_FOR_IN(l, confs) confs[l].randomize(vec(5, 44, 7), vec(25, 64, 27), g);
+    return confs;
+}
+
+// one chain per thread: model::set and model::eval_deriv pose after pose
+void BM_eval_deriv_lanes_scalar(benchmark::State& state) {
+    const Vina& v = fixture().v;
+    model m = v.m_model;
+    const std::vector<conf> confs = lane_confs(m);
+    change g(m.get_size());
+    for (auto _ : state) {
+        VINA_FOR_IN(l, confs) {
+            m.set(confs[l]);
+            benchmark::DoNotOptimize(
+                m.eval_deriv(v.m_precalculated_byatom, v.m_grid, authentic_v, g));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * lockstep_width);
+}
+BENCHMARK(BM_eval_deriv_lanes_scalar)->Unit(benchmark::kMicrosecond);
+
+// the same poses in the lanes of one lockstep_model
+void BM_eval_deriv_lanes_lockstep(benchmark::State& state) {
+    const Vina& v = fixture().v;
+    lockstep_model lm(v.m_model, v.m_precalculated_byatom, v.m_grid);
+    const std::vector<conf> confs = lane_confs(v.m_model);
+    std::vector<change> g(lockstep_width, change(v.m_model.get_size()));
+    const conf* c[lockstep_width];
+    const vec* lane_v[lockstep_width];
+    change* gp[lockstep_width];
+    fl e[lockstep_width];
+    VINA_FOR(l, lockstep_width) {
+        c[l] = &confs[l];
+        lane_v[l] = &authentic_v;
+        gp[l] = &g[l];
+    }
+    for (auto _ : state) {
+        lm.eval_deriv(c, lane_v, e, gp);
+        benchmark::DoNotOptimize(e);
+    }
+    state.SetItemsProcessed(state.iterations() * lockstep_width);
+}
+BENCHMARK(BM_eval_deriv_lanes_lockstep)->Unit(benchmark::kMicrosecond);
+
+void BM_precalculate_byatom(benchmark::State& state) {
+    const Vina& v = fixture().v;
+    for (auto _ : state) {
+        precalculate_byatom p(v.m_scoring_function, v.m_model);
+        benchmark::DoNotOptimize(p);
+    }
+}
+BENCHMARK(BM_precalculate_byatom)->Unit(benchmark::kMillisecond);
+
+void BM_precalculate_analytic(benchmark::State& state) {
+    const Vina& v = fixture().v;
+    for (auto _ : state) {
+        precalculate_byatom p;
+        p.init_analytic(v.m_scoring_function, v.m_model);
+        benchmark::DoNotOptimize(p);
+    }
+}
+BENCHMARK(BM_precalculate_analytic)->Unit(benchmark::kMillisecond);
+
+void BM_cache_populate_no_bias(benchmark::State& state) {
+    const Vina& v = fixture().v;
+    const szv atom_types = v.m_model.get_movable_atom_types(atom_type::XS);
+    grid_dims gd = v.m_grid.get_gd();
+    VINA_FOR_IN(i, gd) {  // 10 A around the box center keeps an iteration well under a second
+        const fl center = (gd[i].begin + gd[i].end) / 2;
+        gd[i].begin = center - 5;
+        gd[i].end = center + 5;
+        gd[i].n_voxels = sz(10 / 0.375);
+    }
+    for (auto _ : state) {
+        cache c(gd);
+        c.populate_no_bias(v.m_model, v.m_precalculated_sf, atom_types);
+        benchmark::DoNotOptimize(c.m_grids.data());
+    }
+    state.counters["grids"] = atom_types.size();
+}
+BENCHMARK(BM_cache_populate_no_bias)->Unit(benchmark::kMillisecond);
+
+void BM_parse_receptor_pdbqt(benchmark::State& state) {
+    for (auto _ : state) benchmark::DoNotOptimize(parse_receptor_pdbqt(receptor_pdbqt));
+}
+BENCHMARK(BM_parse_receptor_pdbqt)->Unit(benchmark::kMillisecond);
+
+void BM_parse_ligand_pdbqt(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(parse_ligand_from_file_no_failure(ligand_pdbqt, atom_type::XS));
+}
+BENCHMARK(BM_parse_ligand_pdbqt)->Unit(benchmark::kMicrosecond);
+
+void BM_parse_ligand_sdf(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(parse_ligand_from_file_no_failure(ligand_sdf, atom_type::XS));
+}
+BENCHMARK(BM_parse_ligand_sdf)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,142 @@
+#include "vina.h"
+#include "ad4cache.h"
+#include "parse_pdbqt.h"
+#include "gtest/gtest.h"
+
+namespace {
+// random maps over most of the ligand, so that some atoms are out of the box
+ad4cache random_maps(const model& m) {
+    vec lo = m.coords[0], hi = m.coords[0];
+    VINA_FOR_IN(i, m.coords) VINA_FOR(d, 3) {
+        lo[d] = (std::min)(lo[d], m.coords[i][d]);
+        hi[d] = (std::max)(hi[d], m.coords[i][d]);
+    }
+    grid_dims gd;
+    VINA_FOR(d, 3) {
+        gd[d].begin = lo[d] + 1;
+        gd[d].end = hi[d];
+        gd[d].n_voxels = 12;
+    }
+    ad4cache c(gd, 10);
+    rng g(17);
+    VINA_FOR_IN(t, c.m_grids) {
+        c.m_grids[t].init(gd);
+        VINA_FOR_IN(i, c.m_grids[t].m_data.m_data)
+        c.m_grids[t].m_data.m_data[i] = random_fl(-2, 2, g);
+    }
+    return c;
+}
+
+// one map at a time, as before the lookups were fused
+fl separate_maps(const ad4cache& c, model& m, fl v) {
+    fl e = 0;
+    VINA_FOR(i, m.num_movable_atoms()) {
+        const atom& a = m.atoms[i];
+        sz t = a.get(atom_type::AD);
+        if (t >= AD_TYPE_G0 && t <= AD_TYPE_G3) {
+            m.minus_forces[i].assign(0);
+            continue;
+        }
+        if (t >= AD_TYPE_CG0 && t <= AD_TYPE_CG3) t = AD_TYPE_C;
+        vec d, de, dd;
+        e += c.m_grids[t].evaluate(m.coords[i], 10, v, d);
+        e += c.m_grids[AD_TYPE_SIZE].evaluate(m.coords[i], 10, v, de) * a.charge;
+        e += c.m_grids[AD_TYPE_SIZE + 1].evaluate(m.coords[i], 10, v, dd) * std::abs(a.charge);
+        m.minus_forces[i] = d + a.charge * de + std::abs(a.charge) * dd;
+    }
+    return e;
+}
+
+void expect_fused(ad4cache& c, model& m, fl v) {
+    model expected = m;
+    const fl e = separate_maps(c, expected, v);
+    EXPECT_NEAR(c.eval(m, v), e, 1e-4 * (1 + std::abs(e)));
+    EXPECT_NEAR(c.eval_deriv(m, v), e, 1e-4 * (1 + std::abs(e)));
+    VINA_FOR(i, m.num_movable_atoms()) VINA_FOR(d, 3) {
+        const fl f = expected.minus_forces[i][d];
+        EXPECT_NEAR(m.minus_forces[i][d], f, 1e-3 * (1 + std::abs(f))) << i << ' ' << d;
+    }
+}
+
+// AutoGrid pair energy of a receptor atom and a probe at r, from the potentials themselves;
+// electrostatics go on past their cutoff as 1 / r
+fl pair_energy(const ScoringFunction& sf, const atom& a, const atom& probe, fl r) {
+    Potential* elec = sf.m_potentials[2];
+    const fl nb_cutoff = sf.m_potentials[0]->get_cutoff();
+    const fl elec_cutoff = elec->get_cutoff() * (1 - 1e-5);
+    fl e = 0;
+    if (r < nb_cutoff)
+        VINA_FOR(i, 4) if (i != 2) e += sf.m_weights[i] * sf.m_potentials[i]->eval(a, probe, r);
+    if (r < elec_cutoff)
+        e += sf.m_weights[2] * elec->eval(a, probe, r);
+    else
+        e += sf.m_weights[2] * elec->eval(a, probe, elec_cutoff) * elec_cutoff / r;
+    return e;
+}
+
+// map value at p for a probe of type t and charge q, summed over the receptor atoms; slack is how
+// much the pairs change within the 0.01 A resolution of the lookup tables
+fl pairwise(const Vina& v, sz t, fl q, const vec& p, fl& slack) {
+    const fl h = 0.005;
+    atom probe;
+    probe.ad = t;
+    probe.charge = q;
+    fl e = 0;
+    slack = 0;
+    VINA_FOR_IN(i, v.m_receptor.grid_atoms) {
+        const atom& a = v.m_receptor.grid_atoms[i];
+        if (a.ad >= AD_TYPE_SIZE) continue;
+        const fl r = std::sqrt(vec_distance_sqr(a.coords, p));
+        e += pair_energy(v.m_scoring_function, a, probe, r);
+        slack += std::abs(pair_energy(v.m_scoring_function, a, probe, r + h)
+                          - pair_energy(v.m_scoring_function, a, probe, (std::max)(r - h, fl(0))));
+    }
+    return e;
+}
+}  // namespace
+
+TEST(ad4cache, fused_lookups) {
+    model m = parse_ligand_from_file_no_failure("ligands/1iep_ligand.pdbqt", atom_type::AD);
+    m.set(m.get_initial_conf());
+    ad4cache c = random_maps(m);
+    expect_fused(c, m, 1000);
+    expect_fused(c, m, 0.5);  // curled
+    c.interleave();
+    ASSERT_TRUE(c.is_interleaved());
+    expect_fused(c, m, 1000);
+}
+
+TEST(ad4cache, maps_match_pairwise_sums) {
+    Vina v("ad4", 1, 7, 0);
+    v.set_receptor("receptor/1iep_receptor.pdbqt");
+    v.set_ligand_from_file("ligands/1iep_ligand.pdbqt");
+    v.compute_ad4_maps(15.19, 53.903, 16.917, 8, 8, 8);
+    const ad4cache& c = v.m_ad4grid;
+    const szv types = v.m_model.get_movable_atom_types(atom_type::AD);
+    const grid& ge = c.m_grids[AD_TYPE_SIZE];
+    const grid& gd = c.m_grids[AD_TYPE_SIZE + 1];
+    const fl charges[3] = {0, 0.3, -0.4};
+    sz checked = 0;
+    for (sz x = 0; x < ge.m_data.dim0(); x += 3)
+        for (sz y = 0; y < ge.m_data.dim1(); y += 5)
+            for (sz z = 0; z < ge.m_data.dim2(); z += 7) {
+                const vec p = ge.index_to_argument(x, y, z);
+                VINA_FOR_IN(i, types) {
+                    sz t = types[i];
+                    if (t >= AD_TYPE_CG0 && t <= AD_TYPE_CG3) t = AD_TYPE_C;
+                    if (t >= AD_TYPE_SIZE || (t >= AD_TYPE_G0 && t <= AD_TYPE_G3)) continue;
+                    VINA_FOR(k, 3) {
+                        const fl q = charges[k];
+                        fl slack = 0;
+                        const fl expected = pairwise(v, t, q, p, slack);
+                        const fl e = c.m_grids[t].m_data(x, y, z) + q * ge.m_data(x, y, z)
+                                     + std::abs(q) * gd.m_data(x, y, z);
+                        EXPECT_NEAR(e, expected, slack + 1e-3 * (1 + std::abs(expected)))
+                            << "type " << t << " charge " << q << " at " << x << ' ' << y << ' '
+                            << z;
+                        ++checked;
+                    }
+                }
+            }
+    EXPECT_GT(checked, 100);
+}
@@ -0,0 +1,92 @@
+#include "batch_pack.h"
+#include "parse_pdbqt.h"
+#include "gtest/gtest.h"
+
+namespace {
+std::vector<model> load_batch() {
+    std::vector<model> models;
+    models.push_back(parse_ligand_from_file_no_failure("ligands/1iep_ligand.pdbqt", atom_type::XS));
+    models.push_back(model());  // parsing failure
+    models.push_back(parse_ligand_from_file_no_failure("ligands/1a30_ligand.sdf", atom_type::XS));
+    return models;
+}
+
+void expect_vec(const vec& v, const float* packed) {
+    for (int k = 0; k < 3; ++k) EXPECT_FLOAT_EQ((float)v[k], packed[k]);
+}
+
+void expect_node(const tree<segment>& t, const packed_ligand& p, int parent, int& next) {
+    const int self = next++;
+    EXPECT_EQ(p.node_parent[self], parent);
+    EXPECT_EQ(p.node_atom_range[2 * self], (int)t.node.begin);
+    EXPECT_EQ(p.node_atom_range[2 * self + 1], (int)t.node.end);
+    expect_vec(t.node.get_origin(), p.node_origin + 3 * self);
+    expect_vec(t.node.get_axis(), p.node_axis + 3 * self);
+    expect_vec(t.node.relative_axis, p.node_relative_axis + 3 * self);
+    expect_vec(t.node.relative_origin, p.node_relative_origin + 3 * self);
+    for (int i = 0; i < 9; ++i)
+        EXPECT_FLOAT_EQ((float)t.node.get_orientation_m().data[i],
+                        p.node_orientation_m[9 * self + i]);
+    for (sz i = 0; i < t.children.size(); ++i) expect_node(t.children[i], p, self, next);
+}
+}  // namespace
+
+TEST(batch_pack, offsets) {
+    std::vector<model> models = load_batch();
+    packed_batch b;
+    b.pack(models, 2);
+
+    ASSERT_EQ(b.num_ligands(), models.size());
+    EXPECT_EQ(b.num_atoms(0), models[0].atoms.size());
+    EXPECT_EQ(b.num_atoms(1), 0);
+    EXPECT_EQ(b.num_pairs(1), 0);
+    EXPECT_EQ(b.num_nodes(1), 0);
+    EXPECT_EQ(b.num_movable_atoms[1], -1);
+    EXPECT_EQ(b.num_atoms(2), models[2].atoms.size());
+    EXPECT_EQ(b.atom_offsets.back() * 4, b.atom_types.size());
+    EXPECT_EQ(b.pair_offsets.back(), models[0].ligands[0].pairs.size()
+                                         + models[2].ligands[0].pairs.size());
+}
+
+TEST(batch_pack, round_trip) {
+    std::vector<model> models = load_batch();
+    packed_batch serial, parallel;
+    serial.pack(models);
+    parallel.pack(models, 4);
+    EXPECT_EQ(serial.coords, parallel.coords);
+    EXPECT_EQ(serial.node_parent, parallel.node_parent);
+    EXPECT_EQ(serial.pair_a, parallel.pair_a);
+
+    for (sz l = 0; l < models.size(); ++l) {
+        const model& m = models[l];
+        if (m.ligands.size() == 0) continue;
+        const packed_ligand p = parallel.ligand(l);
+        const ligand& lig = m.ligands[0];
+
+        EXPECT_EQ(p.num_movable_atoms, (int)m.num_movable_atoms());
+        EXPECT_EQ(p.begin, (int)lig.begin);
+        EXPECT_EQ(p.end, (int)lig.end);
+        for (sz i = 0; i < m.atoms.size(); ++i) {
+            EXPECT_EQ(p.atom_types[4 * i], (int)m.atoms[i].el);
+            EXPECT_EQ(p.atom_types[4 * i + 1], (int)m.atoms[i].ad);
+            EXPECT_EQ(p.atom_types[4 * i + 2], (int)m.atoms[i].xs);
+            EXPECT_EQ(p.atom_types[4 * i + 3], (int)m.atoms[i].sy);
+            expect_vec(m.atoms[i].coords, p.atom_coords + 3 * i);
+            expect_vec(m.coords[i], p.coords + 3 * i);
+        }
+        ASSERT_EQ(p.num_pairs, lig.pairs.size());
+        for (sz i = 0; i < lig.pairs.size(); ++i) {
+            EXPECT_EQ(p.pair_type_pair_index[i], (int)lig.pairs[i].type_pair_index);
+            EXPECT_EQ(p.pair_a[i], (int)lig.pairs[i].a);
+            EXPECT_EQ(p.pair_b[i], (int)lig.pairs[i].b);
+        }
+
+        EXPECT_EQ(p.node_parent[0], -1);
+        EXPECT_EQ(p.node_atom_range[0], (int)lig.node.begin);
+        EXPECT_EQ(p.node_atom_range[1], (int)lig.node.end);
+        expect_vec(lig.node.get_origin(), p.node_origin);
+        int next = 1;
+        for (sz i = 0; i < lig.children.size(); ++i) expect_node(lig.children[i], p, 0, next);
+        EXPECT_EQ(next, (int)p.num_nodes);
+    }
+}
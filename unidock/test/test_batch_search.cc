@@ -0,0 +1,70 @@
+#include <boost/filesystem.hpp>
+
+#include "vina.h"
+#include "utils.h"
+#include "gtest/gtest.h"
+
+namespace fs = boost::filesystem;
+
+namespace {
+const int exhaustiveness = 3;
+const int max_evals = 5000;
+
+Vina receptor_and_maps(int cpu) {
+    Vina v("vina", cpu, 7, 0);
+    v.set_receptor("receptor/1iep_receptor.pdbqt");
+    v.compute_vina_maps(15.19, 53.903, 16.917, 20, 20, 20);  // no ligand: every atom type
+    return v;
+}
+
+// the contents of out_names after a batch over ligand_names with cpu workers, "" if not written
+std::vector<std::string> run_batch(int cpu, const std::vector<std::string>& ligand_names,
+                                   const std::vector<std::string>& out_names) {
+    Vina v = receptor_and_maps(cpu);
+    v.global_search_batch(ligand_names, out_names, exhaustiveness, 9, 1.0, max_evals);
+    std::vector<std::string> contents;
+    VINA_FOR_IN(i, out_names) {
+        contents.push_back(fs::exists(out_names[i]) ? get_file_contents(out_names[i]) : "");
+        fs::remove(out_names[i]);
+    }
+    return contents;
+}
+}  // namespace
+
+TEST(batch_search, output_order) {
+    const fs::path dir = fs::temp_directory_path() / fs::unique_path("batch_search_%%%%%%%%");
+    fs::create_directories(dir);
+    std::vector<std::string> ligand_names, out_names;
+    const char* ligands[] = {"ligands/1iep_ligand.pdbqt", "ligands/1a30_ligand.sdf",
+                             "ligands/missing.pdbqt", "ligands/1iep_ligand.pdbqt",
+                             "ligands/1a30_ligand.sdf"};
+    VINA_FOR(i, 5) {
+        ligand_names.push_back(ligands[i]);
+        const bool sdf = ligand_names[i].substr(ligand_names[i].size() - 4) == ".sdf";
+        out_names.push_back((dir / (std::to_string(i) + (sdf ? ".sdf" : ".pdbqt"))).string());
+    }
+
+    // ligands finish in a different order with more workers, the files must not change
+    const std::vector<std::string> serial = run_batch(1, ligand_names, out_names);
+    const std::vector<std::string> parallel = run_batch(4, ligand_names, out_names);
+    fs::remove_all(dir);
+    VINA_FOR_IN(i, serial) EXPECT_EQ(parallel[i], serial[i]) << "ligand " << i;
+
+    // each file holds its own ligand: the unreadable one is skipped, the others have poses
+    EXPECT_TRUE(serial[2].empty());
+    VINA_FOR_IN(i, serial) {
+        if (i == 2) continue;
+        const bool sdf = i % 3 == 1;
+        ASSERT_FALSE(serial[i].empty()) << "ligand " << i;
+        EXPECT_EQ(serial[i].find("$$$$") != std::string::npos, sdf) << "ligand " << i;
+        EXPECT_EQ(serial[i].find("ENDMDL") != std::string::npos, !sdf) << "ligand " << i;
+    }
+    // the same ligand at another index draws from other streams
+    EXPECT_NE(serial[3], serial[0]);
+
+    // ligand 0 draws the streams of a single global_search with the same seed
+    Vina single = receptor_and_maps(1);
+    single.set_ligand_from_file("ligands/1iep_ligand.pdbqt");
+    single.global_search(exhaustiveness, 9, 1.0, max_evals);
+    EXPECT_EQ(serial[0], single.get_poses(9, 3.0));
+}
@@ -0,0 +1,79 @@
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "vina.h"
+#include "gtest/gtest.h"
+
+namespace {
+const char* const ligand_name = "ligands/1iep_ligand.pdbqt";
+
+std::string file_contents(const std::string& name) {
+    std::ifstream in(name.c_str());
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+// the 1iep ligand in a random conformation, as a MODEL of a multi-model PDBQT
+std::string random_model(const std::string& pdbqt, unsigned seed) {
+    model m = parse_ligand_pdbqt_from_string(pdbqt, atom_type::XS);
+    rng g(seed);
+    conf c = m.get_initial_conf();
+    c.randomize(vec(-5, -5, -5), vec(5, 5, 5), g);
+    m.set(c);
+    return m.write_model(seed, "");
+}
+
+// two conformers of the 1iep ligand, then an analogue with C7 turned into a chlorine
+std::string write_conformers() {
+    const std::string pdbqt = file_contents(ligand_name);
+    std::string analogue = pdbqt;
+    const std::string c7 = "     0.045 C \n";
+    analogue.replace(analogue.find(c7), c7.size(), "     0.045 Cl\n");
+
+    const std::string name
+        = (boost::filesystem::temp_directory_path() / "1iep_conformers.pdbqt").string();
+    std::ofstream out(name.c_str());
+    out << random_model(pdbqt, 1) << random_model(pdbqt, 2) << random_model(analogue, 3);
+    return name;
+}
+}  // namespace
+
+TEST(conformers, parse) {
+    const std::vector<model> conformers
+        = parse_ligand_conformers_from_file_no_failure(write_conformers(), atom_type::XS);
+    ASSERT_EQ(conformers.size(), 2);  // the analogue stops the list
+    EXPECT_EQ(conformers[0].atoms.size(), conformers[1].atoms.size());
+    fl moved = 0;
+    VINA_FOR_IN(i, conformers[0].coords)
+    moved += vec_distance_sqr(conformers[0].coords[i], conformers[1].coords[i]);
+    EXPECT_GT(moved, 1);
+
+    EXPECT_EQ(parse_ligand_conformers_from_file_no_failure(ligand_name, atom_type::XS).size(), 1);
+}
+
+TEST(conformers, global_search) {
+    const std::vector<model> conformers
+        = parse_ligand_conformers_from_file_no_failure(write_conformers(), atom_type::XS);
+    Vina v("vina", 1, 7, 0);
+    v.set_receptor("receptor/1iep_receptor.pdbqt");
+    v.set_ligand_conformers(conformers);
+    v.compute_vina_maps(15.19, 53.903, 16.917, 20, 20, 20);
+    v.global_search(4, 9, 1, 20000);
+    ASSERT_FALSE(v.m_poses.empty());
+    std::vector<bool> seen(conformers.size(), false);
+    VINA_FOR_IN(i, v.m_poses) {
+        ASSERT_LT(v.m_poses[i].conformer, conformers.size());
+        seen[v.m_poses[i].conformer] = true;
+        if (i > 0) EXPECT_LE(v.m_poses[i - 1].e, v.m_poses[i].e);
+    }
+    EXPECT_TRUE(seen[0] && seen[1]);  // a single list over both conformers
+    const std::string poses = v.get_poses(9, 100);
+    EXPECT_NE(poses.find("REMARK CONFORMER:"), std::string::npos);
+
+    // the model is left at the best pose, built from its own conformer
+    const std::vector<double> energies = v.score();
+    EXPECT_NEAR(energies[1] + energies[2], v.m_poses[0].inter, 1e-3);
+}
@@ -0,0 +1,67 @@
+#include "vina.h"
+#include "gtest/gtest.h"
+
+namespace {
+Vina vina_on_box(bool no_refine, const vec& center, const vec& size) {
+    Vina v("vina", 1, 7, 0, no_refine);
+    v.set_receptor("receptor/1iep_receptor.pdbqt");
+    v.set_ligand_from_file("ligands/1iep_ligand.pdbqt");
+    v.compute_vina_maps(center[0], center[1], center[2], size[0], size[1], size[2]);
+    return v;
+}
+
+void shift_ligand(Vina& v, const vec& shift) {
+    conf c = v.m_model.get_initial_conf();
+    c.ligands[0].rigid.position += shift;
+    v.m_model.set(c);
+}
+}  // namespace
+
+TEST(grid_window, matches_fresh_maps) {
+    VINA_FOR(no_refine, 2) {
+        Vina master = vina_on_box(no_refine, vec(15.19, 53.903, 16.917), vec(30, 30, 30));
+        master.set_autobox_window(4);
+        ASSERT_TRUE(master.m_grid.windowed());
+        const grid_dims gd = master.m_grid.get_gd();
+
+        // maps computed for the window itself: same sample points, same edges
+        vec center, size;
+        VINA_FOR(i, 3) {
+            center[i] = (gd[i].begin + gd[i].end) / 2;
+            size[i] = gd[i].span() - 1e-6;  // n_voxels is rounded up
+        }
+        Vina fresh = vina_on_box(no_refine, center, size);
+        VINA_FOR(i, 3) {
+            ASSERT_EQ(fresh.m_grid.get_gd()[i].n_voxels, gd[i].n_voxels);
+            ASSERT_NEAR(fresh.m_grid.get_gd()[i].begin, gd[i].begin, 1e-4);
+        }
+
+        const std::vector<double> expected = fresh.score();
+        const std::vector<double> windowed = master.score();
+        ASSERT_EQ(windowed.size(), expected.size());
+        VINA_FOR_IN(i, expected)
+        EXPECT_NEAR(windowed[i], expected[i], 1e-3 * (1 + std::abs(expected[i])))
+            << "no_refine " << no_refine << " energy " << i;
+
+        // inside the window and partly past its edge, where the out-of-box penalty applies
+        const vec shifts[] = {vec(0.6, -0.4, 0.3), vec(6, 0, 0), vec(0, -5, 7)};
+        VINA_FOR(s, 3) {
+            shift_ligand(master, shifts[s]);
+            shift_ligand(fresh, shifts[s]);
+            const fl e = fresh.m_grid.eval_deriv(fresh.m_model, 1000);
+            EXPECT_NEAR(master.m_grid.eval_deriv(master.m_model, 1000), e,
+                        1e-3 * (1 + std::abs(e)))
+                << "no_refine " << no_refine << " shift " << s;
+            VINA_FOR(i, master.m_model.num_movable_atoms()) VINA_FOR(d, 3) {
+                const fl f = fresh.m_model.minus_forces[i][d];
+                EXPECT_NEAR(master.m_model.minus_forces[i][d], f, 1e-3 * (1 + std::abs(f)))
+                    << "shift " << s << " atom " << i << ' ' << d;
+            }
+            if (no_refine) continue;  // no non_cache, score() is from the maps
+            const fl ne = fresh.m_non_cache.eval_deriv(fresh.m_model, 1000);
+            EXPECT_NEAR(master.m_non_cache.eval_deriv(master.m_model, 1000), ne,
+                        1e-3 * (1 + std::abs(ne)))
+                << "no_refine " << no_refine << " shift " << s;
+        }
+    }
+}
@@ -0,0 +1,102 @@
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/thread/thread.hpp>
+
+#include "ligand_source.h"
+#include "utils.h"
+#include "gtest/gtest.h"
+
+namespace {
+// writes s to fd a few bytes at a time, so that records and lines span reads
+void write_chunks(int fd, const std::string& s, sz chunk) {
+    for (sz i = 0; i < s.size(); i += chunk) {
+        ASSERT_EQ(write(fd, s.data() + i, (std::min)(chunk, s.size() - i)),
+                  ssize_t((std::min)(chunk, s.size() - i)));
+        boost::this_thread::sleep(boost::posix_time::microseconds(50));
+    }
+}
+
+std::vector<named_model> read_all(const std::string& input, bool sdf, sz chunk) {
+    int fds[2];
+    EXPECT_EQ(pipe(fds), 0);
+    boost::thread writer([&]() {
+        write_chunks(fds[1], input, chunk);
+        close(fds[1]);  // end of the stream
+    });
+    std::vector<named_model> out;
+    {
+        ligand_stream stream(fds[0], sdf, atom_type::XS, false, 3, 2);  // the reader waits too
+        named_model m;
+        while (stream.next(m)) out.push_back(std::move(m));
+        EXPECT_FALSE(stream.next(m));
+    }
+    writer.join();
+    close(fds[0]);
+    return out;
+}
+}  // namespace
+
+TEST(ligand_stream, chunked_sdf) {
+    const std::string ligand = get_file_contents("ligands/1a30_ligand.sdf");
+    // the last record has no delimiter, the input no final newline
+    const std::string last = ligand.substr(0, ligand.find("$$$$") - 1);
+    const std::string input = ligand + "broken\n\n\nM  END\n$$$$\n" + ligand + last;
+    const std::vector<named_model> out = read_all(input, true, 7);
+    ASSERT_EQ(out.size(), 4);
+    EXPECT_EQ(out[0].first, "1a30_ligand.sdf");
+    EXPECT_EQ(out[1].first, "broken.sdf");
+    EXPECT_EQ(out[2].first, "1a30_ligand_3.sdf");
+    EXPECT_EQ(out[3].first, "1a30_ligand_4.sdf");
+    EXPECT_GT(out[0].second.num_ligands(), 0);
+    EXPECT_EQ(out[1].second.num_ligands(), 0);  // failed to parse, still in its place
+    VINA_RANGE(i, 2, 4)
+    EXPECT_EQ(out[i].second.num_movable_atoms(), out[0].second.num_movable_atoms());
+}
+
+TEST(ligand_stream, chunked_pdbqt) {
+    const std::string ligand = get_file_contents("ligands/1iep_ligand.pdbqt");
+    std::string input;
+    VINA_FOR(i, 5)
+    input += "MODEL " + std::to_string(i + 1) + "\nREMARK  Name = lig " + std::to_string(i % 2)
+             + "\n" + ligand + "ENDMDL\n";
+    const std::vector<named_model> out = read_all(input, false, 13);
+    ASSERT_EQ(out.size(), 5);
+    EXPECT_EQ(out[0].first, "lig_0.pdbqt");
+    EXPECT_EQ(out[1].first, "lig_1.pdbqt");
+    EXPECT_EQ(out[2].first, "lig_0_3.pdbqt");
+    VINA_FOR_IN(i, out) EXPECT_GT(out[i].second.num_ligands(), 0) << i;
+}
+
+TEST(ligand_stream, stops_while_producer_is_idle) {
+    // the producer writes a record and then nothing, without closing its end
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    write_chunks(fds[1], get_file_contents("ligands/1a30_ligand.sdf"), 1 << 16);
+    boost::thread consumer([&]() {
+        ligand_stream stream(fds[0], true, atom_type::XS, false, 2);
+        named_model m;
+        EXPECT_TRUE(stream.next(m));
+    });  // destroyed while the reader waits for input
+    const bool stopped = consumer.timed_join(boost::posix_time::seconds(10));
+    EXPECT_TRUE(stopped);
+    close(fds[1]);  // lets a stuck reader finish
+    if (!stopped) consumer.join();
+    close(fds[0]);
+}
+
+TEST(ligand_stream, read_error_is_not_the_end) {
+    const int fd = open(".", O_RDONLY);  // polls ready, but read fails with EISDIR
+    ASSERT_GE(fd, 0);
+    {
+        ligand_stream stream(fd, true, atom_type::XS, false, 2);
+        named_model m;
+        try {
+            stream.next(m);
+            ADD_FAILURE() << "no stream_error";
+        } catch (stream_error& e) {
+            EXPECT_EQ(e.errnum, EISDIR);
+        }
+    }
+    close(fd);
+}
@@ -0,0 +1,71 @@
+#include "vina.h"
+#include "lockstep_mc.h"
+#include "gtest/gtest.h"
+
+namespace {
+Vina receptor_and_ligand() {
+    Vina v("vina", 1, 7, 0);
+    v.set_receptor("receptor/1iep_receptor.pdbqt");
+    v.set_ligand_from_file("ligands/1iep_ligand.pdbqt");
+    v.compute_vina_maps(15.19, 53.903, 16.917, 20, 20, 20);
+    return v;
+}
+
+// lane energies and gradients against model::eval_deriv, for poses in and around the box
+void expect_lanes(const vec& v) {
+    Vina vina = receptor_and_ligand();
+    model& m = vina.m_model;
+    ASSERT_TRUE(lockstep_model::supported(m, vina.m_precalculated_byatom, vina.m_grid));
+    lockstep_model lm(m, vina.m_precalculated_byatom, vina.m_grid);
+    const conf_size s = m.get_size();
+    rng g(3);
+    VINA_FOR(trial, 5) {
+        std::vector<conf> confs(lockstep_width, m.get_initial_conf());
+        std::vector<change> lane_g(lockstep_width, change(s));
+        flv lane_e(lockstep_width, 12345);
+        const conf* c[lockstep_width];
+        const vec* lane_v[lockstep_width];
+        change* gp[lockstep_width];
+        VINA_FOR(l, lockstep_width) {
+            confs[l].randomize(vec(2, 41, 4), vec(28, 67, 30), g);  // 3 A past the box
+            c[l] = (l + trial) % 3 == 0 ? NULL : &confs[l];  // masked lanes
+            lane_v[l] = &v;
+            gp[l] = c[l] ? &lane_g[l] : NULL;
+        }
+        lm.eval_deriv(c, lane_v, &lane_e[0], gp);
+        VINA_FOR(l, lockstep_width) {
+            if (!c[l]) {
+                EXPECT_EQ(lane_e[l], 12345);
+                EXPECT_EQ(lane_g[l].ligands[0].rigid.position[0], 0);
+                continue;
+            }
+            change expected(s);
+            m.set(confs[l]);
+            const fl e = m.eval_deriv(vina.m_precalculated_byatom, vina.m_grid, v, expected);
+            EXPECT_NEAR(lane_e[l], e, 1e-3 + 1e-4 * std::abs(e)) << "lane " << l;
+            VINA_FOR(i, expected.num_floats()) {
+                const fl d = expected(i);
+                EXPECT_NEAR(lane_g[l](i), d, 1e-2 + 1e-3 * std::abs(d)) << "lane " << l << ' ' << i;
+            }
+        }
+    }
+}
+}  // namespace
+
+TEST(lockstep_mc, eval_deriv) {
+    expect_lanes(vec(10, 1.5, 10));       // hunt_cap
+    expect_lanes(vec(1000, 1000, 1000));  // authentic_v
+}
+
+TEST(lockstep_mc, global_search) {
+    Vina v = receptor_and_ligand();
+    v.enable_lockstep_chains();
+    v.global_search(lockstep_width + 2, 9, 1, 20000);  // a full and a partial group
+    ASSERT_FALSE(v.m_poses.empty());
+    VINA_FOR_IN(i, v.m_poses) if (i > 0) EXPECT_LE(v.m_poses[i - 1].e, v.m_poses[i].e);
+    EXPECT_LT(v.m_poses[0].e, -8);
+
+    // the pose energies are those of the scalar model
+    const std::vector<double> energies = v.score();
+    EXPECT_NEAR(energies[1] + energies[2], v.m_poses[0].inter, 1e-3);
+}
@@ -0,0 +1,152 @@
+#include "vina.h"
+#include "memory_plan.h"
+#include "batch_pack.h"
+#include "parse_pdbqt.h"
+#include "gtest/gtest.h"
+
+namespace {
+Vina receptor() {
+    Vina v("vina", 1, 7, 0);
+    v.set_receptor("receptor/1iep_receptor.pdbqt");
+    v.compute_vina_maps(15.19, 53.903, 16.917, 20, 20, 20);
+    return v;
+}
+
+batch_memory_planner planner(const Vina& v, bool multi_bias, const memory_footprint& budget) {
+    gpu_search_sizes gpu;
+    gpu.rng_state = 64;
+    gpu.local_memory = 1000;
+    return batch_memory_planner(v.m_receptor, v.m_grid, v.m_scoring_function, 8, 9, multi_bias,
+                                gpu, budget);
+}
+}  // namespace
+
+TEST(memory_plan, ligand_device_buffers) {
+    Vina v = receptor();
+    const model lig = parse_ligand_from_file_no_failure("ligands/1iep_ligand.pdbqt",
+                                                        v.m_scoring_function.get_atom_typing());
+    const memory_footprint f = planner(v, false, memory_footprint()).ligand(lig);
+
+    // what set_ligand_from_object_gpu and monte_carlo allocate, before the pairs are pruned
+    model m = v.m_receptor;
+    m.append(lig);
+    std::vector<model> models(1, m);
+    packed_batch b;
+    b.pack(models);
+    precalculate_byatom p;
+    p.init_without_calculation(v.m_scoring_function, m);
+    const sz threads = 8 * (SIZE_OF_MOLEC_STRUC + 64 + sizeof(output_type_cuda_t)
+                            + sizeof(search_stats_cuda_t));
+    const sz tables = p.m_data.m_data.size() * sizeof(precalculate_element_cuda_t);
+    EXPECT_EQ(f.device, threads + sizeof(p_cuda_t) + tables + b.bytes() - 3 * sizeof(int));
+
+    const sz host_tables = p.m_data.m_data.size()
+                           * (sizeof(precalculate_element) + p.m_n * (sizeof(fl) + sizeof(pr)));
+    EXPECT_GT(f.host, model_bytes(lig) + host_tables);
+
+    // the planned pairs are an upper bound of those left by pruning
+    m.prune_ligand_pairs(sqr(v.m_scoring_function.get_cutoff()));
+    models.assign(1, m);
+    b.pack(models);
+    EXPECT_LE(threads + sizeof(p_cuda_t) + tables + b.bytes() - 3 * sizeof(int), f.device);
+
+    // a per-ligand bias gives every ligand its own device maps
+    EXPECT_EQ(planner(v, true, memory_footprint()).ligand(lig).device,
+              f.device + sizeof(ig_cuda_t));
+}
+
+TEST(memory_plan, batches_fill_the_budget) {
+    Vina v = receptor();
+    const atom_type::t typing = v.m_scoring_function.get_atom_typing();
+    std::vector<model> ligs;
+    ligs.push_back(parse_ligand_from_file_no_failure("ligands/1iep_ligand.pdbqt", typing));
+    ligs.push_back(parse_ligand_from_file_no_failure("ligands/1a30_ligand.sdf", typing));
+    ligs.push_back(ligs[0]);
+
+    // the first ligand joins whatever the budget
+    batch_memory_planner tight = planner(v, false, memory_footprint());
+    EXPECT_TRUE(tight.add(ligs[0]));
+    EXPECT_FALSE(tight.add(ligs[1]));
+    EXPECT_EQ(tight.plan().num_ligands, 1);
+    EXPECT_FALSE(tight.plan().total().fits(tight.budget()));
+
+    const sz unlimited = std::numeric_limits<sz>::max();
+    batch_memory_planner sizing = planner(v, false, memory_footprint(unlimited, unlimited));
+    sizing.add(ligs[0]);
+    sizing.add(ligs[1]);
+    const memory_footprint fixed = sizing.plan().fixed;
+    EXPECT_EQ(fixed.device, sizeof(ig_cuda_t) + 1000 + 10 * sizeof(float));
+
+    batch_memory_planner p = planner(v, false, memory_footprint());
+    const memory_footprint two = p.ligand(ligs[0]) + p.ligand(ligs[1]);
+    p = planner(v, false, two + fixed);
+    EXPECT_TRUE(p.add(ligs[0]));
+    EXPECT_TRUE(p.add(ligs[1]));
+    EXPECT_FALSE(p.add(ligs[2]));
+    EXPECT_EQ(p.plan().num_ligands, 2);
+    EXPECT_TRUE(p.plan().total().fits(p.budget()));
+    EXPECT_EQ(p.plan().ligands.device, two.device);
+
+    p.clear();
+    EXPECT_EQ(p.plan().num_ligands, 0);
+    EXPECT_TRUE(p.add(ligs[2]));
+
+    // however large the budget, a batch ends at the size of the GPU ligand arrays
+    sizing.clear();
+    VINA_FOR(i, MAX_LIGAND_NUM) ASSERT_TRUE(sizing.add(ligs[0])) << i;
+    EXPECT_FALSE(sizing.add(ligs[0]));
+    EXPECT_EQ(sizing.plan().num_ligands, MAX_LIGAND_NUM);
+    sizing.clear();
+    EXPECT_TRUE(sizing.add(ligs[0]));
+}
+
+TEST(memory_plan, interleaved_ad4_maps) {
+    memory_footprint fixed[2];
+    VINA_FOR(interleaved, 2) {
+        Vina v("ad4", 1, 7, 0);
+        if (interleaved) v.enable_interleaved_ad4_maps();
+        v.set_receptor("receptor/1iep_receptor.pdbqt");
+        v.compute_ad4_maps(15.19, 53.903, 16.917, 8, 8, 8);
+        EXPECT_EQ(v.m_ad4grid.is_interleaved(), bool(interleaved));
+        gpu_search_sizes gpu;
+        batch_memory_planner p(v.m_receptor, v.m_ad4grid, v.m_scoring_function, 8, 9, false, gpu,
+                               memory_footprint());
+        fixed[interleaved] = p.plan().fixed;
+    }
+    // (type, elec, dsolv) for every type map
+    sz type_maps = 0;
+    Vina v("ad4", 1, 7, 0);
+    v.set_receptor("receptor/1iep_receptor.pdbqt");
+    v.compute_ad4_maps(15.19, 53.903, 16.917, 8, 8, 8);
+    VINA_FOR(t, AD_TYPE_SIZE) {
+        if (v.m_ad4grid.is_atom_type_grid_initialized(t))
+            type_maps += v.m_ad4grid.get_grid(t).size();
+    }
+    EXPECT_EQ(fixed[1].host - fixed[0].host, 3 * type_maps * sizeof(fl));
+    EXPECT_EQ(fixed[1].device, fixed[0].device);
+
+    // the GPU reads the maps as they are
+    v.enable_gpu();
+    v.enable_interleaved_ad4_maps();
+    v.compute_ad4_maps(15.19, 53.903, 16.917, 8, 8, 8);
+    EXPECT_FALSE(v.m_ad4grid.is_interleaved());
+}
+
+TEST(memory_plan, targets_stay_resident) {
+    Vina v = receptor();
+    const model lig = parse_ligand_from_file_no_failure("ligands/1iep_ligand.pdbqt",
+                                                        v.m_scoring_function.get_atom_typing());
+    batch_memory_planner one = planner(v, false, memory_footprint());
+    batch_memory_planner two = planner(v, false, memory_footprint());
+    two.add_target(v.m_receptor, v.m_grid);
+    sz maps = 0;
+    VINA_FOR(i, v.m_grid.num_grids()) maps += v.m_grid.get_grid(i).size() * sizeof(fl);
+    const sz receptor_bytes = model_bytes(v.m_receptor);
+    EXPECT_EQ(two.plan().fixed.host, one.plan().fixed.host + receptor_bytes + maps);
+    EXPECT_EQ(two.plan().fixed.device, one.plan().fixed.device);
+
+    // the target docking the batch holds its own copy of it, the parsed ligand excepted
+    const memory_footprint f = one.ligand(lig);
+    EXPECT_EQ(two.ligand(lig).host, f.host + f.host - model_bytes(lig));
+    EXPECT_EQ(two.ligand(lig).device, f.device);
+}
@@ -0,0 +1,89 @@
+#include "vina.h"
+#include "pair_kernels.h"
+#include "precalculate.h"
+#include "gtest/gtest.h"
+
+namespace {
+const vec authentic_v(1000, 1000, 1000);
+
+// every XS type pair against the type-indexed tables up to the cutoff; the tables interpolate in
+// r^2, hence the tolerance (relative for the glue terms, which reach 50 * r)
+void expect_tables(const std::string& sf_name) {
+    Vina v(sf_name);
+    const ScoringFunction& sf = v.m_scoring_function;
+    precalculate p(sf);
+    atomv atoms(XS_TYPE_SIZE);
+    VINA_FOR_IN(t, atoms) atoms[t].xs = t;
+    analytic_pairs k(sf, atoms);
+    VINA_FOR(t1, XS_TYPE_SIZE) {
+        VINA_RANGE(t2, t1, XS_TYPE_SIZE) {
+            for (fl r = 0.5; r * r < p.cutoff_sqr() - 0.1; r += 0.01) {
+                const fl table = p.eval_deriv(p.index_permissive(t1, t2), r * r).first;
+                EXPECT_NEAR(k.eval(t1, t2, r * r).first, table, 2e-3 + 1e-3 * std::abs(table))
+                    << sf_name << " types " << t1 << ' ' << t2 << " r " << r;
+            }
+        }
+    }
+}
+
+// pose energies and forces of a ligand against the tables, which are coarser in clashes and at
+// the kinks of the step terms, and the analytic forces against finite differences of the energy
+void expect_ligand(const std::string& sf_name) {
+    Vina v(sf_name);
+    model m = parse_ligand_from_file_no_failure("ligands/1iep_ligand.pdbqt", atom_type::XS);
+    precalculate_byatom tables(v.m_scoring_function, m);
+    precalculate_byatom analytic;
+    analytic.init_analytic(v.m_scoring_function, m);
+    const interacting_pairs& pairs = m.ligands[0].pairs;
+    const fl cutoff = std::sqrt(tables.cutoff_sqr());
+    rng g(7);
+    VINA_FOR(trial, 20) {
+        conf c = m.get_initial_conf();
+        c.randomize(vec(-5, -5, -5), vec(5, 5, 5), g);
+        m.set(c);
+        const fl table_e = m.evali(tables, authentic_v);
+        EXPECT_NEAR(m.evali(analytic, authentic_v), table_e, 1e-2 + 1e-2 * std::abs(table_e));
+
+        vecv forces(m.coords.size(), zero_vec), table_forces(m.coords.size(), zero_vec);
+        const fl e = eval_interacting_pairs_deriv(analytic, authentic_v[0], pairs, m.coords,
+                                                  forces);
+        eval_interacting_pairs_deriv(tables, authentic_v[0], pairs, m.coords, table_forces);
+        EXPECT_FLOAT_EQ(e, eval_interacting_pairs(analytic, authentic_v[0], pairs, m.coords));
+
+        // the energy jumps where a pair crosses the cutoff
+        std::vector<bool> at_cutoff(m.coords.size(), false);
+        VINA_FOR_IN(i, pairs) {
+            const fl r = std::sqrt(vec_distance_sqr(m.coords[pairs[i].a], m.coords[pairs[i].b]));
+            if (std::abs(r - cutoff) < 0.01) at_cutoff[pairs[i].a] = at_cutoff[pairs[i].b] = true;
+        }
+        fl diff = 0, norm = 0;
+        VINA_FOR_IN(i, forces) {
+            if (at_cutoff[i]) continue;
+            diff += sqr(forces[i] - table_forces[i]);
+            norm += sqr(table_forces[i]);
+        }
+        EXPECT_LT(diff, 1e-2 * norm + 1e-2);
+        VINA_FOR_IN(i, forces) {
+            if (at_cutoff[i]) continue;
+            VINA_FOR(d, 3) {
+                vecv coords = m.coords;
+                const fl h = 1e-3;  // fl is float
+                coords[i][d] += h;
+                const fl plus = eval_interacting_pairs(analytic, authentic_v[0], pairs, coords);
+                coords[i][d] -= 2 * h;
+                const fl minus = eval_interacting_pairs(analytic, authentic_v[0], pairs, coords);
+                const fl fd = (plus - minus) / (2 * h);
+                EXPECT_NEAR(forces[i][d], fd, 2e-3 + 2e-3 * std::abs(fd));
+            }
+        }
+    }
+}
+}  // namespace
+
+TEST(pair_kernels, vina_tables) { expect_tables("vina"); }
+
+TEST(pair_kernels, vinardo_tables) { expect_tables("vinardo"); }
+
+TEST(pair_kernels, vina_ligand) { expect_ligand("vina"); }
+
+TEST(pair_kernels, vinardo_ligand) { expect_ligand("vinardo"); }
@@ -0,0 +1,132 @@
+#include <cstdio>
+#include <set>
+
+#include "vina.h"
+#include "parse_pdbqt.h"
+#include "quaternion.h"
+#include "gtest/gtest.h"
+
+namespace {
+// zigzag alkane of n carbons in rigid segments, the bonds between segments rotatable
+model chain(sz n, sz segment, atom_type::t atype) {
+    std::string s = "ROOT\n";
+    char line[100];
+    VINA_FOR(i, n) {
+        if (i > 0 && i % segment == 0) {
+            if (i == segment) s += "ENDROOT\n";
+            s += "BRANCH " + std::to_string(i) + ' ' + std::to_string(i + 1) + '\n';
+        }
+        std::snprintf(line, sizeof(line),
+                      "ATOM  %5d %-4s LIG A   1    %8.3f%8.3f%8.3f  0.00  0.00    %6.3f %-2s\n",
+                      int(i + 1), "C", 1.25 * i, 0.88 * (i % 2), 0.0, 0.0, "C");
+        s += line;
+    }
+    for (sz i = (n - 1) / segment * segment; i > 0; i -= segment)
+        s += "ENDBRANCH " + std::to_string(i) + ' ' + std::to_string(i + 1) + '\n';
+    s += "TORSDOF " + std::to_string((n - 1) / segment) + '\n';
+    return parse_ligand_pdbqt_from_string_no_failure(s, atype);
+}
+
+// zigzag root and a linear branch continuing its last bond, as in an alkyne: the branch atoms lie
+// on its rotatable bond
+model collinear(atom_type::t atype) {
+    std::string s = "ROOT\n";
+    char line[100];
+    const vec step(1.25, 0.88, 0);
+    VINA_FOR(i, 8) {
+        if (i == 4) s += "ENDROOT\nBRANCH 4 5\n";
+        const vec c
+            = i < 4 ? vec(1.25 * i, 0.88 * (i % 2), 0) : vec(3.75, 0.88, 0) + fl(i - 3) * step;
+        std::snprintf(line, sizeof(line),
+                      "ATOM  %5d %-4s LIG A   1    %8.3f%8.3f%8.3f  0.00  0.00    %6.3f %-2s\n",
+                      int(i + 1), "C", c[0], c[1], c[2], 0.0, "C");
+        s += line;
+    }
+    s += "ENDBRANCH 4 5\nTORSDOF 1\n";
+    return parse_ligand_pdbqt_from_string_no_failure(s, atype);
+}
+
+std::set<std::pair<sz, sz> > pair_set(const interacting_pairs& pairs) {
+    std::set<std::pair<sz, sz> > s;
+    VINA_FOR_IN(i, pairs) s.insert(std::make_pair(pairs[i].a, pairs[i].b));
+    return s;
+}
+
+// evali of the pruned model equals that of the full pair list in random conformations, dropped
+// pairs never come within the cutoff and constant pairs keep their distance
+void expect_sound(const std::string& sf_name, model full, const std::string& what) {
+    Vina v(sf_name);
+    const ScoringFunction& sf = v.m_scoring_function;
+    const fl cutoff_sqr = sqr(sf.get_cutoff());
+    model pruned = full;
+    pruned.prune_ligand_pairs(cutoff_sqr);
+    const ligand& lig = pruned.ligands[0];
+    EXPECT_LE(lig.pairs.size() + lig.constant_pairs.size(), full.ligands[0].pairs.size());
+
+    const std::set<std::pair<sz, sz> > kept = pair_set(lig.pairs);
+    std::set<std::pair<sz, sz> > constant;
+    VINA_FOR_IN(i, lig.constant_pairs)
+    constant.insert(std::make_pair(lig.constant_pairs[i].a, lig.constant_pairs[i].b));
+    interacting_pairs dropped;
+    VINA_FOR_IN(i, full.ligands[0].pairs) {
+        const interacting_pair& ip = full.ligands[0].pairs[i];
+        const std::pair<sz, sz> ab(ip.a, ip.b);
+        EXPECT_FALSE(kept.count(ab) && constant.count(ab)) << what;
+        if (!kept.count(ab) && !constant.count(ab)) dropped.push_back(ip);
+    }
+
+    const precalculate_byatom p(sf, full);
+    rng g(5);
+    VINA_FOR(c, 500) {
+        conf x = full.get_initial_conf();
+        x.randomize(vec(-5, -5, -5), vec(5, 5, 5), g);
+        full.set(x);
+        pruned.set(x);
+        VINA_FOR(k, 2) {
+            const vec curl(k == 0 ? max_fl : 1, max_fl, max_fl);
+            const fl e = full.evali(p, curl);
+            EXPECT_NEAR(pruned.evali(p, curl), e, 1e-4 * (1 + std::abs(e)))
+                << what << " conformation " << c;
+        }
+        VINA_FOR_IN(i, dropped)
+        EXPECT_GE(vec_distance_sqr(full.coords[dropped[i].a], full.coords[dropped[i].b]),
+                  cutoff_sqr)
+            << what << " dropped pair " << dropped[i].a << ' ' << dropped[i].b;
+        VINA_FOR_IN(i, lig.constant_pairs) {
+            const fixed_pair& fp = lig.constant_pairs[i];
+            EXPECT_NEAR(std::sqrt(vec_distance_sqr(full.coords[fp.a], full.coords[fp.b])),
+                        std::sqrt(fp.r2), 2e-3)
+                << what << " constant pair " << fp.a << ' ' << fp.b;
+        }
+    }
+}
+}  // namespace
+
+TEST(prune_pairs, pruned_score_equals_unpruned) {
+    expect_sound("vina", parse_ligand_from_file_no_failure("ligands/1iep_ligand.pdbqt",
+                                                           atom_type::XS),
+                 "1iep");
+    expect_sound("vina",
+                 parse_ligand_from_file_no_failure("ligands/1a30_ligand.sdf", atom_type::XS),
+                 "1a30");
+    expect_sound("ad4", parse_ligand_from_file_no_failure("ligands/1iep_ligand.pdbqt",
+                                                          atom_type::AD),
+                 "1iep ad4");
+
+    // a long chain with few torsions: pairs at its two ends are out of reach of each other
+    const model c = chain(40, 10, atom_type::XS);
+    ASSERT_EQ(c.num_movable_atoms(), 40);
+    model pruned = c;
+    Vina v("vina");
+    pruned.prune_ligand_pairs(sqr(v.m_scoring_function.get_cutoff()));
+    EXPECT_LT(pruned.ligands[0].pairs.size(), c.ligands[0].pairs.size());
+    expect_sound("vina", c, "chain");
+    expect_sound("ad4", chain(40, 10, atom_type::AD), "chain ad4");
+
+    // pairs that no torsion moves are scored from their distance
+    model l = collinear(atom_type::XS);
+    ASSERT_EQ(l.num_movable_atoms(), 8);
+    l.prune_ligand_pairs(sqr(v.m_scoring_function.get_cutoff()));
+    EXPECT_GT(l.ligands[0].constant_pairs.size(), 0);
+    expect_sound("vina", collinear(atom_type::XS), "collinear");
+}
@@ -0,0 +1,58 @@
+#include <set>
+
+#include "random.h"
+#include "gtest/gtest.h"
+
+TEST(random, philox_known_answer) {
+    // Random123 kat_vectors: philox4x32 10, zero counter and key
+    rng g(0, 0, 0);
+    EXPECT_EQ(g(), 0x6627e8d5u);
+    EXPECT_EQ(g(), 0xe169c58du);
+    EXPECT_EQ(g(), 0xbc57ac4cu);
+    EXPECT_EQ(g(), 0x9b00dbd8u);
+}
+
+TEST(random, independent_streams) {
+    const boost::uint64_t seed = 12345;
+    const sz n = 4096;
+    rng master(seed);
+    std::vector<std::vector<rng::result_type> > draws;
+    VINA_FOR(ligand, 3) VINA_FOR(chain, 3) {
+        rng g = master.stream(ligand, chain);
+        draws.push_back(std::vector<rng::result_type>(n));
+        VINA_FOR(i, n) draws.back()[i] = g();
+    }
+
+    // a stream depends on (seed, ligand, chain) only, not on the draws of any other stream
+    rng interleaved[2] = {rng(seed, 2, 1), rng(seed, 0, 2)};
+    VINA_FOR(i, n) {
+        EXPECT_EQ(interleaved[0](), draws[2 * 3 + 1][i]);
+        EXPECT_EQ(interleaved[1](), draws[0 * 3 + 2][i]);
+    }
+    rng same_ligand = rng(seed, 1, 0).stream(2);
+    EXPECT_EQ(same_ligand(), draws[1 * 3 + 2][0]);
+
+    // no two streams share a word, and no pair of streams is correlated
+    std::set<rng::result_type> words;
+    VINA_FOR_IN(s, draws) words.insert(draws[s].begin(), draws[s].end());
+    EXPECT_GT(words.size(), draws.size() * n - 8);  // a few 32-bit collisions are expected
+    VINA_FOR_IN(s, draws) VINA_RANGE(t, s + 1, draws.size()) {
+        double sum_s = 0, sum_t = 0, sum_st = 0, sum_ss = 0, sum_tt = 0;
+        VINA_FOR(i, n) {
+            const double x = draws[s][i] / 4294967296.0;
+            const double y = draws[t][i] / 4294967296.0;
+            sum_s += x;
+            sum_t += y;
+            sum_st += x * y;
+            sum_ss += x * x;
+            sum_tt += y * y;
+        }
+        const double cov = sum_st / n - sum_s / n * sum_t / n;
+        const double var_s = sum_ss / n - sum_s / n * sum_s / n;
+        const double var_t = sum_tt / n - sum_t / n * sum_t / n;
+        // 5 standard errors of the sample correlation of independent streams
+        EXPECT_LT(std::abs(cov / std::sqrt(var_s * var_t)), 5 / std::sqrt(double(n)))
+            << "streams " << s << ' ' << t;
+        EXPECT_NEAR(sum_s / n, 0.5, 5 * std::sqrt(1.0 / 12 / n)) << "stream " << s;
+    }
+}
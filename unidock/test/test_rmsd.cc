@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "rmsd.h"
+#include "parse_pdbqt.h"
+#include "random.h"
+#include "gtest/gtest.h"
+
+namespace {
+// rigid 1,4-dichlorobenzene in the xy plane, the Cl-Cl axis along x, no hydrogens
+model dichlorobenzene() {
+    std::string s = "ROOT\n";
+    char line[100];
+    VINA_FOR(i, 8) {
+        const bool cl = i >= 6;
+        const fl angle = cl ? pi * (i - 6) : pi / 3 * i;
+        const fl r = cl ? 3.13 : 1.39;
+        std::snprintf(line, sizeof(line),
+                      "ATOM  %5d %-4s LIG A   1    %8.3f%8.3f%8.3f  0.00  0.00    %6.3f %-2s\n",
+                      int(i + 1), cl ? "CL" : "C", r * std::cos(angle), r * std::sin(angle), 0.0,
+                      0.0, cl ? "Cl" : "A");
+        s += line;
+    }
+    s += "ENDROOT\nTORSDOF 0\n";
+    return parse_ligand_pdbqt_from_string_no_failure(s, atom_type::XS);
+}
+
+// rmsd under the best element-preserving reordering of b: at most the symmetry-corrected rmsd,
+// since every symmetry of the molecule is such a reordering
+fl best_reordered_rmsd(const model& m, const vecv& a, const vecv& b) {
+    szv carbons, chlorines;
+    VINA_FOR(i, m.num_movable_atoms())
+    (m.atoms[i].el == EL_TYPE_Cl ? chlorines : carbons).push_back(i);
+    szv c = carbons, cl = chlorines;  // b's atoms matched to carbons and chlorines of a
+    fl best = max_fl;
+    do {
+        do {
+            fl sum = 0;
+            VINA_FOR_IN(i, carbons) sum += vec_distance_sqr(a[carbons[i]], b[c[i]]);
+            VINA_FOR_IN(i, chlorines) sum += vec_distance_sqr(a[chlorines[i]], b[cl[i]]);
+            best = (std::min)(best, sum);
+        } while (std::next_permutation(cl.begin(), cl.end()));
+    } while (std::next_permutation(c.begin(), c.end()));
+    return std::sqrt(best / m.num_movable_atoms());
+}
+}  // namespace
+
+TEST(rmsd, symmetric_ligand) {
+    const model m = dichlorobenzene();
+    ASSERT_EQ(m.num_movable_atoms(), 8);
+    const vecv& a = m.coords;
+    rmsd_engine rmsd(m);
+    rmsd.add(a);
+
+    // half a turn about the Cl-Cl axis maps the molecule onto itself with the atoms swapped
+    vecv flipped = a;
+    VINA_FOR_IN(i, flipped) flipped[i] = vec(a[i][0], -a[i][1], -a[i][2]);
+    rmsd.add(flipped);
+    EXPECT_NEAR(rmsd.lower_bound(0, 1), 0, 1e-5);
+    EXPECT_NEAR(best_reordered_rmsd(m, a, flipped), 0, 1e-5);
+    model mf = m;
+    mf.coords = flipped;
+    EXPECT_NEAR(rmsd.upper_bound(0, 1), m.rmsd_upper_bound(mf), 1e-5);
+    EXPECT_GT(rmsd.upper_bound(0, 1), 1);  // atom by atom, the flip moves the ring
+
+    // perturbed flips: the lower bound stays below the corrected rmsd, the upper bound above it
+    rng g(3);
+    VINA_RANGE(p, 2, 12) {
+        vecv b = flipped;
+        VINA_FOR_IN(i, b) b[i] += 0.4 * random_inside_sphere(g);
+        ASSERT_EQ(rmsd.add(b), p);
+        const fl corrected = best_reordered_rmsd(m, a, b);
+        model mb = m;
+        mb.coords = b;
+        EXPECT_NEAR(rmsd.lower_bound(0, p), m.rmsd_lower_bound(mb), 1e-5);
+        EXPECT_NEAR(rmsd.upper_bound(0, p), m.rmsd_upper_bound(mb), 1e-5);
+        EXPECT_LE(rmsd.lower_bound(0, p), corrected + 1e-5);
+        EXPECT_LE(corrected, rmsd.upper_bound(0, p) + 1e-5);
+        EXPECT_LT(corrected, 0.4);
+    }
+
+    // the scratch buffer is reused, so repeated and reversed calls agree
+    flv lower;
+    rmsd.matrix(true, lower);
+    VINA_FOR(p, rmsd.num_poses()) {
+        EXPECT_FLOAT_EQ(lower[p], rmsd.lower_bound(0, p));
+        EXPECT_FLOAT_EQ(lower[p * rmsd.num_poses()], rmsd.lower_bound(p, 0));
+    }
+}
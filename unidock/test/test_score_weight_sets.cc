@@ -0,0 +1,49 @@
+#include "vina.h"
+#include "gtest/gtest.h"
+
+namespace {
+// intramolecular pairs are summed exactly by the terms, from tables by score()
+void expect_energies(const std::vector<double>& actual, const std::vector<double>& expected) {
+    ASSERT_EQ(actual.size(), expected.size());
+    VINA_FOR_IN(i, expected)
+    EXPECT_NEAR(actual[i], expected[i], 1e-2 + 1e-3 * std::abs(expected[i])) << "energy " << i;
+}
+}  // namespace
+
+TEST(score_weight_sets, every_pose) {
+    Vina v("vina", 1, 7, 0, true);  // no_refine: score() from the maps too
+    v.enable_term_grids();
+    v.set_receptor("receptor/1iep_receptor.pdbqt");
+    v.set_ligand_from_file("ligands/1iep_ligand.pdbqt");
+    v.compute_vina_maps(15.19, 53.903, 16.917, 20, 20, 20);
+
+    std::vector<flv> weight_sets(2, v.m_weights);
+    weight_sets[1][0] *= 2;  // gauss1
+
+    // before a search, the current pose
+    std::vector<std::vector<std::vector<double> > > energies = v.score_weight_sets(weight_sets);
+    ASSERT_EQ(energies.size(), 1);
+    ASSERT_EQ(energies[0].size(), 2);
+    expect_energies(energies[0][0], v.score());
+
+    v.global_search(8, 9, 1, 20000);
+    ASSERT_GT(v.m_poses.size(), 1);
+    energies = v.score_weight_sets(weight_sets);
+    ASSERT_EQ(energies.size(), v.m_poses.size());
+    const output_container poses = v.m_poses;
+    std::vector<std::vector<double> > expected;
+    VINA_FOR_IN(i, poses) {
+        v.m_model.set(poses[i].c);
+        expected.push_back(v.score());
+        expect_energies(energies[i][0], expected[i]);
+    }
+
+    // the second set, as if the maps had been computed with it
+    v.set_vina_weights(2 * v.m_weights[0], v.m_weights[1], v.m_weights[2], v.m_weights[3],
+                       v.m_weights[4], v.m_weights[5], (v.m_weights[6] + 1) * 0.1 / 5);
+    VINA_FOR_IN(i, poses) {
+        v.m_model.set(poses[i].c);
+        expect_energies(energies[i][1], v.score());
+        EXPECT_NE(energies[i][1][0], expected[i][0]);
+    }
+}
@@ -0,0 +1,94 @@
+#include <algorithm>
+
+#include "vina.h"
+#include "start_sampling.h"
+#include "gtest/gtest.h"
+
+namespace {
+Vina receptor_and_ligand() {
+    Vina v("vina", 1, 7, 0);
+    v.set_receptor("receptor/1iep_receptor.pdbqt");
+    v.set_ligand_from_file("ligands/1iep_ligand.pdbqt");
+    v.compute_vina_maps(15.19, 53.903, 16.917, 20, 20, 20);
+    return v;
+}
+}  // namespace
+
+TEST(start_sampling, radical_inverse) {
+    EXPECT_FLOAT_EQ(radical_inverse(0, 2), 0);
+    EXPECT_FLOAT_EQ(radical_inverse(1, 2), 0.5);
+    EXPECT_FLOAT_EQ(radical_inverse(6, 2), 0.375);  // 110 -> 0.011
+    EXPECT_FLOAT_EQ(radical_inverse(5, 3), 7.0 / 9);  // 12 -> 0.21
+}
+
+TEST(start_sampling, spread) {
+    Vina v = receptor_and_ligand();
+    const vec corner1 = v.m_grid.corner1(), corner2 = v.m_grid.corner2();
+    const sz n = 16;
+    rng g(5);
+    const std::vector<conf> starts = spread_starts(v.m_model, v.m_grid, corner1, corner2, n, g);
+    ASSERT_EQ(starts.size(), n);
+    const sz torsions = starts[0].ligands[0].torsions.size();
+    ASSERT_GT(torsions, 0);
+
+    std::vector<szv> strata(torsions);
+    VINA_FOR(i, n) {
+        const rigid_conf& r = starts[i].ligands[0].rigid;
+        VINA_FOR(d, 3) {
+            EXPECT_GE(r.position[d], corner1[d]);
+            EXPECT_LE(r.position[d], corner2[d]);
+        }
+        EXPECT_NEAR(quaternion_norm_sqr(r.orientation), 1, 1e-5);
+        VINA_FOR(t, torsions) {
+            const fl x = starts[i].ligands[0].torsions[t];
+            ASSERT_GE(x, -pi);
+            ASSERT_LT(x, pi);
+            strata[t].push_back(sz((x + pi) / (2 * pi) * n));
+        }
+    }
+    // one chain per stratum of every torsion
+    VINA_FOR(t, torsions) {
+        std::sort(strata[t].begin(), strata[t].end());
+        VINA_FOR(i, n) EXPECT_EQ(strata[t][i], i);
+    }
+
+    // the same seed gives the same starts
+    rng g2(5);
+    const std::vector<conf> again = spread_starts(v.m_model, v.m_grid, corner1, corner2, n, g2);
+    VINA_FOR(i, n) {
+        EXPECT_EQ(again[i].ligands[0].rigid.position[0], starts[i].ligands[0].rigid.position[0]);
+        EXPECT_EQ(again[i].ligands[0].torsions[0], starts[i].ligands[0].torsions[0]);
+    }
+}
+
+TEST(start_sampling, clash_redraw) {
+    Vina v = receptor_and_ligand();
+    const vec corner1 = v.m_grid.corner1(), corner2 = v.m_grid.corner2();
+    const sz n = 32;
+    model m = v.m_model;
+    rng g(11), g_redraw(11);
+    const std::vector<conf> starts = spread_starts(m, v.m_grid, corner1, corner2, n, g);
+    const std::vector<conf> redrawn
+        = spread_starts(m, v.m_grid, corner1, corner2, n, g_redraw, 1000);
+
+    sz above = 0, above_redrawn = 0;
+    VINA_FOR(i, n) {
+        m.set(starts[i]);
+        const fl e = v.m_grid.eval(m, 1000);
+        m.set(redrawn[i]);
+        const fl e_redrawn = v.m_grid.eval(m, 1000);
+        EXPECT_LE(e_redrawn, e);  // kept, or replaced by a lower one
+        if (e > 1000) ++above;
+        if (e_redrawn > 1000) ++above_redrawn;
+    }
+    EXPECT_GT(above, 0);
+    EXPECT_LT(above_redrawn, above);
+}
+
+TEST(start_sampling, global_search) {
+    Vina v = receptor_and_ligand();
+    v.enable_spread_starts(1000);
+    v.global_search(8, 9, 1, 20000);
+    ASSERT_FALSE(v.m_poses.empty());
+    EXPECT_LT(v.m_poses[0].e, -8);
+}
@@ -0,0 +1,107 @@
+#include <sstream>
+
+#include "parse_pdbqt.h"
+#include "quaternion.h"
+#include "utils.h"
+#include "gtest/gtest.h"
+
+namespace {
+// atom and bond blocks of an SDF string
+struct sdf_molecule {
+    std::vector<std::string> elements;
+    vecv coords;
+    std::vector<szv> neighbors;
+};
+
+sdf_molecule read_sdf(const std::string& sdf) {
+    std::istringstream in(sdf);
+    std::string line;
+    VINA_FOR(i, 4) std::getline(in, line);
+    const sz num_atoms = std::stoul(line.substr(0, 3));
+    const sz num_bonds = std::stoul(line.substr(3, 3));
+    sdf_molecule m;
+    m.elements.resize(num_atoms);
+    m.coords.resize(num_atoms);
+    m.neighbors.resize(num_atoms);
+    VINA_FOR(i, num_atoms) {
+        std::getline(in, line);
+        std::istringstream fields(line);
+        fields >> m.coords[i][0] >> m.coords[i][1] >> m.coords[i][2] >> m.elements[i];
+    }
+    VINA_FOR(i, num_bonds) {
+        std::getline(in, line);
+        const sz a = std::stoul(line.substr(0, 3)) - 1;
+        const sz b = std::stoul(line.substr(3, 3)) - 1;
+        m.neighbors[a].push_back(b);
+        m.neighbors[b].push_back(a);
+    }
+    return m;
+}
+
+// what a pose can't change around a hydrogen h on carbon c: its distances to c and to the other
+// neighbors of c, and on which side of c and two of them it is
+flv local_geometry(const sdf_molecule& m, sz h, sz c) {
+    flv g(1, std::sqrt(vec_distance_sqr(m.coords[h], m.coords[c])));
+    szv others;
+    VINA_FOR_IN(i, m.neighbors[c]) {
+        const sz n = m.neighbors[c][i];
+        if (n == h) continue;
+        g.push_back(std::sqrt(vec_distance_sqr(m.coords[h], m.coords[n])));
+        others.push_back(n);
+    }
+    if (others.size() >= 2)
+        g.push_back(cross_product(m.coords[others[0]] - m.coords[c],
+                                  m.coords[others[1]] - m.coords[c])
+                    * (m.coords[h] - m.coords[c]));
+    return g;
+}
+
+// a random pose: position, orientation and torsions
+conf random_conf(const model& m, rng& g) {
+    conf c = m.get_initial_conf();
+    c.ligands[0].rigid.position += 2.0 * random_inside_sphere(g);
+    c.ligands[0].rigid.orientation = random_orientation(g);
+    VINA_FOR_IN(i, c.ligands[0].torsions) c.ligands[0].torsions[i] = random_fl(-pi, pi, g);
+    return c;
+}
+}  // namespace
+
+TEST(united_atom_sdf, hydrogens_follow_the_pose) {
+    const std::string name = "ligands/1a30_ligand.sdf";
+    model m = parse_ligand_sdf_from_file_no_failure(name, atom_type::XS, false);
+    const sdf_molecule input = read_sdf(get_file_contents(name));
+    szv hydrogens;  // nonpolar, with their carbons
+    VINA_FOR_IN(i, input.elements) {
+        if (input.elements[i] == "H" && input.neighbors[i].size() == 1
+            && input.elements[input.neighbors[i][0]] == "C")
+            hydrogens.push_back(i);
+    }
+    ASSERT_GT(hydrogens.size(), 0);
+    ASSERT_EQ(m.ligands[0].hydrogens.size(), hydrogens.size());  // all out of the search model
+    EXPECT_EQ(m.num_movable_atoms() + hydrogens.size(), input.elements.size());
+
+    // the input pose is written back as it was read
+    m.set(m.get_initial_conf());
+    sdf_molecule out = read_sdf(m.write_sdf_model(1, ""));
+    ASSERT_EQ(out.elements, input.elements);
+    VINA_FOR_IN(i, input.coords) VINA_FOR(d, 3)
+    EXPECT_NEAR(out.coords[i][d], input.coords[i][d], 2e-4) << i << ' ' << d;
+
+    // other poses: each hydrogen moves with its carbon and keeps its place among its neighbors
+    rng g(11);
+    VINA_FOR(p, 5) {
+        m.set(random_conf(m, g));
+        out = read_sdf(m.write_sdf_model(1, ""));
+        ASSERT_EQ(out.elements, input.elements);
+        VINA_FOR_IN(i, hydrogens) {
+            const sz h = hydrogens[i];
+            const sz c = input.neighbors[h][0];
+            EXPECT_GT(vec_distance_sqr(out.coords[h], input.coords[h]), 1e-4) << h;
+            const flv expected = local_geometry(input, h, c);
+            const flv actual = local_geometry(out, h, c);
+            ASSERT_EQ(actual.size(), expected.size());
+            VINA_FOR_IN(k, expected)
+            EXPECT_NEAR(actual[k], expected[k], 2e-3) << "pose " << p << " hydrogen " << h;
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#include <fstream>
+#include <sstream>
+
+#include "vina.h"
+#include "warm_start.h"
+#include "gtest/gtest.h"
+
+namespace {
+const char* const reference_name = "ligands/1iep_ligand.pdbqt";
+
+// 1iep ligand with its methyl C7 turned into a chlorine, parsed from a random conformation
+model analogue(unsigned seed) {
+    std::ifstream in(reference_name);
+    std::stringstream text;
+    text << in.rdbuf();
+    std::string pdbqt = text.str();
+    const std::string c7 = "     0.045 C \n";
+    pdbqt.replace(pdbqt.find(c7), c7.size(), "     0.045 Cl\n");
+
+    model m = parse_ligand_pdbqt_from_string(pdbqt, atom_type::XS);
+    rng g(seed);
+    conf c = m.get_initial_conf();
+    c.randomize(vec(-5, -5, -5), vec(5, 5, 5), g);
+    m.set(c);
+    std::string moved = m.write_model(1, "");
+    moved = moved.substr(moved.find('\n') + 1);  // MODEL and ENDMDL lines
+    moved = moved.substr(0, moved.rfind("ENDMDL"));
+    return parse_ligand_pdbqt_from_string(moved, atom_type::XS);
+}
+
+vecv heavy_coords(const model& m) {
+    vecv tmp;
+    VINA_FOR_IN(i, m.atoms)
+    if (!m.atoms[i].is_hydrogen()) tmp.push_back(m.coords[i]);
+    return tmp;
+}
+}  // namespace
+
+TEST(warm_start, match) {
+    const model reference = parse_ligand_from_file_no_failure(reference_name, atom_type::XS);
+    const warm_start w(reference);
+    EXPECT_EQ(w.reference_atoms(), 37);
+    const warm_start::atom_map pairs = w.match(analogue(1));
+    EXPECT_EQ(pairs.size(), 36);  // all but C7
+}
+
+TEST(warm_start, initial_conf) {
+    const model reference = parse_ligand_from_file_no_failure(reference_name, atom_type::XS);
+    const vecv target = heavy_coords(reference);
+    const warm_start w(reference);
+    VINA_FOR(seed, 5) {
+        model m = analogue(seed);
+        const warm_start::atom_map pairs = w.match(m);
+        conf c;
+        sz matched = 0;
+        ASSERT_TRUE(w.initial_conf(m, c, matched));
+        EXPECT_EQ(matched, pairs.size());
+        m.set(c);
+        fl sum = 0;
+        VINA_FOR_IN(i, pairs)
+        sum += vec_distance_sqr(m.coords[pairs[i].first], target[pairs[i].second]);
+        EXPECT_LT(std::sqrt(sum / pairs.size()), 0.1) << "seed " << seed;
+    }
+}
+
+TEST(warm_start, too_few_matched) {
+    const model reference = parse_ligand_from_file_no_failure(reference_name, atom_type::XS);
+    warm_start w(reference);
+    w.min_matched = 37;
+    conf c;
+    sz matched = 0;
+    EXPECT_FALSE(w.initial_conf(analogue(1), c, matched));
+    EXPECT_EQ(matched, 36);
+    EXPECT_TRUE(c.ligands.empty());
+}
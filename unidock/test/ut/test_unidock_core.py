@@ -0,0 +1,68 @@
+import os
+import shutil
+import unittest as ut
+
+try:
+    import unidock_core
+except ImportError:
+    unidock_core = None
+
+
+@ut.skipIf(unidock_core is None, "unidock_core module not built")
+class TestUniDockCore(ut.TestCase):
+    def setUp(self):
+        testdir = os.path.dirname(os.path.dirname(__file__))
+        self.receptor = os.path.join(testdir, "receptor", "1iep_receptor.pdbqt")
+        with open(os.path.join(testdir, "ligands", "1iep_ligand.pdbqt"), "r") as f:
+            self.ligand = f.read()
+        self.pocket = [15.19, 53.903, 16.917, 20, 20, 20]
+
+    def engine(self, gpu):
+        engine = unidock_core.Engine(scoring="vina", seed=181129, gpu=gpu)
+        engine.set_receptor(self.receptor)
+        engine.compute_maps(self.pocket[:3], self.pocket[3:])
+        return engine
+
+    def dock_twice(self, gpu):
+        engine = self.engine(gpu)
+        first = engine.dock([self.ligand, "not a ligand", self.ligand], exhaustiveness=2,
+                            n_poses=3, max_evals=2000)
+        # fewer ligands the second time: nothing of the first batch may be left over
+        second = engine.dock([self.ligand], exhaustiveness=2, n_poses=3, max_evals=2000)
+        n_atoms = first["atom_offsets"][1]
+        for result, n_ligands in ((first, 3), (second, 1)):
+            offsets = result["pose_offsets"]
+            self.assertEqual(len(offsets), n_ligands + 1)
+            self.assertEqual(len(result["atom_offsets"]), offsets[-1] + 1)
+            self.assertEqual(result["energies"].shape, (offsets[-1], 5))
+            self.assertGreater(offsets[1], 0)
+            atoms_per_pose = result["atom_offsets"][1:] - result["atom_offsets"][:-1]
+            self.assertTrue((atoms_per_pose == n_atoms).all())
+        self.assertEqual(first["pose_offsets"][2], first["pose_offsets"][1])  # skipped
+
+    def test_dock_twice_cpu(self):
+        self.dock_twice(False)
+
+    @ut.skipIf(shutil.which("nvidia-smi") is None, "no GPU")
+    def test_dock_twice_gpu(self):
+        self.dock_twice(True)
+
+    def test_errors_are_raised(self):
+        engine = unidock_core.Engine(scoring="vina")
+        with self.assertRaises(ValueError):
+            engine.set_receptor("")
+        with self.assertRaises(OSError):
+            engine.set_receptor("missing_receptor.pdbqt")
+        with self.assertRaises(ValueError):
+            engine.compute_maps(self.pocket[:3], self.pocket[3:])  # no receptor yet
+        engine.set_receptor(self.receptor)
+        with self.assertRaises(ValueError):
+            engine.dock([self.ligand])  # no maps yet
+        with self.assertRaises(ValueError):
+            engine.load_maps("missing_maps")
+        with self.assertRaises(ValueError):
+            engine.compute_maps(self.pocket[:3], [20, 0, 20])
+
+
+if __name__ == "__main__":
+    ut.main()